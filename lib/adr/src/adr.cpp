@@ -0,0 +1,380 @@
+#include "adr.h"
+#include "ms_time.h"
+#include <cmath>
+#include <cstring>
+
+// SX1276 datasheet, table 13.
+static const AdrDataRate dataRates[ADR_DATA_RATE_COUNT] = {
+    {12, 125000, -20.0f},
+    {11, 125000, -17.5f},
+    {10, 125000, -15.0f},
+    {9, 125000, -12.5f},
+    {8, 125000, -10.0f},
+    {7, 125000, -7.5f},
+    {7, 250000, -7.5f},
+};
+
+// Noise power grows with bandwidth, so the same signal shows a lower SNR
+// on a wider channel.
+static float bandwidthPenaltyDb(uint32_t bandwidth) {
+    return 10.0f * log10f((float)bandwidth / 125000.0f);
+}
+
+const AdrDataRate& adr_data_rate(uint8_t dataRate) {
+    return dataRates[dataRate < ADR_DATA_RATE_COUNT ? dataRate : ADR_SAFE_DATA_RATE];
+}
+
+LoRaModemConfig adr_modem_config(uint8_t dataRate, const LoRaModemConfig& base) {
+    LoRaModemConfig config = base;
+    config.spreadingFactor = adr_data_rate(dataRate).spreadingFactor;
+    config.bandwidth = adr_data_rate(dataRate).bandwidth;
+    return config;
+}
+
+// ----- AdrLinkTable -----
+
+AdrLinkTable::AdrLinkTable(int marginDb) : marginDb(marginDb) {
+    clear();
+}
+
+void AdrLinkTable::clear() {
+    std::memset(links, 0, sizeof(links));
+}
+
+const AdrLinkTable::Link* AdrLinkTable::findLink(uint8_t id) const {
+    for (size_t i = 0; i < ADR_MAX_LINKS; i++) {
+        if (links[i].used && links[i].id == id) return &links[i];
+    }
+    return nullptr;
+}
+
+void AdrLinkTable::record(uint8_t transmitterID, int16_t rssi, float snr, uint8_t dataRate, uint32_t nowMs) {
+    Link* link = const_cast<Link*>(findLink(transmitterID));
+    if (!link) {
+        // A free entry, or else the link heard least recently.
+        link = &links[0];
+        for (size_t i = 0; i < ADR_MAX_LINKS; i++) {
+            if (!links[i].used) {
+                link = &links[i];
+                break;
+            }
+            if ((int32_t)(links[i].lastHeard - link->lastHeard) < 0) link = &links[i];
+        }
+        std::memset(link, 0, sizeof(Link));
+        link->used = true;
+        link->id = transmitterID;
+    }
+
+    float snr125 = snr + bandwidthPenaltyDb(adr_data_rate(dataRate).bandwidth);
+    float quarters = std::round(snr125 * 4.0f);
+    if (quarters > 127.0f) quarters = 127.0f;
+    if (quarters < -128.0f) quarters = -128.0f;
+
+    link->rssi[link->next] = rssi;
+    link->snrQuarterDb[link->next] = (int8_t)quarters;
+    link->next = (link->next + 1) % ADR_HISTORY_SIZE;
+    if (link->count < ADR_HISTORY_SIZE) link->count++;
+    if (dataRate < ADR_DATA_RATE_COUNT && dataRate > link->fastestHeard) link->fastestHeard = dataRate;
+    link->lastHeard = nowMs;
+}
+
+uint8_t AdrLinkTable::recommendLink(const Link& link) const {
+    if (link.count < ADR_MIN_SAMPLES) return link.fastestHeard;
+
+    int8_t best = link.snrQuarterDb[0];
+    for (size_t i = 1; i < link.count; i++) {
+        if (link.snrQuarterDb[i] > best) best = link.snrQuarterDb[i];
+    }
+    float snr125 = best / 4.0f;
+    for (uint8_t dataRate = ADR_DATA_RATE_COUNT - 1; dataRate > ADR_SAFE_DATA_RATE; dataRate--) {
+        const AdrDataRate& rate = dataRates[dataRate];
+        if (snr125 - bandwidthPenaltyDb(rate.bandwidth) - rate.requiredSnrDb >= marginDb) return dataRate;
+    }
+    return ADR_SAFE_DATA_RATE;
+}
+
+uint8_t AdrLinkTable::recommend(uint8_t transmitterID) const {
+    const Link* link = findLink(transmitterID);
+    return link ? recommendLink(*link) : ADR_SAFE_DATA_RATE;
+}
+
+bool AdrLinkTable::slowest_recommendation(uint32_t nowMs, uint32_t windowMs, bool evidenceOnly, uint8_t& dataRate) const {
+    bool found = false;
+    for (size_t i = 0; i < ADR_MAX_LINKS; i++) {
+        const Link& link = links[i];
+        if (!link.used || nowMs - link.lastHeard > windowMs) continue;
+        if (evidenceOnly && link.count < ADR_MIN_SAMPLES) continue;
+        uint8_t rate = recommendLink(link);
+        if (!found || rate < dataRate) dataRate = rate;
+        found = true;
+    }
+    return found;
+}
+
+size_t AdrLinkTable::size() const {
+    return ADR_MAX_LINKS;
+}
+
+bool AdrLinkTable::summary(size_t index, LinkSummary& out) const {
+    if (index >= ADR_MAX_LINKS || !links[index].used) return false;
+    const Link& link = links[index];
+    int32_t rssiSum = 0;
+    int8_t best = link.snrQuarterDb[0];
+    for (size_t i = 0; i < link.count; i++) {
+        rssiSum += link.rssi[i];
+        if (link.snrQuarterDb[i] > best) best = link.snrQuarterDb[i];
+    }
+    out.id = link.id;
+    out.samples = link.count;
+    out.meanRssi = link.count ? (int16_t)(rssiSum / link.count) : 0;
+    out.maxSnrDb = best / 4.0f;
+    out.lastHeard = link.lastHeard;
+    out.recommended = recommendLink(link);
+    return true;
+}
+
+// ----- AdrCoordinator -----
+
+AdrCoordinator::AdrCoordinator(uint8_t deviceID, int marginDb)
+    : table(marginDb),
+      deviceID(deviceID),
+      transmissionID(0),
+      currentRate(ADR_SAFE_DATA_RATE),
+      state(IDLE),
+      nextEvaluationAt(ADR_EVALUATION_INTERVAL_MS),
+      proposedRate(0),
+      agreedRate(0),
+      toPropose(0),
+      awaiting(0),
+      proposalDeadline(0),
+      targetRate(0),
+      repeatsLeft(0),
+      nextRepeatAt(0),
+      switchAt(0) {
+    payloadBuilder.configure_device(deviceID, PAYLOAD_BROADCAST_ID);
+}
+
+void AdrCoordinator::set_integrity_mode(PayloadBuilder::IntegrityMode mode) {
+    payloadBuilder.set_integrity_mode(mode);
+}
+
+void AdrCoordinator::record(uint8_t transmitterID, int16_t rssi, float snr, uint32_t nowMs) {
+    table.record(transmitterID, rssi, snr, currentRate, nowMs);
+}
+
+void AdrCoordinator::announce(uint8_t dataRate, uint32_t nowMs) {
+    state = ANNOUNCING;
+    targetRate = dataRate;
+    repeatsLeft = ADR_SET_REPEATS;
+    nextRepeatAt = nowMs;
+    switchAt = nowMs + ADR_SWITCH_DELAY_MS;
+}
+
+void AdrCoordinator::evaluate(uint32_t nowMs) {
+    if (currentRate != ADR_SAFE_DATA_RATE) {
+        for (size_t i = 0; i < ADR_MAX_LINKS; i++) {
+            const AdrLinkTable::Link& link = table.links[i];
+            uint32_t silence = nowMs - link.lastHeard;
+            if (link.used && silence > ADR_SILENCE_FALLBACK_MS && silence <= ADR_ACTIVE_WINDOW_MS) {
+                fallback(nowMs);
+                return;
+            }
+        }
+    }
+
+    uint8_t target;
+    if (!table.slowest_recommendation(nowMs, ADR_ACTIVE_WINDOW_MS, false, target) || target == currentRate) return;
+    if (target < currentRate) {
+        announce(target, nowMs);
+        return;
+    }
+
+    toPropose = 0;
+    for (size_t i = 0; i < ADR_MAX_LINKS; i++) {
+        const AdrLinkTable::Link& link = table.links[i];
+        if (link.used && nowMs - link.lastHeard <= ADR_ACTIVE_WINDOW_MS) toPropose |= 1u << i;
+    }
+    state = PROPOSING;
+    proposedRate = target;
+    agreedRate = target;
+    awaiting = toPropose;
+    proposalDeadline = nowMs + ADR_PROPOSAL_TIMEOUT_MS;
+}
+
+void AdrCoordinator::on_control(uint8_t sourceID, uint8_t destinationID, const PayloadBuilder::ControlData& control, uint32_t nowMs) {
+    if (state != PROPOSING || control.command != CONTROL_ADR_ACCEPT || destinationID != deviceID) return;
+    for (size_t i = 0; i < ADR_MAX_LINKS; i++) {
+        const AdrLinkTable::Link& link = table.links[i];
+        if (!link.used || link.id != sourceID || !(awaiting & (1u << i))) continue;
+        awaiting &= ~(1u << i);
+        if (control.dataRate < agreedRate) agreedRate = control.dataRate;
+    }
+    if (awaiting == 0 && toPropose == 0) {
+        if (agreedRate > currentRate) {
+            announce(agreedRate, nowMs);
+        } else {
+            state = IDLE;
+        }
+    }
+}
+
+void AdrCoordinator::fallback(uint32_t nowMs) {
+    table.clear();
+    nextEvaluationAt = nowMs + ADR_EVALUATION_INTERVAL_MS;
+    if (state == ANNOUNCING && targetRate == ADR_SAFE_DATA_RATE) return;
+    if (currentRate == ADR_SAFE_DATA_RATE) {
+        state = IDLE;
+        return;
+    }
+    announce(ADR_SAFE_DATA_RATE, nowMs);
+}
+
+size_t AdrCoordinator::poll(uint32_t nowMs, uint8_t* buffer, size_t bufferSize) {
+    if (state == ANNOUNCING) {
+        if (ms_reached(nowMs, switchAt)) {
+            currentRate = targetRate;
+            state = IDLE;
+            nextEvaluationAt = nowMs + ADR_EVALUATION_INTERVAL_MS;
+            return 0;
+        }
+        if (repeatsLeft == 0 || !ms_reached(nowMs, nextRepeatAt)) return 0;
+
+        // The delay is counted from the end of this frame, when the members
+        // receive it.
+        PayloadBuilder::ControlData control = {CONTROL_ADR_SET, targetRate, 0};
+        size_t length = payloadBuilder.encode_control_payload(buffer, bufferSize, PAYLOAD_BROADCAST_ID, transmissionID, control);
+        if (length == 0) return 0;
+        uint32_t airtimeMs = lora_time_on_air_us(adr_modem_config(currentRate, lora_default_config()), length) / 1000;
+        uint32_t delayMs = ms_remaining(nowMs, switchAt);
+        delayMs = delayMs > airtimeMs ? delayMs - airtimeMs : 0;
+        control.parameter = delayMs / 100 > 255 ? 255 : (uint8_t)(delayMs / 100);
+        length = payloadBuilder.encode_control_payload(buffer, bufferSize, PAYLOAD_BROADCAST_ID, transmissionID++, control);
+        repeatsLeft--;
+        nextRepeatAt = nowMs + ADR_SWITCH_DELAY_MS / ADR_SET_REPEATS;
+        return length;
+    }
+
+    if (state == PROPOSING) {
+        if (toPropose != 0) {
+            size_t index = 0;
+            while (!(toPropose & (1u << index))) index++;
+            toPropose &= ~(1u << index);
+            PayloadBuilder::ControlData control = {CONTROL_ADR_PROPOSE, proposedRate, 0};
+            return payloadBuilder.encode_control_payload(buffer, bufferSize, table.links[index].id, transmissionID++, control);
+        }
+        if (ms_reached(nowMs, proposalDeadline)) {
+            // Someone did not answer; stay at the current rate.
+            state = IDLE;
+        }
+        return 0;
+    }
+
+    if (!ms_reached(nowMs, nextEvaluationAt)) return 0;
+    nextEvaluationAt = nowMs + ADR_EVALUATION_INTERVAL_MS;
+    evaluate(nowMs);
+    return state != IDLE ? poll(nowMs, buffer, bufferSize) : 0;
+}
+
+uint32_t AdrCoordinator::time_to_next_event(uint32_t nowMs) const {
+    uint32_t wait;
+    if (state == ANNOUNCING) {
+        wait = ms_remaining(nowMs, switchAt);
+        if (repeatsLeft > 0 && ms_remaining(nowMs, nextRepeatAt) < wait) wait = ms_remaining(nowMs, nextRepeatAt);
+    } else if (state == PROPOSING) {
+        wait = toPropose != 0 ? 0 : ms_remaining(nowMs, proposalDeadline);
+    } else {
+        wait = ms_remaining(nowMs, nextEvaluationAt);
+    }
+    return wait < ADR_EVALUATION_INTERVAL_MS ? wait : ADR_EVALUATION_INTERVAL_MS;
+}
+
+uint8_t AdrCoordinator::data_rate() const {
+    return currentRate;
+}
+
+const AdrLinkTable& AdrCoordinator::links() const {
+    return table;
+}
+
+// ----- AdrMember -----
+
+AdrMember::AdrMember(uint8_t deviceID, int marginDb)
+    : table(marginDb),
+      deviceID(deviceID),
+      transmissionID(0),
+      currentRate(ADR_SAFE_DATA_RATE),
+      replyPending(false),
+      replyTo(0),
+      replyRate(0),
+      replySnrDb(0),
+      switchPending(false),
+      switchRate(0),
+      switchAt(0) {
+    payloadBuilder.configure_device(deviceID, PAYLOAD_BROADCAST_ID);
+}
+
+void AdrMember::set_integrity_mode(PayloadBuilder::IntegrityMode mode) {
+    payloadBuilder.set_integrity_mode(mode);
+}
+
+void AdrMember::record(uint8_t transmitterID, int16_t rssi, float snr, uint32_t nowMs) {
+    table.record(transmitterID, rssi, snr, currentRate, nowMs);
+}
+
+void AdrMember::on_control(uint8_t sourceID, uint8_t destinationID, const PayloadBuilder::ControlData& control, uint32_t nowMs) {
+    if (control.dataRate >= ADR_DATA_RATE_COUNT) return;
+
+    if (control.command == CONTROL_ADR_PROPOSE && destinationID == deviceID) {
+        // Links this device has not heard enough of do not veto; the
+        // coordinator has already judged the reverse direction.
+        uint8_t ownLimit;
+        replyRate = control.dataRate;
+        if (table.slowest_recommendation(nowMs, ADR_ACTIVE_WINDOW_MS, true, ownLimit) && ownLimit < replyRate) {
+            replyRate = ownLimit;
+        }
+        AdrLinkTable::LinkSummary link;
+        replySnrDb = INT8_MIN;
+        for (size_t i = 0; i < table.size(); i++) {
+            if (table.summary(i, link) && link.id == sourceID) replySnrDb = (int8_t)std::round(link.maxSnrDb);
+        }
+        replyTo = sourceID;
+        replyPending = true;
+    } else if (control.command == CONTROL_ADR_SET &&
+               (destinationID == PAYLOAD_BROADCAST_ID || destinationID == deviceID)) {
+        switchPending = true;
+        switchRate = control.dataRate;
+        switchAt = nowMs + (uint32_t)control.parameter * 100;
+    }
+}
+
+void AdrMember::fallback(uint32_t) {
+    table.clear();
+    currentRate = ADR_SAFE_DATA_RATE;
+    switchPending = false;
+    replyPending = false;
+}
+
+size_t AdrMember::poll(uint32_t nowMs, uint8_t* buffer, size_t bufferSize) {
+    if (switchPending && ms_reached(nowMs, switchAt)) {
+        currentRate = switchRate;
+        switchPending = false;
+    }
+    if (!replyPending) return 0;
+    replyPending = false;
+    PayloadBuilder::ControlData control = {CONTROL_ADR_ACCEPT, replyRate, (uint8_t)replySnrDb};
+    return payloadBuilder.encode_control_payload(buffer, bufferSize, replyTo, transmissionID++, control);
+}
+
+uint32_t AdrMember::time_to_next_event(uint32_t nowMs) const {
+    if (replyPending) return 0;
+    if (switchPending) return ms_remaining(nowMs, switchAt);
+    return ADR_EVALUATION_INTERVAL_MS;
+}
+
+uint8_t AdrMember::data_rate() const {
+    return currentRate;
+}
+
+const AdrLinkTable& AdrMember::links() const {
+    return table;
+}
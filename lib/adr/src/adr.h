@@ -0,0 +1,200 @@
+#ifndef ADR_H
+#define ADR_H
+
+#include <cstdint>
+#include <cstddef>
+#include "payload_builder.h"
+#include "lora_airtime.h"
+
+// Data rates, slowest first: DR0..DR5 are SF12..SF7 at 125 kHz and DR6 is
+// SF7 at 250 kHz (the LoRaWAN EU433 set). Every device boots on
+// ADR_SAFE_DATA_RATE and goes back to it when a link fails.
+#define ADR_DATA_RATE_COUNT 7
+#define ADR_SAFE_DATA_RATE 0
+
+// Link history: the last ADR_HISTORY_SIZE frames heard from each
+// transmitter. Until a link has ADR_MIN_SAMPLES of them it is only trusted
+// with the fastest rate it has actually been heard at.
+#define ADR_HISTORY_SIZE 16
+#define ADR_MIN_SAMPLES 4
+#define ADR_MAX_LINKS 16
+
+// Headroom kept above the demodulation floor for fading and body loss,
+// in dB (the usual LoRaWAN installation margin).
+#define ADR_DEFAULT_MARGIN_DB 10
+
+// Coordinator timing. Links heard within ADR_ACTIVE_WINDOW_MS take part in
+// the choice; a link that then stays silent for ADR_SILENCE_FALLBACK_MS is
+// assumed lost and the network falls back to the safe rate, which is also
+// where a member that gave up on its own has gone. A SET is repeated
+// ADR_SET_REPEATS times before everyone switches, ADR_SWITCH_DELAY_MS
+// after the first copy.
+#define ADR_EVALUATION_INTERVAL_MS 30000
+#define ADR_ACTIVE_WINDOW_MS 300000
+#define ADR_SILENCE_FALLBACK_MS 120000
+#define ADR_PROPOSAL_TIMEOUT_MS 8000
+#define ADR_SWITCH_DELAY_MS 6000
+#define ADR_SET_REPEATS 3
+
+struct AdrDataRate {
+    uint8_t spreadingFactor;
+    uint32_t bandwidth;      // Hz
+    float requiredSnrDb;     // SX127x demodulation floor
+};
+
+// Rates past the table clamp to the safe rate.
+const AdrDataRate& adr_data_rate(uint8_t dataRate);
+// base with the spreading factor and bandwidth of dataRate.
+LoRaModemConfig adr_modem_config(uint8_t dataRate, const LoRaModemConfig& base);
+
+// RSSI/SNR history per transmitter (source ID, or relay ID for relayed
+// frames, since the relay's link is the one the rate has to cover). SNR is
+// stored normalised to 125 kHz so samples stay comparable across a
+// bandwidth change; it does not depend on the spreading factor.
+class AdrLinkTable {
+public:
+    struct LinkSummary {
+        uint8_t id;
+        uint8_t samples;
+        int16_t meanRssi;
+        float maxSnrDb;          // at 125 kHz
+        uint32_t lastHeard;
+        uint8_t recommended;
+    };
+
+    explicit AdrLinkTable(int marginDb = ADR_DEFAULT_MARGIN_DB);
+
+    void record(uint8_t transmitterID, int16_t rssi, float snr, uint8_t dataRate, uint32_t nowMs);
+    void clear();
+
+    // Fastest rate whose demodulation floor the link's best recent SNR
+    // clears by the margin (the LoRaWAN network-server rule). An unknown
+    // link gets ADR_SAFE_DATA_RATE.
+    uint8_t recommend(uint8_t transmitterID) const;
+    // Slowest recommendation among links heard within windowMs; false if
+    // there are none. With evidenceOnly, links that have too few samples
+    // to be judged are skipped instead of capping the result.
+    bool slowest_recommendation(uint32_t nowMs, uint32_t windowMs, bool evidenceOnly, uint8_t& dataRate) const;
+
+    size_t size() const;
+    bool summary(size_t index, LinkSummary& out) const;
+
+private:
+    struct Link {
+        bool used;
+        uint8_t id;
+        uint8_t count;
+        uint8_t next;
+        uint8_t fastestHeard;
+        uint32_t lastHeard;
+        int16_t rssi[ADR_HISTORY_SIZE];
+        int8_t snrQuarterDb[ADR_HISTORY_SIZE];
+    };
+
+    int marginDb;
+    Link links[ADR_MAX_LINKS];
+
+    const Link* findLink(uint8_t id) const;
+    uint8_t recommendLink(const Link& link) const;
+
+    friend class AdrCoordinator;
+};
+
+// Base station side. The SX127x demodulates one spreading factor at a
+// time, so the base cannot listen to each user at its own rate: it runs
+// the whole network at the slowest rate its active links need. Speeding up
+// is negotiated (PROPOSE to every active transmitter, each ACCEPTs the
+// fastest rate it can take, the minimum wins); slowing down needs no
+// agreement. Either way a broadcast SET tells every node when to switch.
+class AdrCoordinator {
+public:
+    explicit AdrCoordinator(uint8_t deviceID, int marginDb = ADR_DEFAULT_MARGIN_DB);
+
+    void set_integrity_mode(PayloadBuilder::IntegrityMode mode);
+
+    // Call for every valid frame heard, at the current data rate.
+    void record(uint8_t transmitterID, int16_t rssi, float snr, uint32_t nowMs);
+    void on_control(uint8_t sourceID, uint8_t destinationID, const PayloadBuilder::ControlData& control, uint32_t nowMs);
+    // A reliable message went unacknowledged: announce the safe rate and
+    // start collecting evidence again.
+    void fallback(uint32_t nowMs);
+
+    // Writes the next control frame due into buffer and returns its length,
+    // or 0. Also applies a scheduled switch once it is due, so check
+    // data_rate() after every call.
+    size_t poll(uint32_t nowMs, uint8_t* buffer, size_t bufferSize);
+    uint32_t time_to_next_event(uint32_t nowMs) const;
+
+    uint8_t data_rate() const;
+    const AdrLinkTable& links() const;
+
+private:
+    enum State {
+        IDLE,
+        PROPOSING,
+        ANNOUNCING
+    };
+
+    PayloadBuilder payloadBuilder;
+    AdrLinkTable table;
+    uint8_t deviceID;
+    uint16_t transmissionID;
+    uint8_t currentRate;
+    State state;
+    uint32_t nextEvaluationAt;
+
+    // PROPOSING: one bit per table entry still to be sent a PROPOSE, and
+    // one per entry whose ACCEPT is outstanding.
+    uint8_t proposedRate;
+    uint8_t agreedRate;
+    uint16_t toPropose;
+    uint16_t awaiting;
+    uint32_t proposalDeadline;
+
+    // ANNOUNCING
+    uint8_t targetRate;
+    uint8_t repeatsLeft;
+    uint32_t nextRepeatAt;
+    uint32_t switchAt;
+
+    void evaluate(uint32_t nowMs);
+    void announce(uint8_t dataRate, uint32_t nowMs);
+};
+
+// User and relay side: answers proposals from its own view of the links
+// it depends on, follows SETs, and drops to the safe rate on its own when
+// the link fails.
+class AdrMember {
+public:
+    explicit AdrMember(uint8_t deviceID, int marginDb = ADR_DEFAULT_MARGIN_DB);
+
+    void set_integrity_mode(PayloadBuilder::IntegrityMode mode);
+
+    void record(uint8_t transmitterID, int16_t rssi, float snr, uint32_t nowMs);
+    void on_control(uint8_t sourceID, uint8_t destinationID, const PayloadBuilder::ControlData& control, uint32_t nowMs);
+    void fallback(uint32_t nowMs);
+
+    size_t poll(uint32_t nowMs, uint8_t* buffer, size_t bufferSize);
+    uint32_t time_to_next_event(uint32_t nowMs) const;
+
+    uint8_t data_rate() const;
+    const AdrLinkTable& links() const;
+
+private:
+    PayloadBuilder payloadBuilder;
+    AdrLinkTable table;
+    uint8_t deviceID;
+    uint16_t transmissionID;
+    uint8_t currentRate;
+
+    bool replyPending;
+    uint8_t replyTo;
+    uint8_t replyRate;
+    int8_t replySnrDb;
+
+    bool switchPending;
+    uint8_t switchRate;
+    uint32_t switchAt;
+};
+
+#endif // ADR_H
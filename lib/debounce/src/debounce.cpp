@@ -0,0 +1,80 @@
+#include "debounce.h"
+#include "ms_time.h"
+
+const char* button_event_name(ButtonEventType type) {
+    switch (type) {
+        case BUTTON_PRESS: return "press";
+        case BUTTON_RELEASE: return "release";
+        case BUTTON_LONG_PRESS: return "long";
+        case BUTTON_REPEAT: return "repeat";
+    }
+    return "?";
+}
+
+ButtonDebouncer::ButtonDebouncer(uint8_t button, Gesture gesture)
+    : button(button),
+      gesture(gesture),
+      raw(false),
+      rawSince(0),
+      settling(false),
+      settleStart(0),
+      stable(false),
+      gesturePending(false),
+      gestureAt(0) {}
+
+void ButtonDebouncer::on_edge(bool pressed, uint32_t atMs) {
+    if (pressed == raw) {
+        return;
+    }
+    if (!settling) {
+        settling = true;
+        settleStart = atMs;
+    }
+    raw = pressed;
+    rawSince = atMs;
+}
+
+bool ButtonDebouncer::poll(uint32_t nowMs, ButtonEvent& event) {
+    if (settling && ms_reached(nowMs, rawSince + DEBOUNCE_SETTLE_MS)) {
+        settling = false;
+        if (raw != stable) {
+            stable = raw;
+            event.button = button;
+            event.type = stable ? BUTTON_PRESS : BUTTON_RELEASE;
+            event.timeMs = settleStart;
+            gesturePending = stable && gesture != GESTURE_NONE;
+            gestureAt = settleStart + (gesture == GESTURE_LONG_PRESS ? DEBOUNCE_LONG_PRESS_MS : DEBOUNCE_REPEAT_DELAY_MS);
+            return true;
+        }
+    }
+
+    // Held, and not on its way up: a release that is still bouncing must
+    // not repeat.
+    if (gesturePending && !settling && ms_reached(nowMs, gestureAt)) {
+        event.button = button;
+        event.timeMs = gestureAt;
+        if (gesture == GESTURE_LONG_PRESS) {
+            event.type = BUTTON_LONG_PRESS;
+            gesturePending = false;
+        } else {
+            event.type = BUTTON_REPEAT;
+            gestureAt += DEBOUNCE_REPEAT_INTERVAL_MS;
+        }
+        return true;
+    }
+    return false;
+}
+
+uint32_t ButtonDebouncer::time_to_next_event(uint32_t nowMs) const {
+    if (settling) {
+        return ms_remaining(nowMs, rawSince + DEBOUNCE_SETTLE_MS);
+    }
+    if (gesturePending) {
+        return ms_remaining(nowMs, gestureAt);
+    }
+    return UINT32_MAX;
+}
+
+bool ButtonDebouncer::pressed() const {
+    return stable;
+}
@@ -0,0 +1,75 @@
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <cstdint>
+
+// A new level only counts once the contact has stayed there for
+// DEBOUNCE_SETTLE_MS. Bounces shorter than that are absorbed, and a glitch
+// that returns to the old level produces no event at all.
+#define DEBOUNCE_SETTLE_MS 30
+
+// Held buttons: a long press fires once DEBOUNCE_LONG_PRESS_MS after the
+// press, an auto-repeat button repeats from DEBOUNCE_REPEAT_DELAY_MS after
+// the press every DEBOUNCE_REPEAT_INTERVAL_MS until released.
+#define DEBOUNCE_LONG_PRESS_MS 800
+#define DEBOUNCE_REPEAT_DELAY_MS 500
+#define DEBOUNCE_REPEAT_INTERVAL_MS 150
+
+enum ButtonEventType : uint8_t {
+    BUTTON_PRESS,
+    BUTTON_RELEASE,
+    BUTTON_LONG_PRESS,
+    BUTTON_REPEAT
+};
+
+// Timestamped with when it happened on the pin (the first edge of a press
+// or release, the due time of a long press or repeat), not when it was
+// detected.
+struct ButtonEvent {
+    uint8_t button;
+    ButtonEventType type;
+    uint32_t timeMs;
+};
+
+const char* button_event_name(ButtonEventType type);
+
+// Debounce state of one button, fed with the raw edges (typically recorded
+// by a GPIO interrupt) and polled for the events they and the timers
+// produce. No hardware access, so it runs the same on the host.
+class ButtonDebouncer {
+public:
+    enum Gesture {
+        GESTURE_NONE,
+        GESTURE_LONG_PRESS,
+        GESTURE_AUTO_REPEAT
+    };
+
+    explicit ButtonDebouncer(uint8_t button, Gesture gesture = GESTURE_NONE);
+
+    // A raw level seen at atMs. Repeating the current raw level is ignored,
+    // so levels read back after a lost edge can be fed in as well.
+    void on_edge(bool pressed, uint32_t atMs);
+
+    // Writes the next due event to event and returns true; call until it
+    // returns false.
+    bool poll(uint32_t nowMs, ButtonEvent& event);
+    // Until poll() has something, or UINT32_MAX while nothing is pending.
+    uint32_t time_to_next_event(uint32_t nowMs) const;
+
+    bool pressed() const;
+
+private:
+    uint8_t button;
+    Gesture gesture;
+
+    bool raw;
+    uint32_t rawSince;          // last raw edge
+    bool settling;
+    uint32_t settleStart;       // first edge since the level was stable
+
+    bool stable;
+    bool gesturePending;
+    uint32_t gestureAt;
+};
+
+#endif // DEBOUNCE_H
@@ -0,0 +1,36 @@
+#include "dirty_tiles.h"
+#include <cstring>
+
+size_t dirty_tile_spans(const uint8_t* shown, const uint8_t* frame, uint8_t tileWidth, uint8_t tileHeight,
+                        TileSpan* spans, size_t maxSpans) {
+    size_t rowBytes = (size_t)tileWidth * DIRTY_TILE_BYTES;
+    size_t count = 0;
+    for (uint8_t y = 0; y < tileHeight && count < maxSpans; y++) {
+        const uint8_t* before = shown + y * rowBytes;
+        const uint8_t* after = frame + y * rowBytes;
+        // Most rows are unchanged; one memcmp settles those.
+        if (std::memcmp(before, after, rowBytes) == 0) continue;
+
+        uint8_t first = 0;
+        while (std::memcmp(before + first * DIRTY_TILE_BYTES, after + first * DIRTY_TILE_BYTES, DIRTY_TILE_BYTES) == 0) {
+            first++;
+        }
+        uint8_t last = tileWidth - 1;
+        while (std::memcmp(before + last * DIRTY_TILE_BYTES, after + last * DIRTY_TILE_BYTES, DIRTY_TILE_BYTES) == 0) {
+            last--;
+        }
+        spans[count].x = first;
+        spans[count].y = y;
+        spans[count].width = last - first + 1;
+        count++;
+    }
+    return count;
+}
+
+void dirty_tiles_commit(uint8_t* shown, const uint8_t* frame, uint8_t tileWidth, const TileSpan* spans, size_t count) {
+    size_t rowBytes = (size_t)tileWidth * DIRTY_TILE_BYTES;
+    for (size_t i = 0; i < count; i++) {
+        size_t offset = spans[i].y * rowBytes + spans[i].x * DIRTY_TILE_BYTES;
+        std::memcpy(shown + offset, frame + offset, spans[i].width * DIRTY_TILE_BYTES);
+    }
+}
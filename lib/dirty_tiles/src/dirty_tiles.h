@@ -0,0 +1,29 @@
+#ifndef DIRTY_TILES_H
+#define DIRTY_TILES_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Buffer layout used by u8g2 full-frame buffers and the SSD1306: rows of
+// tiles 8 pixels high, each tile 8 bytes (one per pixel column, LSB on
+// top), tile rows stored one after the other.
+#define DIRTY_TILE_BYTES 8
+
+// A run of tiles in one tile row, in tile units as u8g2's
+// updateDisplayArea() takes them.
+struct TileSpan {
+    uint8_t x;
+    uint8_t y;
+    uint8_t width;
+};
+
+// One span per changed tile row, from its first to its last changed tile,
+// written to spans (room for tileHeight is always enough). Returns the
+// number of spans; 0 when the frames are identical.
+size_t dirty_tile_spans(const uint8_t* shown, const uint8_t* frame, uint8_t tileWidth, uint8_t tileHeight,
+                        TileSpan* spans, size_t maxSpans);
+
+// Copies the spans from frame into shown, so it matches the panel again.
+void dirty_tiles_commit(uint8_t* shown, const uint8_t* frame, uint8_t tileWidth, const TileSpan* spans, size_t count);
+
+#endif // DIRTY_TILES_H
@@ -0,0 +1,67 @@
+#include "file_journal_storage.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+FileJournalStorage::FileJournalStorage(const char* directory) {
+    std::snprintf(this->directory, sizeof(this->directory), "%s", directory);
+}
+
+void FileJournalStorage::path(uint32_t segment, char* output, size_t outputSize) const {
+    std::snprintf(output, outputSize, "%s/%08lu.seg", directory, (unsigned long)segment);
+}
+
+bool FileJournalStorage::segments(uint32_t& first, uint32_t& last) {
+    DIR* dir = opendir(directory);
+    if (dir == NULL) return false;
+    bool found = false;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        char* end = NULL;
+        unsigned long number = std::strtoul(entry->d_name, &end, 10);
+        if (end == entry->d_name || std::strcmp(end, ".seg") != 0 || number == 0) continue;
+        if (!found || number < first) first = (uint32_t)number;
+        if (!found || number > last) last = (uint32_t)number;
+        found = true;
+    }
+    closedir(dir);
+    return found;
+}
+
+bool FileJournalStorage::append(uint32_t segment, const uint8_t* data, size_t length) {
+    char name[128];
+    path(segment, name, sizeof(name));
+    FILE* file = std::fopen(name, "ab");
+    if (file == NULL) return false;
+    bool written = std::fwrite(data, 1, length, file) == length && std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+    return std::fclose(file) == 0 && written;
+}
+
+size_t FileJournalStorage::read(uint32_t segment, uint32_t offset, uint8_t* data, size_t length) {
+    char name[128];
+    path(segment, name, sizeof(name));
+    FILE* file = std::fopen(name, "rb");
+    if (file == NULL) return 0;
+    size_t bytes = 0;
+    if (std::fseek(file, (long)offset, SEEK_SET) == 0) {
+        bytes = std::fread(data, 1, length, file);
+    }
+    std::fclose(file);
+    return bytes;
+}
+
+uint32_t FileJournalStorage::size(uint32_t segment) {
+    char name[128];
+    path(segment, name, sizeof(name));
+    struct stat info;
+    return stat(name, &info) == 0 ? (uint32_t)info.st_size : 0;
+}
+
+bool FileJournalStorage::remove(uint32_t segment) {
+    char name[128];
+    path(segment, name, sizeof(name));
+    return std::remove(name) == 0;
+}
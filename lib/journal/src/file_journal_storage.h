@@ -0,0 +1,26 @@
+#ifndef FILE_JOURNAL_STORAGE_H
+#define FILE_JOURNAL_STORAGE_H
+
+#include "journal.h"
+
+// Journal segments as files named <number>.seg in an existing directory,
+// through stdio: the host half, for the benchmarks and simulations and for
+// reading a journal copied off a base station. Each append is flushed and
+// synced before it returns.
+class FileJournalStorage : public JournalStorage {
+public:
+    explicit FileJournalStorage(const char* directory);
+
+    bool segments(uint32_t& first, uint32_t& last) override;
+    bool append(uint32_t segment, const uint8_t* data, size_t length) override;
+    size_t read(uint32_t segment, uint32_t offset, uint8_t* data, size_t length) override;
+    uint32_t size(uint32_t segment) override;
+    bool remove(uint32_t segment) override;
+
+private:
+    char directory[96];
+
+    void path(uint32_t segment, char* output, size_t outputSize) const;
+};
+
+#endif // FILE_JOURNAL_STORAGE_H
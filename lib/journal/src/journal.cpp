@@ -0,0 +1,336 @@
+#include "journal.h"
+#include <cstring>
+
+#define HEADER_CRC_OFFSET (JOURNAL_BLOCK_HEADER_SIZE - 2)
+#define RECORD_CRC_OFFSET (JOURNAL_BLOCK_HEADER_SIZE - 4)
+#define SOURCES_OFFSET 20
+
+static void put16(uint8_t* data, uint16_t value) {
+    data[0] = (uint8_t)(value >> 8);
+    data[1] = (uint8_t)value;
+}
+
+static void put32(uint8_t* data, uint32_t value) {
+    data[0] = (uint8_t)(value >> 24);
+    data[1] = (uint8_t)(value >> 16);
+    data[2] = (uint8_t)(value >> 8);
+    data[3] = (uint8_t)value;
+}
+
+static uint16_t get16(const uint8_t* data) {
+    return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+static uint32_t get32(const uint8_t* data) {
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+// Wrap-safe, like the millis() comparisons elsewhere.
+static bool inRange(uint32_t timeMs, uint32_t fromMs, uint32_t toMs) {
+    return timeMs - fromMs <= toMs - fromMs;
+}
+
+static bool overlaps(uint32_t firstMs, uint32_t lastMs, uint32_t fromMs, uint32_t toMs) {
+    return inRange(firstMs, fromMs, toMs) || inRange(fromMs, firstMs, lastMs);
+}
+
+static bool hasSource(const uint8_t* sources, int sourceID) {
+    return sourceID < 0 || (sources[sourceID >> 3] >> (sourceID & 7)) & 1;
+}
+
+Journal::Journal(JournalStorage& storage, size_t maxSegments)
+    : storage(storage), maxSegments(maxSegments), segmentCount(0), nextSegment(1), appendToLast(false),
+      nextSequence(1), clockOffset(0), openCount(0), openUsed(0), openFirstMs(0), openLastMs(0), openSinceMs(0) {
+    if (this->maxSegments < 1) this->maxSegments = 1;
+    if (this->maxSegments > JOURNAL_MAX_SEGMENTS) this->maxSegments = JOURNAL_MAX_SEGMENTS;
+    std::memset(segments, 0, sizeof(segments));
+    std::memset(openSources, 0, sizeof(openSources));
+    std::memset(&counters, 0, sizeof(counters));
+}
+
+void Journal::mount() {
+    segmentCount = 0;
+    nextSegment = 1;
+    appendToLast = false;
+    nextSequence = 1;
+    clockOffset = 0;
+    openCount = 0;
+    openUsed = 0;
+    std::memset(openSources, 0, sizeof(openSources));
+
+    uint32_t first, last;
+    if (!storage.segments(first, last)) return;
+    nextSegment = last + 1;
+    bool haveClock = false;
+    uint32_t lastMs = 0;
+    for (uint32_t number = first; number - first <= last - first; number++) {
+        if (last - number >= maxSegments) {
+            storage.remove(number);
+            continue;
+        }
+        uint32_t bytes = storage.size(number);
+        uint32_t blocks = bytes / JOURNAL_BLOCK_SIZE;
+        bool whole = bytes % JOURNAL_BLOCK_SIZE == 0 && blocks <= JOURNAL_SEGMENT_BLOCKS;
+        if (blocks > JOURNAL_SEGMENT_BLOCKS) blocks = JOURNAL_SEGMENT_BLOCKS;
+
+        Segment segment;
+        std::memset(&segment, 0, sizeof(segment));
+        segment.number = number;
+        bool any = false;
+        for (uint32_t block = 0; block < blocks; block++) {
+            BlockHeader header;
+            if (storage.read(number, block * JOURNAL_BLOCK_SIZE, readBuffer, JOURNAL_BLOCK_HEADER_SIZE) != JOURNAL_BLOCK_HEADER_SIZE ||
+                !decodeHeader(readBuffer, header)) {
+                whole = false;  // replay skips it too
+                continue;
+            }
+            if (!any) segment.firstMs = header.firstMs;
+            any = true;
+            segment.lastMs = header.lastMs;
+            segment.blocks = (uint16_t)(block + 1);
+            for (size_t i = 0; i < sizeof(segment.sources); i++) segment.sources[i] |= header.sources[i];
+            if (!haveClock || (int32_t)(header.sequence - nextSequence) >= 0) {
+                haveClock = true;
+                nextSequence = header.sequence + 1;
+                lastMs = header.lastMs;
+            }
+        }
+        if (!any) {
+            storage.remove(number);
+            continue;
+        }
+        segments[segmentCount++] = segment;
+        appendToLast = whole && number == last && segment.blocks == blocks && blocks < JOURNAL_SEGMENT_BLOCKS;
+    }
+    if (haveClock) clockOffset = lastMs + 1;
+}
+
+uint32_t Journal::now(uint32_t uptimeMs) const {
+    return clockOffset + uptimeMs;
+}
+
+bool Journal::append(uint32_t uptimeMs, int16_t rssi, float snr, uint8_t sourceID, const uint8_t* frame, uint8_t length) {
+    size_t size = JOURNAL_RECORD_HEADER_SIZE + length;
+    bool written = true;
+    if (JOURNAL_BLOCK_HEADER_SIZE + openUsed + size > JOURNAL_BLOCK_SIZE) {
+        written = writeBlock();
+    }
+    uint32_t timeMs = now(uptimeMs);
+    uint8_t* record = &writeBuffer[JOURNAL_BLOCK_HEADER_SIZE + openUsed];
+    record[0] = length;
+    put32(&record[1], timeMs);
+    put16(&record[5], (uint16_t)rssi);
+    put16(&record[7], (uint16_t)(int16_t)(snr * 4.0f));
+    record[9] = sourceID;
+    std::memcpy(&record[JOURNAL_RECORD_HEADER_SIZE], frame, length);
+
+    if (openCount == 0) {
+        openFirstMs = timeMs;
+        openSinceMs = uptimeMs;
+    }
+    openLastMs = timeMs;
+    openCount++;
+    openUsed += (uint16_t)size;
+    openSources[sourceID >> 3] |= (uint8_t)(1u << (sourceID & 7));
+    counters.records++;
+    return written;
+}
+
+bool Journal::flush() {
+    return openCount == 0 || writeBlock();
+}
+
+uint32_t Journal::unwritten_ms(uint32_t uptimeMs) const {
+    return openCount > 0 ? uptimeMs - openSinceMs : 0;
+}
+
+void Journal::startSegment() {
+    if (segmentCount == maxSegments) {
+        storage.remove(segments[0].number);
+        std::memmove(&segments[0], &segments[1], (segmentCount - 1) * sizeof(Segment));
+        segmentCount--;
+    }
+    Segment& segment = segments[segmentCount++];
+    std::memset(&segment, 0, sizeof(segment));
+    segment.number = nextSegment++;
+    appendToLast = true;
+}
+
+bool Journal::writeBlock() {
+    if (openCount == 0) return true;
+    uint8_t* header = writeBuffer;
+    header[0] = 'W';
+    header[1] = 'J';
+    header[2] = JOURNAL_VERSION;
+    header[3] = 0;
+    put32(&header[4], nextSequence);
+    put32(&header[8], openFirstMs);
+    put32(&header[12], openLastMs);
+    put16(&header[16], openCount);
+    put16(&header[18], openUsed);
+    std::memcpy(&header[SOURCES_OFFSET], openSources, sizeof(openSources));
+    put16(&header[RECORD_CRC_OFFSET], PayloadBuilder::crc16(&writeBuffer[JOURNAL_BLOCK_HEADER_SIZE], openUsed));
+    put16(&header[HEADER_CRC_OFFSET], PayloadBuilder::crc16(header, HEADER_CRC_OFFSET));
+    std::memset(&writeBuffer[JOURNAL_BLOCK_HEADER_SIZE + openUsed], 0, JOURNAL_BLOCK_SIZE - JOURNAL_BLOCK_HEADER_SIZE - openUsed);
+
+    if (write_segment() == nextSegment) {
+        startSegment();
+    }
+    Segment& segment = segments[segmentCount - 1];
+    bool written = storage.append(segment.number, writeBuffer, JOURNAL_BLOCK_SIZE);
+    if (written) {
+        if (segment.blocks == 0) segment.firstMs = openFirstMs;
+        segment.lastMs = openLastMs;
+        segment.blocks++;
+        for (size_t i = 0; i < sizeof(segment.sources); i++) segment.sources[i] |= openSources[i];
+        nextSequence++;
+        counters.blocksWritten++;
+    } else {
+        // The segment may now end in part of a block; the next block starts
+        // a new one.
+        appendToLast = false;
+        counters.writeFailures++;
+        counters.recordsLost += openCount;
+        if (segment.blocks == 0) {
+            storage.remove(segment.number);
+            segmentCount--;
+        }
+    }
+    openCount = 0;
+    openUsed = 0;
+    std::memset(openSources, 0, sizeof(openSources));
+    return written;
+}
+
+bool Journal::decodeHeader(const uint8_t* data, BlockHeader& header) {
+    if (data[0] != 'W' || data[1] != 'J' || data[2] != JOURNAL_VERSION) return false;
+    if (get16(&data[HEADER_CRC_OFFSET]) != PayloadBuilder::crc16(data, HEADER_CRC_OFFSET)) return false;
+    header.sequence = get32(&data[4]);
+    header.firstMs = get32(&data[8]);
+    header.lastMs = get32(&data[12]);
+    header.count = get16(&data[16]);
+    header.used = get16(&data[18]);
+    std::memcpy(header.sources, &data[SOURCES_OFFSET], sizeof(header.sources));
+    header.recordCrc = get16(&data[RECORD_CRC_OFFSET]);
+    return header.used <= JOURNAL_BLOCK_SIZE - JOURNAL_BLOCK_HEADER_SIZE;
+}
+
+void Journal::begin_replay(Cursor& cursor, uint32_t fromMs, uint32_t toMs, int sourceID) const {
+    std::memset(&cursor, 0, sizeof(cursor));
+    cursor.fromMs = fromMs;
+    cursor.toMs = toMs;
+    cursor.sourceID = (int16_t)(sourceID >= 0 && sourceID <= 0xFF ? sourceID : -1);
+    cursor.segment = segmentCount > 0 ? segments[0].number : nextSegment;
+}
+
+// Moves the cursor to the next block whose index entry matches, checks its
+// records' CRC and loads it into the read buffer. The unwritten block comes
+// last, as a copy.
+bool Journal::loadNextBlock(Cursor& cursor) {
+    for (size_t i = 0; i < segmentCount; i++) {
+        const Segment& segment = segments[i];
+        if (segment.number < cursor.segment) continue;
+        if (segment.number > cursor.segment) {
+            cursor.segment = segment.number;
+            cursor.block = 0;
+        }
+        if (!overlaps(segment.firstMs, segment.lastMs, cursor.fromMs, cursor.toMs) || !hasSource(segment.sources, cursor.sourceID)) {
+            if (segment.blocks > cursor.block) cursor.blocksSkipped += segment.blocks - cursor.block;
+            cursor.segment++;
+            cursor.block = 0;
+            continue;
+        }
+        while (cursor.block < segment.blocks) {
+            uint32_t offset = (uint32_t)cursor.block * JOURNAL_BLOCK_SIZE;
+            BlockHeader header;
+            bool wanted = storage.read(segment.number, offset, readBuffer, JOURNAL_BLOCK_HEADER_SIZE) == JOURNAL_BLOCK_HEADER_SIZE &&
+                          decodeHeader(readBuffer, header) &&
+                          overlaps(header.firstMs, header.lastMs, cursor.fromMs, cursor.toMs) &&
+                          hasSource(header.sources, cursor.sourceID);
+            // A block cut short by a reset fails here.
+            if (wanted && (storage.read(segment.number, offset + JOURNAL_BLOCK_HEADER_SIZE, &readBuffer[JOURNAL_BLOCK_HEADER_SIZE], header.used) != header.used ||
+                           PayloadBuilder::crc16(&readBuffer[JOURNAL_BLOCK_HEADER_SIZE], header.used) != header.recordCrc)) {
+                wanted = false;
+            }
+            if (!wanted) {
+                cursor.blocksSkipped++;
+                cursor.block++;
+                continue;
+            }
+            cursor.blocksRead++;
+            cursor.loaded = true;
+            cursor.offset = JOURNAL_BLOCK_HEADER_SIZE;
+            cursor.end = (uint16_t)(JOURNAL_BLOCK_HEADER_SIZE + header.used);
+            return true;
+        }
+        cursor.segment++;
+        cursor.block = 0;
+    }
+
+    if (openCount == 0 || !overlaps(openFirstMs, openLastMs, cursor.fromMs, cursor.toMs) || !hasSource(openSources, cursor.sourceID)) {
+        return false;
+    }
+    std::memcpy(&readBuffer[JOURNAL_BLOCK_HEADER_SIZE], &writeBuffer[JOURNAL_BLOCK_HEADER_SIZE], openUsed);
+    cursor.loaded = true;
+    cursor.inOpenBlock = true;
+    cursor.offset = JOURNAL_BLOCK_HEADER_SIZE;
+    cursor.end = (uint16_t)(JOURNAL_BLOCK_HEADER_SIZE + openUsed);
+    return true;
+}
+
+bool Journal::next(Cursor& cursor, JournalRecord& record) {
+    while (!cursor.done) {
+        while (cursor.loaded && cursor.offset + JOURNAL_RECORD_HEADER_SIZE <= cursor.end) {
+            const uint8_t* data = &readBuffer[cursor.offset];
+            size_t size = JOURNAL_RECORD_HEADER_SIZE + data[0];
+            if (cursor.offset + size > cursor.end) break;
+            cursor.offset += (uint16_t)size;
+            record.timeMs = get32(&data[1]);
+            record.rssi = (int16_t)get16(&data[5]);
+            record.snr = (int16_t)get16(&data[7]) / 4.0f;
+            record.sourceID = data[9];
+            record.frame = &data[JOURNAL_RECORD_HEADER_SIZE];
+            record.length = data[0];
+            if (inRange(record.timeMs, cursor.fromMs, cursor.toMs) && (cursor.sourceID < 0 || record.sourceID == cursor.sourceID)) {
+                return true;
+            }
+        }
+        if (cursor.loaded) {
+            cursor.loaded = false;
+            if (cursor.inOpenBlock) {
+                cursor.done = true;
+                break;
+            }
+            cursor.block++;
+        }
+        if (!loadNextBlock(cursor)) cursor.done = true;
+    }
+    return false;
+}
+
+const Journal::Stats& Journal::stats() const {
+    return counters;
+}
+
+uint32_t Journal::write_segment() const {
+    if (!appendToLast || segmentCount == 0 || segments[segmentCount - 1].blocks >= JOURNAL_SEGMENT_BLOCKS) {
+        return nextSegment;
+    }
+    return segments[segmentCount - 1].number;
+}
+
+size_t Journal::segment_count() const {
+    return segmentCount;
+}
+
+uint32_t Journal::stored_blocks() const {
+    uint32_t blocks = 0;
+    for (size_t i = 0; i < segmentCount; i++) blocks += segments[i].blocks;
+    return blocks;
+}
+
+bool Journal::oldest_ms(uint32_t& timeMs) const {
+    if (segmentCount == 0) return false;
+    timeMs = segments[0].firstMs;
+    return true;
+}
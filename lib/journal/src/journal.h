@@ -0,0 +1,189 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <cstdint>
+#include <cstddef>
+#include "payload_builder.h"
+
+// Records are written in blocks of this size, the flash sector and
+// LittleFS block size on the ESP32. A block is only ever appended whole,
+// so every write programs one fresh block and none is rewritten to add
+// to it; a partly filled block is padded.
+#define JOURNAL_BLOCK_SIZE 4096
+
+// A segment is one file of up to this many blocks (64 KB). Retention
+// removes whole segments, oldest first.
+#define JOURNAL_SEGMENT_BLOCKS 16
+
+// Most segments kept: 1 MB, which fits the ESP32's default 1.4 MB data
+// partition with room for LittleFS's own metadata.
+#define JOURNAL_MAX_SEGMENTS 16
+
+// A partly filled block is written once its oldest record has waited this
+// long. A reset loses at most this much traffic, and a quiet network still
+// writes at most one block a minute.
+#define JOURNAL_FLUSH_MS 60000
+
+// Block layout, multi-byte fields big-endian:
+//   [magic 'W' 'J'][version][reserved][sequence, 4][first ms, 4][last ms, 4]
+//   [record count, 2][record bytes, 2][sources, 32]
+//   [record CRC-16][header CRC-16]
+// then the records, each
+//   [frame length][time ms, 4][rssi, 2][snr in 0.25 dB, 2][source][frame]
+// and zero padding. sources has bit n set if a record in the block is
+// filed under node n; with the time range it is the block's index entry,
+// so a replay reads the 56-byte header of a block it does not need instead
+// of the whole block.
+#define JOURNAL_VERSION 1
+#define JOURNAL_BLOCK_HEADER_SIZE 56
+#define JOURNAL_RECORD_HEADER_SIZE 10
+
+// Where the journal's segments live: LittleFS on the base station, plain
+// files on a host. Segments are numbered upwards from 1 and are only ever
+// appended to, read, or removed whole.
+class JournalStorage {
+public:
+    virtual ~JournalStorage() {}
+
+    // Oldest and newest segment present; false if there are none.
+    virtual bool segments(uint32_t& first, uint32_t& last) = 0;
+    // Appends to the segment, creating it if needed. Returns true once the
+    // data is durable.
+    virtual bool append(uint32_t segment, const uint8_t* data, size_t length) = 0;
+    // Returns the number of bytes read, short at the end of the segment.
+    virtual size_t read(uint32_t segment, uint32_t offset, uint8_t* data, size_t length) = 0;
+    // 0 if the segment does not exist.
+    virtual uint32_t size(uint32_t segment) = 0;
+    virtual bool remove(uint32_t segment) = 0;
+};
+
+// A received frame as journaled.
+struct JournalRecord {
+    uint32_t timeMs;        // journal time, see Journal::now()
+    int16_t rssi;           // dBm
+    float snr;              // dB, to 0.25 dB
+    uint8_t sourceID;       // node the record is indexed under
+    const uint8_t* frame;   // validated frame as received, relay envelope included
+    uint8_t length;
+};
+
+// Crash-safe append-only journal of received frames. Records collect in a
+// RAM block that is written out when it is full or when the caller
+// flushes it; a block is written in one append, behind its header, and a
+// block cut short by a reset fails its CRC and is skipped. A record is
+// durable once its block is written, so a reset loses at most the open
+// block.
+//
+// The journal keeps a summary of each segment (time range and sources) in
+// RAM, rebuilt from the block headers at mount, and replays a time range,
+// optionally for one node, without reading the blocks outside it.
+//
+// Journal time is ms since boot plus the time of the last record written
+// before this boot, so it never goes backwards across resets (the time the
+// base was off is not counted). Like millis() it wraps after 49 days;
+// ranges are compared wrap-safely. Not locked: the firmware guards it.
+class Journal {
+public:
+    struct Stats {
+        uint32_t records;           // appended since mount
+        uint32_t blocksWritten;
+        uint32_t writeFailures;
+        uint32_t recordsLost;       // in blocks whose write failed
+    };
+
+    // Replay position. One replay at a time: the cursor's current block is
+    // held in the journal's read buffer.
+    struct Cursor {
+        uint32_t fromMs;
+        uint32_t toMs;
+        int16_t sourceID;           // -1 for every node
+        uint32_t segment;
+        uint16_t block;
+        uint16_t offset;            // next record in the loaded block
+        uint16_t end;               // end of the loaded block's records
+        bool loaded;
+        bool inOpenBlock;           // the loaded block is the unwritten one
+        bool done;
+        uint32_t blocksRead;
+        uint32_t blocksSkipped;     // passed over on their index entry
+    };
+
+    explicit Journal(JournalStorage& storage, size_t maxSegments = JOURNAL_MAX_SEGMENTS);
+
+    // Rebuilds the segment summaries and the clock from the block headers
+    // (not the records) and removes segments beyond retention. New blocks
+    // go on the end of the newest segment if it ends on a whole, valid
+    // block, otherwise into a new segment.
+    void mount();
+
+    uint32_t now(uint32_t uptimeMs) const;
+
+    // Adds a frame to the open block, writing the block first if the frame
+    // does not fit. Returns false if that write failed.
+    bool append(uint32_t uptimeMs, int16_t rssi, float snr, uint8_t sourceID, const uint8_t* frame, uint8_t length);
+    // Writes the open block if it holds any records.
+    bool flush();
+    // How long the oldest record in the open block has waited; 0 if empty.
+    uint32_t unwritten_ms(uint32_t uptimeMs) const;
+
+    // Records from fromMs to toMs (journal time, inclusive), oldest first,
+    // the unwritten ones included. sourceID -1 replays every node.
+    void begin_replay(Cursor& cursor, uint32_t fromMs, uint32_t toMs, int sourceID) const;
+    // record.frame points into the read buffer until the next call.
+    bool next(Cursor& cursor, JournalRecord& record);
+
+    const Stats& stats() const;
+    // Segment the next block is written to: the newest one if it has room,
+    // otherwise the one after it.
+    uint32_t write_segment() const;
+    size_t segment_count() const;
+    uint32_t stored_blocks() const;
+    // Time of the oldest stored record; false if nothing is stored.
+    bool oldest_ms(uint32_t& timeMs) const;
+
+private:
+    struct Segment {
+        uint32_t number;
+        uint32_t firstMs;
+        uint32_t lastMs;
+        uint16_t blocks;
+        uint8_t sources[32];
+    };
+
+    struct BlockHeader {
+        uint32_t sequence;
+        uint32_t firstMs;
+        uint32_t lastMs;
+        uint16_t count;
+        uint16_t used;
+        uint8_t sources[32];
+        uint16_t recordCrc;
+    };
+
+    JournalStorage& storage;
+    size_t maxSegments;
+    Segment segments[JOURNAL_MAX_SEGMENTS];
+    size_t segmentCount;
+    uint32_t nextSegment;
+    bool appendToLast;          // the newest segment ends on a whole block
+    uint32_t nextSequence;
+    uint32_t clockOffset;
+
+    uint8_t writeBuffer[JOURNAL_BLOCK_SIZE];
+    uint16_t openCount;
+    uint16_t openUsed;
+    uint32_t openFirstMs;
+    uint32_t openLastMs;
+    uint32_t openSinceMs;       // uptime of the first record
+    uint8_t openSources[32];
+
+    uint8_t readBuffer[JOURNAL_BLOCK_SIZE];
+    Stats counters;
+
+    bool writeBlock();
+    void startSegment();
+    bool loadNextBlock(Cursor& cursor);
+    static bool decodeHeader(const uint8_t* data, BlockHeader& header);
+};
+
+#endif // JOURNAL_H
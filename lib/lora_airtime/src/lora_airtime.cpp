@@ -0,0 +1,43 @@
+#include "lora_airtime.h"
+
+LoRaModemConfig lora_default_config() {
+    LoRaModemConfig config;
+    config.spreadingFactor = 7;
+    config.bandwidth = 125000;
+    config.codingRate4 = 5;
+    config.preambleLength = 8;
+    config.implicitHeader = false;
+    config.crc = false;
+    return config;
+}
+
+uint32_t lora_symbol_time_us(const LoRaModemConfig& config) {
+    return (uint32_t)(((uint64_t)1000000 << config.spreadingFactor) / config.bandwidth);
+}
+
+bool lora_low_data_rate_optimize(const LoRaModemConfig& config) {
+    long symbolRate = (long)config.bandwidth / (1L << config.spreadingFactor);
+    if (symbolRate == 0) {
+        return true;
+    }
+    long symbolDurationMs = 1000 / symbolRate;
+    return symbolDurationMs > 16;
+}
+
+uint32_t lora_time_on_air_us(const LoRaModemConfig& config, size_t payloadLength) {
+    int sf = config.spreadingFactor;
+    int de = lora_low_data_rate_optimize(config) ? 1 : 0;
+    int numerator = 8 * (int)payloadLength - 4 * sf + 28 + (config.crc ? 16 : 0) - (config.implicitHeader ? 20 : 0);
+    int denominator = 4 * (sf - 2 * de);
+
+    int payloadSymbols = 8;
+    if (numerator > 0) {
+        payloadSymbols += ((numerator + denominator - 1) / denominator) * config.codingRate4;
+    }
+
+    // Preamble adds 4.25 symbols to the programmed length; work in quarter
+    // symbols to stay in integer arithmetic.
+    uint64_t quarterSymbols = 4 * (uint64_t)(config.preambleLength + payloadSymbols) + 17;
+    uint64_t symbolNs = ((uint64_t)1000000000 << sf) / config.bandwidth;
+    return (uint32_t)((quarterSymbols * symbolNs / 4 + 500) / 1000);
+}
@@ -0,0 +1,34 @@
+#ifndef LORA_AIRTIME_H
+#define LORA_AIRTIME_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Modem settings that determine the time-on-air of a frame.
+struct LoRaModemConfig {
+    uint8_t spreadingFactor;  // 6..12
+    uint32_t bandwidth;       // Hz
+    uint8_t codingRate4;      // denominator of the coding rate, 5..8 (4/5..4/8)
+    uint16_t preambleLength;  // programmed preamble symbols
+    bool implicitHeader;
+    bool crc;
+};
+
+// Settings the LoRa library uses after begin(): SF7, 125 kHz, 4/5,
+// 8 preamble symbols, explicit header, payload CRC off.
+LoRaModemConfig lora_default_config();
+
+uint32_t lora_symbol_time_us(const LoRaModemConfig& config);
+
+// Mirrors the LoRa library's setLdoFlag(), which runs on every spreading
+// factor or bandwidth change. It works in whole milliseconds,
+// 1000 / (bandwidth / 2^SF), and sets the bit only above 16. The integer
+// division truncates SF11/125 kHz (16.38 ms) to 16, so at 125 kHz only
+// SF12 gets the optimisation.
+bool lora_low_data_rate_optimize(const LoRaModemConfig& config);
+
+// Time-on-air of one packet carrying payloadLength bytes, following the
+// SX1276 datasheet formula (section 4.1.1.7).
+uint32_t lora_time_on_air_us(const LoRaModemConfig& config, size_t payloadLength);
+
+#endif // LORA_AIRTIME_H
@@ -0,0 +1,160 @@
+#include "metrics.h"
+#include <cstdio>
+
+static const uint32_t latencyBoundsUs[METRICS_LATENCY_BUCKETS - 1] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000
+};
+
+// ----- LatencyHistogram -----
+
+LatencyHistogram::LatencyHistogram() : maxUs(0) {
+    for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) buckets[i].store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::record(uint32_t latencyUs) {
+    size_t index = 0;
+    while (index < METRICS_LATENCY_BUCKETS - 1 && latencyUs >= latencyBoundsUs[index]) {
+        index++;
+    }
+    buckets[index].fetch_add(1, std::memory_order_relaxed);
+    if (latencyUs > maxUs.load(std::memory_order_relaxed)) {
+        maxUs.store(latencyUs, std::memory_order_relaxed);
+    }
+}
+
+uint32_t LatencyHistogram::count() const {
+    uint32_t total = 0;
+    for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) total += buckets[i].load(std::memory_order_relaxed);
+    return total;
+}
+
+uint32_t LatencyHistogram::bucket(size_t index) const {
+    return index < METRICS_LATENCY_BUCKETS ? buckets[index].load(std::memory_order_relaxed) : 0;
+}
+
+uint32_t LatencyHistogram::max_us() const {
+    return maxUs.load(std::memory_order_relaxed);
+}
+
+uint32_t LatencyHistogram::percentile_us(uint32_t permille) const {
+    uint32_t total = count();
+    if (total == 0) return 0;
+    uint64_t wanted = ((uint64_t)total * permille + 999) / 1000;
+    uint32_t seen = 0;
+    for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+        seen += bucket(i);
+        if (seen >= wanted) {
+            uint32_t largest = max_us();
+            return i < METRICS_LATENCY_BUCKETS - 1 && latencyBoundsUs[i] < largest ? latencyBoundsUs[i] : largest;
+        }
+    }
+    return max_us();
+}
+
+uint32_t LatencyHistogram::bound_us(size_t index) {
+    return index < METRICS_LATENCY_BUCKETS - 1 ? latencyBoundsUs[index] : UINT32_MAX;
+}
+
+// ----- Metrics -----
+
+Metrics::Metrics() : taskCount(0), queueCount(0) {
+    for (size_t i = 0; i < COUNTER_COUNT; i++) counters[i].store(0, std::memory_order_relaxed);
+}
+
+void Metrics::count(Counter counter, uint32_t amount) {
+    counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+uint32_t Metrics::counter(Counter counter) const {
+    return counters[counter].load(std::memory_order_relaxed);
+}
+
+int Metrics::add_task(const char* name, void* handle, uint32_t stackBytes) {
+    if (taskCount >= METRICS_MAX_TASKS) return -1;
+    tasks[taskCount].name = name;
+    tasks[taskCount].handle = handle;
+    tasks[taskCount].stackBytes = stackBytes;
+    tasks[taskCount].stackFree = stackBytes;
+    return (int)taskCount++;
+}
+
+int Metrics::add_queue(const char* name, uint32_t capacity) {
+    if (queueCount >= METRICS_MAX_QUEUES) return -1;
+    queues[queueCount].name = name;
+    queues[queueCount].capacity = capacity;
+    queues[queueCount].peak.store(0, std::memory_order_relaxed);
+    return (int)queueCount++;
+}
+
+size_t Metrics::task_count() const {
+    return taskCount;
+}
+
+void* Metrics::task_handle(size_t index) const {
+    return index < taskCount ? tasks[index].handle : nullptr;
+}
+
+void Metrics::set_task_stack_free(size_t index, uint32_t freeBytes) {
+    if (index < taskCount) tasks[index].stackFree = freeBytes;
+}
+
+void Metrics::queue_depth(int index, uint32_t depth) {
+    if (index < 0 || (size_t)index >= queueCount) return;
+    if (depth > queues[index].peak.load(std::memory_order_relaxed)) {
+        queues[index].peak.store(depth, std::memory_order_relaxed);
+    }
+}
+
+uint32_t Metrics::queue_peak(int index) const {
+    if (index < 0 || (size_t)index >= queueCount) return 0;
+    return queues[index].peak.load(std::memory_order_relaxed);
+}
+
+void Metrics::record_latency_us(uint32_t latencyUs) {
+    latencyHistogram.record(latencyUs);
+}
+
+const LatencyHistogram& Metrics::latency() const {
+    return latencyHistogram;
+}
+
+void Metrics::report(uint32_t uptimeMs, void (*writeLine)(const char* line)) const {
+    char line[112];
+    std::snprintf(line, sizeof(line), "Uptime: %lu s", (unsigned long)(uptimeMs / 1000));
+    writeLine(line);
+    std::snprintf(line, sizeof(line), "RX: %lu packets, %lu bytes, %lu checksum failures",
+                  (unsigned long)counter(RX_PACKETS), (unsigned long)counter(RX_BYTES), (unsigned long)counter(CHECKSUM_FAILURES));
+    writeLine(line);
+    std::snprintf(line, sizeof(line), "TX: %lu packets, %lu bytes",
+                  (unsigned long)counter(TX_PACKETS), (unsigned long)counter(TX_BYTES));
+    writeLine(line);
+
+    for (size_t i = 0; i < taskCount; i++) {
+        const TaskEntry& task = tasks[i];
+        std::snprintf(line, sizeof(line), "Task %s: stack peak %lu of %lu bytes", task.name,
+                      (unsigned long)(task.stackBytes - task.stackFree), (unsigned long)task.stackBytes);
+        writeLine(line);
+    }
+    for (size_t i = 0; i < queueCount; i++) {
+        std::snprintf(line, sizeof(line), "Queue %s: peak %lu of %lu", queues[i].name,
+                      (unsigned long)queue_peak((int)i), (unsigned long)queues[i].capacity);
+        writeLine(line);
+    }
+
+    const LatencyHistogram& latency = latencyHistogram;
+    std::snprintf(line, sizeof(line), "Receive to processed: %lu frames, p50 <= %lu us, p99 <= %lu us, max %lu us",
+                  (unsigned long)latency.count(), (unsigned long)latency.percentile_us(500),
+                  (unsigned long)latency.percentile_us(990), (unsigned long)latency.max_us());
+    writeLine(line);
+    for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+        if (latency.bucket(i) == 0) continue;
+        if (i < METRICS_LATENCY_BUCKETS - 1) {
+            std::snprintf(line, sizeof(line), "  < %lu us: %lu", (unsigned long)LatencyHistogram::bound_us(i),
+                          (unsigned long)latency.bucket(i));
+        } else {
+            std::snprintf(line, sizeof(line), "  >= %lu us: %lu", (unsigned long)latencyBoundsUs[i - 1],
+                          (unsigned long)latency.bucket(i));
+        }
+        writeLine(line);
+    }
+}
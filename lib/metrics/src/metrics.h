@@ -0,0 +1,112 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Latency buckets, in µs: each holds samples below its bound and above the
+// previous one; the last holds everything from 500 ms up.
+#define METRICS_LATENCY_BUCKETS 13
+#define METRICS_MAX_TASKS 8
+#define METRICS_MAX_QUEUES 8
+
+// Fixed-bucket histogram. record() is a short scan over constant bounds
+// and a few stores; no division, no allocation.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void record(uint32_t latencyUs);
+
+    uint32_t count() const;
+    uint32_t bucket(size_t index) const;
+    uint32_t max_us() const;
+    // Upper bound of the bucket that holds the given fraction of samples,
+    // in µs, or the largest sample if that is lower (always for the open
+    // last bucket); 0 without samples.
+    uint32_t percentile_us(uint32_t permille) const;
+
+    static uint32_t bound_us(size_t index);
+
+private:
+    std::atomic<uint32_t> buckets[METRICS_LATENCY_BUCKETS];
+    std::atomic<uint32_t> maxUs;
+};
+
+// One device's instrumentation. Counters may be bumped from any task; the
+// stack figures are filled in by the firmware just before a dump, since
+// reading them is FreeRTOS's business, not this library's.
+class Metrics {
+public:
+    enum Counter {
+        RX_PACKETS,
+        RX_BYTES,
+        TX_PACKETS,
+        TX_BYTES,
+        CHECKSUM_FAILURES,
+        COUNTER_COUNT
+    };
+
+    Metrics();
+
+    void count(Counter counter, uint32_t amount = 1);
+    uint32_t counter(Counter counter) const;
+
+    // Registration at startup; each returns the index to report against,
+    // or -1 once the table is full. Names must outlive the Metrics.
+    int add_task(const char* name, void* handle, uint32_t stackBytes);
+    int add_queue(const char* name, uint32_t capacity);
+
+    size_t task_count() const;
+    void* task_handle(size_t index) const;
+    // Smallest free stack seen for the task, in bytes.
+    void set_task_stack_free(size_t index, uint32_t freeBytes);
+
+    // Current occupancy of a queue; only the peak is kept.
+    void queue_depth(int index, uint32_t depth);
+    uint32_t queue_peak(int index) const;
+
+    // Time from a frame's reception to the end of its processing.
+    void record_latency_us(uint32_t latencyUs);
+    const LatencyHistogram& latency() const;
+
+    // Writes the report as text lines, each without a line ending.
+    void report(uint32_t uptimeMs, void (*writeLine)(const char* line)) const;
+
+private:
+    struct TaskEntry {
+        const char* name;
+        void* handle;
+        uint32_t stackBytes;
+        uint32_t stackFree;
+    };
+
+    struct QueueEntry {
+        const char* name;
+        uint32_t capacity;
+        std::atomic<uint32_t> peak;
+    };
+
+    std::atomic<uint32_t> counters[COUNTER_COUNT];
+    TaskEntry tasks[METRICS_MAX_TASKS];
+    size_t taskCount;
+    QueueEntry queues[METRICS_MAX_QUEUES];
+    size_t queueCount;
+    LatencyHistogram latencyHistogram;
+};
+
+// Instrumentation points. The firmware defines one Metrics named
+// `metrics`; built with METRICS_DISABLED it leaves that out, and these
+// expand to nothing, arguments included.
+#ifndef METRICS_DISABLED
+#define METRICS_COUNT(counter, amount) metrics.count(Metrics::counter, (amount))
+#define METRICS_QUEUE_DEPTH(index, depth) metrics.queue_depth((index), (depth))
+#define METRICS_LATENCY_US(latencyUs) metrics.record_latency_us(latencyUs)
+#else
+#define METRICS_COUNT(counter, amount) ((void)0)
+#define METRICS_QUEUE_DEPTH(index, depth) ((void)0)
+#define METRICS_LATENCY_US(latencyUs) ((void)0)
+#endif
+
+#endif // METRICS_H
@@ -0,0 +1,20 @@
+#ifndef MS_TIME_H
+#define MS_TIME_H
+
+#include <cstdint>
+
+// Deadlines on a 32-bit millisecond clock such as millis(), which wraps
+// every 49.7 days. Both helpers stay correct across the wrap as long as
+// nowMs and dueAt are less than 2^31 ms (24.8 days) apart.
+
+// True once nowMs is at or past dueAt.
+inline bool ms_reached(uint32_t nowMs, uint32_t dueAt) {
+    return (int32_t)(nowMs - dueAt) >= 0;
+}
+
+// Milliseconds from nowMs until dueAt, or 0 once it has been reached.
+inline uint32_t ms_remaining(uint32_t nowMs, uint32_t dueAt) {
+    return ms_reached(nowMs, dueAt) ? 0 : dueAt - nowMs;
+}
+
+#endif // MS_TIME_H
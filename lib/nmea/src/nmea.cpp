@@ -0,0 +1,208 @@
+#include "nmea.h"
+#include <cstring>
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+static bool isDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Decimal number with the given number of fractional digits kept, e.g.
+// "12.3456" with 3 decimals is 12345. Extra digits are truncated.
+static bool parseFixed(const char* text, int decimals, int32_t& value) {
+    int64_t result = 0;
+    int integerDigits = 0;
+    int fractionDigits = -1;  // -1 before the point
+    for (const char* p = text; *p; p++) {
+        if (*p == '.' && fractionDigits < 0) {
+            fractionDigits = 0;
+            continue;
+        }
+        if (!isDigit(*p)) return false;
+        if (fractionDigits < 0) {
+            if (++integerDigits > 9) return false;
+            result = result * 10 + (*p - '0');
+        } else if (fractionDigits < decimals) {
+            result = result * 10 + (*p - '0');
+            fractionDigits++;
+        }
+    }
+    if (integerDigits == 0 && fractionDigits <= 0) return false;
+    for (int i = fractionDigits < 0 ? 0 : fractionDigits; i < decimals; i++) result *= 10;
+    value = (int32_t)result;
+    return true;
+}
+
+// hhmmss with optional fraction of a second.
+static bool parseTime(const char* text, uint32_t& timeOfDayMs) {
+    for (int i = 0; i < 6; i++) {
+        if (!isDigit(text[i])) return false;
+    }
+    uint32_t hours = (text[0] - '0') * 10 + (text[1] - '0');
+    uint32_t minutes = (text[2] - '0') * 10 + (text[3] - '0');
+    int32_t secondsMs;
+    if (!parseFixed(&text[4], 3, secondsMs)) return false;
+    if (hours > 23 || minutes > 59 || secondsMs >= 61000) return false;
+    timeOfDayMs = hours * 3600000 + minutes * 60000 + (uint32_t)secondsMs;
+    return true;
+}
+
+// (d)ddmm.mmmm and a hemisphere letter, to 1e-7 degree. The degrees are
+// whatever precedes the two minute digits before the point.
+static bool parseCoordinate(const char* text, const char* hemisphere, int32_t maxDegrees, int32_t& valueE7) {
+    const char* point = std::strchr(text, '.');
+    size_t integerDigits = point ? (size_t)(point - text) : std::strlen(text);
+    if (integerDigits < 2 || integerDigits > 5) return false;
+    int32_t degrees = 0;
+    for (size_t i = 0; i < integerDigits - 2; i++) {
+        if (!isDigit(text[i])) return false;
+        degrees = degrees * 10 + (text[i] - '0');
+    }
+    int32_t minutesE5;  // minutes with five decimals: 1e-5 minute is about 2 cm
+    if (!parseFixed(&text[integerDigits - 2], 5, minutesE5)) return false;
+    if (degrees > maxDegrees || minutesE5 >= 6000000) return false;
+    // 1e-5 minute is 1e-7 degree x 100 / 60.
+    int64_t result = (int64_t)degrees * 10000000 + ((int64_t)minutesE5 * 100 + 30) / 60;
+    if (result > (int64_t)maxDegrees * 10000000) return false;
+    char h = hemisphere[0];
+    if (h == 'S' || h == 'W') {
+        result = -result;
+    } else if (h != 'N' && h != 'E') {
+        return false;
+    }
+    valueE7 = (int32_t)result;
+    return true;
+}
+
+NmeaParser::NmeaParser() : length(0), collecting(false), reported(false) {
+    std::memset(&current, 0, sizeof(current));
+    std::memset(&counters, 0, sizeof(counters));
+}
+
+bool NmeaParser::feed(char c) {
+    if (c == '$') {
+        // Also restarts after a sentence that lost its line ending.
+        collecting = true;
+        length = 0;
+        sentence[length++] = c;
+        return false;
+    }
+    if (!collecting) return false;
+    if (c == '\r' || c == '\n') {
+        collecting = false;
+        return endSentence();
+    }
+    if (length == NMEA_MAX_SENTENCE) {
+        counters.overflows++;
+        collecting = false;
+        return false;
+    }
+    sentence[length++] = c;
+    return false;
+}
+
+bool NmeaParser::endSentence() {
+    sentence[length] = '\0';
+    // "$<body>*hh": the checksum is the XOR of the body.
+    if (length < 4 || sentence[length - 3] != '*') {
+        counters.checksumErrors++;
+        return false;
+    }
+    int high = hexValue(sentence[length - 2]);
+    int low = hexValue(sentence[length - 1]);
+    uint8_t checksum = 0;
+    for (size_t i = 1; i < length - 3; i++) {
+        checksum ^= (uint8_t)sentence[i];
+    }
+    if (high < 0 || low < 0 || checksum != (uint8_t)((high << 4) | low)) {
+        counters.checksumErrors++;
+        return false;
+    }
+    counters.sentences++;
+    sentence[length - 3] = '\0';
+
+    char* fields[NMEA_MAX_FIELDS];
+    size_t count = 0;
+    char* field = &sentence[1];
+    for (;;) {
+        if (count == NMEA_MAX_FIELDS) return false;
+        fields[count++] = field;
+        char* comma = std::strchr(field, ',');
+        if (comma == nullptr) break;
+        *comma = '\0';
+        field = comma + 1;
+    }
+
+    // Talker (2 letters) and sentence type; proprietary $P... sentences
+    // have other lengths and are skipped.
+    if (std::strlen(fields[0]) != 5) return false;
+    const char* type = &fields[0][2];
+    if (std::strcmp(type, "RMC") == 0) return parseRmc(fields, count);
+    if (std::strcmp(type, "GGA") == 0) return parseGga(fields, count);
+    return false;
+}
+
+// $--RMC,time,status,lat,N/S,lon,E/W,speed (knots),course,date,...
+bool NmeaParser::parseRmc(char** fields, size_t count) {
+    if (count < 9 || fields[2][0] != 'A') return false;
+    uint32_t timeOfDayMs;
+    int32_t latitudeE7;
+    int32_t longitudeE7;
+    if (!parseTime(fields[1], timeOfDayMs) ||
+        !parseCoordinate(fields[3], fields[4], 90, latitudeE7) ||
+        !parseCoordinate(fields[5], fields[6], 180, longitudeE7)) {
+        return false;
+    }
+    // Both are empty on some receivers while standing still.
+    int32_t knotsMilli = 0;
+    int32_t courseCentiDeg = 0;
+    parseFixed(fields[7], 3, knotsMilli);
+    parseFixed(fields[8], 2, courseCentiDeg);
+    current.speedMmS = (uint32_t)(((int64_t)knotsMilli * 514444 + 500000) / 1000000);
+    current.courseCentiDeg = courseCentiDeg < 36000 ? (uint16_t)courseCentiDeg : 0;
+    return takePosition(timeOfDayMs, latitudeE7, longitudeE7);
+}
+
+// $--GGA,time,lat,N/S,lon,E/W,quality,satellites,hdop,altitude,...
+bool NmeaParser::parseGga(char** fields, size_t count) {
+    if (count < 9 || fields[6][0] == '\0' || fields[6][0] == '0') return false;
+    uint32_t timeOfDayMs;
+    int32_t latitudeE7;
+    int32_t longitudeE7;
+    if (!parseTime(fields[1], timeOfDayMs) ||
+        !parseCoordinate(fields[2], fields[3], 90, latitudeE7) ||
+        !parseCoordinate(fields[4], fields[5], 180, longitudeE7)) {
+        return false;
+    }
+    int32_t satellites = 0;
+    int32_t hdopCenti = 0;
+    parseFixed(fields[7], 0, satellites);
+    parseFixed(fields[8], 2, hdopCenti);
+    current.satellites = satellites < 255 ? (uint8_t)satellites : 255;
+    current.hdopCenti = hdopCenti < 65535 ? (uint16_t)hdopCenti : 65535;
+    return takePosition(timeOfDayMs, latitudeE7, longitudeE7);
+}
+
+bool NmeaParser::takePosition(uint32_t timeOfDayMs, int32_t latitudeE7, int32_t longitudeE7) {
+    bool newEpoch = !reported || timeOfDayMs != current.timeOfDayMs;
+    current.timeOfDayMs = timeOfDayMs;
+    current.latitudeE7 = latitudeE7;
+    current.longitudeE7 = longitudeE7;
+    if (!newEpoch) return false;
+    reported = true;
+    counters.fixes++;
+    return true;
+}
+
+const NmeaFix& NmeaParser::fix() const {
+    return current;
+}
+
+const NmeaParser::Stats& NmeaParser::stats() const {
+    return counters;
+}
@@ -0,0 +1,63 @@
+#ifndef NMEA_H
+#define NMEA_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Longest sentence NMEA 0183 allows, from '$' to the checksum digits.
+// Anything longer is dropped as line noise.
+#define NMEA_MAX_SENTENCE 82
+#define NMEA_MAX_FIELDS 20
+
+// Position of one receiver epoch. Coordinates are in units of 1e-7 degree
+// (about 1.1 cm), parsed with integer arithmetic so no precision is lost
+// on the way from the sentence.
+struct NmeaFix {
+    int32_t latitudeE7;
+    int32_t longitudeE7;
+    uint32_t timeOfDayMs;    // UTC
+    uint32_t speedMmS;       // RMC; 0 from a GGA-only receiver
+    uint16_t courseCentiDeg; // RMC, track made good
+    uint8_t satellites;      // GGA; 0 until one is seen
+    uint16_t hdopCenti;      // GGA; 0 until one is seen
+};
+
+// Fed one byte at a time as the UART delivers them, so nothing waits for
+// a whole sentence or a whole second. A sentence is checked against its
+// checksum when its line ends and parsed in place; only RMC and GGA are
+// read, from any talker (GP, GN, GL, ...). Memory is one sentence buffer.
+class NmeaParser {
+public:
+    struct Stats {
+        uint32_t sentences;       // complete, checksum correct
+        uint32_t checksumErrors;  // complete but damaged or without checksum
+        uint32_t overflows;       // longer than NMEA_MAX_SENTENCE
+        uint32_t fixes;
+    };
+
+    NmeaParser();
+
+    // Returns true when this byte completed a sentence that gave a valid
+    // position for a new epoch. Receivers send RMC and GGA for the same
+    // epoch; only the first of them reports it, the other fills in what it
+    // adds (satellites and HDOP, or speed and course).
+    bool feed(char c);
+
+    const NmeaFix& fix() const;
+    const Stats& stats() const;
+
+private:
+    char sentence[NMEA_MAX_SENTENCE + 1];
+    size_t length;
+    bool collecting;
+    NmeaFix current;
+    bool reported;          // current.timeOfDayMs has been reported
+    Stats counters;
+
+    bool endSentence();
+    bool parseRmc(char** fields, size_t count);
+    bool parseGga(char** fields, size_t count);
+    bool takePosition(uint32_t timeOfDayMs, int32_t latitudeE7, int32_t longitudeE7);
+};
+
+#endif // NMEA_H
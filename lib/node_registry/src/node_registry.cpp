@@ -0,0 +1,141 @@
+#include "node_registry.h"
+#include <cstdio>
+#include <cstring>
+
+NodeRegistry::NodeRegistry() : knownCount(0) {
+    std::memset(nodes, 0, sizeof(nodes));
+}
+
+NodeRegistry::Node& NodeRegistry::touch(uint8_t id, uint32_t nowMs) {
+    Node& node = nodes[id];
+    if (!(node.flags & NODE_KNOWN)) {
+        std::memset(&node, 0, sizeof(node));
+        node.flags = NODE_KNOWN;
+        knownCount++;
+    } else if (node.flags & NODE_STALE) {
+        node.flags = (node.flags & ~NODE_STALE) | NODE_BACK;
+        node.silenceMs = nowMs - node.lastHeardMs;
+    }
+    node.lastHeardMs = nowMs;
+    return node;
+}
+
+void NodeRegistry::record_frame(uint8_t id, uint16_t transmissionID, uint32_t nowMs, uint8_t relayID, uint8_t hopCount) {
+    Node& node = touch(id, nowMs);
+    node.frames++;
+    node.lastTransmissionID = transmissionID;
+    node.relayID = hopCount > 0 ? relayID : 0;
+    node.hopCount = hopCount;
+}
+
+void NodeRegistry::record_link(uint8_t id, int16_t rssi, float snr, uint32_t nowMs) {
+    Node& node = touch(id, nowMs);
+    int16_t rssiQ4 = (int16_t)(rssi * 16);
+    int16_t snrQ4 = (int16_t)(snr * 16);
+    if (!(node.flags & NODE_HAS_LINK)) {
+        node.rssiQ4 = rssiQ4;
+        node.snrQ4 = snrQ4;
+        node.flags |= NODE_HAS_LINK;
+        return;
+    }
+    node.rssiQ4 += (rssiQ4 - node.rssiQ4) / NODE_AVERAGE_WEIGHT;
+    node.snrQ4 += (snrQ4 - node.snrQ4) / NODE_AVERAGE_WEIGHT;
+}
+
+void NodeRegistry::record_position(uint8_t id, float latitude, float longitude, uint32_t nowMs) {
+    Node& node = touch(id, nowMs);
+    node.latitude = latitude;
+    node.longitude = longitude;
+    node.positionMs = nowMs;
+    node.flags |= NODE_HAS_POSITION;
+}
+
+void NodeRegistry::record_message(uint8_t id, bool duplicate) {
+    Node& node = nodes[id];
+    if (!(node.flags & NODE_KNOWN)) return;  // record_frame comes first
+    if (duplicate) {
+        node.duplicates++;
+    } else {
+        node.messages++;
+    }
+}
+
+bool NodeRegistry::accept_position(uint8_t id, uint16_t transmissionID) {
+    Node& node = nodes[id];
+    if (!(node.flags & NODE_KNOWN)) return true;
+    int16_t ahead = (int16_t)(transmissionID - node.positionID);
+    if (!(node.flags & NODE_HAS_POSITION_ID) || ahead >= NODE_DUPLICATE_WINDOW || ahead <= -NODE_DUPLICATE_WINDOW) {
+        node.flags |= NODE_HAS_POSITION_ID;
+        node.positionID = transmissionID;
+        node.positionWindow = 1;
+        return true;
+    }
+    if (ahead > 0) {
+        node.positionWindow = (node.positionWindow << ahead) | 1;
+        node.positionID = transmissionID;
+        return true;
+    }
+    uint32_t bit = 1u << -ahead;
+    if (node.positionWindow & bit) {
+        node.duplicates++;
+        return false;
+    }
+    node.positionWindow |= bit;  // late, e.g. the relayed copy of a lost frame
+    return true;
+}
+
+bool NodeRegistry::next_alert(uint32_t nowMs, Alert& alert) {
+    for (size_t i = 0; i < NODE_REGISTRY_SIZE; i++) {
+        Node& node = nodes[i];
+        if (!(node.flags & NODE_KNOWN)) continue;
+        if (node.flags & NODE_BACK) {
+            node.flags &= ~NODE_BACK;
+            alert = Alert{(uint8_t)i, ALERT_BACK, node.silenceMs};
+            return true;
+        }
+        uint32_t silentMs = nowMs - node.lastHeardMs;
+        if (!(node.flags & NODE_STALE) && silentMs >= NODE_STALE_MS) {
+            node.flags |= NODE_STALE;
+            alert = Alert{(uint8_t)i, ALERT_STALE, silentMs};
+            return true;
+        }
+    }
+    return false;
+}
+
+const NodeRegistry::Node& NodeRegistry::node(uint8_t id) const {
+    return nodes[id];
+}
+
+bool NodeRegistry::known(uint8_t id) const {
+    return (nodes[id].flags & NODE_KNOWN) != 0;
+}
+
+size_t NodeRegistry::known_count() const {
+    return knownCount;
+}
+
+const char* NodeRegistry::header() {
+    return " id  heard s   frames  msgs  dups   rssi   snr  via  last tx  position (age s)";
+}
+
+void NodeRegistry::format(uint8_t id, const Node& node, uint32_t nowMs, char* line, size_t lineSize) {
+    char via[8] = "-";
+    if (node.hopCount > 0) std::snprintf(via, sizeof(via), "%u", node.relayID);
+    char link[16] = "     -     -";
+    if (node.flags & NODE_HAS_LINK) std::snprintf(link, sizeof(link), "%6.1f %5.1f", node.rssiQ4 / 16.0f, node.snrQ4 / 16.0f);
+    char lastID[8] = "-";
+    if (node.frames > 0) std::snprintf(lastID, sizeof(lastID), "%u", node.lastTransmissionID);
+    int written = std::snprintf(line, lineSize, "%3u %8lu %8lu %5u %5u %s %4s %8s", id,
+                                (unsigned long)((nowMs - node.lastHeardMs) / 1000), (unsigned long)node.frames,
+                                node.messages, node.duplicates, link, via, lastID);
+    if (written < 0 || (size_t)written >= lineSize) return;
+    if (node.flags & NODE_HAS_POSITION) {
+        std::snprintf(&line[written], lineSize - written, "  %.6f,%.6f (%lu)", node.latitude, node.longitude,
+                      (unsigned long)((nowMs - node.positionMs) / 1000));
+    }
+    if (node.flags & NODE_STALE) {
+        size_t length = std::strlen(line);
+        std::snprintf(&line[length], lineSize - length, "  STALE");
+    }
+}
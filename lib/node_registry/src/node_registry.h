@@ -0,0 +1,103 @@
+#ifndef NODE_REGISTRY_H
+#define NODE_REGISTRY_H
+
+#include <cstdint>
+#include <cstddef>
+
+// One entry per 8-bit node ID, so a lookup is an array index.
+#define NODE_REGISTRY_SIZE 256
+
+// A node that has sent nothing for this long is reported stale: two
+// missed track heartbeats from a user (TRACK_HEARTBEAT_MS) and a margin.
+#define NODE_STALE_MS 660000
+
+// RSSI and SNR are exponential moving averages; each frame moves them
+// 1/NODE_AVERAGE_WEIGHT of the way to its own value.
+#define NODE_AVERAGE_WEIGHT 8
+
+// Transmission IDs remembered per node for duplicate detection, behind
+// the newest one seen.
+#define NODE_DUPLICATE_WINDOW 32
+
+// Everything the base knows about the nodes it hears: users by the frames
+// they originate, relays (and users heard directly) by the frames they put
+// on air. Updates and lookups take constant time and no allocation; the
+// table is a fixed array. Not locked: the firmware guards it.
+class NodeRegistry {
+public:
+    enum Flags {
+        NODE_KNOWN = 0x01,
+        NODE_HAS_POSITION = 0x02,
+        NODE_HAS_LINK = 0x04,       // rssiQ4/snrQ4 are set
+        NODE_HAS_POSITION_ID = 0x08,
+        NODE_STALE = 0x10,          // reported stale, not heard since
+        NODE_BACK = 0x20            // heard again after being reported stale
+    };
+
+    struct Node {
+        uint32_t lastHeardMs;
+        uint32_t silenceMs;         // length of the last stale period
+        uint32_t positionMs;
+        float latitude;
+        float longitude;
+        uint32_t frames;            // frames and aggregate records it originated, copies included
+        uint16_t messages;          // predefined and custom messages
+        uint16_t duplicates;        // copies dropped, messages and positions
+        uint16_t lastTransmissionID;
+        uint16_t positionID;        // newest position transmission
+        uint32_t positionWindow;    // bit n: positionID - n was seen
+        int16_t rssiQ4;             // in 1/16 dBm
+        int16_t snrQ4;              // in 1/16 dB
+        uint8_t flags;
+        uint8_t relayID;            // last relay its frames came through
+        uint8_t hopCount;           // 0 if last heard directly
+    };
+
+    enum AlertType {
+        ALERT_STALE,
+        ALERT_BACK
+    };
+
+    struct Alert {
+        uint8_t id;
+        AlertType type;
+        uint32_t silentMs;          // since last heard (stale) or how long it was silent (back)
+    };
+
+    NodeRegistry();
+
+    // A frame (or aggregate record) originated by id.
+    void record_frame(uint8_t id, uint16_t transmissionID, uint32_t nowMs, uint8_t relayID, uint8_t hopCount);
+    // Radio quality of a frame id put on air itself.
+    void record_link(uint8_t id, int16_t rssi, float snr, uint32_t nowMs);
+    void record_position(uint8_t id, float latitude, float longitude, uint32_t nowMs);
+    void record_message(uint8_t id, bool duplicate);
+
+    // Position frames are not acknowledged, so the reliable link does not
+    // see them; a copy heard both directly and through a relay is caught
+    // here. Returns false (and counts a duplicate) for a transmission ID
+    // already seen from id. An ID far behind the window is taken as the
+    // node having restarted its count.
+    bool accept_position(uint8_t id, uint16_t transmissionID);
+
+    // Next alert since the last call: a node silent for NODE_STALE_MS, or
+    // one heard again after that. Scans the table (256 entries), so it is
+    // meant for a periodic check, not the receive path.
+    bool next_alert(uint32_t nowMs, Alert& alert);
+
+    const Node& node(uint8_t id) const;
+    bool known(uint8_t id) const;
+    size_t known_count() const;
+
+    // One-line text forms for a console dump, without line endings.
+    static const char* header();
+    static void format(uint8_t id, const Node& node, uint32_t nowMs, char* line, size_t lineSize);
+
+private:
+    Node nodes[NODE_REGISTRY_SIZE];
+    size_t knownCount;
+
+    Node& touch(uint8_t id, uint32_t nowMs);
+};
+
+#endif // NODE_REGISTRY_H
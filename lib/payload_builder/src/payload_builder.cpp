@@ -1,89 +1,503 @@
 #include "payload_builder.h"
+#include "text_codec.h"
 #include <vector>
 #include <cstring>
 #include <cstdlib>
+#include <chrono>
 
-void PayloadBuilder::getCurrentDateTime(uint8_t *buffer) {
+// Days since 1970-01-01 for a proleptic Gregorian date, and back.
+static int32_t daysFromCivil(int32_t year, uint32_t month, uint32_t day) {
+    year -= month <= 2;
+    int32_t era = (year >= 0 ? year : year - 399) / 400;
+    uint32_t yearOfEra = (uint32_t)(year - era * 400);
+    uint32_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + (int32_t)dayOfEra - 719468;
+}
+
+// Header dateTime (years since 2000, month, day, hour, minute, second) for
+// seconds since 1970-01-01.
+static void toDateTime(int64_t seconds, uint8_t* dateTime) {
+    int64_t days = (seconds >= 0 ? seconds : seconds - 86399) / 86400;
+    uint32_t secondOfDay = (uint32_t)(seconds - days * 86400);
+    int64_t z = days + 719468;
+    int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    uint32_t dayOfEra = (uint32_t)(z - era * 146097);
+    uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    uint32_t mp = (5 * dayOfYear + 2) / 153;
+    uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+    int64_t year = yearOfEra + era * 400 + (month <= 2);
+    dateTime[0] = year - 2000;
+    dateTime[1] = month;
+    dateTime[2] = dayOfYear - (153 * mp + 2) / 5 + 1;
+    dateTime[3] = secondOfDay / 3600;
+    dateTime[4] = secondOfDay / 60 % 60;
+    dateTime[5] = secondOfDay % 60;
+}
+
+static uint64_t monotonicMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+PayloadBuilder::PayloadBuilder() {
+    sync_time_base();
+}
+
+void PayloadBuilder::sync_time_base() {
     time_t now = time(nullptr);
-    struct tm *tm_struct = localtime(&now);
-    buffer[0] = tm_struct->tm_year - 100;
-    buffer[1] = tm_struct->tm_mon + 1;
-    buffer[2] = tm_struct->tm_mday;
-    buffer[3] = tm_struct->tm_hour;
-    buffer[4] = tm_struct->tm_min;
-    buffer[5] = tm_struct->tm_sec;
+    struct tm local;
+    localtime_r(&now, &local);
+    int64_t localSeconds = (int64_t)daysFromCivil(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday) * 86400 +
+                           local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec;
+    utcOffsetSeconds = (int32_t)(localSeconds - (int64_t)now);
+    baseSeconds = (uint32_t)now;
+    baseMs = monotonicMs();
+}
+
+uint32_t PayloadBuilder::currentTime() {
+    return baseSeconds + (uint32_t)((monotonicMs() - baseMs) / 1000);
+}
+
+void PayloadBuilder::getCurrentDateTime(uint8_t *buffer) {
+    toDateTime((int64_t)currentTime() + utcOffsetSeconds, buffer);
+}
+
+static bool hasHeader(uint8_t type) {
+    return type == PAYLOAD_TYPE_GPS || type == PAYLOAD_TYPE_P_MSG || type == PAYLOAD_TYPE_C_MSG ||
+           type == PAYLOAD_TYPE_C_MSG_PACKED || type == PAYLOAD_TYPE_AGGREGATE;
+}
+
+// Header fields of a frame with the 12-byte header or its v2 form. Returns
+// the header size, or 0 if the frame is too short to hold it. dataLength is
+// read from a v1 header and implied by the frame length for v2; it is not
+// checked against the frame.
+static size_t readHeader(const uint8_t* payload, size_t length, PayloadBuilder::PayloadDetails& details) {
+    if (length == 0) return 0;
+    details.type = PayloadBuilder::frame_type(payload[0]);
+    if (payload[0] == PAYLOAD_TYPE_ACK || !(payload[0] & PAYLOAD_FLAG_V2)) {
+        if (length < PAYLOAD_HEADER_SIZE) return 0;
+        details.sourceID = payload[1];
+        details.destinationID = payload[2];
+        details.transmissionID = (payload[3] << 8) | payload[4];
+        std::memcpy(details.dateTime, &payload[5], 6);
+        details.dataLength = payload[11];
+        return PAYLOAD_HEADER_SIZE;
+    }
+    size_t offset = 3;
+    uint32_t transmissionID = 0;
+    for (int shift = 0;; shift += 7) {
+        if (offset >= length || shift > 14) return 0;
+        uint8_t byte = payload[offset++];
+        transmissionID |= (uint32_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    size_t trailer = PayloadBuilder::trailer_size(payload[0]);
+    if (transmissionID > 0xFFFF || length < offset + 4 + trailer) return 0;
+    uint32_t seconds = ((uint32_t)payload[offset] << 24) | ((uint32_t)payload[offset + 1] << 16) |
+                       ((uint32_t)payload[offset + 2] << 8) | payload[offset + 3];
+    offset += 4;
+    details.sourceID = payload[1];
+    details.destinationID = payload[2];
+    details.transmissionID = transmissionID;
+    toDateTime(seconds, details.dateTime);
+    size_t dataLength = length - offset - trailer;
+    details.dataLength = dataLength < 0xFF ? dataLength : 0xFF;
+    return offset;
 }
 
-uint8_t PayloadBuilder::calculateXORChecksum(const std::vector<uint8_t>& data) {
+uint8_t PayloadBuilder::calculateXORChecksum(const uint8_t* data, size_t length) {
     uint8_t checksum = 0;
-    for (uint8_t byte : data) {
-        checksum ^= byte;
+    for (size_t i = 0; i < length; i++) {
+        checksum ^= data[i];
     }
     return checksum;
 }
 
+size_t PayloadBuilder::writeHeader(uint8_t* buffer, uint8_t type, uint16_t transmissionID, uint8_t dataLength) {
+    if (headerVersion == HEADER_V2) {
+        buffer[0] = type | PAYLOAD_FLAG_V2;
+        buffer[1] = sourceID;
+        buffer[2] = destinationID;
+        size_t length = 3;
+        while (transmissionID >= 0x80) {
+            buffer[length++] = (transmissionID & 0x7F) | 0x80;
+            transmissionID >>= 7;
+        }
+        buffer[length++] = transmissionID;
+        uint32_t seconds = currentTime();
+        buffer[length++] = seconds >> 24;
+        buffer[length++] = seconds >> 16;
+        buffer[length++] = seconds >> 8;
+        buffer[length++] = seconds;
+        return length;
+    }
+    buffer[0] = type;
+    buffer[1] = sourceID;
+    buffer[2] = destinationID;
+    buffer[3] = transmissionID >> 8;
+    buffer[4] = transmissionID & 0xFF;
+    getCurrentDateTime(&buffer[5]);
+    buffer[11] = dataLength;
+    return PAYLOAD_HEADER_SIZE;
+}
+
+size_t PayloadBuilder::writeCompactHeader(uint8_t* buffer, uint8_t type, uint16_t transmissionID) {
+    buffer[0] = type;
+    buffer[1] = sourceID;
+    buffer[2] = transmissionID >> 8;
+    buffer[3] = transmissionID & 0xFF;
+    return GPS_COMPACT_HEADER_SIZE;
+}
+
+// CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF), slice-by-8: table[k][i]
+// is the CRC contribution of byte i followed by k zero bytes, so eight
+// input bytes cost eight independent lookups instead of a serial chain.
+// The 4 KB of tables are built once on first use.
+struct Crc16Tables {
+    uint16_t table[8][256];
+};
+
+static Crc16Tables buildCrc16Tables() {
+    Crc16Tables tables;
+    for (int i = 0; i < 256; i++) {
+        uint16_t crc = i << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+        tables.table[0][i] = crc;
+    }
+    for (int k = 1; k < 8; k++) {
+        for (int i = 0; i < 256; i++) {
+            uint16_t prev = tables.table[k - 1][i];
+            tables.table[k][i] = (prev << 8) ^ tables.table[0][prev >> 8];
+        }
+    }
+    return tables;
+}
+
+uint16_t PayloadBuilder::crc16(const uint8_t* data, size_t length) {
+    static const Crc16Tables tables = buildCrc16Tables();
+    const uint16_t (*t)[256] = tables.table;
+    uint16_t crc = 0xFFFF;
+    while (length >= 8) {
+        uint16_t x = crc ^ ((data[0] << 8) | data[1]);
+        crc = t[7][x >> 8] ^ t[6][x & 0xFF] ^ t[5][data[2]] ^ t[4][data[3]] ^
+              t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+        data += 8;
+        length -= 8;
+    }
+    while (length--) {
+        crc = (crc << 8) ^ t[0][(crc >> 8) ^ *data++];
+    }
+    return crc;
+}
+
+uint8_t PayloadBuilder::frame_type(uint8_t typeByte) {
+    return typeByte == PAYLOAD_TYPE_ACK ? typeByte : (typeByte & ~(PAYLOAD_FLAG_CRC16 | PAYLOAD_FLAG_V2));
+}
+
+size_t PayloadBuilder::trailer_size(uint8_t typeByte) {
+    return (typeByte != PAYLOAD_TYPE_ACK && (typeByte & PAYLOAD_FLAG_CRC16)) ? PAYLOAD_CRC_SIZE : PAYLOAD_CHECKSUM_SIZE;
+}
+
+size_t PayloadBuilder::trailerSize() const {
+    return integrityMode == INTEGRITY_CRC16 ? PAYLOAD_CRC_SIZE : PAYLOAD_CHECKSUM_SIZE;
+}
+
+size_t PayloadBuilder::finishPayload(uint8_t* buffer, size_t length) {
+    if (integrityMode == INTEGRITY_CRC16 && buffer[0] != PAYLOAD_TYPE_ACK) {
+        buffer[0] |= PAYLOAD_FLAG_CRC16;
+        uint16_t crc = crc16(buffer, length);
+        buffer[length++] = crc >> 8;
+        buffer[length++] = crc & 0xFF;
+    } else {
+        buffer[length] = calculateXORChecksum(buffer, length);
+        length += PAYLOAD_CHECKSUM_SIZE;
+    }
+    lastPayloadSize = length;
+    return length;
+}
+
 void PayloadBuilder::configure_device(uint8_t srcID, uint8_t destID) {
     sourceID = srcID;
     destinationID = destID;
 }
 
-std::vector<uint8_t> PayloadBuilder::create_gps_payload(uint16_t transmissionID, float longitude, float latitude) {
-    std::vector<uint8_t> payload;
-    uint8_t dateTime[6];
-    getCurrentDateTime(dateTime);
+void PayloadBuilder::set_integrity_mode(IntegrityMode mode) {
+    integrityMode = mode;
+}
 
-    payload.push_back(0x01);
-    payload.push_back(sourceID);
-    payload.push_back(destinationID);
-    payload.push_back(transmissionID >> 8);
-    payload.push_back(transmissionID & 0xFF);
-    payload.insert(payload.end(), dateTime, dateTime + 6);
-    payload.push_back(8);
-    payload.insert(payload.end(), reinterpret_cast<uint8_t*>(&longitude), reinterpret_cast<uint8_t*>(&longitude) + 4);
-    payload.insert(payload.end(), reinterpret_cast<uint8_t*>(&latitude), reinterpret_cast<uint8_t*>(&latitude) + 4);
-    payload.push_back(calculateXORChecksum(payload));
+void PayloadBuilder::set_header_version(HeaderVersion version) {
+    headerVersion = version;
+}
 
-    lastPayloadSize = payload.size();
-    return payload;
+size_t PayloadBuilder::encode_gps_payload(uint8_t* buffer, size_t bufferSize, uint16_t transmissionID, float longitude, float latitude) {
+    if (bufferSize < PAYLOAD_HEADER_SIZE + 8 + trailerSize()) return 0;
+    size_t length = writeHeader(buffer, 0x01, transmissionID, 8);
+    std::memcpy(&buffer[length], &longitude, 4);
+    std::memcpy(&buffer[length + 4], &latitude, 4);
+    return finishPayload(buffer, length + 8);
 }
 
-std::vector<uint8_t> PayloadBuilder::create_p_msg_payload(uint16_t transmissionID, uint8_t msgID) {
-    std::vector<uint8_t> payload;
-    uint8_t dateTime[6];
-    getCurrentDateTime(dateTime);
+size_t PayloadBuilder::encode_p_msg_payload(uint8_t* buffer, size_t bufferSize, uint16_t transmissionID, uint8_t msgID) {
+    if (bufferSize < PAYLOAD_HEADER_SIZE + 1 + trailerSize()) return 0;
+    size_t length = writeHeader(buffer, 0x02, transmissionID, 1);
+    buffer[length] = msgID;
+    return finishPayload(buffer, length + 1);
+}
+
+size_t PayloadBuilder::encode_c_msg_payload(uint8_t* buffer, size_t bufferSize, uint16_t transmissionID, const char* msg, size_t msgLength) {
+    if (textCompression && msgLength > 0 && msgLength <= C_MSG_TEXT_MAX_LENGTH &&
+        bufferSize > PAYLOAD_HEADER_SIZE + trailerSize()) {
+        // Compressed straight into the data section; text that does not get
+        // shorter goes out raw.
+        size_t room = bufferSize - PAYLOAD_HEADER_SIZE - trailerSize();
+        if (room > C_MSG_MAX_LENGTH) room = C_MSG_MAX_LENGTH;
+        size_t packedLength = text_compress(msg, msgLength, &buffer[PAYLOAD_HEADER_SIZE], room);
+        if (packedLength > 0 && packedLength < msgLength) {
+            size_t length = writeHeader(buffer, PAYLOAD_TYPE_C_MSG_PACKED, transmissionID, packedLength);
+            if (length != PAYLOAD_HEADER_SIZE) std::memmove(&buffer[length], &buffer[PAYLOAD_HEADER_SIZE], packedLength);
+            return finishPayload(buffer, length + packedLength);
+        }
+    }
+    if (msgLength > C_MSG_MAX_LENGTH) return 0;
+    if (bufferSize < PAYLOAD_HEADER_SIZE + msgLength + trailerSize()) return 0;
+    size_t length = writeHeader(buffer, 0x03, transmissionID, msgLength);
+    std::memcpy(&buffer[length], msg, msgLength);
+    return finishPayload(buffer, length + msgLength);
+}
+
+size_t PayloadBuilder::encode_gps_payload(Buffer& buffer, uint16_t transmissionID, float longitude, float latitude) {
+    return encode_gps_payload(buffer.data(), buffer.size(), transmissionID, longitude, latitude);
+}
+
+size_t PayloadBuilder::encode_p_msg_payload(Buffer& buffer, uint16_t transmissionID, uint8_t msgID) {
+    return encode_p_msg_payload(buffer.data(), buffer.size(), transmissionID, msgID);
+}
+
+size_t PayloadBuilder::encode_c_msg_payload(Buffer& buffer, uint16_t transmissionID, const char* msg, size_t msgLength) {
+    return encode_c_msg_payload(buffer.data(), buffer.size(), transmissionID, msg, msgLength);
+}
 
-    payload.push_back(0x02);
-    payload.push_back(sourceID);
-    payload.push_back(destinationID);
-    payload.push_back(transmissionID >> 8);
-    payload.push_back(transmissionID & 0xFF);
-    payload.insert(payload.end(), dateTime, dateTime + 6);
-    payload.push_back(1);
-    payload.push_back(msgID);
-    payload.push_back(calculateXORChecksum(payload));
+void PayloadBuilder::set_text_compression(bool enabled) {
+    textCompression = enabled;
+}
+
+std::vector<uint8_t> PayloadBuilder::create_gps_payload(uint16_t transmissionID, float longitude, float latitude) {
+    Buffer buffer;
+    size_t length = encode_gps_payload(buffer, transmissionID, longitude, latitude);
+    return std::vector<uint8_t>(buffer.begin(), buffer.begin() + length);
+}
 
-    lastPayloadSize = payload.size();
-    return payload;
+std::vector<uint8_t> PayloadBuilder::create_p_msg_payload(uint16_t transmissionID, uint8_t msgID) {
+    Buffer buffer;
+    size_t length = encode_p_msg_payload(buffer, transmissionID, msgID);
+    return std::vector<uint8_t>(buffer.begin(), buffer.begin() + length);
 }
 
 std::vector<uint8_t> PayloadBuilder::create_c_msg_payload(uint16_t transmissionID, const std::string& msg) {
-    if (msg.size() > MAX_PAYLOAD_SIZE - 14) return {};
-    std::vector<uint8_t> payload;
-    uint8_t dateTime[6];
-    getCurrentDateTime(dateTime);
+    Buffer buffer;
+    size_t length = encode_c_msg_payload(buffer, transmissionID, msg.data(), msg.size());
+    if (length == 0) return {};
+    return std::vector<uint8_t>(buffer.begin(), buffer.begin() + length);
+}
+
+static int32_t toFixed(float degrees) {
+    double scaled = (double)degrees * GPS_FIXED_SCALE;
+    return (int32_t)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+}
+
+void PayloadBuilder::set_gps_delta_mode(bool enabled, uint8_t keyframeInterval) {
+    gpsDeltaMode = enabled;
+    gpsKeyframeInterval = keyframeInterval;
+    gpsTrack.valid = false;
+}
+
+size_t PayloadBuilder::encode_gps_compact_payload(uint8_t* buffer, size_t bufferSize, uint16_t transmissionID, float longitude, float latitude) {
+    int32_t lat = toFixed(latitude);
+    int32_t lon = toFixed(longitude);
+    int32_t dLat = lat - gpsTrack.latitudeFixed;
+    int32_t dLon = lon - gpsTrack.longitudeFixed;
+
+    bool delta = gpsDeltaMode && gpsTrack.valid && gpsTrack.sinceKeyframe < gpsKeyframeInterval &&
+                 dLat >= -GPS_DELTA_LIMIT && dLat <= GPS_DELTA_LIMIT &&
+                 dLon >= -GPS_DELTA_LIMIT && dLon <= GPS_DELTA_LIMIT;
+
+    if (delta) {
+        if (bufferSize < GPS_COMPACT_HEADER_SIZE + GPS_DELTA_BODY_SIZE + trailerSize()) return 0;
+        size_t length = writeCompactHeader(buffer, PAYLOAD_TYPE_GPS_DELTA, transmissionID);
+        uint32_t packed = ((uint32_t)(dLat & 0xFFF) << 12) | (uint32_t)(dLon & 0xFFF);
+        buffer[length++] = gpsTrack.keyTransmissionID & 0xFF;
+        buffer[length++] = packed >> 16;
+        buffer[length++] = packed >> 8;
+        buffer[length++] = packed;
+        gpsTrack.sinceKeyframe++;
+        return finishPayload(buffer, length);
+    }
+
+    if (bufferSize < GPS_COMPACT_HEADER_SIZE + GPS_COMPACT_BODY_SIZE + trailerSize()) return 0;
+    size_t length = writeCompactHeader(buffer, PAYLOAD_TYPE_GPS_COMPACT, transmissionID);
+    uint64_t latU = (uint64_t)(lat + 90 * GPS_FIXED_SCALE);
+    uint64_t lonU = (uint64_t)(lon + 180 * GPS_FIXED_SCALE);
+    uint64_t packed = (latU << 26) | lonU;
+    for (int shift = 48; shift >= 0; shift -= 8) {
+        buffer[length++] = packed >> shift;
+    }
+
+    gpsTrack.valid = true;
+    gpsTrack.keyTransmissionID = transmissionID;
+    gpsTrack.latitudeFixed = lat;
+    gpsTrack.longitudeFixed = lon;
+    gpsTrack.sinceKeyframe = 0;
+    return finishPayload(buffer, length);
+}
+
+size_t PayloadBuilder::encode_gps_compact_payload(Buffer& buffer, uint16_t transmissionID, float longitude, float latitude) {
+    return encode_gps_compact_payload(buffer.data(), buffer.size(), transmissionID, longitude, latitude);
+}
+
+std::vector<uint8_t> PayloadBuilder::create_gps_compact_payload(uint16_t transmissionID, float longitude, float latitude) {
+    Buffer buffer;
+    size_t length = encode_gps_compact_payload(buffer, transmissionID, longitude, latitude);
+    return std::vector<uint8_t>(buffer.begin(), buffer.begin() + length);
+}
+
+void PayloadBuilder::begin_aggregate_payload(AggregateWriter& writer, uint8_t* buffer, size_t bufferSize, uint16_t transmissionID) {
+    writer.buffer = buffer;
+    writer.capacity = bufferSize < MAX_PAYLOAD_SIZE ? bufferSize : MAX_PAYLOAD_SIZE;
+    writer.length = 0;
+    writer.count = 0;
+    if (writer.capacity < PAYLOAD_HEADER_SIZE + trailerSize()) {
+        writer.capacity = 0;
+        return;
+    }
+    writer.length = writeHeader(buffer, PAYLOAD_TYPE_AGGREGATE, transmissionID, 0);
+}
+
+void PayloadBuilder::begin_aggregate_payload(AggregateWriter& writer, Buffer& buffer, uint16_t transmissionID) {
+    begin_aggregate_payload(writer, buffer.data(), buffer.size(), transmissionID);
+}
+
+bool PayloadBuilder::append_record(AggregateWriter& writer, const AggregateRecord& record) {
+    if (writer.capacity == 0) return false;
+    if (writer.length + AGGREGATE_RECORD_HEADER_SIZE + record.length + trailerSize() > writer.capacity) return false;
+    uint8_t* out = &writer.buffer[writer.length];
+    out[0] = record.type;
+    out[1] = record.sourceID;
+    out[2] = record.transmissionID >> 8;
+    out[3] = record.transmissionID & 0xFF;
+    out[4] = record.length;
+    std::memcpy(&out[AGGREGATE_RECORD_HEADER_SIZE], record.data, record.length);
+    writer.length += AGGREGATE_RECORD_HEADER_SIZE + record.length;
+    writer.count++;
+    return true;
+}
+
+bool PayloadBuilder::append_gps_record(AggregateWriter& writer, uint8_t srcID, uint16_t transmissionID, float longitude, float latitude) {
+    uint8_t body[8];
+    std::memcpy(&body[0], &longitude, 4);
+    std::memcpy(&body[4], &latitude, 4);
+    AggregateRecord record = {PAYLOAD_TYPE_GPS, srcID, transmissionID, body, 8};
+    return append_record(writer, record);
+}
+
+bool PayloadBuilder::append_p_msg_record(AggregateWriter& writer, uint8_t srcID, uint16_t transmissionID, uint8_t msgID) {
+    AggregateRecord record = {PAYLOAD_TYPE_P_MSG, srcID, transmissionID, &msgID, 1};
+    return append_record(writer, record);
+}
+
+bool PayloadBuilder::append_c_msg_record(AggregateWriter& writer, uint8_t srcID, uint16_t transmissionID, const char* msg, size_t msgLength) {
+    if (msgLength > C_MSG_MAX_LENGTH) return false;
+    AggregateRecord record = {PAYLOAD_TYPE_C_MSG, srcID, transmissionID, reinterpret_cast<const uint8_t*>(msg), (uint8_t)msgLength};
+    return append_record(writer, record);
+}
 
-    payload.push_back(0x03);
-    payload.push_back(sourceID);
-    payload.push_back(destinationID);
-    payload.push_back(transmissionID >> 8);
-    payload.push_back(transmissionID & 0xFF);
-    payload.insert(payload.end(), dateTime, dateTime + 6);
-    payload.push_back(msg.size());
-    payload.insert(payload.end(), msg.begin(), msg.end());
-    payload.push_back(calculateXORChecksum(payload));
+bool PayloadBuilder::append_frame_record(AggregateWriter& writer, const uint8_t* payload, size_t length) {
+    PayloadDetails details = {};
+    size_t headerLength = readHeader(payload, length, details);
+    if (headerLength == 0) return false;
+    uint8_t type = details.type;
+    if (type != PAYLOAD_TYPE_GPS && type != PAYLOAD_TYPE_P_MSG && type != PAYLOAD_TYPE_C_MSG &&
+        type != PAYLOAD_TYPE_C_MSG_PACKED) return false;
+    if (details.dataLength > length - headerLength) return false;
+    AggregateRecord record = {type, details.sourceID, details.transmissionID, &payload[headerLength], details.dataLength};
+    return append_record(writer, record);
+}
+
+size_t PayloadBuilder::finish_aggregate_payload(AggregateWriter& writer) {
+    if (writer.count == 0) return 0;
+    if (!(writer.buffer[0] & PAYLOAD_FLAG_V2)) writer.buffer[11] = writer.length - PAYLOAD_HEADER_SIZE;
+    return finishPayload(writer.buffer, writer.length);
+}
+
+size_t PayloadBuilder::encode_relay_payload(uint8_t* buffer, size_t bufferSize, uint8_t relayID, uint8_t hopCount, const uint8_t* frame, size_t frameLength) {
+    if (frameLength == 0 || frameLength > MAX_PAYLOAD_SIZE) return 0;
+    if (bufferSize < RELAY_HEADER_SIZE + frameLength + trailerSize()) return 0;
+    buffer[0] = PAYLOAD_TYPE_RELAY;
+    buffer[1] = hopCount;
+    buffer[2] = relayID;
+    std::memcpy(&buffer[RELAY_HEADER_SIZE], frame, frameLength);
+    return finishPayload(buffer, RELAY_HEADER_SIZE + frameLength);
+}
+
+size_t PayloadBuilder::encode_ack_payload(uint8_t* buffer, size_t bufferSize, uint8_t destinationID, const AckData& ack) {
+    if (bufferSize < ACK_HEADER_SIZE + ACK_BODY_SIZE + PAYLOAD_CHECKSUM_SIZE) return 0;
+    buffer[0] = PAYLOAD_TYPE_ACK;
+    buffer[1] = sourceID;
+    buffer[2] = destinationID;
+    buffer[3] = ack.transmissionID >> 8;
+    buffer[4] = ack.transmissionID & 0xFF;
+    buffer[5] = ack.receivedMap >> 8;
+    buffer[6] = ack.receivedMap & 0xFF;
+    return finishPayload(buffer, ACK_HEADER_SIZE + ACK_BODY_SIZE);
+}
+
+size_t PayloadBuilder::encode_control_payload(uint8_t* buffer, size_t bufferSize, uint8_t destinationID, uint16_t transmissionID, const ControlData& control) {
+    if (bufferSize < CONTROL_HEADER_SIZE + CONTROL_BODY_SIZE + trailerSize()) return 0;
+    buffer[0] = PAYLOAD_TYPE_CONTROL;
+    buffer[1] = sourceID;
+    buffer[2] = destinationID;
+    buffer[3] = transmissionID >> 8;
+    buffer[4] = transmissionID & 0xFF;
+    buffer[5] = control.command;
+    buffer[6] = control.dataRate;
+    buffer[7] = control.parameter;
+    return finishPayload(buffer, CONTROL_HEADER_SIZE + CONTROL_BODY_SIZE);
+}
+
+size_t PayloadBuilder::encode_beacon_payload(uint8_t* buffer, size_t bufferSize, const BeaconData& beacon) {
+    if (beacon.dataSlots > BEACON_MAX_DATA_SLOTS) return 0;
+    size_t mapSize = (beacon.dataSlots + 7) / 8;
+    if (bufferSize < BEACON_HEADER_SIZE + mapSize + trailerSize()) return 0;
+    buffer[0] = PAYLOAD_TYPE_BEACON;
+    buffer[1] = sourceID;
+    buffer[2] = beacon.sequence >> 8;
+    buffer[3] = beacon.sequence & 0xFF;
+    buffer[4] = beacon.slotMs >> 8;
+    buffer[5] = beacon.slotMs & 0xFF;
+    buffer[6] = beacon.downlinkSlots;
+    buffer[7] = beacon.contentionSlots;
+    buffer[8] = beacon.dataSlots;
+    if (mapSize > 0) std::memcpy(&buffer[BEACON_HEADER_SIZE], beacon.slotMap, mapSize);
+    return finishPayload(buffer, BEACON_HEADER_SIZE + mapSize);
+}
+
+size_t PayloadBuilder::encode_slot_payload(uint8_t* buffer, size_t bufferSize, uint8_t destinationID, const SlotData& slot) {
+    if (bufferSize < SLOT_FRAME_SIZE + trailerSize()) return 0;
+    buffer[0] = PAYLOAD_TYPE_SLOT;
+    buffer[1] = sourceID;
+    buffer[2] = destinationID;
+    buffer[3] = slot.command;
+    buffer[4] = slot.slot;
+    return finishPayload(buffer, SLOT_FRAME_SIZE);
+}
 
-    lastPayloadSize = payload.size();
-    return payload;
+bool PayloadBuilder::append_ack_record(AggregateWriter& writer, const AckData& ack) {
+    uint8_t body[ACK_BODY_SIZE] = {(uint8_t)(ack.receivedMap >> 8), (uint8_t)(ack.receivedMap & 0xFF)};
+    AggregateRecord record = {PAYLOAD_TYPE_ACK, sourceID, ack.transmissionID, body, ACK_BODY_SIZE};
+    return append_record(writer, record);
 }
 
 size_t PayloadBuilder::get_last_payload_size() const {
@@ -92,39 +506,423 @@ size_t PayloadBuilder::get_last_payload_size() const {
 
 //Decoders
 
+uint8_t PayloadBuilder::identify_type_and_check_checksum(const uint8_t* payload, size_t length) {
+    if (length == 0) return PAYLOAD_INVALID;
+    if (trailer_size(payload[0]) == PAYLOAD_CRC_SIZE) {
+        if (length < 1 + PAYLOAD_CRC_SIZE) return PAYLOAD_INVALID;
+        uint16_t crc = crc16(payload, length - PAYLOAD_CRC_SIZE);
+        uint16_t received = (payload[length - 2] << 8) | payload[length - 1];
+        return (crc == received) ? frame_type(payload[0]) : PAYLOAD_INVALID;
+    }
+    uint8_t checksum = calculateXORChecksum(payload, length - 1);
+    return (checksum == payload[length - 1]) ? frame_type(payload[0]) : PAYLOAD_INVALID;
+}
+
+PayloadBuilder::GPSData PayloadBuilder::decode_gps_payload(const uint8_t* payload, size_t length) {
+    GPSData data = {0.0f, 0.0f};
+    PayloadDetails details;
+    size_t headerLength = readHeader(payload, length, details);
+    if (headerLength == 0 || length < headerLength + 8) return data;
+    std::memcpy(&data.longitude, &payload[headerLength], 4);
+    std::memcpy(&data.latitude, &payload[headerLength + 4], 4);
+    return data;
+}
+
+PayloadBuilder::PMsgData PayloadBuilder::decode_p_msg_payload(const uint8_t* payload, size_t length) {
+    PMsgData data = {0};
+    PayloadDetails details;
+    size_t headerLength = readHeader(payload, length, details);
+    if (headerLength == 0 || length < headerLength + 1) return data;
+    data.msgID = payload[headerLength];
+    return data;
+}
+
+PayloadBuilder::CMsgView PayloadBuilder::decode_c_msg_view(const uint8_t* payload, size_t length) {
+    CMsgView view = {nullptr, 0};
+    PayloadDetails details;
+    size_t headerLength = readHeader(payload, length, details);
+    if (headerLength == 0) return view;
+    size_t available = length - headerLength;
+    view.message = reinterpret_cast<const char*>(&payload[headerLength]);
+    view.length = details.dataLength < available ? details.dataLength : available;
+    return view;
+}
+
+static size_t decodeText(uint8_t type, const uint8_t* data, size_t length, char* text, size_t textSize) {
+    if (type == PAYLOAD_TYPE_C_MSG_PACKED) return text_decompress(data, length, text, textSize);
+    if (type != PAYLOAD_TYPE_C_MSG || length > textSize) return 0;
+    std::memcpy(text, data, length);
+    return length;
+}
+
+size_t PayloadBuilder::decode_c_msg_text(const uint8_t* payload, size_t length, char* text, size_t textSize) {
+    CMsgView view = decode_c_msg_view(payload, length);
+    if (view.message == nullptr) return 0;
+    return decodeText(frame_type(payload[0]), reinterpret_cast<const uint8_t*>(view.message), view.length, text, textSize);
+}
+
+size_t PayloadBuilder::decode_c_msg_record_text(const AggregateRecord& record, char* text, size_t textSize) {
+    return decodeText(record.type, record.data, record.length, text, textSize);
+}
+
+bool PayloadBuilder::decode_gps_compact_payload(const uint8_t* payload, size_t length, GPSTrackState& track, GPSData& data) {
+    if (length < GPS_COMPACT_HEADER_SIZE) return false;
+    const uint8_t* body = &payload[GPS_COMPACT_HEADER_SIZE];
+    uint16_t transmissionID = (payload[2] << 8) | payload[3];
+
+    uint8_t type = frame_type(payload[0]);
+    if (type == PAYLOAD_TYPE_GPS_COMPACT) {
+        if (length < GPS_COMPACT_HEADER_SIZE + GPS_COMPACT_BODY_SIZE) return false;
+        uint64_t packed = 0;
+        for (int i = 0; i < GPS_COMPACT_BODY_SIZE; i++) {
+            packed = (packed << 8) | body[i];
+        }
+        track.valid = true;
+        track.keyTransmissionID = transmissionID;
+        track.latitudeFixed = (int32_t)((packed >> 26) & 0x1FFFFFF) - 90 * GPS_FIXED_SCALE;
+        track.longitudeFixed = (int32_t)(packed & 0x3FFFFFF) - 180 * GPS_FIXED_SCALE;
+        track.sinceKeyframe = 0;
+        data.latitude = (float)track.latitudeFixed / GPS_FIXED_SCALE;
+        data.longitude = (float)track.longitudeFixed / GPS_FIXED_SCALE;
+        return true;
+    }
+
+    if (type == PAYLOAD_TYPE_GPS_DELTA) {
+        if (length < GPS_COMPACT_HEADER_SIZE + GPS_DELTA_BODY_SIZE) return false;
+        if (!track.valid || (track.keyTransmissionID & 0xFF) != body[0]) return false;
+        uint32_t packed = ((uint32_t)body[1] << 16) | ((uint32_t)body[2] << 8) | body[3];
+        int32_t dLat = (int32_t)(packed >> 12);
+        int32_t dLon = (int32_t)(packed & 0xFFF);
+        if (dLat & 0x800) dLat -= 0x1000;
+        if (dLon & 0x800) dLon -= 0x1000;
+        data.latitude = (float)(track.latitudeFixed + dLat) / GPS_FIXED_SCALE;
+        data.longitude = (float)(track.longitudeFixed + dLon) / GPS_FIXED_SCALE;
+        return true;
+    }
+
+    return false;
+}
+
+PayloadBuilder::AggregateReader::AggregateReader(const uint8_t* payload, size_t length)
+    : cursor(payload), end(payload), error(false) {
+    PayloadDetails details;
+    size_t headerLength = readHeader(payload, length, details);
+    if (headerLength == 0 || details.type != PAYLOAD_TYPE_AGGREGATE) {
+        error = true;
+        return;
+    }
+    size_t available = length - headerLength;
+    size_t dataLength = details.dataLength;
+    if (dataLength > available) {
+        dataLength = available;
+        error = true;
+    }
+    cursor = &payload[headerLength];
+    end = cursor + dataLength;
+}
+
+bool PayloadBuilder::AggregateReader::next(AggregateRecord& record) {
+    if (cursor == end) return false;
+    if ((size_t)(end - cursor) < AGGREGATE_RECORD_HEADER_SIZE ||
+        cursor[4] > (size_t)(end - cursor) - AGGREGATE_RECORD_HEADER_SIZE) {
+        error = true;
+        cursor = end;
+        return false;
+    }
+    record.type = cursor[0];
+    record.sourceID = cursor[1];
+    record.transmissionID = (cursor[2] << 8) | cursor[3];
+    record.length = cursor[4];
+    record.data = &cursor[AGGREGATE_RECORD_HEADER_SIZE];
+    cursor += AGGREGATE_RECORD_HEADER_SIZE + record.length;
+    return true;
+}
+
+bool PayloadBuilder::AggregateReader::malformed() const {
+    return error;
+}
+
+PayloadBuilder::GPSData PayloadBuilder::decode_gps_record(const AggregateRecord& record) {
+    GPSData data = {0.0f, 0.0f};
+    if (record.length < 8) return data;
+    std::memcpy(&data.longitude, &record.data[0], 4);
+    std::memcpy(&data.latitude, &record.data[4], 4);
+    return data;
+}
+
+PayloadBuilder::PMsgData PayloadBuilder::decode_p_msg_record(const AggregateRecord& record) {
+    PMsgData data = {0};
+    if (record.length < 1) return data;
+    data.msgID = record.data[0];
+    return data;
+}
+
+PayloadBuilder::CMsgView PayloadBuilder::decode_c_msg_record(const AggregateRecord& record) {
+    CMsgView view = {reinterpret_cast<const char*>(record.data), record.length};
+    return view;
+}
+
+PayloadBuilder::AckData PayloadBuilder::decode_ack_payload(const uint8_t* payload, size_t length) {
+    AckData ack = {0, 0};
+    if (length < ACK_HEADER_SIZE + ACK_BODY_SIZE) return ack;
+    ack.transmissionID = (payload[3] << 8) | payload[4];
+    ack.receivedMap = (payload[5] << 8) | payload[6];
+    return ack;
+}
+
+PayloadBuilder::ControlData PayloadBuilder::decode_control_payload(const uint8_t* payload, size_t length) {
+    ControlData control = {0, 0, 0};
+    if (length < CONTROL_HEADER_SIZE + CONTROL_BODY_SIZE) return control;
+    control.command = payload[5];
+    control.dataRate = payload[6];
+    control.parameter = payload[7];
+    return control;
+}
+
+PayloadBuilder::BeaconData PayloadBuilder::decode_beacon_payload(const uint8_t* payload, size_t length) {
+    BeaconData beacon = {0, 0, 0, 0, 0, nullptr};
+    if (length < BEACON_HEADER_SIZE) return beacon;
+    beacon.sequence = (payload[2] << 8) | payload[3];
+    beacon.slotMs = (payload[4] << 8) | payload[5];
+    beacon.downlinkSlots = payload[6];
+    beacon.contentionSlots = payload[7];
+    size_t mapSize = (payload[8] + 7) / 8;
+    if (length >= BEACON_HEADER_SIZE + mapSize + trailer_size(payload[0])) {
+        beacon.dataSlots = payload[8];
+        beacon.slotMap = &payload[BEACON_HEADER_SIZE];
+    }
+    return beacon;
+}
+
+PayloadBuilder::SlotData PayloadBuilder::decode_slot_payload(const uint8_t* payload, size_t length) {
+    SlotData slot = {0, TDMA_NO_SLOT};
+    if (length < SLOT_FRAME_SIZE) return slot;
+    slot.command = payload[3];
+    slot.slot = payload[4];
+    return slot;
+}
+
+PayloadBuilder::AckData PayloadBuilder::decode_ack_record(const AggregateRecord& record) {
+    AckData ack = {record.transmissionID, 0};
+    if (record.length < ACK_BODY_SIZE) return ack;
+    ack.receivedMap = (record.data[0] << 8) | record.data[1];
+    return ack;
+}
+
+PayloadBuilder::RelayView PayloadBuilder::decode_relay_view(const uint8_t* payload, size_t length) {
+    RelayView view = {0, 0, nullptr, 0};
+    size_t trailer = length > 0 ? trailer_size(payload[0]) : 0;
+    if (length <= RELAY_HEADER_SIZE + trailer || frame_type(payload[0]) != PAYLOAD_TYPE_RELAY) return view;
+    view.hopCount = payload[1];
+    view.relayID = payload[2];
+    view.frame = &payload[RELAY_HEADER_SIZE];
+    view.length = length - RELAY_HEADER_SIZE - trailer;
+    return view;
+}
+
+PayloadBuilder::PayloadDetails PayloadBuilder::get_payload_details(const uint8_t* payload, size_t length) {
+    PayloadDetails details = {};
+    if (length == 0) return details;
+    uint8_t type = frame_type(payload[0]);
+    if (length >= GPS_COMPACT_HEADER_SIZE &&
+        (type == PAYLOAD_TYPE_GPS_COMPACT || type == PAYLOAD_TYPE_GPS_DELTA)) {
+        details.type = type;
+        details.sourceID = payload[1];
+        details.destinationID = PAYLOAD_BROADCAST_ID;
+        details.transmissionID = (payload[2] << 8) | payload[3];
+        details.dataLength = type == PAYLOAD_TYPE_GPS_COMPACT ? GPS_COMPACT_BODY_SIZE : GPS_DELTA_BODY_SIZE;
+        return details;
+    }
+    if (length >= ACK_HEADER_SIZE && type == PAYLOAD_TYPE_ACK) {
+        details.type = type;
+        details.sourceID = payload[1];
+        details.destinationID = payload[2];
+        details.transmissionID = (payload[3] << 8) | payload[4];
+        details.dataLength = ACK_BODY_SIZE;
+        return details;
+    }
+    if (length >= CONTROL_HEADER_SIZE && type == PAYLOAD_TYPE_CONTROL) {
+        details.type = type;
+        details.sourceID = payload[1];
+        details.destinationID = payload[2];
+        details.transmissionID = (payload[3] << 8) | payload[4];
+        details.dataLength = CONTROL_BODY_SIZE;
+        return details;
+    }
+    if (length >= BEACON_HEADER_SIZE && type == PAYLOAD_TYPE_BEACON) {
+        details.type = type;
+        details.sourceID = payload[1];
+        details.destinationID = PAYLOAD_BROADCAST_ID;
+        details.transmissionID = (payload[2] << 8) | payload[3];
+        details.dataLength = (payload[8] + 7) / 8;
+        return details;
+    }
+    if (length >= SLOT_FRAME_SIZE && type == PAYLOAD_TYPE_SLOT) {
+        details.type = type;
+        details.sourceID = payload[1];
+        details.destinationID = payload[2];
+        details.dataLength = 2;
+        return details;
+    }
+    PayloadDetails header = {};
+    if (readHeader(payload, length, header) == 0) return details;
+    return header;
+}
+
+static bool parseFailed(PayloadBuilder::ParsedFrame& frame, PayloadBuilder::ParseStatus status) {
+    frame.status = status;
+    return false;
+}
+
+// For the fixed-size types: a frame must end exactly where its body does.
+static bool sizeMismatch(PayloadBuilder::ParsedFrame& frame, size_t end, size_t expected) {
+    if (end == expected) return false;
+    frame.status = end < expected ? PayloadBuilder::PARSE_TOO_SHORT : PayloadBuilder::PARSE_BAD_LENGTH;
+    return true;
+}
+
+bool PayloadBuilder::parse(const uint8_t* payload, size_t length, ParsedFrame& frame) {
+    frame.details = PayloadDetails();
+    frame.body = nullptr;
+    frame.bodyLength = 0;
+    if (length == 0) return parseFailed(frame, PARSE_TOO_SHORT);
+    size_t trailer = trailer_size(payload[0]);
+    if (length <= trailer) return parseFailed(frame, PARSE_TOO_SHORT);
+    size_t end = length - trailer;  // everything before the trailer
+    if (trailer == PAYLOAD_CRC_SIZE) {
+        if (crc16(payload, end) != ((payload[end] << 8) | payload[end + 1])) return parseFailed(frame, PARSE_BAD_CHECKSUM);
+    } else if (calculateXORChecksum(payload, end) != payload[end]) {
+        return parseFailed(frame, PARSE_BAD_CHECKSUM);
+    }
+
+    PayloadDetails& details = frame.details;
+    details.type = frame_type(payload[0]);
+    if (payload[0] != PAYLOAD_TYPE_ACK && (payload[0] & PAYLOAD_FLAG_V2) && !hasHeader(details.type)) {
+        return parseFailed(frame, PARSE_UNKNOWN_TYPE);
+    }
+    switch (details.type) {
+    case PAYLOAD_TYPE_GPS:
+    case PAYLOAD_TYPE_P_MSG:
+    case PAYLOAD_TYPE_C_MSG:
+    case PAYLOAD_TYPE_C_MSG_PACKED:
+    case PAYLOAD_TYPE_AGGREGATE: {
+        size_t headerLength = readHeader(payload, length, details);
+        if (headerLength == 0 || end < headerLength) return parseFailed(frame, PARSE_TOO_SHORT);
+        if (details.dataLength != end - headerLength) return parseFailed(frame, PARSE_BAD_LENGTH);
+        frame.body = &payload[headerLength];
+        frame.bodyLength = details.dataLength;
+        if (details.type == PAYLOAD_TYPE_GPS) {
+            if (frame.bodyLength != 8) return parseFailed(frame, PARSE_BAD_LENGTH);
+            std::memcpy(&frame.gps.longitude, &frame.body[0], 4);
+            std::memcpy(&frame.gps.latitude, &frame.body[4], 4);
+        } else if (details.type == PAYLOAD_TYPE_P_MSG) {
+            if (frame.bodyLength != 1) return parseFailed(frame, PARSE_BAD_LENGTH);
+            frame.pMsg.msgID = frame.body[0];
+        } else if (details.type == PAYLOAD_TYPE_AGGREGATE) {
+            // Record headers only: each length must land inside the data.
+            size_t offset = 0;
+            while (offset < frame.bodyLength) {
+                if (frame.bodyLength - offset < AGGREGATE_RECORD_HEADER_SIZE) return parseFailed(frame, PARSE_BAD_LENGTH);
+                offset += AGGREGATE_RECORD_HEADER_SIZE + frame.body[offset + 4];
+            }
+            if (offset != frame.bodyLength) return parseFailed(frame, PARSE_BAD_LENGTH);
+        } else if (frame.bodyLength > C_MSG_MAX_LENGTH) {
+            return parseFailed(frame, PARSE_BAD_LENGTH);
+        }
+        break;
+    }
+    case PAYLOAD_TYPE_GPS_COMPACT:
+    case PAYLOAD_TYPE_GPS_DELTA:
+        details.dataLength = details.type == PAYLOAD_TYPE_GPS_COMPACT ? GPS_COMPACT_BODY_SIZE : GPS_DELTA_BODY_SIZE;
+        if (sizeMismatch(frame, end, GPS_COMPACT_HEADER_SIZE + details.dataLength)) return false;
+        details.sourceID = payload[1];
+        details.destinationID = PAYLOAD_BROADCAST_ID;
+        details.transmissionID = (payload[2] << 8) | payload[3];
+        frame.body = &payload[GPS_COMPACT_HEADER_SIZE];
+        frame.bodyLength = details.dataLength;
+        break;
+    case PAYLOAD_TYPE_ACK:
+    case PAYLOAD_TYPE_CONTROL:
+        // Same header; ACKs are XOR-only, which trailer_size already implies.
+        details.dataLength = details.type == PAYLOAD_TYPE_ACK ? ACK_BODY_SIZE : CONTROL_BODY_SIZE;
+        if (sizeMismatch(frame, end, ACK_HEADER_SIZE + details.dataLength)) return false;
+        details.sourceID = payload[1];
+        details.destinationID = payload[2];
+        details.transmissionID = (payload[3] << 8) | payload[4];
+        frame.body = &payload[ACK_HEADER_SIZE];
+        frame.bodyLength = details.dataLength;
+        if (details.type == PAYLOAD_TYPE_ACK) {
+            frame.ack.transmissionID = details.transmissionID;
+            frame.ack.receivedMap = (frame.body[0] << 8) | frame.body[1];
+        } else {
+            frame.control.command = frame.body[0];
+            frame.control.dataRate = frame.body[1];
+            frame.control.parameter = frame.body[2];
+        }
+        break;
+    case PAYLOAD_TYPE_BEACON:
+        if (end < BEACON_HEADER_SIZE) return parseFailed(frame, PARSE_TOO_SHORT);
+        if (payload[8] > BEACON_MAX_DATA_SLOTS) return parseFailed(frame, PARSE_BAD_LENGTH);
+        details.dataLength = (payload[8] + 7) / 8;
+        if (sizeMismatch(frame, end, BEACON_HEADER_SIZE + details.dataLength)) return false;
+        details.sourceID = payload[1];
+        details.destinationID = PAYLOAD_BROADCAST_ID;
+        details.transmissionID = (payload[2] << 8) | payload[3];
+        frame.body = &payload[BEACON_HEADER_SIZE];
+        frame.bodyLength = details.dataLength;
+        frame.beacon.sequence = details.transmissionID;
+        frame.beacon.slotMs = (payload[4] << 8) | payload[5];
+        frame.beacon.downlinkSlots = payload[6];
+        frame.beacon.contentionSlots = payload[7];
+        frame.beacon.dataSlots = payload[8];
+        frame.beacon.slotMap = frame.body;
+        break;
+    case PAYLOAD_TYPE_SLOT:
+        if (sizeMismatch(frame, end, SLOT_FRAME_SIZE)) return false;
+        details.sourceID = payload[1];
+        details.destinationID = payload[2];
+        details.dataLength = 2;
+        frame.body = &payload[3];
+        frame.bodyLength = 2;
+        frame.slot.command = payload[3];
+        frame.slot.slot = payload[4];
+        break;
+    case PAYLOAD_TYPE_RELAY:
+        if (end <= RELAY_HEADER_SIZE) return parseFailed(frame, PARSE_TOO_SHORT);
+        if (end - RELAY_HEADER_SIZE > MAX_PAYLOAD_SIZE) return parseFailed(frame, PARSE_BAD_LENGTH);
+        frame.body = &payload[RELAY_HEADER_SIZE];
+        frame.bodyLength = end - RELAY_HEADER_SIZE;
+        frame.relay.hopCount = payload[1];
+        frame.relay.relayID = payload[2];
+        frame.relay.frame = frame.body;
+        frame.relay.length = frame.bodyLength;
+        break;
+    default:
+        return parseFailed(frame, PARSE_UNKNOWN_TYPE);
+    }
+    frame.status = PARSE_OK;
+    return true;
+}
+
 uint8_t PayloadBuilder::identify_type_and_check_checksum(const std::vector<uint8_t>& payload) {
-    if (payload.empty()) return 101;
-    uint8_t checksum = calculateXORChecksum(std::vector<uint8_t>(payload.begin(), payload.end() - 1));
-    return (checksum == payload.back()) ? payload[0] : 101;
+    return identify_type_and_check_checksum(payload.data(), payload.size());
 }
 
 PayloadBuilder::GPSData PayloadBuilder::decode_gps_payload(const std::vector<uint8_t>& payload) {
-    GPSData data;
-    std::memcpy(&data.longitude, &payload[12], 4);
-    std::memcpy(&data.latitude, &payload[16], 4);
-    return data;
+    return decode_gps_payload(payload.data(), payload.size());
 }
 
 PayloadBuilder::PMsgData PayloadBuilder::decode_p_msg_payload(const std::vector<uint8_t>& payload) {
-    PMsgData data;
-    data.msgID = payload[12];
-    return data;
+    return decode_p_msg_payload(payload.data(), payload.size());
 }
 
 PayloadBuilder::CMsgData PayloadBuilder::decode_c_msg_payload(const std::vector<uint8_t>& payload) {
     CMsgData data;
-    uint8_t length = payload[11];
-    data.message.assign(payload.begin() + 12, payload.begin() + 12 + length);
+    CMsgView view = decode_c_msg_view(payload.data(), payload.size());
+    if (view.message) data.message.assign(view.message, view.length);
     return data;
 }
 
 PayloadBuilder::PayloadDetails PayloadBuilder::get_payload_details(const std::vector<uint8_t>& payload) {
-    PayloadDetails details;
-    details.type = payload[0];
-    details.sourceID = payload[1];
-    details.destinationID = payload[2];
-    details.transmissionID = (payload[3] << 8) | payload[4];
-    std::memcpy(details.dateTime, &payload[5], 6);
-    details.dataLength = payload[11];
-    return details;
+    return get_payload_details(payload.data(), payload.size());
 }
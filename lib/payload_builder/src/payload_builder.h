@@ -3,13 +3,145 @@
 
 #include <vector>
 #include <string>
+#include <array>
 #include <cstdint>
+#include <cstddef>
 #include <ctime>
 
 #define MAX_PAYLOAD_SIZE 100
+#define PAYLOAD_HEADER_SIZE 12
+#define PAYLOAD_CHECKSUM_SIZE 1
+#define PAYLOAD_CRC_SIZE 2
+#define PAYLOAD_INVALID 101
+#define PAYLOAD_BROADCAST_ID 0xFF
+
+// Longest custom message text: what is left of MAX_PAYLOAD_SIZE after the
+// header and the larger (CRC-16) trailer.
+#define C_MSG_MAX_LENGTH (MAX_PAYLOAD_SIZE - PAYLOAD_HEADER_SIZE - PAYLOAD_CRC_SIZE)
+// Longest text a packed custom message may expand to; receivers size their
+// text buffers for it. Its compressed form is still bounded by
+// C_MSG_MAX_LENGTH.
+#define C_MSG_TEXT_MAX_LENGTH 128
+
+// Frame types (first byte of every frame).
+#define PAYLOAD_TYPE_GPS 0x01
+#define PAYLOAD_TYPE_P_MSG 0x02
+#define PAYLOAD_TYPE_C_MSG 0x03
+#define PAYLOAD_TYPE_GPS_COMPACT 0x04
+#define PAYLOAD_TYPE_GPS_DELTA 0x05
+#define PAYLOAD_TYPE_AGGREGATE 0x06
+#define PAYLOAD_TYPE_RELAY 0x07
+#define PAYLOAD_TYPE_CONTROL 0x08
+#define PAYLOAD_TYPE_BEACON 0x09
+#define PAYLOAD_TYPE_SLOT 0x0A
+#define PAYLOAD_TYPE_C_MSG_PACKED 0x0B
+#define PAYLOAD_TYPE_ACK 0xFF
+
+// Integrity versioning: a frame whose type byte has this bit set (other than
+// the ACK type) ends in a 2-byte CRC-16/CCITT-FALSE over all preceding bytes
+// instead of the 1-byte XOR checksum. Decoders accept both forms.
+#define PAYLOAD_FLAG_CRC16 0x80
+
+// Compact GPS frames drop the destination and timestamp: a 4-byte header
+// (type, sourceID, transmissionID) followed by fixed-point coordinates in
+// units of 1e-5 degree (about 1.1 m). An absolute fix packs latitude into
+// 25 bits and longitude into 26 bits (7 bytes). A delta frame carries the
+// low byte of its keyframe's transmissionID and two signed 12-bit offsets
+// from that keyframe (4 bytes), covering about +/-2.2 km.
+#define GPS_COMPACT_HEADER_SIZE 4
+#define GPS_COMPACT_BODY_SIZE 7
+#define GPS_DELTA_BODY_SIZE 4
+#define GPS_FIXED_SCALE 100000L
+#define GPS_DELTA_LIMIT 2047
+#define GPS_DEFAULT_KEYFRAME_INTERVAL 8
+
+// Aggregate frames use the regular 12-byte header; the data section is a
+// sequence of records, each [type][sourceID][transmissionID hi][lo][length]
+// followed by the body of a type 1, 2 or 3 frame.
+#define AGGREGATE_RECORD_HEADER_SIZE 5
+
+// A relay wraps an unchanged frame as [type][hopCount][relayID][frame]
+// plus its own checksum. The largest frame on air is therefore a relayed
+// MAX_PAYLOAD_SIZE frame; receivers size their buffers for it.
+#define RELAY_HEADER_SIZE 3
+#define RELAY_MAX_HOPS 3
+#define MAX_FRAME_SIZE (MAX_PAYLOAD_SIZE + RELAY_HEADER_SIZE + PAYLOAD_CRC_SIZE)
+
+// ACK frames: [0xFF][sourceID][destinationID][transmissionID hi][lo]
+// [received map hi][lo] plus the XOR checksum (ACKs never carry the CRC
+// flag). transmissionID is the highest reliable frame received from
+// destinationID; bit i of the received map is set if transmissionID - 1 - i
+// arrived too, and anything older is acknowledged cumulatively. Inside an
+// aggregate frame an ACK is a record of type 0xFF whose body is the map,
+// addressed to the aggregate's destination.
+#define ACK_HEADER_SIZE 5
+#define ACK_BODY_SIZE 2
+
+// Control frames: [0x08][sourceID][destinationID][transmissionID hi][lo]
+// [command][dataRate][parameter] plus the checksum trailer. They carry
+// data-rate negotiation for lib/adr:
+//   PROPOSE  coordinator -> member: switch to dataRate?
+//   ACCEPT   member -> coordinator: dataRate is the fastest the member can
+//            take (at most the proposal); parameter is the SNR at which it
+//            hears the coordinator, in whole dB (signed).
+//   SET      coordinator -> all: switch to dataRate after parameter x 100 ms.
+#define CONTROL_HEADER_SIZE 5
+#define CONTROL_BODY_SIZE 3
+#define CONTROL_ADR_PROPOSE 0x01
+#define CONTROL_ADR_ACCEPT 0x02
+#define CONTROL_ADR_SET 0x03
+
+// TDMA beacons (lib/tdma): [0x09][sourceID][sequence hi][lo][slot ms hi][lo]
+// [downlink slots][contention slots][data slots][slot map] plus trailer.
+// A superframe starts with the beacon and is made of equal slots: the
+// base's downlink slots (the beacon goes first in them), the contention
+// slots for joining, then the data slots. Bit i of the map (LSB first) is
+// set while data slot i is assigned.
+#define BEACON_HEADER_SIZE 9
+#define BEACON_MAX_DATA_SLOTS 250
+
+// Slot frames: [0x0A][sourceID][destinationID][command][slot] plus trailer.
+// A user sends REQUEST in a contention slot and RELEASE when it leaves; the
+// base answers with ASSIGN, whose slot is TDMA_NO_SLOT when none is free.
+#define SLOT_FRAME_SIZE 5
+#define SLOT_REQUEST 0x01
+#define SLOT_ASSIGN 0x02
+#define SLOT_RELEASE 0x03
+#define TDMA_NO_SLOT 0xFF
+
+// Header v2, for the types that carry the 12-byte header (GPS, predefined,
+// custom, packed custom and aggregate): [type | PAYLOAD_FLAG_V2][sourceID]
+// [destinationID][transmissionID, varint][time, 4 bytes] and then the data,
+// whose length is whatever precedes the trailer. The varint holds 7 bits
+// per byte, low bits first, with the top bit set on all but the last byte:
+// 1 byte below 128, 2 below 16384, else 3. time is Unix seconds by the
+// sender's clock, big-endian. The header takes 8 to 10 bytes instead of 12.
+// Decoders read both versions and report a v2 time as a UTC dateTime.
+// Aggregate records keep their own 5-byte headers.
+#define PAYLOAD_FLAG_V2 0x40
+#define PAYLOAD_V2_HEADER_MAX_SIZE 10
+
+// Packed custom messages use the regular 12-byte header; dataLength and the
+// data section hold the text compressed with lib/text_codec instead of the
+// text itself. Inside an aggregate frame they are records of type 0x0B.
 
 class PayloadBuilder {
 public:
+    enum IntegrityMode {
+        INTEGRITY_XOR,    // 1-byte XOR checksum, readable by every receiver
+        INTEGRITY_CRC16   // 2-byte CRC-16, type byte flagged with PAYLOAD_FLAG_CRC16
+    };
+
+    enum HeaderVersion {
+        HEADER_V1,        // 12-byte header with a calendar timestamp, readable by every receiver
+        HEADER_V2         // 8 to 10 bytes, type byte flagged with PAYLOAD_FLAG_V2
+    };
+
+    // Fixed-size frame buffer for the allocation-free API.
+    typedef std::array<uint8_t, MAX_PAYLOAD_SIZE> Buffer;
+    // Receive buffer, large enough for a relayed frame.
+    typedef std::array<uint8_t, MAX_FRAME_SIZE> FrameBuffer;
+
     struct GPSData {
         float longitude;
         float latitude;
@@ -23,6 +155,86 @@ public:
         std::string message;
     };
 
+    // Non-owning view of a custom message inside a received frame.
+    struct CMsgView {
+        const char* message;
+        uint8_t length;
+    };
+
+    // Last keyframe seen on a compact GPS stream. The encoder keeps one for
+    // its own reports; a decoder keeps one per sourceID.
+    struct GPSTrackState {
+        bool valid;
+        uint16_t keyTransmissionID;
+        int32_t latitudeFixed;
+        int32_t longitudeFixed;
+        uint8_t sinceKeyframe;
+    };
+
+    // One record inside an aggregate frame; data points into the frame.
+    struct AggregateRecord {
+        uint8_t type;
+        uint8_t sourceID;
+        uint16_t transmissionID;
+        const uint8_t* data;
+        uint8_t length;
+    };
+
+    // Build state for an aggregate frame in a caller-owned buffer.
+    struct AggregateWriter {
+        uint8_t* buffer;
+        size_t capacity;
+        size_t length;
+        uint8_t count;
+    };
+
+    // Walks the records of a received aggregate frame without copying.
+    class AggregateReader {
+    public:
+        AggregateReader(const uint8_t* payload, size_t length);
+        bool next(AggregateRecord& record);
+        bool malformed() const;
+
+    private:
+        const uint8_t* cursor;
+        const uint8_t* end;
+        bool error;
+    };
+
+    // The original frame carried by a relay envelope; frame points into it.
+    struct RelayView {
+        uint8_t hopCount;
+        uint8_t relayID;
+        const uint8_t* frame;
+        size_t length;
+    };
+
+    struct AckData {
+        uint16_t transmissionID;
+        uint16_t receivedMap;
+    };
+
+    struct ControlData {
+        uint8_t command;
+        uint8_t dataRate;
+        uint8_t parameter;
+    };
+
+    // slotMap points into the received frame.
+    struct BeaconData {
+        uint16_t sequence;
+        uint16_t slotMs;
+        uint8_t downlinkSlots;
+        uint8_t contentionSlots;
+        uint8_t dataSlots;
+        const uint8_t* slotMap;
+    };
+
+    struct SlotData {
+        uint8_t command;
+        uint8_t slot;
+    };
+
     struct PayloadDetails {
         uint8_t type;
         uint8_t sourceID;
@@ -32,7 +244,50 @@ public:
         uint8_t dataLength;
     };
 
+    // Why parse() rejected a frame.
+    enum ParseStatus {
+        PARSE_OK,
+        PARSE_TOO_SHORT,        // shorter than its type's header and trailer
+        PARSE_BAD_CHECKSUM,
+        PARSE_UNKNOWN_TYPE,
+        PARSE_BAD_LENGTH        // length disagrees with the type or with dataLength
+    };
+
+    // A received frame validated by parse(). details is filled as
+    // get_payload_details fills it (only the type for a relay), and body
+    // spans the data section inside the frame: the records of an aggregate,
+    // the text of a custom message, the wrapped frame of a relay. The union
+    // member for details.type holds the decoded body; compact GPS and
+    // aggregate bodies are left to decode_gps_compact_payload and
+    // AggregateReader, which need a track or walk the records.
+    struct ParsedFrame {
+        ParseStatus status;
+        PayloadDetails details;
+        const uint8_t* body;
+        uint8_t bodyLength;
+        union {
+            GPSData gps;
+            PMsgData pMsg;
+            AckData ack;
+            ControlData control;
+            BeaconData beacon;
+            SlotData slot;
+            RelayView relay;
+        };
+    };
+
+    PayloadBuilder();
+
     void configure_device(uint8_t srcID, uint8_t destID);
+    void set_integrity_mode(IntegrityMode mode);
+    // Off (v1) by default: receivers built before v2 drop v2 frames.
+    void set_header_version(HeaderVersion version);
+    // Frames are timestamped from the wall clock read here plus a monotonic
+    // clock, with no calendar conversion per frame, so tasks sharing a
+    // builder can encode at once. The constructor reads it; call this again
+    // after setting the clock, before any task encodes with the builder,
+    // since encoding reads the time base without a lock.
+    void sync_time_base();
     std::vector<uint8_t> create_gps_payload(uint16_t transmissionID, float longitude, float latitude);
     std::vector<uint8_t> create_p_msg_payload(uint16_t transmissionID, uint8_t msgID);
     std::vector<uint8_t> create_c_msg_payload(uint16_t transmissionID, const std::string& msg);
@@ -43,12 +298,119 @@ public:
     CMsgData decode_c_msg_payload(const std::vector<uint8_t>& payload);
     PayloadDetails get_payload_details(const std::vector<uint8_t>& payload);
 
+    // Encoders writing into a caller-owned buffer. They never allocate and
+    // return the frame length, or 0 if the frame does not fit.
+    size_t encode_gps_payload(uint8_t* buffer, size_t bufferSize, uint16_t transmissionID, float longitude, float latitude);
+    size_t encode_p_msg_payload(uint8_t* buffer, size_t bufferSize, uint16_t transmissionID, uint8_t msgID);
+    size_t encode_c_msg_payload(uint8_t* buffer, size_t bufferSize, uint16_t transmissionID, const char* msg, size_t msgLength);
+    size_t encode_gps_payload(Buffer& buffer, uint16_t transmissionID, float longitude, float latitude);
+    size_t encode_p_msg_payload(Buffer& buffer, uint16_t transmissionID, uint8_t msgID);
+    size_t encode_c_msg_payload(Buffer& buffer, uint16_t transmissionID, const char* msg, size_t msgLength);
+
+    // Frame type with the integrity and header-version flags stripped, and
+    // the size of the checksum trailer that type byte implies.
+    static uint8_t frame_type(uint8_t typeByte);
+    static size_t trailer_size(uint8_t typeByte);
+    static uint16_t crc16(const uint8_t* data, size_t length);
+
+    // Decoders reading from a pointer/length view. Frames shorter than the
+    // fields they read decode to zeroed values instead of reading past the end.
+    uint8_t identify_type_and_check_checksum(const uint8_t* payload, size_t length);
+    GPSData decode_gps_payload(const uint8_t* payload, size_t length);
+    PMsgData decode_p_msg_payload(const uint8_t* payload, size_t length);
+    CMsgView decode_c_msg_view(const uint8_t* payload, size_t length);
+    PayloadDetails get_payload_details(const uint8_t* payload, size_t length);
+
+    // Checks integrity, type and every length field of a received frame in
+    // one pass over it, then decodes it into frame without copying the body.
+    // Unlike the decoders above it rejects a frame whose size disagrees with
+    // its type or dataLength, and an aggregate whose records do not fill its
+    // data section exactly. A relay's wrapped frame is not checked; parse it
+    // in turn. Returns false, with frame.status saying why, for a frame to drop.
+    bool parse(const uint8_t* payload, size_t length, ParsedFrame& frame);
+
+    // Custom message text, packed or raw, copied into text without a
+    // terminator. Returns the text length, or 0 for a frame of another type,
+    // malformed packed data or text longer than textSize
+    // (C_MSG_TEXT_MAX_LENGTH always fits).
+    size_t decode_c_msg_text(const uint8_t* payload, size_t length, char* text, size_t textSize);
+    size_t decode_c_msg_record_text(const AggregateRecord& record, char* text, size_t textSize);
+
+    // With text compression enabled, encode_c_msg_payload sends a packed
+    // custom message (type 0x0B) whenever that is shorter, and accepts text
+    // up to C_MSG_TEXT_MAX_LENGTH as long as its packed form fits. Off by
+    // default: receivers need decode_c_msg_text to read packed frames.
+    void set_text_compression(bool enabled);
+
+    // Compact GPS. With delta mode enabled the encoder sends a keyframe, then
+    // deltas against it until the offset overflows or keyframeInterval
+    // deltas have gone out. decode_gps_compact_payload returns false for a
+    // delta whose keyframe was never received.
+    void set_gps_delta_mode(bool enabled, uint8_t keyframeInterval = GPS_DEFAULT_KEYFRAME_INTERVAL);
+    size_t encode_gps_compact_payload(uint8_t* buffer, size_t bufferSize, uint16_t transmissionID, float longitude, float latitude);
+    size_t encode_gps_compact_payload(Buffer& buffer, uint16_t transmissionID, float longitude, float latitude);
+    std::vector<uint8_t> create_gps_compact_payload(uint16_t transmissionID, float longitude, float latitude);
+    bool decode_gps_compact_payload(const uint8_t* payload, size_t length, GPSTrackState& track, GPSData& data);
+
+    // Aggregate frames. Each append returns false, leaving the frame
+    // unchanged, once the record no longer fits; finish returns the frame
+    // length, or 0 if no record was added.
+    void begin_aggregate_payload(AggregateWriter& writer, uint8_t* buffer, size_t bufferSize, uint16_t transmissionID);
+    void begin_aggregate_payload(AggregateWriter& writer, Buffer& buffer, uint16_t transmissionID);
+    bool append_record(AggregateWriter& writer, const AggregateRecord& record);
+    bool append_gps_record(AggregateWriter& writer, uint8_t srcID, uint16_t transmissionID, float longitude, float latitude);
+    bool append_p_msg_record(AggregateWriter& writer, uint8_t srcID, uint16_t transmissionID, uint8_t msgID);
+    bool append_c_msg_record(AggregateWriter& writer, uint8_t srcID, uint16_t transmissionID, const char* msg, size_t msgLength);
+    bool append_frame_record(AggregateWriter& writer, const uint8_t* payload, size_t length);
+    size_t finish_aggregate_payload(AggregateWriter& writer);
+    GPSData decode_gps_record(const AggregateRecord& record);
+    PMsgData decode_p_msg_record(const AggregateRecord& record);
+    CMsgView decode_c_msg_record(const AggregateRecord& record);
+
+    // Relay envelopes. The wrapped frame is copied verbatim, so its own
+    // checksum still protects it end to end.
+    size_t encode_relay_payload(uint8_t* buffer, size_t bufferSize, uint8_t relayID, uint8_t hopCount, const uint8_t* frame, size_t frameLength);
+    RelayView decode_relay_view(const uint8_t* payload, size_t length);
+
+    // ACKs for the reliable link (lib/reliable_link), sent by this device to
+    // destinationID either as their own frame or piggybacked in an aggregate.
+    size_t encode_ack_payload(uint8_t* buffer, size_t bufferSize, uint8_t destinationID, const AckData& ack);
+    AckData decode_ack_payload(const uint8_t* payload, size_t length);
+    bool append_ack_record(AggregateWriter& writer, const AckData& ack);
+    AckData decode_ack_record(const AggregateRecord& record);
+
+    // Control frames for data-rate negotiation (lib/adr), sent by this
+    // device to destinationID (PAYLOAD_BROADCAST_ID for a SET).
+    size_t encode_control_payload(uint8_t* buffer, size_t bufferSize, uint8_t destinationID, uint16_t transmissionID, const ControlData& control);
+    ControlData decode_control_payload(const uint8_t* payload, size_t length);
+
+    // TDMA beacons and slot management. decode_beacon_payload returns zero
+    // data slots and a null map for a frame too short for its own map.
+    size_t encode_beacon_payload(uint8_t* buffer, size_t bufferSize, const BeaconData& beacon);
+    BeaconData decode_beacon_payload(const uint8_t* payload, size_t length);
+    size_t encode_slot_payload(uint8_t* buffer, size_t bufferSize, uint8_t destinationID, const SlotData& slot);
+    SlotData decode_slot_payload(const uint8_t* payload, size_t length);
+
 private:
     uint8_t sourceID;
     uint8_t destinationID;
     size_t lastPayloadSize = 0;
+    IntegrityMode integrityMode = INTEGRITY_XOR;
+    bool gpsDeltaMode = false;
+    bool textCompression = false;
+    HeaderVersion headerVersion = HEADER_V1;
+    uint32_t baseSeconds = 0;           // Unix time at baseMs
+    uint64_t baseMs = 0;                // monotonic clock
+    int32_t utcOffsetSeconds = 0;       // local time minus UTC, for v1 timestamps
+    uint8_t gpsKeyframeInterval = GPS_DEFAULT_KEYFRAME_INTERVAL;
+    GPSTrackState gpsTrack = {};
+    uint32_t currentTime();
     void getCurrentDateTime(uint8_t *buffer);
-    uint8_t calculateXORChecksum(const std::vector<uint8_t>& data);
+    size_t writeHeader(uint8_t* buffer, uint8_t type, uint16_t transmissionID, uint8_t dataLength);
+    size_t writeCompactHeader(uint8_t* buffer, uint8_t type, uint16_t transmissionID);
+    size_t finishPayload(uint8_t* buffer, size_t length);
+    size_t trailerSize() const;
+    uint8_t calculateXORChecksum(const uint8_t* data, size_t length);
 };
 
 #endif // PAYLOAD_BUILDER_H
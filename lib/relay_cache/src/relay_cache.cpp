@@ -0,0 +1,69 @@
+#include "relay_cache.h"
+#include <cstring>
+
+RelayCache::RelayCache(uint32_t expiryMs) : expiryMs(expiryMs) {
+    clear();
+}
+
+// Exact for stream 0. Other streams fold in as a 32-bit fingerprint, so two
+// different live frames would need a 32-bit collision inside one set to be
+// mistaken for each other.
+uint32_t RelayCache::makeKey(uint8_t sourceID, uint16_t transmissionID, uint16_t stream) {
+    uint32_t key = (0x01000000UL | ((uint32_t)sourceID << 16) | transmissionID) ^ ((uint32_t)stream * 0x9E3779B1u);
+    return key != 0 ? key : 1;
+}
+
+size_t RelayCache::setIndex(uint32_t key) {
+    // Fibonacci hashing spreads consecutive transmission IDs across sets.
+    return (size_t)((uint32_t)(key * 2654435769u) >> 16) % RELAY_CACHE_SETS;
+}
+
+bool RelayCache::isLive(const Entry& entry, uint32_t nowMs) const {
+    return entry.key != 0 && (uint32_t)(nowMs - entry.seenAt) < expiryMs;
+}
+
+RelayCache::Result RelayCache::check_and_insert(uint8_t sourceID, uint16_t transmissionID, uint32_t nowMs, uint16_t stream) {
+    uint32_t key = makeKey(sourceID, transmissionID, stream);
+    Entry* set = entries[setIndex(key)];
+    Entry* freeSlot = nullptr;
+
+    for (size_t way = 0; way < RELAY_CACHE_WAYS; way++) {
+        if (isLive(set[way], nowMs)) {
+            if (set[way].key == key) {
+                duplicateCount++;
+                return DUPLICATE;
+            }
+        } else if (!freeSlot) {
+            freeSlot = &set[way];
+        }
+    }
+
+    if (!freeSlot) {
+        fullDropCount++;
+        return FULL;
+    }
+    freeSlot->key = key;
+    freeSlot->seenAt = nowMs;
+    return NEW_FRAME;
+}
+
+bool RelayCache::contains(uint8_t sourceID, uint16_t transmissionID, uint32_t nowMs, uint16_t stream) const {
+    uint32_t key = makeKey(sourceID, transmissionID, stream);
+    const Entry* set = entries[setIndex(key)];
+    for (size_t way = 0; way < RELAY_CACHE_WAYS; way++) {
+        if (set[way].key == key && isLive(set[way], nowMs)) return true;
+    }
+    return false;
+}
+
+void RelayCache::clear() {
+    std::memset(entries, 0, sizeof(entries));
+}
+
+uint32_t RelayCache::duplicates() const {
+    return duplicateCount;
+}
+
+uint32_t RelayCache::full_drops() const {
+    return fullDropCount;
+}
@@ -0,0 +1,53 @@
+#ifndef RELAY_CACHE_H
+#define RELAY_CACHE_H
+
+#include <cstdint>
+#include <cstddef>
+
+// 4-way set-associative table of recently seen (sourceID, transmissionID)
+// pairs. Lookup and insert touch one set, so both are O(1), and memory is
+// fixed at RELAY_CACHE_SETS * RELAY_CACHE_WAYS entries (8 bytes each).
+#define RELAY_CACHE_SETS 128
+#define RELAY_CACHE_WAYS 4
+#define RELAY_CACHE_EXPIRY_MS 60000
+
+class RelayCache {
+public:
+    enum Result {
+        NEW_FRAME,  // not seen within the expiry window, now recorded
+        DUPLICATE,  // already recorded, do not relay again
+        FULL        // set holds only live entries; treat as not relayable
+    };
+
+    explicit RelayCache(uint32_t expiryMs = RELAY_CACHE_EXPIRY_MS);
+
+    // Looks the frame up and records it if new. An entry is only replaced
+    // once it has expired, so a frame is never reported as NEW_FRAME twice
+    // within the expiry window; when a set is full of live entries the
+    // frame is refused instead. stream separates transmissionID sequences
+    // a source keeps independently (the reliable link numbers messages per
+    // destination), e.g. (frame type << 8) | destinationID.
+    Result check_and_insert(uint8_t sourceID, uint16_t transmissionID, uint32_t nowMs, uint16_t stream = 0);
+    bool contains(uint8_t sourceID, uint16_t transmissionID, uint32_t nowMs, uint16_t stream = 0) const;
+    void clear();
+
+    uint32_t duplicates() const;
+    uint32_t full_drops() const;
+
+private:
+    struct Entry {
+        uint32_t key;  // 0 marks an empty slot
+        uint32_t seenAt;
+    };
+
+    Entry entries[RELAY_CACHE_SETS][RELAY_CACHE_WAYS];
+    uint32_t expiryMs;
+    uint32_t duplicateCount = 0;
+    uint32_t fullDropCount = 0;
+
+    bool isLive(const Entry& entry, uint32_t nowMs) const;
+    static uint32_t makeKey(uint8_t sourceID, uint16_t transmissionID, uint16_t stream);
+    static size_t setIndex(uint32_t key);
+};
+
+#endif // RELAY_CACHE_H
@@ -0,0 +1,113 @@
+#include "relay_queue.h"
+#include <cstring>
+
+RelayQueue::RelayQueue(uint8_t relayID, uint32_t duplicateWindowMs)
+    : relayID(relayID), relayCache(duplicateWindowMs), jobCount(0) {
+    std::memset(jobs, 0, sizeof(jobs));
+    std::memset(&counters, 0, sizeof(counters));
+}
+
+TxScheduler::TrafficClass RelayQueue::traffic_class(uint8_t type, uint8_t sourceID, uint32_t& coalesceKey) {
+    coalesceKey = 0;
+    if (type == PAYLOAD_TYPE_C_MSG || type == PAYLOAD_TYPE_C_MSG_PACKED) {
+        return TxScheduler::TX_CUSTOM;
+    }
+    if (type == PAYLOAD_TYPE_ACK || type == PAYLOAD_TYPE_CONTROL) {
+        return TxScheduler::TX_CONTROL;
+    }
+    if (type == PAYLOAD_TYPE_GPS || type == PAYLOAD_TYPE_GPS_COMPACT || type == PAYLOAD_TYPE_GPS_DELTA) {
+        coalesceKey = ((uint32_t)type << 24) | ((uint32_t)sourceID << 16);
+        return TxScheduler::TX_GPS;
+    }
+    return TxScheduler::TX_PREDEFINED;
+}
+
+RelayQueue::Decision RelayQueue::offer(const uint8_t* payload, size_t length, const PayloadBuilder::ParsedFrame& received,
+                                       const PayloadBuilder::ParsedFrame& original, uint32_t nowMs, uint32_t backoffMs) {
+    if (received.status != PayloadBuilder::PARSE_OK || original.status != PayloadBuilder::PARSE_OK) {
+        counters.invalid++;
+        return RELAY_INVALID;
+    }
+
+    // Frames already relayed by another node are unwrapped so the cache
+    // sees the original source and transmission ID.
+    const uint8_t* frame = payload;
+    size_t frameLength = length;
+    uint8_t hopCount = 1;
+    if (received.details.type == PAYLOAD_TYPE_RELAY) {
+        frame = received.relay.frame;
+        frameLength = received.relay.length;
+        hopCount = received.relay.hopCount + 1;
+    }
+
+    // Reliable messages are numbered per destination, so the destination is
+    // part of the key; the type keeps them apart from other traffic.
+    const PayloadBuilder::PayloadDetails& details = original.details;
+    uint16_t stream = ((uint16_t)details.type << 8) | details.destinationID;
+    if (relayCache.check_and_insert(details.sourceID, details.transmissionID, nowMs, stream) != RelayCache::NEW_FRAME) {
+        counters.duplicates++;
+        return RELAY_DUPLICATE;
+    }
+    if (hopCount > RELAY_MAX_HOPS || frameLength > MAX_PAYLOAD_SIZE) {
+        counters.hopLimit++;
+        return RELAY_HOP_LIMIT;
+    }
+    if (jobCount == RELAY_QUEUE_DEPTH) {
+        counters.queueFull++;
+        return RELAY_QUEUE_FULL;
+    }
+
+    Job& job = jobs[jobCount++];
+    job.dueAt = nowMs + backoffMs;
+    job.trafficClass = (uint8_t)traffic_class(details.type, details.sourceID, job.coalesceKey);
+    job.hopCount = hopCount;
+    job.length = (uint8_t)frameLength;
+    std::memcpy(job.frame, frame, frameLength);
+    counters.queued++;
+    return RELAY_QUEUED;
+}
+
+size_t RelayQueue::schedule_due(uint32_t nowMs, PayloadBuilder& builder, TxScheduler& scheduler) {
+    size_t moved = 0;
+    for (size_t j = 0; j < jobCount;) {
+        const Job& job = jobs[j];
+        if ((int32_t)(job.dueAt - nowMs) > 0) {
+            j++;
+            continue;
+        }
+        uint8_t envelope[MAX_FRAME_SIZE];
+        size_t length = builder.encode_relay_payload(envelope, sizeof(envelope), relayID, job.hopCount, job.frame, job.length);
+        if (length > 0 && scheduler.enqueue((TxScheduler::TrafficClass)job.trafficClass, envelope, length, nowMs, job.coalesceKey)) {
+            counters.scheduled++;
+            moved++;
+        } else {
+            counters.schedulerFull++;
+        }
+        // Arrival order is kept for the frames still waiting.
+        std::memmove(&jobs[j], &jobs[j + 1], (jobCount - j - 1) * sizeof(Job));
+        jobCount--;
+    }
+    return moved;
+}
+
+uint32_t RelayQueue::time_to_next_event(uint32_t nowMs) const {
+    uint32_t wait = UINT32_MAX;
+    for (size_t j = 0; j < jobCount; j++) {
+        int32_t remaining = (int32_t)(jobs[j].dueAt - nowMs);
+        uint32_t due = remaining > 0 ? (uint32_t)remaining : 0;
+        if (due < wait) wait = due;
+    }
+    return wait;
+}
+
+size_t RelayQueue::pending() const {
+    return jobCount;
+}
+
+const RelayQueue::Stats& RelayQueue::stats() const {
+    return counters;
+}
+
+const RelayCache& RelayQueue::cache() const {
+    return relayCache;
+}
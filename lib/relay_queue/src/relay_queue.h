@@ -0,0 +1,96 @@
+#ifndef RELAY_QUEUE_H
+#define RELAY_QUEUE_H
+
+#include <cstdint>
+#include <cstddef>
+#include "payload_builder.h"
+#include "relay_cache.h"
+#include "tx_scheduler.h"
+
+// Frames waiting out their backoff.
+#define RELAY_QUEUE_DEPTH 8
+
+// Random delay before re-broadcasting, so relays that heard the same frame
+// do not all transmit at once.
+#define RELAY_BACKOFF_MIN_MS 50
+#define RELAY_BACKOFF_MAX_MS 400
+
+// A frame heard again this long after it was first relayed is relayed
+// again: by then it is a reliable-link retransmission, not an echo of the
+// copy this node or a neighbour already forwarded.
+#define RELAY_DUPLICATE_WINDOW_MS 10000
+
+// What a store-and-forward relay does with the frames it hears, without
+// the radio: which ones to forward, and when. The inter node firmware and
+// the network simulator both run this, so the sim exercises the relay
+// logic that ships.
+//
+// offer() drops a frame that failed to parse, one this node (or the relay
+// cache) has already seen and one that has used up RELAY_MAX_HOPS, and
+// queues the rest for a backoff the caller draws. schedule_due() wraps the
+// frames whose backoff is over in a relay envelope and hands them to the
+// transmit scheduler by the class of the frame inside; position reports
+// coalesce per source and kind, so when the budget runs short only the
+// newest of each is forwarded. Not locked: the firmware guards it.
+class RelayQueue {
+public:
+    enum Decision {
+        RELAY_QUEUED,
+        RELAY_INVALID,      // failed to parse, the wrapped frame included
+        RELAY_DUPLICATE,    // already relayed within the window, or the cache is full
+        RELAY_HOP_LIMIT,
+        RELAY_QUEUE_FULL
+    };
+
+    struct Stats {
+        uint32_t queued;
+        uint32_t invalid;
+        uint32_t duplicates;
+        uint32_t hopLimit;
+        uint32_t queueFull;
+        uint32_t scheduled;
+        uint32_t schedulerFull;  // refused by the transmit scheduler
+    };
+
+    explicit RelayQueue(uint8_t relayID, uint32_t duplicateWindowMs = RELAY_DUPLICATE_WINDOW_MS);
+
+    // received is the frame as heard; original is the same frame, or the
+    // one a relay envelope wraps. backoffMs is drawn by the caller from
+    // [RELAY_BACKOFF_MIN_MS, RELAY_BACKOFF_MAX_MS).
+    Decision offer(const uint8_t* payload, size_t length, const PayloadBuilder::ParsedFrame& received,
+                   const PayloadBuilder::ParsedFrame& original, uint32_t nowMs, uint32_t backoffMs);
+
+    // Moves every frame whose backoff is over into the scheduler, in a
+    // relay envelope from this node. Returns how many went in.
+    size_t schedule_due(uint32_t nowMs, PayloadBuilder& builder, TxScheduler& scheduler);
+
+    // 0 if a frame is due now, the wait for the next one otherwise, or
+    // UINT32_MAX when none is waiting.
+    uint32_t time_to_next_event(uint32_t nowMs) const;
+
+    size_t pending() const;
+    const Stats& stats() const;
+    const RelayCache& cache() const;
+
+    // Class and coalescing key a relayed frame of this type and source
+    // travels under.
+    static TxScheduler::TrafficClass traffic_class(uint8_t type, uint8_t sourceID, uint32_t& coalesceKey);
+
+private:
+    struct Job {
+        uint32_t dueAt;
+        uint32_t coalesceKey;
+        uint8_t trafficClass;
+        uint8_t hopCount;
+        uint8_t length;
+        uint8_t frame[MAX_PAYLOAD_SIZE];
+    };
+
+    uint8_t relayID;
+    RelayCache relayCache;
+    Job jobs[RELAY_QUEUE_DEPTH];
+    size_t jobCount;
+    Stats counters;
+};
+
+#endif // RELAY_QUEUE_H
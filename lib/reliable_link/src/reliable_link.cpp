@@ -0,0 +1,347 @@
+#include "reliable_link.h"
+#include "ms_time.h"
+#include <cstring>
+
+ReliableLink::ReliableLink(uint8_t deviceID, uint16_t initialTransmissionID)
+    : deviceID(deviceID),
+      initialTransmissionID(initialTransmissionID),
+      controlTransmissionID(initialTransmissionID),
+      windowSize(RELIABLE_WINDOW_SIZE) {
+    payloadBuilder.configure_device(deviceID, PAYLOAD_BROADCAST_ID);
+    std::memset(peers, 0, sizeof(peers));
+    std::memset(&counters, 0, sizeof(counters));
+}
+
+void ReliableLink::set_integrity_mode(PayloadBuilder::IntegrityMode mode) {
+    payloadBuilder.set_integrity_mode(mode);
+}
+
+void ReliableLink::set_text_compression(bool enabled) {
+    payloadBuilder.set_text_compression(enabled);
+}
+
+void ReliableLink::set_header_version(PayloadBuilder::HeaderVersion version) {
+    payloadBuilder.set_header_version(version);
+}
+
+void ReliableLink::set_window(uint8_t size) {
+    if (size < 1) size = 1;
+    if (size > RELIABLE_WINDOW_SIZE) size = RELIABLE_WINDOW_SIZE;
+    windowSize = size;
+}
+
+ReliableLink::Peer* ReliableLink::findPeer(uint8_t id) {
+    for (size_t i = 0; i < RELIABLE_MAX_PEERS; i++) {
+        if (peers[i].used && peers[i].id == id) return &peers[i];
+    }
+    return nullptr;
+}
+
+const ReliableLink::Peer* ReliableLink::findPeer(uint8_t id) const {
+    for (size_t i = 0; i < RELIABLE_MAX_PEERS; i++) {
+        if (peers[i].used && peers[i].id == id) return &peers[i];
+    }
+    return nullptr;
+}
+
+// An unused entry, or else the least recently active peer with nothing in
+// flight and no ACK owed. Returns -1 if every peer is busy.
+int ReliableLink::freePeerIndex() const {
+    int victim = -1;
+    for (size_t i = 0; i < RELIABLE_MAX_PEERS; i++) {
+        const Peer& peer = peers[i];
+        if (!peer.used) return (int)i;
+        if (peer.inFlight == 0 && !peer.ackPending &&
+            (victim < 0 || (int32_t)(peer.lastActive - peers[victim].lastActive) < 0)) {
+            victim = (int)i;
+        }
+    }
+    return victim;
+}
+
+ReliableLink::Peer* ReliableLink::findOrAddPeer(uint8_t id, uint32_t nowMs) {
+    Peer* peer = findPeer(id);
+    if (!peer) {
+        int index = freePeerIndex();
+        if (index < 0) return nullptr;
+        peer = &peers[index];
+        std::memset(peer, 0, sizeof(Peer));
+        peer->used = true;
+        peer->id = id;
+        peer->nextTransmissionID = initialTransmissionID;
+        peer->rtoMs = RELIABLE_INITIAL_RTO_MS;
+    }
+    peer->lastActive = nowMs;
+    return peer;
+}
+
+bool ReliableLink::windowOpen(const Peer& peer) const {
+    if (peer.inFlight >= windowSize) return false;
+    for (size_t s = 0; s < RELIABLE_WINDOW_SIZE; s++) {
+        const Slot& slot = peer.slots[s];
+        if (slot.inUse && (uint16_t)(peer.nextTransmissionID - slot.transmissionID) >= RELIABLE_MAX_SPAN) return false;
+    }
+    return true;
+}
+
+ReliableLink::Slot* ReliableLink::claimSlot(Peer& peer) {
+    if (!windowOpen(peer)) return nullptr;
+    for (size_t s = 0; s < RELIABLE_WINDOW_SIZE; s++) {
+        if (!peer.slots[s].inUse) return &peer.slots[s];
+    }
+    return nullptr;
+}
+
+void ReliableLink::releaseSlot(Peer& peer, Slot& slot) {
+    slot.inUse = false;
+    peer.inFlight--;
+}
+
+bool ReliableLink::can_send(uint8_t destinationID) const {
+    if (destinationID == PAYLOAD_BROADCAST_ID || destinationID == deviceID) return false;
+    const Peer* peer = findPeer(destinationID);
+    if (!peer) return freePeerIndex() >= 0;
+    return windowOpen(*peer);
+}
+
+bool ReliableLink::send_p_msg(uint8_t destinationID, uint8_t msgID, uint32_t nowMs) {
+    if (!can_send(destinationID)) return false;
+    Peer* peer = findOrAddPeer(destinationID, nowMs);
+    Slot* slot = claimSlot(*peer);
+
+    payloadBuilder.configure_device(deviceID, destinationID);
+    size_t length = payloadBuilder.encode_p_msg_payload(slot->frame, sizeof(slot->frame), peer->nextTransmissionID, msgID);
+    if (length == 0) return false;
+
+    slot->inUse = true;
+    slot->transmissionID = peer->nextTransmissionID++;
+    slot->attempts = 0;
+    slot->dueAt = nowMs;
+    slot->length = length;
+    peer->inFlight++;
+    counters.messagesQueued++;
+    return true;
+}
+
+bool ReliableLink::send_c_msg(uint8_t destinationID, const char* msg, size_t msgLength, uint32_t nowMs) {
+    if (!can_send(destinationID)) return false;
+    Peer* peer = findOrAddPeer(destinationID, nowMs);
+    Slot* slot = claimSlot(*peer);
+
+    payloadBuilder.configure_device(deviceID, destinationID);
+    size_t length = payloadBuilder.encode_c_msg_payload(slot->frame, sizeof(slot->frame), peer->nextTransmissionID, msg, msgLength);
+    if (length == 0) return false;
+
+    slot->inUse = true;
+    slot->transmissionID = peer->nextTransmissionID++;
+    slot->attempts = 0;
+    slot->dueAt = nowMs;
+    slot->length = length;
+    peer->inFlight++;
+    counters.messagesQueued++;
+    return true;
+}
+
+PayloadBuilder::AckData ReliableLink::pendingAck(const Peer& peer) const {
+    PayloadBuilder::AckData ack = {peer.rxHighest, (uint16_t)(peer.rxHistory >> 1)};
+    return ack;
+}
+
+size_t ReliableLink::transmitSlot(Peer& peer, Slot& slot, uint32_t nowMs, uint8_t* buffer, size_t bufferSize) {
+    if (slot.attempts == 0) {
+        counters.framesSent++;
+    } else {
+        counters.retransmissions++;
+    }
+    // Exponential backoff per message; the peer's RTO only moves with samples.
+    uint8_t shift = slot.attempts < 4 ? slot.attempts : 4;
+    uint32_t timeout = peer.rtoMs << shift;
+    slot.attempts++;
+    slot.lastSentAt = nowMs;
+    slot.dueAt = nowMs + (timeout < RELIABLE_MAX_RTO_MS ? timeout : RELIABLE_MAX_RTO_MS);
+
+    if (peer.ackPending) {
+        payloadBuilder.configure_device(deviceID, peer.id);
+        PayloadBuilder::AggregateWriter writer;
+        payloadBuilder.begin_aggregate_payload(writer, buffer, bufferSize, controlTransmissionID);
+        if (payloadBuilder.append_frame_record(writer, slot.frame, slot.length) &&
+            payloadBuilder.append_ack_record(writer, pendingAck(peer))) {
+            controlTransmissionID++;
+            peer.ackPending = false;
+            counters.acksPiggybacked++;
+            return payloadBuilder.finish_aggregate_payload(writer);
+        }
+        // Too large to share a frame; the ACK goes out on its own later.
+    }
+
+    if (bufferSize < slot.length) return 0;
+    std::memcpy(buffer, slot.frame, slot.length);
+    return slot.length;
+}
+
+size_t ReliableLink::poll(uint32_t nowMs, uint8_t* buffer, size_t bufferSize) {
+    for (;;) {
+        Peer* duePeer = nullptr;
+        Slot* dueSlot = nullptr;
+        for (size_t p = 0; p < RELIABLE_MAX_PEERS; p++) {
+            Peer& peer = peers[p];
+            if (!peer.used || peer.inFlight == 0) continue;
+            for (size_t s = 0; s < RELIABLE_WINDOW_SIZE; s++) {
+                Slot& slot = peer.slots[s];
+                if (!slot.inUse || !ms_reached(nowMs, slot.dueAt)) continue;
+                if (!dueSlot || (int32_t)(slot.dueAt - dueSlot->dueAt) < 0) {
+                    duePeer = &peer;
+                    dueSlot = &slot;
+                }
+            }
+        }
+        if (!dueSlot) break;
+
+        if (dueSlot->attempts >= RELIABLE_MAX_ATTEMPTS) {
+            counters.failed++;
+            releaseSlot(*duePeer, *dueSlot);
+            continue;
+        }
+        return transmitSlot(*duePeer, *dueSlot, nowMs, buffer, bufferSize);
+    }
+
+    for (size_t p = 0; p < RELIABLE_MAX_PEERS; p++) {
+        Peer& peer = peers[p];
+        if (!peer.used || !peer.ackPending || !ms_reached(nowMs, peer.ackDueAt)) continue;
+        payloadBuilder.configure_device(deviceID, peer.id);
+        size_t length = payloadBuilder.encode_ack_payload(buffer, bufferSize, peer.id, pendingAck(peer));
+        if (length == 0) return 0;
+        peer.ackPending = false;
+        counters.acksSent++;
+        return length;
+    }
+    return 0;
+}
+
+uint32_t ReliableLink::time_to_next_event(uint32_t nowMs) const {
+    uint32_t wait = RELIABLE_MAX_RTO_MS;
+    for (size_t p = 0; p < RELIABLE_MAX_PEERS; p++) {
+        const Peer& peer = peers[p];
+        if (!peer.used) continue;
+        if (peer.ackPending) {
+            if (ms_reached(nowMs, peer.ackDueAt)) return 0;
+            if (peer.ackDueAt - nowMs < wait) wait = peer.ackDueAt - nowMs;
+        }
+        for (size_t s = 0; s < RELIABLE_WINDOW_SIZE; s++) {
+            const Slot& slot = peer.slots[s];
+            if (!slot.inUse) continue;
+            if (ms_reached(nowMs, slot.dueAt)) return 0;
+            if (slot.dueAt - nowMs < wait) wait = slot.dueAt - nowMs;
+        }
+    }
+    return wait;
+}
+
+bool ReliableLink::append_pending_ack(PayloadBuilder::AggregateWriter& writer, uint8_t destinationID) {
+    Peer* peer = findPeer(destinationID);
+    if (!peer || !peer->ackPending) return false;
+    if (!payloadBuilder.append_ack_record(writer, pendingAck(*peer))) return false;
+    peer->ackPending = false;
+    counters.acksPiggybacked++;
+    return true;
+}
+
+ReliableLink::Acceptance ReliableLink::on_data(uint8_t sourceID, uint8_t destinationID, uint16_t transmissionID, uint32_t nowMs) {
+    if (destinationID != deviceID) return ACCEPT_NOT_FOR_US;
+    Peer* peer = findOrAddPeer(sourceID, nowMs);
+    if (!peer) return ACCEPT_NEW;  // cannot track or ACK it, but do not lose it
+
+    bool duplicate = false;
+    int16_t ahead = (int16_t)(transmissionID - peer->rxHighest);
+    if (!peer->rxValid || ahead <= -RELIABLE_RX_HISTORY) {
+        // First contact, or the sender restarted with a new initial ID.
+        peer->rxValid = true;
+        peer->rxHighest = transmissionID;
+        peer->rxHistory = 1;
+    } else if (ahead > 0) {
+        peer->rxHistory = ahead >= RELIABLE_RX_HISTORY ? 1 : (peer->rxHistory << ahead) | 1;
+        peer->rxHighest = transmissionID;
+    } else {
+        uint32_t bit = 1UL << -ahead;
+        duplicate = (peer->rxHistory & bit) != 0;
+        peer->rxHistory |= bit;
+    }
+
+    if (duplicate) {
+        // The sender is retransmitting, so our last ACK was lost.
+        counters.duplicatesReceived++;
+        peer->ackDueAt = nowMs;
+    } else if (!peer->ackPending) {
+        peer->ackDueAt = nowMs + RELIABLE_ACK_DELAY_MS;
+    }
+    peer->ackPending = true;
+    return duplicate ? ACCEPT_DUPLICATE : ACCEPT_NEW;
+}
+
+void ReliableLink::sampleRtt(Peer& peer, uint32_t rttMs) {
+    int32_t rtt = (int32_t)rttMs;
+    if (!peer.rttValid) {
+        peer.srttMs = rtt;
+        peer.rttVarMs = rtt / 2;
+        peer.rttValid = true;
+    } else {
+        int32_t error = peer.srttMs - rtt;
+        if (error < 0) error = -error;
+        peer.rttVarMs = (3 * peer.rttVarMs + error) / 4;
+        peer.srttMs = (7 * peer.srttMs + rtt) / 8;
+    }
+    uint32_t rto = peer.srttMs + (peer.rttVarMs > 0 ? 4 * peer.rttVarMs : 1);
+    if (rto < RELIABLE_MIN_RTO_MS) rto = RELIABLE_MIN_RTO_MS;
+    if (rto > RELIABLE_MAX_RTO_MS) rto = RELIABLE_MAX_RTO_MS;
+    peer.rtoMs = rto;
+}
+
+void ReliableLink::on_ack(uint8_t sourceID, uint8_t destinationID, const PayloadBuilder::AckData& ack, uint32_t nowMs) {
+    if (destinationID != deviceID) return;
+    Peer* peer = findPeer(sourceID);
+    if (!peer || peer->inFlight == 0) return;
+    peer->lastActive = nowMs;
+
+    // Send time of the newest message the receiver has, for fast retransmit.
+    bool haveNewest = false;
+    uint32_t newestSentAt = 0;
+    for (size_t s = 0; s < RELIABLE_WINDOW_SIZE; s++) {
+        const Slot& slot = peer->slots[s];
+        if (slot.inUse && slot.attempts > 0 && slot.transmissionID == ack.transmissionID) {
+            haveNewest = true;
+            newestSentAt = slot.lastSentAt;
+        }
+    }
+
+    for (size_t s = 0; s < RELIABLE_WINDOW_SIZE; s++) {
+        Slot& slot = peer->slots[s];
+        if (!slot.inUse || slot.attempts == 0) continue;
+        int16_t behind = (int16_t)(ack.transmissionID - slot.transmissionID);
+        if (behind < 0) continue;
+
+        bool acked = behind == 0 || behind > RELIABLE_MAX_SPAN || (ack.receivedMap & (1u << (behind - 1)));
+        if (acked) {
+            if (slot.attempts == 1) sampleRtt(*peer, nowMs - slot.lastSentAt);
+            counters.delivered++;
+            releaseSlot(*peer, slot);
+        } else if (haveNewest && (int32_t)(newestSentAt - slot.lastSentAt) > 0) {
+            // A later message got through while this one did not: resend
+            // now instead of waiting out the timeout.
+            slot.dueAt = nowMs;
+        }
+    }
+}
+
+const ReliableLink::Stats& ReliableLink::stats() const {
+    return counters;
+}
+
+uint32_t ReliableLink::rto_ms(uint8_t peerID) const {
+    const Peer* peer = findPeer(peerID);
+    return peer ? peer->rtoMs : RELIABLE_INITIAL_RTO_MS;
+}
+
+uint8_t ReliableLink::in_flight(uint8_t peerID) const {
+    const Peer* peer = findPeer(peerID);
+    return peer ? peer->inFlight : 0;
+}
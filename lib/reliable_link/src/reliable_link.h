@@ -0,0 +1,153 @@
+#ifndef RELIABLE_LINK_H
+#define RELIABLE_LINK_H
+
+#include <cstdint>
+#include <cstddef>
+#include "payload_builder.h"
+
+// Per-peer sliding window. Reliable messages to one destination take
+// consecutive transmissionIDs, and at most RELIABLE_WINDOW_SIZE of them are
+// unacknowledged at once. A new message is also held back while the oldest
+// unacknowledged one is RELIABLE_MAX_SPAN IDs behind, so everything in
+// flight stays inside the range an ACK's 16-bit received map covers, while
+// one slow message does not stall the whole window.
+#define RELIABLE_WINDOW_SIZE 8
+#define RELIABLE_MAX_SPAN 16
+#define RELIABLE_MAX_PEERS 8
+
+// Retransmit timeout, adapted per peer from measured round trips
+// (RFC 6298 smoothing, Karn's rule for retransmitted messages) and doubled
+// on every timeout (per message, up to 16x). Retries keep going for longer
+// than the relays' duplicate window, so a retransmission whose first copy a
+// relay already forwarded still gets relayed again.
+#define RELIABLE_INITIAL_RTO_MS 3000
+#define RELIABLE_MIN_RTO_MS 500
+#define RELIABLE_MAX_RTO_MS 32000
+#define RELIABLE_MAX_ATTEMPTS 8
+
+// A receiver holds its ACK this long hoping to piggyback it on outgoing
+// traffic to the same peer; a duplicate (our ACK was lost) is ACKed at once.
+#define RELIABLE_ACK_DELAY_MS 150
+
+// Receivers remember this many transmissionIDs per source to drop
+// duplicates. An ID further behind than this starts a new session
+// (the sender restarted with a fresh initial ID).
+#define RELIABLE_RX_HISTORY 32
+
+class ReliableLink {
+public:
+    enum Acceptance {
+        ACCEPT_NEW,        // deliver to the application
+        ACCEPT_DUPLICATE,  // already delivered; re-ACKed, do not deliver again
+        ACCEPT_NOT_FOR_US  // addressed to another device
+    };
+
+    struct Stats {
+        uint32_t messagesQueued;
+        uint32_t framesSent;        // first transmissions
+        uint32_t retransmissions;
+        uint32_t delivered;         // acknowledged by the peer
+        uint32_t failed;            // given up after RELIABLE_MAX_ATTEMPTS
+        uint32_t acksSent;          // standalone ACK frames
+        uint32_t acksPiggybacked;   // ACK records inside outgoing frames
+        uint32_t duplicatesReceived;
+    };
+
+    // initialTransmissionID should differ across reboots (e.g. random), so
+    // receivers can tell a restarted sender from a stale retransmission.
+    ReliableLink(uint8_t deviceID, uint16_t initialTransmissionID);
+
+    void set_integrity_mode(PayloadBuilder::IntegrityMode mode);
+    // Custom messages go out packed when that is shorter (see
+    // PayloadBuilder::set_text_compression).
+    void set_text_compression(bool enabled);
+    // Messages and ACK aggregates go out with the v2 header (see
+    // PayloadBuilder::set_header_version).
+    void set_header_version(PayloadBuilder::HeaderVersion version);
+    // Caps the window below RELIABLE_WINDOW_SIZE; 1 is stop-and-wait.
+    void set_window(uint8_t size);
+
+    // Sending. Messages are encoded immediately; these return false if the
+    // peer's window is full, the peer table is full, or the message does
+    // not fit. Broadcasts cannot be sent reliably.
+    bool can_send(uint8_t destinationID) const;
+    bool send_p_msg(uint8_t destinationID, uint8_t msgID, uint32_t nowMs);
+    bool send_c_msg(uint8_t destinationID, const char* msg, size_t msgLength, uint32_t nowMs);
+
+    // Writes the next frame due for transmission into buffer and returns its
+    // length, or 0 if nothing is due. Call repeatedly until it returns 0.
+    // Covers first transmissions, timed-out retransmissions (a pending ACK
+    // for the same peer rides along in an aggregate frame) and standalone
+    // ACKs whose delay has expired.
+    size_t poll(uint32_t nowMs, uint8_t* buffer, size_t bufferSize);
+    // Milliseconds until poll() has work, capped at RELIABLE_MAX_RTO_MS.
+    uint32_t time_to_next_event(uint32_t nowMs) const;
+
+    // Piggybacking on other traffic: appends the pending ACK for
+    // destinationID (if any) to an aggregate frame addressed to it.
+    bool append_pending_ack(PayloadBuilder::AggregateWriter& writer, uint8_t destinationID);
+
+    // Receiving. Call on_data for every predefined/custom message (frame or
+    // aggregate record) and on_ack for every ACK frame or ACK record.
+    Acceptance on_data(uint8_t sourceID, uint8_t destinationID, uint16_t transmissionID, uint32_t nowMs);
+    void on_ack(uint8_t sourceID, uint8_t destinationID, const PayloadBuilder::AckData& ack, uint32_t nowMs);
+
+    const Stats& stats() const;
+    uint32_t rto_ms(uint8_t peerID) const;
+    uint8_t in_flight(uint8_t peerID) const;
+
+private:
+    struct Slot {
+        bool inUse;
+        uint16_t transmissionID;
+        uint8_t attempts;  // transmissions so far
+        uint32_t lastSentAt;
+        uint32_t dueAt;
+        uint8_t length;
+        uint8_t frame[MAX_PAYLOAD_SIZE];
+    };
+
+    struct Peer {
+        bool used;
+        uint8_t id;
+        uint32_t lastActive;
+
+        // Transmit side.
+        uint16_t nextTransmissionID;
+        uint8_t inFlight;
+        Slot slots[RELIABLE_WINDOW_SIZE];
+        bool rttValid;
+        int32_t srttMs;
+        int32_t rttVarMs;
+        uint32_t rtoMs;
+
+        // Receive side: highest ID seen and a history bitmap (bit i set if
+        // rxHighest - i was received).
+        bool rxValid;
+        uint16_t rxHighest;
+        uint32_t rxHistory;
+        bool ackPending;
+        uint32_t ackDueAt;
+    };
+
+    PayloadBuilder payloadBuilder;
+    uint8_t deviceID;
+    uint16_t initialTransmissionID;
+    uint16_t controlTransmissionID;
+    uint8_t windowSize;
+    Peer peers[RELIABLE_MAX_PEERS];
+    Stats counters;
+
+    Peer* findPeer(uint8_t id);
+    const Peer* findPeer(uint8_t id) const;
+    Peer* findOrAddPeer(uint8_t id, uint32_t nowMs);
+    int freePeerIndex() const;
+    Slot* claimSlot(Peer& peer);
+    bool windowOpen(const Peer& peer) const;
+    void releaseSlot(Peer& peer, Slot& slot);
+    PayloadBuilder::AckData pendingAck(const Peer& peer) const;
+    void sampleRtt(Peer& peer, uint32_t rttMs);
+    size_t transmitSlot(Peer& peer, Slot& slot, uint32_t nowMs, uint8_t* buffer, size_t bufferSize);
+};
+
+#endif // RELIABLE_LINK_H
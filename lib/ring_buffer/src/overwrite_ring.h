@@ -0,0 +1,87 @@
+#ifndef OVERWRITE_RING_H
+#define OVERWRITE_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Single-producer/single-consumer ring that never blocks or fails the
+// producer: when the consumer falls behind, the oldest records are
+// overwritten. Each slot carries a sequence number (odd while being
+// written, 2 * index + 2 once complete), which lets the consumer detect
+// records that were overwritten before or while it copied them and count
+// them as dropped. T must be trivially copyable.
+template <typename T, size_t Capacity>
+class OverwriteRing {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    OverwriteRing() {
+        for (size_t i = 0; i < Capacity; i++) slots[i].sequence.store(0, std::memory_order_relaxed);
+    }
+
+    // Producer: always succeeds.
+    void push(const T& item) {
+        uint32_t head = headIndex.load(std::memory_order_relaxed);
+        Slot& slot = slots[head & (Capacity - 1)];
+        slot.sequence.store(2 * head + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        std::memcpy(&slot.item, &item, sizeof(T));
+        slot.sequence.store(2 * head + 2, std::memory_order_release);
+        headIndex.store(head + 1, std::memory_order_release);
+    }
+
+    // Consumer: copies out the oldest record still intact. Returns false
+    // once the ring is empty.
+    bool pop(T& item) {
+        for (;;) {
+            uint32_t head = headIndex.load(std::memory_order_acquire);
+            if (tailIndex == head) return false;
+            if (head - tailIndex > peakCount) {
+                peakCount = head - tailIndex < Capacity ? head - tailIndex : Capacity;
+            }
+            if (head - tailIndex > Capacity) {
+                dropCount += head - tailIndex - Capacity;
+                tailIndex = head - Capacity;
+            }
+
+            Slot& slot = slots[tailIndex & (Capacity - 1)];
+            uint32_t expected = 2 * tailIndex + 2;
+            uint32_t before = slot.sequence.load(std::memory_order_acquire);
+            if (before == expected) {
+                std::memcpy(&item, &slot.item, sizeof(T));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.sequence.load(std::memory_order_relaxed) == expected) {
+                    tailIndex++;
+                    return true;
+                }
+            } else if ((int32_t)(before - expected) < 0) {
+                return false;  // producer has claimed the slot but not finished it
+            }
+            // Overwritten before or during the copy.
+            dropCount++;
+            tailIndex++;
+        }
+    }
+
+    // Records lost to overwriting, and the largest backlog, both as
+    // observed by the consumer.
+    uint32_t dropped() const { return dropCount; }
+    uint32_t peak() const { return peakCount; }
+    static size_t capacity() { return Capacity; }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> sequence;
+        T item;
+    };
+
+    Slot slots[Capacity];
+    std::atomic<uint32_t> headIndex{0};
+    uint32_t tailIndex = 0;  // consumer only
+    uint32_t dropCount = 0;  // consumer only
+    uint32_t peakCount = 0;  // consumer only
+};
+
+#endif // OVERWRITE_RING_H
@@ -0,0 +1,88 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Single-producer/single-consumer ring of fixed-size slots. The producer
+// may be an ISR: no call blocks, allocates or takes a lock. When the ring
+// is full the newest item is dropped and counted, since the producer must
+// never touch a slot the consumer may be reading.
+//
+// Slots are filled and drained in place (acquire/commit, peek/release) so
+// large records such as radio frames are copied exactly once.
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    // Producer: returns the next free slot, or nullptr (and counts a drop)
+    // if the ring is full. The slot becomes visible on commit().
+    T* acquire() {
+        uint32_t head = headIndex.load(std::memory_order_relaxed);
+        if (head - tailIndex.load(std::memory_order_acquire) >= Capacity) {
+            dropCount.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &slots[head & (Capacity - 1)];
+    }
+
+    void commit() {
+        uint32_t head = headIndex.load(std::memory_order_relaxed) + 1;
+        headIndex.store(head, std::memory_order_release);
+        uint32_t used = head - tailIndex.load(std::memory_order_relaxed);
+        if (used > peakCount.load(std::memory_order_relaxed)) {
+            peakCount.store(used, std::memory_order_relaxed);
+        }
+    }
+
+    bool push(const T& item) {
+        T* slot = acquire();
+        if (!slot) return false;
+        *slot = item;
+        commit();
+        return true;
+    }
+
+    // Consumer: returns the oldest item without removing it, or nullptr if
+    // the ring is empty. The slot stays valid until release().
+    const T* peek() const {
+        uint32_t tail = tailIndex.load(std::memory_order_relaxed);
+        if (tail == headIndex.load(std::memory_order_acquire)) return nullptr;
+        return &slots[tail & (Capacity - 1)];
+    }
+
+    void release() {
+        tailIndex.store(tailIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool pop(T& item) {
+        const T* slot = peek();
+        if (!slot) return false;
+        item = *slot;
+        release();
+        return true;
+    }
+
+    size_t size() const {
+        return headIndex.load(std::memory_order_acquire) - tailIndex.load(std::memory_order_acquire);
+    }
+
+    bool empty() const { return size() == 0; }
+    static size_t capacity() { return Capacity; }
+
+    // Items refused because the ring was full, and the highest occupancy
+    // seen, both since start-up.
+    uint32_t dropped() const { return dropCount.load(std::memory_order_relaxed); }
+    uint32_t peak() const { return peakCount.load(std::memory_order_relaxed); }
+
+private:
+    T slots[Capacity];
+    std::atomic<uint32_t> headIndex{0};
+    std::atomic<uint32_t> tailIndex{0};
+    std::atomic<uint32_t> dropCount{0};
+    std::atomic<uint32_t> peakCount{0};
+};
+
+#endif // SPSC_RING_H
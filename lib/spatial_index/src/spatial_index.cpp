@@ -0,0 +1,339 @@
+#include "spatial_index.h"
+#include <cmath>
+#include <cstring>
+
+#define METRES_PER_DEGREE 111319.5f
+#define CELL_OUTSIDE 0
+#define CELL_INSIDE 1
+#define CELL_BOUNDARY 2
+
+static const float RADIANS_PER_DEGREE = 0.0174532925f;
+
+// Keeps best[] sorted by distance, holding the nearest `limit` so far.
+// Searches rank by squared distance and take the root of the results only.
+static void insertNeighbor(SpatialIndex::Neighbor* best, size_t& found, size_t limit, uint8_t id, float distanceM) {
+    if (limit == 0 || (found == limit && distanceM >= best[found - 1].distanceM)) return;
+    size_t i = found < limit ? found++ : limit - 1;
+    while (i > 0 && best[i - 1].distanceM > distanceM) {
+        best[i] = best[i - 1];
+        i--;
+    }
+    best[i] = SpatialIndex::Neighbor{id, distanceM};
+}
+
+static size_t rootDistances(SpatialIndex::Neighbor* best, size_t found) {
+    for (size_t i = 0; i < found; i++) best[i].distanceM = std::sqrt(best[i].distanceM);
+    return found;
+}
+
+static bool pointInPolygon(const float* xs, const float* ys, size_t count, float x, float y) {
+    bool inside = false;
+    for (size_t i = 0, j = count - 1; i < count; j = i++) {
+        if ((ys[i] > y) != (ys[j] > y) && x < (xs[j] - xs[i]) * (y - ys[i]) / (ys[j] - ys[i]) + xs[i]) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+static float distanceToSegment(float px, float py, float ax, float ay, float bx, float by) {
+    float dx = bx - ax;
+    float dy = by - ay;
+    float lengthSquared = dx * dx + dy * dy;
+    float t = lengthSquared > 0 ? ((px - ax) * dx + (py - ay) * dy) / lengthSquared : 0;
+    if (t < 0) t = 0;
+    if (t > 1) t = 1;
+    float ex = px - (ax + t * dx);
+    float ey = py - (ay + t * dy);
+    return std::sqrt(ex * ex + ey * ey);
+}
+
+SpatialIndex::SpatialIndex(float cellM)
+    : cellM(cellM), hasOrigin(false), originLatitude(0), originLongitude(0),
+      metresPerDegreeLongitude(METRES_PER_DEGREE), count(0) {
+    for (size_t i = 0; i < SPATIAL_BUCKETS; i++) buckets[i] = -1;
+    std::memset(nodes, 0, sizeof(nodes));
+    std::memset(fences, 0, sizeof(fences));
+}
+
+void SpatialIndex::project(float latitude, float longitude, float& x, float& y) {
+    if (!hasOrigin) {
+        hasOrigin = true;
+        originLatitude = latitude;
+        originLongitude = longitude;
+        metresPerDegreeLongitude = METRES_PER_DEGREE * std::cos(latitude * RADIANS_PER_DEGREE);
+    }
+    projectConst(latitude, longitude, x, y);
+}
+
+void SpatialIndex::projectConst(float latitude, float longitude, float& x, float& y) const {
+    x = (longitude - originLongitude) * metresPerDegreeLongitude;
+    y = (latitude - originLatitude) * METRES_PER_DEGREE;
+}
+
+int32_t SpatialIndex::cellOf(float metres) const {
+    return (int32_t)std::floor(metres / cellM);
+}
+
+size_t SpatialIndex::bucketOf(int32_t cellX, int32_t cellY) {
+    return ((uint32_t)cellX * 73856093u ^ (uint32_t)cellY * 19349663u) & (SPATIAL_BUCKETS - 1);
+}
+
+void SpatialIndex::link(uint8_t id) {
+    NodeEntry& node = nodes[id];
+    size_t bucket = bucketOf(node.cellX, node.cellY);
+    node.prev = -1;
+    node.next = buckets[bucket];
+    if (node.next >= 0) nodes[node.next].prev = id;
+    buckets[bucket] = id;
+}
+
+void SpatialIndex::unlink(uint8_t id) {
+    NodeEntry& node = nodes[id];
+    if (node.prev >= 0) {
+        nodes[node.prev].next = node.next;
+    } else {
+        buckets[bucketOf(node.cellX, node.cellY)] = node.next;
+    }
+    if (node.next >= 0) nodes[node.next].prev = node.prev;
+}
+
+size_t SpatialIndex::update(uint8_t id, float latitude, float longitude, FenceEvent* events, size_t maxEvents) {
+    NodeEntry& node = nodes[id];
+    float x, y;
+    project(latitude, longitude, x, y);
+    int32_t cellX = cellOf(x);
+    int32_t cellY = cellOf(y);
+    if (!node.present) {
+        node.present = true;
+        node.fences = 0;
+        node.cellX = cellX;
+        node.cellY = cellY;
+        link(id);
+        count++;
+    } else if (cellX != node.cellX || cellY != node.cellY) {
+        unlink(id);
+        node.cellX = cellX;
+        node.cellY = cellY;
+        link(id);
+    }
+    node.latitude = latitude;
+    node.longitude = longitude;
+    node.x = x;
+    node.y = y;
+
+    size_t eventCount = 0;
+    for (size_t f = 0; f < SPATIAL_MAX_FENCES; f++) {
+        Fence& fence = fences[f];
+        if (!fence.used) continue;
+        bool isInside = fenceContains(fence, x, y, cellX, cellY);
+        bool wasInside = (node.fences >> f) & 1;
+        if (isInside == wasInside) continue;
+        node.fences ^= (uint8_t)(1u << f);
+        fence.members += isInside ? 1 : -1;
+        if (eventCount < maxEvents) {
+            events[eventCount++] = FenceEvent{(uint8_t)f, fence.kind, id, isInside};
+        }
+    }
+    return eventCount;
+}
+
+void SpatialIndex::remove(uint8_t id) {
+    NodeEntry& node = nodes[id];
+    if (!node.present) return;
+    unlink(id);
+    for (size_t f = 0; f < SPATIAL_MAX_FENCES; f++) {
+        if ((node.fences >> f) & 1) fences[f].members--;
+    }
+    node.present = false;
+    node.fences = 0;
+    count--;
+}
+
+bool SpatialIndex::contains(uint8_t id) const {
+    return nodes[id].present;
+}
+
+size_t SpatialIndex::size() const {
+    return count;
+}
+
+// Offers every node in the cell (not just in its bucket) to best[].
+void SpatialIndex::scanCell(int32_t cellX, int32_t cellY, float x, float y, float maxSquaredM, Neighbor* best,
+                            size_t& found, size_t limit) const {
+    for (int16_t id = buckets[bucketOf(cellX, cellY)]; id >= 0; id = nodes[id].next) {
+        const NodeEntry& node = nodes[id];
+        if (node.cellX != cellX || node.cellY != cellY) continue;
+        float squaredM = (node.x - x) * (node.x - x) + (node.y - y) * (node.y - y);
+        if (squaredM <= maxSquaredM) insertNeighbor(best, found, limit, (uint8_t)id, squaredM);
+    }
+}
+
+size_t SpatialIndex::nearest(float latitude, float longitude, size_t k, Neighbor* out) const {
+    if (!hasOrigin || count == 0 || k == 0) return 0;
+    float x, y;
+    projectConst(latitude, longitude, x, y);
+    int32_t centreX = cellOf(x);
+    int32_t centreY = cellOf(y);
+    size_t found = 0;
+    // Once the rings cover more cells than there are nodes, visiting every
+    // node once is cheaper.
+    for (int32_t ring = 0; (size_t)(2 * ring + 1) * (2 * ring + 1) <= count; ring++) {
+        for (int32_t dy = -ring; dy <= ring; dy++) {
+            // Whole rows at the top and bottom, the two ends in between.
+            int32_t step = (dy == -ring || dy == ring) ? 1 : 2 * ring;
+            for (int32_t dx = -ring; dx <= ring; dx += step > 0 ? step : 1) {
+                scanCell(centreX + dx, centreY + dy, x, y, INFINITY, out, found, k);
+            }
+        }
+        // Anything not yet seen lies beyond the edge of the searched square.
+        float edgeM = std::fmin(std::fmin(x - (centreX - ring) * cellM, (centreX + ring + 1) * cellM - x),
+                                std::fmin(y - (centreY - ring) * cellM, (centreY + ring + 1) * cellM - y));
+        if (found == count || (found == k && out[k - 1].distanceM <= edgeM * edgeM)) return rootDistances(out, found);
+    }
+    found = 0;
+    for (size_t id = 0; id < SPATIAL_MAX_NODES; id++) {
+        const NodeEntry& node = nodes[id];
+        if (!node.present) continue;
+        insertNeighbor(out, found, k, (uint8_t)id, (node.x - x) * (node.x - x) + (node.y - y) * (node.y - y));
+    }
+    return rootDistances(out, found);
+}
+
+size_t SpatialIndex::within(float latitude, float longitude, float radiusM, Neighbor* out, size_t maxOut) const {
+    if (!hasOrigin || count == 0 || radiusM < 0) return 0;
+    float x, y;
+    projectConst(latitude, longitude, x, y);
+    int32_t minX = cellOf(x - radiusM);
+    int32_t maxX = cellOf(x + radiusM);
+    int32_t minY = cellOf(y - radiusM);
+    int32_t maxY = cellOf(y + radiusM);
+    size_t found = 0;
+    if ((int64_t)(maxX - minX + 1) * (maxY - minY + 1) > (int64_t)count) {
+        // More cells than nodes: visiting every node once is cheaper.
+        for (size_t id = 0; id < SPATIAL_MAX_NODES; id++) {
+            const NodeEntry& node = nodes[id];
+            if (!node.present) continue;
+            float squaredM = (node.x - x) * (node.x - x) + (node.y - y) * (node.y - y);
+            if (squaredM <= radiusM * radiusM) insertNeighbor(out, found, maxOut, (uint8_t)id, squaredM);
+        }
+        return rootDistances(out, found);
+    }
+    for (int32_t cellY = minY; cellY <= maxY; cellY++) {
+        for (int32_t cellX = minX; cellX <= maxX; cellX++) {
+            scanCell(cellX, cellY, x, y, radiusM * radiusM, out, found, maxOut);
+        }
+    }
+    return rootDistances(out, found);
+}
+
+int SpatialIndex::add_fence(FenceKind kind, const float* latitudes, const float* longitudes, size_t vertexCount) {
+    if (vertexCount < 3 || vertexCount > SPATIAL_MAX_VERTICES) return -1;
+    int index = -1;
+    for (size_t f = 0; f < SPATIAL_MAX_FENCES; f++) {
+        if (!fences[f].used) {
+            index = (int)f;
+            break;
+        }
+    }
+    if (index < 0) return -1;
+
+    Fence& fence = fences[index];
+    std::memset(&fence, 0, sizeof(fence));
+    fence.used = true;
+    fence.kind = kind;
+    fence.vertexCount = (uint8_t)vertexCount;
+    for (size_t i = 0; i < vertexCount; i++) {
+        project(latitudes[i], longitudes[i], fence.x[i], fence.y[i]);
+        if (i == 0 || fence.x[i] < fence.minX) fence.minX = fence.x[i];
+        if (i == 0 || fence.x[i] > fence.maxX) fence.maxX = fence.x[i];
+        if (i == 0 || fence.y[i] < fence.minY) fence.minY = fence.y[i];
+        if (i == 0 || fence.y[i] > fence.maxY) fence.maxY = fence.y[i];
+    }
+    classify(fence);
+
+    // Members from now on; an operator adding a fence sees the count.
+    for (size_t id = 0; id < SPATIAL_MAX_NODES; id++) {
+        NodeEntry& node = nodes[id];
+        if (node.present && fenceContains(fence, node.x, node.y, node.cellX, node.cellY)) {
+            node.fences |= (uint8_t)(1u << index);
+            fence.members++;
+        }
+    }
+    return index;
+}
+
+bool SpatialIndex::remove_fence(int fence) {
+    if (!fence_used(fence)) return false;
+    fences[fence].used = false;
+    for (size_t id = 0; id < SPATIAL_MAX_NODES; id++) {
+        nodes[id].fences &= (uint8_t)~(1u << fence);
+    }
+    return true;
+}
+
+bool SpatialIndex::fence_used(int fence) const {
+    return fence >= 0 && fence < SPATIAL_MAX_FENCES && fences[fence].used;
+}
+
+SpatialIndex::FenceKind SpatialIndex::fence_kind(int fence) const {
+    return fences[fence].kind;
+}
+
+size_t SpatialIndex::fence_vertices(int fence) const {
+    return fence_used(fence) ? fences[fence].vertexCount : 0;
+}
+
+size_t SpatialIndex::fence_members(int fence) const {
+    return fence_used(fence) ? fences[fence].members : 0;
+}
+
+bool SpatialIndex::inside(uint8_t id, int fence) const {
+    return fence_used(fence) && ((nodes[id].fences >> fence) & 1);
+}
+
+// Cells no closer to an edge than half their diagonal are wholly inside or
+// outside; the rest are marked boundary (a few too many, never too few).
+void SpatialIndex::classify(Fence& fence) {
+    int32_t cellX0 = cellOf(fence.minX);
+    int32_t cellY0 = cellOf(fence.minY);
+    int64_t wide = (int64_t)cellOf(fence.maxX) - cellX0 + 1;
+    int64_t high = (int64_t)cellOf(fence.maxY) - cellY0 + 1;
+    fence.classified = wide * high <= SPATIAL_FENCE_MAX_CELLS;
+    if (!fence.classified) return;
+    fence.cellX0 = cellX0;
+    fence.cellY0 = cellY0;
+    fence.cellsWide = (uint16_t)wide;
+    fence.cellsHigh = (uint16_t)high;
+
+    float halfDiagonal = cellM * 0.7072f;
+    for (int32_t row = 0; row < high; row++) {
+        for (int32_t column = 0; column < wide; column++) {
+            float centreX = (cellX0 + column + 0.5f) * cellM;
+            float centreY = (cellY0 + row + 0.5f) * cellM;
+            uint8_t cellClass = pointInPolygon(fence.x, fence.y, fence.vertexCount, centreX, centreY) ? CELL_INSIDE : CELL_OUTSIDE;
+            for (size_t i = 0, j = fence.vertexCount - 1; i < fence.vertexCount; j = i++) {
+                if (distanceToSegment(centreX, centreY, fence.x[j], fence.y[j], fence.x[i], fence.y[i]) <= halfDiagonal) {
+                    cellClass = CELL_BOUNDARY;
+                    break;
+                }
+            }
+            size_t index = (size_t)(row * wide + column);
+            fence.cells[index / 4] |= (uint8_t)(cellClass << (index % 4 * 2));
+        }
+    }
+}
+
+bool SpatialIndex::fenceContains(const Fence& fence, float x, float y, int32_t cellX, int32_t cellY) const {
+    if (x < fence.minX || x > fence.maxX || y < fence.minY || y > fence.maxY) return false;
+    if (fence.classified) {
+        int32_t column = cellX - fence.cellX0;
+        int32_t row = cellY - fence.cellY0;
+        if (column >= 0 && row >= 0 && column < fence.cellsWide && row < fence.cellsHigh) {
+            size_t index = (size_t)row * fence.cellsWide + column;
+            uint8_t cellClass = (fence.cells[index / 4] >> (index % 4 * 2)) & 3;
+            if (cellClass != CELL_BOUNDARY) return cellClass == CELL_INSIDE;
+        }
+    }
+    return pointInPolygon(fence.x, fence.y, fence.vertexCount, x, y);
+}
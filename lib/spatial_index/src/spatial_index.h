@@ -0,0 +1,132 @@
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Grid cell edge. A 500 m radius query covers 5 x 5 cells; a walking user
+// changes cell every few minutes at most.
+#define SPATIAL_CELL_M 250
+
+// Cells are hashed into this many buckets (a power of two), each a list of
+// the nodes in the cells that hash there, so the grid needs no bounds and
+// no memory per empty cell. One per node keeps the lists about one long.
+#define SPATIAL_BUCKETS 256
+
+// Node IDs are 8 bits, as in every frame header.
+#define SPATIAL_MAX_NODES 256
+
+// Geofences: polygons of up to SPATIAL_MAX_VERTICES corners. Each one
+// classifies the cells of its bounding box once, when it is added, as
+// inside, outside or on the boundary (2 bits per cell, up to
+// SPATIAL_FENCE_MAX_CELLS cells); only positions in boundary cells need
+// the exact polygon test. A larger fence falls back to the exact test.
+#define SPATIAL_MAX_FENCES 8
+#define SPATIAL_MAX_VERTICES 12
+#define SPATIAL_FENCE_MAX_CELLS 1024
+
+// Latest position of each node on a flat grid around the first position
+// (or fence corner) it is given. Distances are planar, which is well under
+// a percent off across the few tens of kilometres a LoRa network covers.
+// An update costs O(1): relinking when the node changes cell, and one
+// constant-time containment check per fence. Not locked: the firmware
+// guards it.
+class SpatialIndex {
+public:
+    enum FenceKind {
+        FENCE_KEEP_IN,      // safe zone: leaving it is the alert
+        FENCE_KEEP_OUT      // hazard: entering it is the alert
+    };
+
+    struct Neighbor {
+        uint8_t id;
+        float distanceM;
+    };
+
+    // A node crossed a fence's boundary.
+    struct FenceEvent {
+        uint8_t fence;
+        FenceKind kind;
+        uint8_t id;
+        bool entered;
+    };
+
+    explicit SpatialIndex(float cellM = SPATIAL_CELL_M);
+
+    // Moves id to the position and writes the fence crossings this causes
+    // to events (at most SPATIAL_MAX_FENCES); returns how many.
+    size_t update(uint8_t id, float latitude, float longitude, FenceEvent* events, size_t maxEvents);
+    void remove(uint8_t id);
+    bool contains(uint8_t id) const;
+    size_t size() const;
+
+    // The k nodes nearest to the point, nearest first. Searches outwards
+    // ring by ring of cells and stops once no closer node can remain.
+    size_t nearest(float latitude, float longitude, size_t k, Neighbor* out) const;
+    // Nodes within radiusM of the point, nearest first, at most maxOut.
+    size_t within(float latitude, float longitude, float radiusM, Neighbor* out, size_t maxOut) const;
+
+    // Returns the fence's index, or -1 if the table is full, the polygon
+    // has fewer than 3 or more than SPATIAL_MAX_VERTICES corners. Nodes
+    // already inside count as members without an event.
+    int add_fence(FenceKind kind, const float* latitudes, const float* longitudes, size_t vertexCount);
+    bool remove_fence(int fence);
+    bool fence_used(int fence) const;
+    FenceKind fence_kind(int fence) const;
+    size_t fence_vertices(int fence) const;
+    size_t fence_members(int fence) const;
+    bool inside(uint8_t id, int fence) const;
+
+private:
+    struct NodeEntry {
+        float latitude;
+        float longitude;
+        float x;
+        float y;
+        int32_t cellX;
+        int32_t cellY;
+        int16_t next;           // in the bucket's list, -1 at the end
+        int16_t prev;
+        uint8_t fences;         // bit n: inside fence n
+        bool present;
+    };
+
+    struct Fence {
+        bool used;
+        FenceKind kind;
+        uint8_t vertexCount;
+        float x[SPATIAL_MAX_VERTICES];
+        float y[SPATIAL_MAX_VERTICES];
+        float minX, minY, maxX, maxY;
+        bool classified;        // cells[] holds the bounding box's cells
+        int32_t cellX0;
+        int32_t cellY0;
+        uint16_t cellsWide;
+        uint16_t cellsHigh;
+        uint8_t cells[SPATIAL_FENCE_MAX_CELLS / 4];
+        uint16_t members;
+    };
+
+    float cellM;
+    bool hasOrigin;
+    float originLatitude;
+    float originLongitude;
+    float metresPerDegreeLongitude;
+    int16_t buckets[SPATIAL_BUCKETS];
+    NodeEntry nodes[SPATIAL_MAX_NODES];
+    size_t count;
+    Fence fences[SPATIAL_MAX_FENCES];
+
+    void project(float latitude, float longitude, float& x, float& y);
+    void projectConst(float latitude, float longitude, float& x, float& y) const;
+    int32_t cellOf(float metres) const;
+    static size_t bucketOf(int32_t cellX, int32_t cellY);
+    void link(uint8_t id);
+    void unlink(uint8_t id);
+    void scanCell(int32_t cellX, int32_t cellY, float x, float y, float maxSquaredM, Neighbor* best, size_t& found,
+                  size_t limit) const;
+    bool fenceContains(const Fence& fence, float x, float y, int32_t cellX, int32_t cellY) const;
+    void classify(Fence& fence);
+};
+
+#endif // SPATIAL_INDEX_H
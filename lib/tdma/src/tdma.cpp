@@ -0,0 +1,326 @@
+#include "tdma.h"
+#include "ms_time.h"
+#include <cstring>
+
+uint16_t tdma_slot_ms(const LoRaModemConfig& config, size_t frameLength) {
+    uint32_t slot = (lora_time_on_air_us(config, frameLength) + 999) / 1000 + 2 * TDMA_GUARD_MS;
+    return slot < UINT16_MAX ? (uint16_t)slot : UINT16_MAX;
+}
+
+// ----- TdmaCoordinator -----
+
+TdmaCoordinator::TdmaCoordinator(uint8_t deviceID, uint8_t downlinkSlots, uint8_t contentionSlots)
+    : modem(lora_default_config()),
+      deviceID(deviceID),
+      minDownlinkSlots(downlinkSlots > 0 ? downlinkSlots : 1),
+      minContentionSlots(contentionSlots),
+      requestsHeard(0),
+      started(false),
+      sequence(0),
+      superframeStart(0),
+      slotMs(0),
+      downlinkSlots(0),
+      contentionSlots(contentionSlots),
+      dataSlots(0),
+      pendingCount(0) {
+    payloadBuilder.configure_device(deviceID, PAYLOAD_BROADCAST_ID);
+    nextSlotMs = tdma_slot_ms(modem, TDMA_DEFAULT_SLOT_FRAME_SIZE);
+    std::memset(slotMap, 0, sizeof(slotMap));
+    std::memset(owner, 0, sizeof(owner));
+    std::memset(lastHeard, 0, sizeof(lastHeard));
+}
+
+void TdmaCoordinator::set_integrity_mode(PayloadBuilder::IntegrityMode mode) {
+    payloadBuilder.set_integrity_mode(mode);
+}
+
+void TdmaCoordinator::set_modem_config(const LoRaModemConfig& config, size_t slotFrameLength) {
+    modem = config;
+    nextSlotMs = tdma_slot_ms(config, slotFrameLength);
+}
+
+bool TdmaCoordinator::slotUsed(uint8_t slot) const {
+    return (slotMap[slot / 8] >> (slot % 8)) & 1;
+}
+
+void TdmaCoordinator::setSlotUsed(uint8_t slot, bool used) {
+    if (used) {
+        slotMap[slot / 8] |= 1 << (slot % 8);
+    } else {
+        slotMap[slot / 8] &= ~(1 << (slot % 8));
+    }
+}
+
+uint8_t TdmaCoordinator::slot_of(uint8_t userID) const {
+    for (uint8_t slot = 0; slot < BEACON_MAX_DATA_SLOTS; slot++) {
+        if (slotUsed(slot) && owner[slot] == userID) return slot;
+    }
+    return TDMA_NO_SLOT;
+}
+
+void TdmaCoordinator::on_frame(uint8_t sourceID, uint32_t nowMs) {
+    uint8_t slot = slot_of(sourceID);
+    if (slot != TDMA_NO_SLOT) lastHeard[slot] = nowMs;
+}
+
+void TdmaCoordinator::on_slot(uint8_t sourceID, uint8_t destinationID, const PayloadBuilder::SlotData& request, uint32_t nowMs) {
+    if (destinationID != deviceID) return;
+
+    uint8_t slot = slot_of(sourceID);
+    if (request.command == SLOT_RELEASE) {
+        if (slot != TDMA_NO_SLOT) setSlotUsed(slot, false);
+        return;
+    }
+    if (request.command != SLOT_REQUEST) return;
+    if (requestsHeard < UINT8_MAX) requestsHeard++;
+
+    // A repeated request means the assignment was lost: send it again.
+    if (slot == TDMA_NO_SLOT) {
+        for (uint8_t free = 0; free < BEACON_MAX_DATA_SLOTS; free++) {
+            if (!slotUsed(free)) {
+                slot = free;
+                break;
+            }
+        }
+        if (slot != TDMA_NO_SLOT) {
+            setSlotUsed(slot, true);
+            owner[slot] = sourceID;
+            lastHeard[slot] = nowMs;
+        }
+    }
+    for (size_t i = 0; i < pendingCount; i++) {
+        if (pending[i] == sourceID) return;
+    }
+    if (pendingCount < TDMA_PENDING_ASSIGNMENTS) pending[pendingCount++] = sourceID;
+}
+
+// Worst case, with a CRC trailer.
+uint32_t TdmaCoordinator::assignmentAirtimeUs() const {
+    return lora_time_on_air_us(modem, SLOT_FRAME_SIZE + PAYLOAD_CRC_SIZE);
+}
+
+// Reclaims idle slots and lays out the superframe the next beacon opens.
+void TdmaCoordinator::startSuperframe(uint32_t nowMs) {
+    sequence++;
+    dataSlots = 0;
+    for (uint16_t slot = 0; slot < BEACON_MAX_DATA_SLOTS; slot++) {
+        if (!slotUsed(slot)) continue;
+        if (ms_reached(nowMs, lastHeard[slot] + TDMA_SLOT_IDLE_MS)) {
+            setSlotUsed(slot, false);
+            continue;
+        }
+        dataSlots = slot + 1;
+    }
+    uint32_t contention = requestsHeard > 0 ? contentionSlots + (uint32_t)requestsHeard * TDMA_CONTENTION_PER_REQUEST
+                                            : contentionSlots / 2;
+    if (contention > TDMA_MAX_CONTENTION_SLOTS) contention = TDMA_MAX_CONTENTION_SLOTS;
+    contentionSlots = contention > minContentionSlots ? (uint8_t)contention : minContentionSlots;
+    requestsHeard = 0;
+    slotMs = nextSlotMs;
+    superframeStart = nowMs;
+    started = true;
+}
+
+size_t TdmaCoordinator::poll(uint32_t nowMs, uint8_t* buffer, size_t bufferSize) {
+    if (!started || ms_reached(nowMs, superframeStart + superframe_ms())) {
+        startSuperframe(nowMs);
+
+        // Encoded once for its length: the downlink slots must at least
+        // hold the beacon and the assignments waiting to go out.
+        PayloadBuilder::BeaconData beacon = {sequence, slotMs, minDownlinkSlots, contentionSlots, dataSlots, slotMap};
+        size_t length = payloadBuilder.encode_beacon_payload(buffer, bufferSize, beacon);
+        if (length == 0) return 0;
+        uint32_t downlinkMs = tdma_slot_ms(modem, length) + pendingCount * ((assignmentAirtimeUs() + 999) / 1000);
+        uint32_t needed = (downlinkMs + slotMs - 1) / slotMs;
+        downlinkSlots = needed > minDownlinkSlots ? (uint8_t)needed : minDownlinkSlots;
+        beacon.downlinkSlots = downlinkSlots;
+        return payloadBuilder.encode_beacon_payload(buffer, bufferSize, beacon);
+    }
+
+    if (pendingCount == 0 || downlink_remaining_us(nowMs) < assignmentAirtimeUs()) return 0;
+    PayloadBuilder::SlotData assignment = {SLOT_ASSIGN, slot_of(pending[0])};
+    size_t length = payloadBuilder.encode_slot_payload(buffer, bufferSize, pending[0], assignment);
+    if (length == 0) return 0;
+    pendingCount--;
+    std::memmove(pending, pending + 1, pendingCount);
+    return length;
+}
+
+uint32_t TdmaCoordinator::time_to_next_event(uint32_t nowMs) const {
+    if (!started) return 0;
+    uint32_t wait = ms_remaining(nowMs, superframeStart + superframe_ms());
+    if (pendingCount > 0 && downlink_remaining_us(nowMs) >= assignmentAirtimeUs()) return 0;
+    return wait;
+}
+
+uint32_t TdmaCoordinator::downlink_remaining_us(uint32_t nowMs) const {
+    if (!started || !ms_reached(nowMs, superframeStart)) return 0;
+    return ms_remaining(nowMs, superframeStart + downlinkSlots * slotMs - TDMA_GUARD_MS) * 1000;
+}
+
+uint8_t TdmaCoordinator::assigned() const {
+    uint8_t count = 0;
+    for (uint8_t slot = 0; slot < BEACON_MAX_DATA_SLOTS; slot++) {
+        if (slotUsed(slot)) count++;
+    }
+    return count;
+}
+
+uint16_t TdmaCoordinator::slot_ms() const {
+    return slotMs;
+}
+
+uint32_t TdmaCoordinator::superframe_ms() const {
+    return (uint32_t)(downlinkSlots + contentionSlots + dataSlots) * slotMs;
+}
+
+// ----- TdmaMember -----
+
+TdmaMember::TdmaMember(uint8_t deviceID, uint32_t seed)
+    : deviceID(deviceID),
+      random(seed != 0 ? seed : 1),
+      synced(false),
+      baseID(PAYLOAD_BROADCAST_ID),
+      sequence(0),
+      superframeStart(0),
+      slotMs(0),
+      downlinkSlots(0),
+      contentionSlots(0),
+      dataSlots(0),
+      current(UNSYNCED),
+      assignedSlot(TDMA_NO_SLOT),
+      attempts(0),
+      backoff(0),
+      requestChosen(false),
+      requestAt(0),
+      requestSequence(0) {
+    payloadBuilder.configure_device(deviceID, PAYLOAD_BROADCAST_ID);
+}
+
+void TdmaMember::set_integrity_mode(PayloadBuilder::IntegrityMode mode) {
+    payloadBuilder.set_integrity_mode(mode);
+}
+
+// xorshift32: cheap, and plenty for picking contention slots.
+uint32_t TdmaMember::nextRandom() {
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    return random;
+}
+
+uint32_t TdmaMember::superframeMs() const {
+    return (uint32_t)(downlinkSlots + contentionSlots + dataSlots) * slotMs;
+}
+
+bool TdmaMember::syncLost(uint32_t nowMs) const {
+    return !synced || ms_reached(nowMs, superframeStart + TDMA_SYNC_LOSS_SUPERFRAMES * superframeMs());
+}
+
+uint32_t TdmaMember::slotOpensAt() const {
+    return superframeStart + (uint32_t)(downlinkSlots + contentionSlots + assignedSlot) * slotMs + TDMA_GUARD_MS;
+}
+
+void TdmaMember::on_beacon(uint8_t sourceID, const PayloadBuilder::BeaconData& beacon, uint32_t startedAtMs) {
+    if (beacon.slotMs == 0 || (beacon.dataSlots > 0 && beacon.slotMap == nullptr)) return;
+    if (syncLost(startedAtMs)) {
+        current = IDLE;
+        assignedSlot = TDMA_NO_SLOT;
+        attempts = 0;
+        backoff = 0;
+    }
+    synced = true;
+    baseID = sourceID;
+    sequence = beacon.sequence;
+    superframeStart = startedAtMs;
+    slotMs = beacon.slotMs;
+    downlinkSlots = beacon.downlinkSlots;
+    contentionSlots = beacon.contentionSlots;
+    dataSlots = beacon.dataSlots;
+    requestChosen = false;
+
+    if (current == ASSIGNED) {
+        bool kept = assignedSlot < dataSlots && ((beacon.slotMap[assignedSlot / 8] >> (assignedSlot % 8)) & 1);
+        if (!kept) {
+            current = IDLE;
+            assignedSlot = TDMA_NO_SLOT;
+            attempts = 0;
+        }
+    } else if (current == JOINING && (uint16_t)(sequence - requestSequence) >= 2) {
+        // The request collided, or its assignment was lost.
+        if (attempts < TDMA_MAX_BACKOFF_EXPONENT) attempts++;
+        backoff = nextRandom() % (1u << attempts);
+        current = IDLE;
+    } else if (current == IDLE && backoff > 0) {
+        backoff--;
+    }
+}
+
+void TdmaMember::on_slot(uint8_t sourceID, uint8_t destinationID, const PayloadBuilder::SlotData& slot) {
+    if (destinationID != deviceID || sourceID != baseID || slot.command != SLOT_ASSIGN) return;
+    if (slot.slot == TDMA_NO_SLOT) {
+        // Cell full: wait as long as the backoff allows before asking again.
+        attempts = TDMA_MAX_BACKOFF_EXPONENT;
+        backoff = nextRandom() % (1u << attempts);
+        current = IDLE;
+        return;
+    }
+    current = ASSIGNED;
+    assignedSlot = slot.slot;
+    attempts = 0;
+    backoff = 0;
+}
+
+size_t TdmaMember::poll(uint32_t nowMs, bool haveTraffic, uint8_t* buffer, size_t bufferSize) {
+    if (syncLost(nowMs) || current != IDLE || !haveTraffic || backoff > 0 || contentionSlots == 0) return 0;
+
+    if (!requestChosen) {
+        uint8_t contention = nextRandom() % contentionSlots;
+        requestAt = superframeStart + (uint32_t)(downlinkSlots + contention) * slotMs + TDMA_GUARD_MS;
+        requestChosen = true;
+    }
+    // Too early, or the chosen slot has already gone by in this superframe.
+    if (!ms_reached(nowMs, requestAt) || ms_reached(nowMs, requestAt + slotMs - 2 * TDMA_GUARD_MS)) return 0;
+
+    PayloadBuilder::SlotData request = {SLOT_REQUEST, TDMA_NO_SLOT};
+    size_t length = payloadBuilder.encode_slot_payload(buffer, bufferSize, baseID, request);
+    if (length > 0) {
+        current = JOINING;
+        requestSequence = sequence;
+    }
+    return length;
+}
+
+bool TdmaMember::may_transmit(uint32_t nowMs, uint32_t airtimeUs) const {
+    if (syncLost(nowMs)) return true;
+    if (current != ASSIGNED || assignedSlot >= dataSlots) return false;
+
+    uint32_t opensAt = slotOpensAt();
+    uint32_t closesAt = opensAt + slotMs - 2 * TDMA_GUARD_MS;
+    uint32_t endsAt = nowMs + (airtimeUs + 999) / 1000;
+    return ms_reached(nowMs, opensAt) && ms_reached(closesAt, endsAt);
+}
+
+uint32_t TdmaMember::time_to_next_event(uint32_t nowMs, bool haveTraffic) const {
+    if (syncLost(nowMs)) return UINT32_MAX;
+    uint32_t nextBeacon = ms_remaining(nowMs, superframeStart + superframeMs());
+
+    if (current == ASSIGNED && assignedSlot < dataSlots) {
+        uint32_t wait = ms_remaining(nowMs, slotOpensAt());
+        if (wait > 0) return wait;
+        return haveTraffic && may_transmit(nowMs, 0) ? 0 : nextBeacon;
+    }
+    if (current == IDLE && haveTraffic && backoff == 0 && requestChosen) {
+        uint32_t wait = ms_remaining(nowMs, requestAt);
+        if (wait > 0) return wait;
+    }
+    return nextBeacon;
+}
+
+TdmaMember::State TdmaMember::state(uint32_t nowMs) const {
+    return syncLost(nowMs) ? UNSYNCED : current;
+}
+
+uint8_t TdmaMember::slot() const {
+    return assignedSlot;
+}
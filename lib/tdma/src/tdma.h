@@ -0,0 +1,178 @@
+#ifndef TDMA_H
+#define TDMA_H
+
+#include <cstdint>
+#include <cstddef>
+#include "payload_builder.h"
+#include "lora_airtime.h"
+
+// Superframe layout (the beacon in payload_builder.h describes it): the
+// base's downlink slots, the contention slots where users without a slot
+// ask for one, then one data slot per assigned user. Every slot fits one
+// frame of the slot frame length plus TDMA_GUARD_MS on each side, which
+// covers the jitter of timestamping the beacon and the clock drift over a
+// superframe.
+#define TDMA_GUARD_MS 20
+#define TDMA_DEFAULT_DOWNLINK_SLOTS 2
+#define TDMA_DEFAULT_CONTENTION_SLOTS 4
+#define TDMA_DEFAULT_SLOT_FRAME_SIZE MAX_FRAME_SIZE
+
+// The base cannot see collisions, only the requests that got through, so
+// every request heard adds TDMA_CONTENTION_PER_REQUEST contention slots to
+// the next superframe, up to TDMA_MAX_CONTENTION_SLOTS, and a superframe
+// in which none got through halves them. When many users join at once the
+// contention area grows until they spread out, and it shrinks back to the
+// minimum once they are in.
+#define TDMA_CONTENTION_PER_REQUEST 3
+#define TDMA_MAX_CONTENTION_SLOTS 64
+
+// A data slot whose owner has not been heard for TDMA_SLOT_IDLE_MS is
+// reclaimed. The owner sees its bit cleared in the next beacon and joins
+// again once it has something to send. Counted in time, not superframes:
+// a small cell cycles in seconds, and a user that reports every few minutes
+// must keep its slot.
+#define TDMA_SLOT_IDLE_MS 600000
+
+// A member that misses TDMA_SYNC_LOSS_SUPERFRAMES beacons in a row gives up
+// its slot and transmits freely, as without TDMA, until it hears a beacon
+// again. That also keeps users working with a base that does not run TDMA.
+#define TDMA_SYNC_LOSS_SUPERFRAMES 4
+
+// A slot request that is not answered by the second beacon after it is
+// retried after a random backoff below 2^attempts superframes, the
+// exponent capped at TDMA_MAX_BACKOFF_EXPONENT.
+#define TDMA_MAX_BACKOFF_EXPONENT 5
+
+// Slot assignments waiting for the downlink slots.
+#define TDMA_PENDING_ASSIGNMENTS 16
+
+// Slot length, in ms, for frames of up to frameLength bytes at config.
+uint16_t tdma_slot_ms(const LoRaModemConfig& config, size_t frameLength);
+
+// Base station side: hands out data slots and opens every superframe with a
+// beacon carrying the slot map. The superframe only has as many data slots
+// as the highest one assigned, so a small cell keeps a short cycle, and as
+// many downlink slots as the beacon and the waiting assignments need.
+class TdmaCoordinator {
+public:
+    explicit TdmaCoordinator(uint8_t deviceID,
+                             uint8_t downlinkSlots = TDMA_DEFAULT_DOWNLINK_SLOTS,
+                             uint8_t contentionSlots = TDMA_DEFAULT_CONTENTION_SLOTS);
+
+    void set_integrity_mode(PayloadBuilder::IntegrityMode mode);
+    // Settings the network runs at and the longest frame a data slot has
+    // to carry. Takes effect with the next beacon.
+    void set_modem_config(const LoRaModemConfig& config, size_t slotFrameLength = TDMA_DEFAULT_SLOT_FRAME_SIZE);
+
+    // Call for every valid frame heard; keeps the source's slot alive.
+    void on_frame(uint8_t sourceID, uint32_t nowMs);
+    void on_slot(uint8_t sourceID, uint8_t destinationID, const PayloadBuilder::SlotData& slot, uint32_t nowMs);
+
+    // The beacon once the current superframe is over (the first one at
+    // once), otherwise a queued slot assignment if it fits in what is left
+    // of the downlink slots. Returns its length, or 0.
+    size_t poll(uint32_t nowMs, uint8_t* buffer, size_t bufferSize);
+    uint32_t time_to_next_event(uint32_t nowMs) const;
+    // Airtime left for other base traffic in this superframe's downlink
+    // slots, in µs; 0 outside them.
+    uint32_t downlink_remaining_us(uint32_t nowMs) const;
+
+    uint8_t assigned() const;
+    // Data slot held by userID, or TDMA_NO_SLOT.
+    uint8_t slot_of(uint8_t userID) const;
+    uint16_t slot_ms() const;
+    uint32_t superframe_ms() const;
+
+private:
+    PayloadBuilder payloadBuilder;
+    LoRaModemConfig modem;
+    uint8_t deviceID;
+    uint8_t minDownlinkSlots;
+    uint8_t minContentionSlots;
+    uint16_t nextSlotMs;
+    uint8_t requestsHeard;      // this superframe
+
+    // The superframe the last beacon opened.
+    bool started;
+    uint16_t sequence;
+    uint32_t superframeStart;
+    uint16_t slotMs;
+    uint8_t downlinkSlots;
+    uint8_t contentionSlots;
+    uint8_t dataSlots;
+
+    uint8_t slotMap[(BEACON_MAX_DATA_SLOTS + 7) / 8];
+    uint8_t owner[BEACON_MAX_DATA_SLOTS];
+    uint32_t lastHeard[BEACON_MAX_DATA_SLOTS];
+
+    uint8_t pending[TDMA_PENDING_ASSIGNMENTS];
+    uint8_t pendingCount;
+
+    bool slotUsed(uint8_t slot) const;
+    void setSlotUsed(uint8_t slot, bool used);
+    void startSuperframe(uint32_t nowMs);
+    uint32_t assignmentAirtimeUs() const;
+};
+
+// User side: follows the beacons, asks for a slot in a random contention
+// slot when it has traffic and no slot, and then keeps its transmissions
+// inside its own data slot.
+class TdmaMember {
+public:
+    enum State {
+        UNSYNCED,   // no beacon heard lately: transmit freely
+        IDLE,       // synchronised, no slot
+        JOINING,    // slot requested
+        ASSIGNED
+    };
+
+    explicit TdmaMember(uint8_t deviceID, uint32_t seed = 1);
+
+    void set_integrity_mode(PayloadBuilder::IntegrityMode mode);
+
+    // startedAtMs is when the beacon went on air: its reception time minus
+    // its time-on-air.
+    void on_beacon(uint8_t sourceID, const PayloadBuilder::BeaconData& beacon, uint32_t startedAtMs);
+    void on_slot(uint8_t sourceID, uint8_t destinationID, const PayloadBuilder::SlotData& slot);
+
+    // With traffic waiting and no slot, returns a slot request once its
+    // contention slot starts; 0 otherwise.
+    size_t poll(uint32_t nowMs, bool haveTraffic, uint8_t* buffer, size_t bufferSize);
+    // Whether a frame of airtimeUs may go on air now.
+    bool may_transmit(uint32_t nowMs, uint32_t airtimeUs) const;
+    // Until this device's next transmit opportunity, or UINT32_MAX while
+    // unsynchronised (transmissions are not gated then).
+    uint32_t time_to_next_event(uint32_t nowMs, bool haveTraffic) const;
+
+    State state(uint32_t nowMs) const;
+    uint8_t slot() const;
+
+private:
+    PayloadBuilder payloadBuilder;
+    uint8_t deviceID;
+    uint32_t random;
+
+    bool synced;
+    uint8_t baseID;
+    uint16_t sequence;
+    uint32_t superframeStart;
+    uint16_t slotMs;
+    uint8_t downlinkSlots;
+    uint8_t contentionSlots;
+    uint8_t dataSlots;
+
+    State current;
+    uint8_t assignedSlot;
+    uint8_t attempts;
+    uint8_t backoff;            // superframes still to skip
+    bool requestChosen;         // contention slot picked in this superframe
+    uint32_t requestAt;
+    uint16_t requestSequence;
+
+    uint32_t superframeMs() const;
+    bool syncLost(uint32_t nowMs) const;
+    uint32_t slotOpensAt() const;
+    uint32_t nextRandom();
+};
+
+#endif // TDMA_H
@@ -0,0 +1,134 @@
+#include "telemetry.h"
+
+size_t cobs_encode(const uint8_t* input, size_t length, uint8_t* output, size_t outputSize) {
+    if (outputSize == 0) return 0;
+    size_t codeIndex = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < length; i++) {
+        if (input[i] != 0) {
+            if (out >= outputSize) return 0;
+            output[out++] = input[i];
+            code++;
+        }
+        if (input[i] == 0 || code == 0xFF) {
+            output[codeIndex] = code;
+            if (out >= outputSize) return 0;
+            codeIndex = out++;
+            code = 1;
+        }
+    }
+    output[codeIndex] = code;
+    return out;
+}
+
+size_t cobs_decode(const uint8_t* input, size_t length, uint8_t* output, size_t outputSize) {
+    size_t in = 0;
+    size_t out = 0;
+    while (in < length) {
+        uint8_t code = input[in++];
+        if (code == 0 || in + code - 1 > length) return 0;
+        for (uint8_t i = 1; i < code; i++) {
+            if (input[in] == 0 || out >= outputSize) return 0;
+            output[out++] = input[in++];
+        }
+        if (code != 0xFF && in < length) {
+            if (out >= outputSize) return 0;
+            output[out++] = 0;
+        }
+    }
+    return out;
+}
+
+size_t telemetry_encode(const TelemetryRecord& record, uint8_t* output, size_t outputSize) {
+    if (record.length > MAX_FRAME_SIZE || outputSize < 2) return 0;
+
+    uint8_t raw[TELEMETRY_MAX_RECORD_SIZE];
+    int16_t snrQuarterDb = (int16_t)(record.snr * 4.0f);
+    raw[0] = TELEMETRY_VERSION;
+    raw[1] = (uint8_t)(record.receivedAt >> 24);
+    raw[2] = (uint8_t)(record.receivedAt >> 16);
+    raw[3] = (uint8_t)(record.receivedAt >> 8);
+    raw[4] = (uint8_t)record.receivedAt;
+    raw[5] = (uint8_t)((uint16_t)record.rssi >> 8);
+    raw[6] = (uint8_t)record.rssi;
+    raw[7] = (uint8_t)((uint16_t)snrQuarterDb >> 8);
+    raw[8] = (uint8_t)snrQuarterDb;
+    raw[9] = record.length;
+    for (size_t i = 0; i < record.length; i++) {
+        raw[TELEMETRY_RECORD_HEADER_SIZE + i] = record.frame[i];
+    }
+    size_t rawLength = TELEMETRY_RECORD_HEADER_SIZE + record.length;
+    uint16_t crc = PayloadBuilder::crc16(raw, rawLength);
+    raw[rawLength++] = (uint8_t)(crc >> 8);
+    raw[rawLength++] = (uint8_t)crc;
+
+    output[0] = TELEMETRY_DELIMITER;
+    size_t encoded = cobs_encode(raw, rawLength, output + 1, outputSize - 2);
+    if (encoded == 0) return 0;
+    output[encoded + 1] = TELEMETRY_DELIMITER;
+    return encoded + 2;
+}
+
+TelemetryDecoder::TelemetryDecoder()
+    : packetLength(0), overflow(false), badLength(0), current(), recordCount(0), badCount(0) {}
+
+bool TelemetryDecoder::feed(uint8_t byte) {
+    if (byte != TELEMETRY_DELIMITER) {
+        if (packetLength < sizeof(packet)) {
+            packet[packetLength++] = byte;
+        } else {
+            overflow = true;
+        }
+        return false;
+    }
+
+    // Back-to-back delimiters (the trailing one of a record followed by the
+    // leading one of the next) are not packets.
+    if (packetLength == 0 && !overflow) return false;
+    bool ok = finishPacket();
+    packetLength = 0;
+    overflow = false;
+    return ok;
+}
+
+bool TelemetryDecoder::finishPacket() {
+    size_t length = overflow ? 0 : cobs_decode(packet, packetLength, decoded, sizeof(decoded));
+    bool ok = length >= TELEMETRY_RECORD_HEADER_SIZE + PAYLOAD_CRC_SIZE
+        && decoded[0] == TELEMETRY_VERSION
+        && decoded[9] == length - TELEMETRY_RECORD_HEADER_SIZE - PAYLOAD_CRC_SIZE
+        && PayloadBuilder::crc16(decoded, length - PAYLOAD_CRC_SIZE)
+            == (uint16_t)((decoded[length - 2] << 8) | decoded[length - 1]);
+    if (!ok) {
+        badLength = packetLength;
+        badCount++;
+        return false;
+    }
+
+    current.receivedAt = ((uint32_t)decoded[1] << 24) | ((uint32_t)decoded[2] << 16)
+        | ((uint32_t)decoded[3] << 8) | decoded[4];
+    current.rssi = (int16_t)((decoded[5] << 8) | decoded[6]);
+    current.snr = (int16_t)((decoded[7] << 8) | decoded[8]) / 4.0f;
+    current.length = decoded[9];
+    current.frame = decoded + TELEMETRY_RECORD_HEADER_SIZE;
+    recordCount++;
+    return true;
+}
+
+const TelemetryRecord& TelemetryDecoder::record() const {
+    return current;
+}
+
+uint32_t TelemetryDecoder::records() const {
+    return recordCount;
+}
+
+uint32_t TelemetryDecoder::bad_packets() const {
+    return badCount;
+}
+
+const uint8_t* TelemetryDecoder::last_bad_packet(size_t& length) const {
+    length = badLength;
+    return packet;
+}
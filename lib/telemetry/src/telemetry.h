@@ -0,0 +1,68 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <cstdint>
+#include <cstddef>
+#include "payload_builder.h"
+
+// One telemetry record per received frame, before COBS encoding:
+//   [version][receivedAt, 4 bytes][rssi, 2 bytes][snr in 0.25 dB, 2 bytes]
+//   [frame length][frame bytes][CRC-16 over everything before it]
+// Multi-byte fields are big-endian like the frame header. On the wire each
+// record is COBS encoded and surrounded by 0x00 delimiters, so a receiver
+// can start listening at any point and resynchronises on the next 0x00;
+// stray console text between records decodes as a bad record and is skipped.
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_DELIMITER 0x00
+#define TELEMETRY_RECORD_HEADER_SIZE 10
+#define TELEMETRY_MAX_RECORD_SIZE (TELEMETRY_RECORD_HEADER_SIZE + MAX_FRAME_SIZE + PAYLOAD_CRC_SIZE)
+// COBS adds one byte per 254 plus the leading code byte; two delimiters.
+#define TELEMETRY_MAX_PACKET_SIZE (TELEMETRY_MAX_RECORD_SIZE + TELEMETRY_MAX_RECORD_SIZE / 254 + 1 + 2)
+
+struct TelemetryRecord {
+    uint32_t receivedAt;   // ms since boot of the base station
+    int16_t rssi;          // dBm
+    float snr;             // dB
+    const uint8_t* frame;  // validated frame as received, relay envelope included
+    uint8_t length;
+};
+
+// COBS encode/decode without delimiters. Both return the output length, or
+// 0 if the output does not fit (or the input is not valid COBS).
+size_t cobs_encode(const uint8_t* input, size_t length, uint8_t* output, size_t outputSize);
+size_t cobs_decode(const uint8_t* input, size_t length, uint8_t* output, size_t outputSize);
+
+// Writes the delimited packet for one record; returns its length or 0.
+size_t telemetry_encode(const TelemetryRecord& record, uint8_t* output, size_t outputSize);
+
+// Byte-at-a-time stream decoder. feed() returns true when a complete,
+// CRC-checked record is available through record(); its frame pointer stays
+// valid until the next call to feed().
+class TelemetryDecoder {
+public:
+    TelemetryDecoder();
+
+    bool feed(uint8_t byte);
+    const TelemetryRecord& record() const;
+
+    uint32_t records() const;
+    // Delimited chunks that were not valid records (line noise, console text).
+    uint32_t bad_packets() const;
+    // Raw bytes of the last bad packet, for callers that want to show
+    // interleaved console text.
+    const uint8_t* last_bad_packet(size_t& length) const;
+
+private:
+    uint8_t packet[TELEMETRY_MAX_PACKET_SIZE];
+    uint8_t decoded[TELEMETRY_MAX_RECORD_SIZE];
+    size_t packetLength;
+    bool overflow;
+    size_t badLength;
+    TelemetryRecord current;
+    uint32_t recordCount;
+    uint32_t badCount;
+
+    bool finishPacket();
+};
+
+#endif // TELEMETRY_H
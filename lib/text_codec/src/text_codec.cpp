@@ -0,0 +1,178 @@
+#include "text_codec.h"
+#include <cstring>
+
+// ----- Shared dictionary -----
+// Code n is entry n. Seeded with the vocabulary of the predefined user and
+// base messages, the words field teams add to them, and common English
+// fragments (with their spaces, as SMAZ does) for everything else. Single
+// characters keep ordinary text from falling back to 2-byte escapes.
+struct DictionaryEntry {
+    const char* text;
+    uint8_t length;
+};
+
+#define ENTRY(text) {text, sizeof(text) - 1}
+
+static const DictionaryEntry dictionary[] = {
+    // Single characters
+    ENTRY(" "), ENTRY("e"), ENTRY("t"), ENTRY("a"), ENTRY("o"), ENTRY("i"), ENTRY("n"), ENTRY("s"),
+    ENTRY("r"), ENTRY("h"), ENTRY("l"), ENTRY("d"), ENTRY("c"), ENTRY("u"), ENTRY("m"), ENTRY("w"),
+    ENTRY("f"), ENTRY("g"), ENTRY("y"), ENTRY("p"), ENTRY("b"), ENTRY("v"), ENTRY("k"), ENTRY("x"),
+    ENTRY("j"), ENTRY("q"), ENTRY("z"), ENTRY("0"), ENTRY("1"), ENTRY("2"), ENTRY("3"), ENTRY("4"),
+    ENTRY("5"), ENTRY("6"), ENTRY("7"), ENTRY("8"), ENTRY("9"), ENTRY("."), ENTRY(","), ENTRY("'"),
+    ENTRY("-"), ENTRY("!"), ENTRY("?"), ENTRY(":"), ENTRY("/"), ENTRY("I"), ENTRY("N"), ENTRY("S"),
+    ENTRY("E"), ENTRY("W"),
+
+    // English fragments
+    ENTRY("e "), ENTRY("s "), ENTRY("t "), ENTRY("d "), ENTRY("y "), ENTRY("n "), ENTRY("r "), ENTRY("o "),
+    ENTRY("th"), ENTRY("he"), ENTRY("in"), ENTRY("er"), ENTRY("an"), ENTRY("re"), ENTRY("on"), ENTRY("en"),
+    ENTRY("at"), ENTRY("es"), ENTRY("ed"), ENTRY("nd"), ENTRY("or"), ENTRY("ou"), ENTRY("ar"), ENTRY("st"),
+    ENTRY("te"), ENTRY("ti"), ENTRY("it"), ENTRY("is"), ENTRY("al"), ENTRY("le"), ENTRY("ea"), ENTRY("ee"),
+    ENTRY("oo"), ENTRY("ll"), ENTRY("ck"), ENTRY(", "), ENTRY(". "), ENTRY("00"),
+    ENTRY("ing"), ENTRY("ing "), ENTRY("tion"), ENTRY("ed "), ENTRY("er "), ENTRY("es "), ENTRY("ly "),
+    ENTRY("the"), ENTRY("the "), ENTRY(" the "), ENTRY("The "), ENTRY("and "), ENTRY(" and "),
+    ENTRY("to "), ENTRY(" to "), ENTRY("of "), ENTRY(" of "), ENTRY("in "), ENTRY(" in "), ENTRY("is "),
+    ENTRY(" is "), ENTRY("at "), ENTRY(" at "), ENTRY("on "), ENTRY(" on "), ENTRY("for "), ENTRY(" for "),
+    ENTRY("with "), ENTRY(" with "), ENTRY("from "), ENTRY("are "), ENTRY("we "), ENTRY("We "),
+    ENTRY("our "), ENTRY("my "), ENTRY("me"), ENTRY("no "), ENTRY("not "), ENTRY("have "), ENTRY("has "),
+    ENTRY("can"), ENTRY("can't "), ENTRY("all "), ENTRY("here"), ENTRY("there"), ENTRY("There "),
+    ENTRY("now"), ENTRY("near "), ENTRY("need "), ENTRY("Need "), ENTRY("I need "), ENTRY("we need "),
+    ENTRY("I'm "), ENTRY("I am "), ENTRY("please"), ENTRY("Please "), ENTRY("send "), ENTRY("Send "),
+    ENTRY("help"), ENTRY("Help"), ENTRY("HELP"), ENTRY("SOS"),
+
+    // Vocabulary of the predefined messages
+    ENTRY("OK"), ENTRY("water"), ENTRY("food"), ENTRY("medical"), ENTRY("Medical "), ENTRY("assistance"),
+    ENTRY("lost"), ENTRY("injured"), ENTRY("injur"), ENTRY("fire"), ENTRY("nearby"), ENTRY("shelter"),
+    ENTRY("trapped"), ENTRY("rescue"), ENTRY("Rescue "), ENTRY("location"), ENTRY("team"), ENTRY("clear"),
+    ENTRY("All "), ENTRY("vacuat"), ENTRY("Evacuate "), ENTRY("immediately"), ENTRY("proceed"),
+    ENTRY("Proceed to "), ENTRY("checkpoint"), ENTRY("remain"), ENTRY("calm"), ENTRY("await"),
+    ENTRY("further"), ENTRY("instructions"), ENTRY("en route"), ENTRY("dispatch"), ENTRY("arriv"),
+    ENTRY("ituation"), ENTRY("under control"), ENTRY("ission"), ENTRY("accomplished"),
+
+    // Field vocabulary
+    ENTRY("north"), ENTRY("south"), ENTRY("east"), ENTRY("west"), ENTRY("river"), ENTRY("bridge"),
+    ENTRY("road"), ENTRY("building"), ENTRY("floor"), ENTRY("people"), ENTRY("person"), ENTRY("child"),
+    ENTRY("children"), ENTRY("elderly"), ENTRY("broken"), ENTRY("leg"), ENTRY("bleeding"),
+    ENTRY("unconscious"), ENTRY("breathing"), ENTRY("hurt"), ENTRY("safe"), ENTRY("stuck"), ENTRY("flood"),
+    ENTRY("rising"), ENTRY("collaps"), ENTRY("smoke"), ENTRY("camp"), ENTRY("village"), ENTRY("trail"),
+    ENTRY("ambulance"), ENTRY("doctor"), ENTRY("supplies"), ENTRY("battery"), ENTRY("signal"),
+    ENTRY("night"), ENTRY("minutes"), ENTRY("hours"), ENTRY("meters"), ENTRY("km"), ENTRY("wait"),
+    ENTRY("mov"), ENTRY("going"), ENTRY("com"), ENTRY("stay"), ENTRY("urgent"), ENTRY("emergency"),
+    ENTRY("helicopter"), ENTRY("boat"), ENTRY("vehicle"), ENTRY("tree"), ENTRY("blocked"), ENTRY("path"),
+    ENTRY("house"), ENTRY("school"), ENTRY("hospital"), ENTRY("two "), ENTRY("three "), ENTRY("one "),
+    ENTRY("lat "), ENTRY("lon "), ENTRY("GPS"), ENTRY("position"), ENTRY("landslide"), ENTRY("injuries"),
+};
+
+#undef ENTRY
+
+static const size_t dictionarySize = sizeof(dictionary) / sizeof(dictionary[0]);
+static_assert(sizeof(dictionary) / sizeof(dictionary[0]) <= TEXT_CODEC_VERBATIM_BYTE, "codes 0xFE and 0xFF are escapes");
+
+// Encoder lookup: for each first byte, a chain of the entries starting
+// with it, longest first, so the first match is the longest. Built once on
+// first use (about 450 bytes); the decoder never needs it.
+#define NO_ENTRY 0xFF
+
+struct DictionaryIndex {
+    uint8_t head[256];
+    uint8_t next[dictionarySize];
+};
+
+static DictionaryIndex buildDictionaryIndex() {
+    DictionaryIndex index;
+    std::memset(index.head, NO_ENTRY, sizeof(index.head));
+    uint8_t maxLength = 0;
+    for (size_t i = 0; i < dictionarySize; i++) {
+        if (dictionary[i].length > maxLength) maxLength = dictionary[i].length;
+    }
+    // Shortest pushed first ends up last in its chain.
+    for (uint8_t length = 1; length <= maxLength; length++) {
+        for (size_t i = 0; i < dictionarySize; i++) {
+            if (dictionary[i].length != length) continue;
+            uint8_t first = (uint8_t)dictionary[i].text[0];
+            index.next[i] = index.head[first];
+            index.head[first] = (uint8_t)i;
+        }
+    }
+    return index;
+}
+
+// Writes the pending verbatim bytes as one escape; false if out is full.
+static bool flushVerbatim(const char* bytes, size_t count, uint8_t* out, size_t outSize, size_t& written) {
+    if (count == 0) return true;
+    size_t needed = count == 1 ? 2 : 2 + count;
+    if (needed > outSize - written) return false;
+    if (count == 1) {
+        out[written++] = TEXT_CODEC_VERBATIM_BYTE;
+    } else {
+        out[written++] = TEXT_CODEC_VERBATIM_RUN;
+        out[written++] = (uint8_t)(count - 1);
+    }
+    std::memcpy(&out[written], bytes, count);
+    written += count;
+    return true;
+}
+
+size_t text_compress(const char* text, size_t length, uint8_t* out, size_t outSize) {
+    static const DictionaryIndex index = buildDictionaryIndex();
+    size_t written = 0;
+    size_t verbatimStart = 0;
+    size_t verbatimCount = 0;
+    size_t i = 0;
+    while (i < length) {
+        uint8_t match = NO_ENTRY;
+        for (uint8_t e = index.head[(uint8_t)text[i]]; e != NO_ENTRY; e = index.next[e]) {
+            if (dictionary[e].length <= length - i && std::memcmp(dictionary[e].text, &text[i], dictionary[e].length) == 0) {
+                match = e;
+                break;
+            }
+        }
+        if (match == NO_ENTRY) {
+            if (verbatimCount == 0) verbatimStart = i;
+            verbatimCount++;
+            i++;
+            if (verbatimCount == TEXT_CODEC_MAX_RUN) {
+                if (!flushVerbatim(&text[verbatimStart], verbatimCount, out, outSize, written)) return 0;
+                verbatimCount = 0;
+            }
+            continue;
+        }
+        if (!flushVerbatim(&text[verbatimStart], verbatimCount, out, outSize, written)) return 0;
+        verbatimCount = 0;
+        if (written == outSize) return 0;
+        out[written++] = match;
+        i += dictionary[match].length;
+    }
+    if (!flushVerbatim(&text[verbatimStart], verbatimCount, out, outSize, written)) return 0;
+    return written;
+}
+
+size_t text_decompress(const uint8_t* data, size_t length, char* text, size_t textSize) {
+    size_t written = 0;
+    size_t i = 0;
+    while (i < length) {
+        uint8_t code = data[i++];
+        const char* from;
+        size_t count;
+        if (code == TEXT_CODEC_VERBATIM_BYTE) {
+            if (i == length) return 0;
+            from = reinterpret_cast<const char*>(&data[i]);
+            count = 1;
+        } else if (code == TEXT_CODEC_VERBATIM_RUN) {
+            if (i == length) return 0;
+            count = (size_t)data[i++] + 1;
+            if (count > length - i) return 0;
+            from = reinterpret_cast<const char*>(&data[i]);
+        } else if (code < dictionarySize) {
+            from = dictionary[code].text;
+            count = dictionary[code].length;
+        } else {
+            return 0;
+        }
+        if (code >= TEXT_CODEC_VERBATIM_BYTE) i += count;
+        if (count > textSize - written) return 0;
+        std::memcpy(&text[written], from, count);
+        written += count;
+    }
+    return written;
+}
@@ -0,0 +1,30 @@
+#ifndef TEXT_CODEC_H
+#define TEXT_CODEC_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Compressed text is a sequence of codes. A code below
+// TEXT_CODEC_VERBATIM_BYTE stands for one entry of the shared dictionary
+// in text_codec.cpp; the other two escape bytes the dictionary cannot
+// express:
+//   [0xFE][byte]                one byte as is
+//   [0xFF][n - 1][n bytes]      a run of 2 to 256 bytes as is
+// The dictionary is part of the wire format: entries may only be added at
+// the end, never changed or reordered.
+#define TEXT_CODEC_VERBATIM_BYTE 0xFE
+#define TEXT_CODEC_VERBATIM_RUN 0xFF
+#define TEXT_CODEC_MAX_RUN 256
+
+// Compresses length bytes of text into out. Greedy longest match, so the
+// encoder costs one short dictionary scan per output code. Returns the
+// compressed length, or 0 if it does not fit in outSize (or the text is
+// empty).
+size_t text_compress(const char* text, size_t length, uint8_t* out, size_t outSize);
+
+// Expands compressed data into text, without a terminator. Needs no state
+// beyond the dictionary, which is constant. Returns the text length, or 0
+// if the data is malformed or the text would not fit in textSize.
+size_t text_decompress(const uint8_t* data, size_t length, char* text, size_t textSize);
+
+#endif // TEXT_CODEC_H
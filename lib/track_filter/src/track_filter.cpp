@@ -0,0 +1,128 @@
+#include "track_filter.h"
+#include <cmath>
+
+// 1e-7 degree of latitude (and of longitude at the equator), in metres.
+// Distances are taken on a flat projection around the last point sent,
+// which is well under a percent off over the few kilometres between two
+// points of a walking or driving track.
+#define METRES_PER_E7 0.0111319f
+
+static const float DEGREES_PER_RADIAN = 57.2957795f;
+
+TrackFilter::TrackFilter(float corridorM, float deadBandM, float turnDeg)
+    : corridorM(corridorM), deadBandM(deadBandM), turnDeg(turnDeg) {
+    reset();
+}
+
+void TrackFilter::reset() {
+    anchored = false;
+    anchor = TrackPoint{0, 0, 0};
+    metresPerE7Longitude = METRES_PER_E7;
+    count = 0;
+    counters = Stats{0, 0};
+}
+
+bool TrackFilter::offer(const TrackPoint& point, TrackPoint& out) {
+    counters.fixes++;
+    if (!anchored) return send(point, out);
+
+    const TrackPoint& last = count > 0 ? window[count - 1] : anchor;
+    if (distance(last, point) < deadBandM) {
+        if (count == 0) {
+            // Standing still at the point sent last.
+            return point.timeMs - anchor.timeMs >= TRACK_HEARTBEAT_MS && send(point, out);
+        }
+        // Stopped at the newest held point: send it once it has settled,
+        // or sooner if the heartbeat is due.
+        if (point.timeMs - last.timeMs < TRACK_SETTLE_MS && point.timeMs - anchor.timeMs < TRACK_HEARTBEAT_MS) {
+            return false;
+        }
+        return send(last, out);
+    }
+
+    window[count++] = point;
+    if (count >= 2 && (leavesCorridor(point) || turns(window[count - 2], point))) {
+        // window[count - 2] was the newest point when the held points last
+        // all fitted, so the line up to it covers them.
+        TrackPoint corner = window[count - 2];
+        send(corner, out);
+        window[0] = point;
+        count = 1;
+        return true;
+    }
+    // The held points all fit the line up to this one, so it can go out
+    // early when the window is full or the heartbeat is due.
+    if (count == TRACK_WINDOW_POINTS || point.timeMs - anchor.timeMs >= TRACK_HEARTBEAT_MS) {
+        return send(point, out);
+    }
+    return false;
+}
+
+bool TrackFilter::flush(TrackPoint& out) {
+    if (count == 0) return false;
+    return send(window[count - 1], out);
+}
+
+const TrackFilter::Stats& TrackFilter::stats() const {
+    return counters;
+}
+
+void TrackFilter::setAnchor(const TrackPoint& point) {
+    anchored = true;
+    anchor = point;
+    metresPerE7Longitude = METRES_PER_E7 * std::cos(point.latitudeE7 / 1e7f / DEGREES_PER_RADIAN);
+}
+
+void TrackFilter::toMetres(const TrackPoint& point, float& x, float& y) const {
+    // Differences in 64 bits: two longitudes either side of the antimeridian
+    // are more than INT32_MAX apart.
+    x = (float)((int64_t)point.longitudeE7 - anchor.longitudeE7) * metresPerE7Longitude;
+    y = (float)((int64_t)point.latitudeE7 - anchor.latitudeE7) * METRES_PER_E7;
+}
+
+float TrackFilter::distance(const TrackPoint& a, const TrackPoint& b) const {
+    float ax, ay, bx, by;
+    toMetres(a, ax, ay);
+    toMetres(b, bx, by);
+    return std::sqrt((bx - ax) * (bx - ax) + (by - ay) * (by - ay));
+}
+
+// Whether a held point lies further than the corridor from the segment
+// from the anchor to end.
+bool TrackFilter::leavesCorridor(const TrackPoint& end) const {
+    float ex, ey;
+    toMetres(end, ex, ey);
+    float lengthSquared = ex * ex + ey * ey;
+    for (size_t i = 0; i + 1 < count; i++) {
+        float px, py;
+        toMetres(window[i], px, py);
+        float t = lengthSquared > 0 ? (px * ex + py * ey) / lengthSquared : 0;
+        if (t < 0) t = 0;
+        if (t > 1) t = 1;
+        float dx = px - t * ex;
+        float dy = py - t * ey;
+        if (dx * dx + dy * dy > corridorM * corridorM) return true;
+    }
+    return false;
+}
+
+// Whether the direction from corner to end differs from the direction of
+// the leg from the anchor to corner by more than the turn angle.
+bool TrackFilter::turns(const TrackPoint& corner, const TrackPoint& end) const {
+    float cx, cy, ex, ey;
+    toMetres(corner, cx, cy);
+    toMetres(end, ex, ey);
+    float legBearing = std::atan2(cx, cy) * DEGREES_PER_RADIAN;
+    float turnBearing = std::atan2(ex - cx, ey - cy) * DEGREES_PER_RADIAN;
+    float change = std::fabs(turnBearing - legBearing);
+    if (change > 180) change = 360 - change;
+    return change > turnDeg;
+}
+
+bool TrackFilter::send(const TrackPoint& point, TrackPoint& out) {
+    out = point;
+    setAnchor(point);
+    count = 0;
+    counters.sent++;
+    return true;
+}
@@ -0,0 +1,86 @@
+#ifndef TRACK_FILTER_H
+#define TRACK_FILTER_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Fixes closer than this to the last point kept are receiver jitter (a
+// consumer GPS wanders a few metres standing still) and are not looked at.
+#define TRACK_DEAD_BAND_M 10
+
+// Largest distance a skipped fix may lie from the straight line between
+// the points sent around it. With the dead-band, every fix is within
+// TRACK_DEAD_BAND_M + TRACK_CORRIDOR_M of the track the base reconstructs.
+#define TRACK_CORRIDOR_M 8
+
+// A change of direction sharper than this sends the corner point before
+// the corridor would notice it, which only happens after a long leg.
+#define TRACK_TURN_DEG 45
+
+// Someone who has stopped is reported once they have stayed within the
+// dead-band for TRACK_SETTLE_MS. Points are never more than
+// TRACK_HEARTBEAT_MS apart, whether the user stands still or walks a long
+// straight leg, so the base can tell them from a lost device. The base's
+// ADR takes a link silent for ADR_SILENCE_FALLBACK_MS (120 s) as lost, so
+// the heartbeat comes often enough that one point can be lost without
+// that happening.
+#define TRACK_SETTLE_MS 15000
+#define TRACK_HEARTBEAT_MS 50000
+
+// Candidate points held since the last point sent. A full window sends its
+// newest point, which bounds the gap on a long straight leg.
+#define TRACK_WINDOW_POINTS 16
+
+// Coordinates in 1e-7 degree, as NmeaFix has them; timeMs only has to be
+// monotonic (the firmware uses millis()).
+struct TrackPoint {
+    int32_t latitudeE7;
+    int32_t longitudeE7;
+    uint32_t timeMs;
+};
+
+// Streaming line simplification of a position track (an opening-window
+// variant of Douglas-Peucker): points are held while every one of them
+// stays within the corridor around the line from the last point sent to
+// the newest fix, and the last point that fitted is sent when one does not.
+// Memory is fixed (one window), and points come out in time order.
+class TrackFilter {
+public:
+    struct Stats {
+        uint32_t fixes;
+        uint32_t sent;
+    };
+
+    explicit TrackFilter(float corridorM = TRACK_CORRIDOR_M, float deadBandM = TRACK_DEAD_BAND_M,
+                         float turnDeg = TRACK_TURN_DEG);
+
+    // Offers the next fix. Returns true with out set when a point should be
+    // sent now; that point may be an earlier fix than this one.
+    bool offer(const TrackPoint& point, TrackPoint& out);
+    // The newest point held back, if any, e.g. before the GPS is turned off.
+    bool flush(TrackPoint& out);
+
+    void reset();
+    const Stats& stats() const;
+
+private:
+    float corridorM;
+    float deadBandM;
+    float turnDeg;
+
+    bool anchored;
+    TrackPoint anchor;              // last point sent
+    float metresPerE7Longitude;     // at the anchor's latitude
+    TrackPoint window[TRACK_WINDOW_POINTS];
+    size_t count;
+    Stats counters;
+
+    void setAnchor(const TrackPoint& point);
+    void toMetres(const TrackPoint& point, float& x, float& y) const;
+    float distance(const TrackPoint& a, const TrackPoint& b) const;
+    bool leavesCorridor(const TrackPoint& end) const;
+    bool turns(const TrackPoint& corner, const TrackPoint& end) const;
+    bool send(const TrackPoint& point, TrackPoint& out);
+};
+
+#endif // TRACK_FILTER_H
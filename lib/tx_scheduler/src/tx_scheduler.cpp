@@ -0,0 +1,143 @@
+#include "tx_scheduler.h"
+#include <cstring>
+
+TxScheduler::TxScheduler(uint16_t dutyCyclePermille, uint32_t bucketMs)
+    : modem(lora_default_config()),
+      dutyCyclePermille(dutyCyclePermille),
+      capacityUs((uint64_t)bucketMs * 1000),
+      tokensUs((uint64_t)bucketMs * 1000),
+      lastRefill(0) {
+    std::memset(queues, 0, sizeof(queues));
+    std::memset(counters, 0, sizeof(counters));
+}
+
+void TxScheduler::set_modem_config(const LoRaModemConfig& config) {
+    modem = config;
+}
+
+// A millisecond of wall time earns dutyCyclePermille microseconds of airtime.
+uint64_t TxScheduler::tokensAt(uint32_t nowMs) const {
+    uint64_t tokens = tokensUs + (uint64_t)(nowMs - lastRefill) * dutyCyclePermille;
+    return tokens < capacityUs ? tokens : capacityUs;
+}
+
+// A frame longer than the whole bucket is sent once the bucket is full.
+uint64_t TxScheduler::costUs(const Entry& entry) const {
+    uint64_t cost = lora_time_on_air_us(modem, entry.length);
+    return cost < capacityUs ? cost : capacityUs;
+}
+
+const TxScheduler::Queue* TxScheduler::headQueue() const {
+    for (size_t c = 0; c < TX_CLASS_COUNT; c++) {
+        if (queues[c].count > 0) return &queues[c];
+    }
+    return nullptr;
+}
+
+bool TxScheduler::enqueue(TrafficClass trafficClass, const uint8_t* frame, size_t length, uint32_t nowMs, uint32_t coalesceKey) {
+    if (trafficClass >= TX_CLASS_COUNT || length == 0 || length > MAX_FRAME_SIZE) return false;
+    Queue& queue = queues[trafficClass];
+    ClassStats& stats = counters[trafficClass];
+
+    if (coalesceKey != 0) {
+        for (size_t i = 0; i < queue.count; i++) {
+            Entry& entry = queue.entries[(queue.head + i) % TX_QUEUE_DEPTH];
+            if (entry.key == coalesceKey) {
+                entry.length = length;
+                std::memcpy(entry.frame, frame, length);
+                stats.coalesced++;
+                return true;
+            }
+        }
+    }
+
+    if (queue.count == TX_QUEUE_DEPTH) {
+        stats.dropped++;
+        return false;
+    }
+    Entry& entry = queue.entries[(queue.head + queue.count) % TX_QUEUE_DEPTH];
+    entry.key = coalesceKey;
+    entry.enqueuedAt = nowMs;
+    entry.length = length;
+    std::memcpy(entry.frame, frame, length);
+    queue.count++;
+    stats.enqueued++;
+    return true;
+}
+
+size_t TxScheduler::next(uint32_t nowMs, uint8_t* buffer, size_t bufferSize, uint32_t maxAirtimeUs) {
+    tokensUs = tokensAt(nowMs);
+    lastRefill = nowMs;
+
+    for (size_t c = 0; c < TX_CLASS_COUNT; c++) {
+        Queue& queue = queues[c];
+        if (queue.count == 0) continue;
+
+        const Entry& entry = queue.entries[queue.head];
+        uint64_t cost = costUs(entry);
+        if (cost > tokensUs || entry.length > bufferSize) return 0;
+        if (lora_time_on_air_us(modem, entry.length) > maxAirtimeUs) return 0;
+
+        tokensUs -= cost;
+        std::memcpy(buffer, entry.frame, entry.length);
+        size_t length = entry.length;
+
+        ClassStats& stats = counters[c];
+        uint32_t delay = nowMs - entry.enqueuedAt;
+        stats.sent++;
+        stats.airtimeUs += lora_time_on_air_us(modem, length);
+        stats.totalDelayMs += delay;
+        if (delay > stats.maxDelayMs) stats.maxDelayMs = delay;
+
+        queue.head = (queue.head + 1) % TX_QUEUE_DEPTH;
+        queue.count--;
+        return length;
+    }
+    return 0;
+}
+
+void TxScheduler::charge(uint32_t nowMs, size_t length) {
+    tokensUs = tokensAt(nowMs);
+    lastRefill = nowMs;
+    uint64_t cost = lora_time_on_air_us(modem, length);
+    tokensUs = cost < tokensUs ? tokensUs - cost : 0;
+}
+
+uint32_t TxScheduler::time_to_next_event(uint32_t nowMs) const {
+    const Queue* queue = headQueue();
+    if (!queue) return UINT32_MAX;
+    uint64_t cost = costUs(queue->entries[queue->head]);
+    uint64_t tokens = tokensAt(nowMs);
+    if (tokens >= cost) return 0;
+    if (dutyCyclePermille == 0) return UINT32_MAX;
+    return (uint32_t)((cost - tokens + dutyCyclePermille - 1) / dutyCyclePermille);
+}
+
+size_t TxScheduler::queued() const {
+    size_t total = 0;
+    for (size_t c = 0; c < TX_CLASS_COUNT; c++) total += queues[c].count;
+    return total;
+}
+
+size_t TxScheduler::queued(TrafficClass trafficClass) const {
+    return trafficClass < TX_CLASS_COUNT ? queues[trafficClass].count : 0;
+}
+
+uint32_t TxScheduler::budget_ms(uint32_t nowMs) const {
+    return (uint32_t)(tokensAt(nowMs) / 1000);
+}
+
+const TxScheduler::ClassStats& TxScheduler::stats(TrafficClass trafficClass) const {
+    return counters[trafficClass < TX_CLASS_COUNT ? trafficClass : TX_GPS];
+}
+
+const char* TxScheduler::class_name(TrafficClass trafficClass) {
+    switch (trafficClass) {
+        case TX_EMERGENCY: return "emergency";
+        case TX_CONTROL: return "control";
+        case TX_PREDEFINED: return "predefined";
+        case TX_CUSTOM: return "custom";
+        case TX_GPS: return "gps";
+        default: return "unknown";
+    }
+}
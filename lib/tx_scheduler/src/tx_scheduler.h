@@ -0,0 +1,103 @@
+#ifndef TX_SCHEDULER_H
+#define TX_SCHEDULER_H
+
+#include <cstdint>
+#include <cstddef>
+#include "payload_builder.h"
+#include "lora_airtime.h"
+
+// Frames waiting per traffic class; each holds up to MAX_FRAME_SIZE bytes.
+#define TX_QUEUE_DEPTH 8
+
+// Duty-cycle budget. Airtime is paid from a token bucket refilled at the
+// duty cycle (10% is the limit for the 433.05-434.79 MHz SRD band under
+// ETSI EN 300 220) and holding at most TX_DEFAULT_BUCKET_MS of airtime, so
+// a burst can use the budget saved up while the channel was quiet.
+#define TX_DEFAULT_DUTY_CYCLE_PERMILLE 100
+#define TX_DEFAULT_BUCKET_MS 36000
+
+// Strict-priority transmit queue in front of the radio. The highest class
+// with a frame waiting goes first, and only once the budget covers its
+// time-on-air at the current modem settings; a smaller frame of a lower
+// class never overtakes it, so an emergency is not starved by chatter.
+class TxScheduler {
+public:
+    enum TrafficClass {
+        TX_EMERGENCY,   // must not wait behind routine traffic
+        TX_CONTROL,     // ACKs and data-rate control: small, and late ones cost retransmissions
+        TX_PREDEFINED,
+        TX_CUSTOM,
+        TX_GPS,
+        TX_CLASS_COUNT
+    };
+
+    struct ClassStats {
+        uint32_t enqueued;
+        uint32_t sent;
+        uint32_t coalesced;     // replaced by a newer frame with the same key
+        uint32_t dropped;       // queue full
+        uint64_t airtimeUs;
+        uint32_t totalDelayMs;  // queueing delay summed over sent frames
+        uint32_t maxDelayMs;
+    };
+
+    explicit TxScheduler(uint16_t dutyCyclePermille = TX_DEFAULT_DUTY_CYCLE_PERMILLE,
+                         uint32_t bucketMs = TX_DEFAULT_BUCKET_MS);
+
+    // Settings the next frames are sent with; call again after every change.
+    void set_modem_config(const LoRaModemConfig& config);
+
+    // Queues a frame. A nonzero coalesceKey replaces a frame with the same
+    // key still waiting in that class, keeping its place in the queue (the
+    // newest GPS fix from a source, a retransmission of a queued message).
+    // Returns false if the class queue is full or the frame is too long.
+    bool enqueue(TrafficClass trafficClass, const uint8_t* frame, size_t length, uint32_t nowMs, uint32_t coalesceKey = 0);
+
+    // Copies the next frame into buffer, charges its airtime and returns its
+    // length; 0 if nothing is queued or the budget does not cover it yet.
+    // With maxAirtimeUs (what is left of a TDMA downlink slot) the next
+    // frame also has to fit in it; a shorter one behind it does not go first.
+    size_t next(uint32_t nowMs, uint8_t* buffer, size_t bufferSize, uint32_t maxAirtimeUs = UINT32_MAX);
+    // Pays for a frame sent without going through the queues, such as a
+    // TDMA beacon that has to go out on time. Empties the bucket at worst.
+    void charge(uint32_t nowMs, size_t length);
+    // 0 if next() would send now, the wait for the budget otherwise, or
+    // UINT32_MAX when nothing is queued.
+    uint32_t time_to_next_event(uint32_t nowMs) const;
+
+    size_t queued() const;
+    size_t queued(TrafficClass trafficClass) const;
+    // Airtime the bucket holds right now.
+    uint32_t budget_ms(uint32_t nowMs) const;
+    const ClassStats& stats(TrafficClass trafficClass) const;
+    static const char* class_name(TrafficClass trafficClass);
+
+private:
+    struct Entry {
+        uint32_t key;
+        uint32_t enqueuedAt;
+        uint8_t length;
+        uint8_t frame[MAX_FRAME_SIZE];
+    };
+
+    struct Queue {
+        Entry entries[TX_QUEUE_DEPTH];
+        uint8_t head;
+        uint8_t count;
+    };
+
+    Queue queues[TX_CLASS_COUNT];
+    ClassStats counters[TX_CLASS_COUNT];
+    LoRaModemConfig modem;
+    uint16_t dutyCyclePermille;
+    uint64_t capacityUs;
+    uint64_t tokensUs;
+    uint32_t lastRefill;
+
+    // Tokens after refilling up to nowMs, without changing state.
+    uint64_t tokensAt(uint32_t nowMs) const;
+    uint64_t costUs(const Entry& entry) const;
+    const Queue* headQueue() const;
+};
+
+#endif // TX_SCHEDULER_H
@@ -1,9 +1,21 @@
 #include <Arduino.h>
 #include <SPI.h>
 #include <LoRa.h>
+#include <LittleFS.h>
+#include <esp_heap_caps.h>
 #include "payload_builder.h"
-#include <vector>
-#include <string>
+#include "spsc_ring.h"
+#include "overwrite_ring.h"
+#include "telemetry.h"
+#include "reliable_link.h"
+#include "adr.h"
+#include "tx_scheduler.h"
+#include "tdma.h"
+#include "metrics.h"
+#include "node_registry.h"
+#include "spatial_index.h"
+#include "journal.h"
+#include <type_traits>
 #include <Wire.h>
 
 // ----- Message Command Definitions -----
@@ -12,11 +24,15 @@ enum MessageType {
   CUSTOM
 };
 
+// Copied byte for byte through msgQueue, so the custom text travels inline
+// rather than in a heap-backed String.
 struct MessageCommand {
   MessageType type;
-  int predefinedID;   // Valid if type == PREDEFINED
-  String customText;  // Valid if type == CUSTOM
+  int predefinedID;      // Valid if type == PREDEFINED
+  uint8_t customLength;  // Valid if type == CUSTOM
+  char customText[C_MSG_TEXT_MAX_LENGTH];
 };
+static_assert(std::is_trivially_copyable<MessageCommand>::value, "MessageCommand goes through a FreeRTOS queue");
 
 // ----- User Emergency Messages (sent from user to base) -----
 // Using C-strings for Arduino compatibility.
@@ -47,30 +63,30 @@ const char* baseMessages[10] = {
   "Mission accomplished"
 };
 
-// Helper function to return a user emergency message as an Arduino String.
+// Helper function to return a user emergency message.
 // Expects a 1-based index, converts it to 0-based.
-String getMessage(int index) {
+const char* getMessage(int index) {
   int adjustedIndex = index - 1;
   if (adjustedIndex >= 0 && adjustedIndex < 10) {
-    return String(emergencyMessages[adjustedIndex]);
+    return emergencyMessages[adjustedIndex];
   } else {
     return "Invalid index! Please enter a number between 1 and 10.";
   }
 }
 
-// Helper function to return a base station message as an Arduino String.
+// Helper function to return a base station message.
 // Expects a 1-based index, converts it to 0-based.
-String getBaseMessage(int index) {
+const char* getBaseMessage(int index) {
   int adjustedIndex = index - 1;
   if (adjustedIndex >= 0 && adjustedIndex < 10) {
-    return String(baseMessages[adjustedIndex]);
+    return baseMessages[adjustedIndex];
   } else {
     return "Invalid index! Please enter a number between 1 and 10.";
   }
 }
 
 // ----- Helper Function for RSSI Status -----
-String getRSSIStatus(int rssi) {
+const char* getRSSIStatus(int rssi) {
   if (rssi > -65) return "Excellent";
   else if (rssi > -75) return "Good";
   else if (rssi > -85) return "Fair";
@@ -85,122 +101,1275 @@ const int irqPin   = 2;
 // Frequency for the SX1278
 const long frequency = 433E6;
 
+// ----- Serial Console -----
+// Built with TELEMETRY_BINARY (env:base_telemetry) the base forwards each
+// validated frame to the host as a COBS-framed binary record instead of
+// decoding it to text, at a baud rate high enough for the busiest channel.
+#ifdef TELEMETRY_BINARY
+const unsigned long serialBaud = 921600;
+#else
+const unsigned long serialBaud = 9600;
+#endif
+
+// ----- Device IDs -----
+const uint8_t baseID = 0x02;
+const uint8_t userID = 0x01;
+
 // ----- Global Instance of PayloadBuilder -----
 PayloadBuilder payloadBuilder;
 
+// ----- Reliable Link -----
+// Messages to users are retransmitted until ACKed; messages from users are
+// ACKed and their duplicates dropped. Shared by the receive and transmit
+// tasks, so every call goes through linkMutex.
+ReliableLink link(baseID, (uint16_t)esp_random());
+SemaphoreHandle_t linkMutex;
+TaskHandle_t transmitTaskHandle = NULL;
+
+// ----- Adaptive Data Rate -----
+// The base coordinates the network's spreading factor/bandwidth from the
+// RSSI/SNR history of every transmitter it hears. Also guarded by
+// linkMutex; only the transmit task reconfigures the radio.
+AdrCoordinator adr(baseID);
+uint8_t radioDataRate = ADR_SAFE_DATA_RATE;
+
+// ----- Transmit Scheduling -----
+// Every outgoing frame waits here until the duty-cycle budget covers it,
+// most urgent class first. Used by the transmit task under linkMutex.
+TxScheduler txScheduler;
+
+#ifdef TDMA_MODE
+// ----- Slotted Access -----
+// Beacons open every superframe and hand out one data slot per user, so
+// users stop colliding with each other. Everything the base sends goes out
+// in the downlink slots right after the beacon. Guarded by linkMutex.
+TdmaCoordinator tdma(baseID);
+#endif
+
+// Base messages that must not wait behind routine traffic (0-based IDs).
+bool isEmergencyBaseMessage(uint8_t msgID) {
+  return msgID == 1;  // "Evacuate immediately"
+}
+
+// ----- Node Registry -----
+// Last position, link quality, last-heard time and counters of every node
+// the base hears, updated per frame by LoRaReceiveTask. Drops duplicate
+// position frames and drives the stale-node alerts. Guarded by linkMutex.
+NodeRegistry registry;
+
+// ----- Spatial Index -----
+// The latest position of every user on a 250 m grid, for the "near" and
+// "within" console queries, and the geofences whose crossings are checked
+// as each position arrives. Guarded by linkMutex.
+SpatialIndex spatialIndex;
+
+// ----- Compact GPS Keyframes -----
+// Delta GPS frames are decoded against the last keyframe of their source.
+PayloadBuilder::GPSTrackState gpsTracks[256];
+
+// ----- Received Frame Ring -----
+// Filled by the DIO0 interrupt and drained by LoRaReceiveTask. The frame
+// and its RSSI/SNR are copied in the ISR, before the transmit task can
+// reuse the FIFO or the radio can overwrite them with the next packet.
+struct RxFrame {
+  uint32_t receivedAt;
+#ifndef METRICS_DISABLED
+  uint32_t receivedAtUs;  // start of the receive-to-processed latency
+#endif
+  int16_t rssi;
+  int8_t snrRaw;  // SX127x RegPktSnrValue, 0.25 dB steps
+  uint8_t length;
+  uint8_t data[MAX_FRAME_SIZE];
+};
+
+SpscRing<RxFrame, 8> rxRing;
+TaskHandle_t receiveTaskHandle = NULL;
+
+// ----- Frame Journal -----
+// Every validated frame also goes to a journal in flash (lib/journal), so a
+// reset or an unplugged laptop loses at most JOURNAL_FLUSH_MS of reports.
+// LoRaReceiveTask copies frames into journalRing and JournalTask appends
+// them and does the flash writes, so reception never waits on flash. The
+// journal is guarded by journalMutex; the "replay" command reads it too.
+#define JOURNAL_DIR "/journal"
+
+// Segments as LittleFS files. Each open allocates a File and LittleFS's
+// buffers on the heap, so setup() opens the segment being written before
+// it snapshots the heap, and that file stays open for both appends and
+// reads of its segment. Two things still open a file after setup():
+// - the journal rolling over to a new segment, once every 64 KB. The old
+//   segment is closed first, so the heap returns to the same footprint;
+// - "replay" reading an older segment, through a second file that the
+//   command closes again when it is done.
+class LittleFsJournalStorage : public JournalStorage {
+public:
+  bool begin() {
+    if (!LittleFS.begin(true)) {  // formats a partition that was never used
+      return false;
+    }
+    if (!LittleFS.exists(JOURNAL_DIR)) {
+      LittleFS.mkdir(JOURNAL_DIR);
+    }
+    return true;
+  }
+
+  // Opens the segment the journal writes next. The one-byte read makes
+  // stdio allocate the file's buffer now rather than on the first append.
+  bool open_write_segment(uint32_t segment) {
+    if (!openFile(writeFile, writeSegment, segment, "a+")) {
+      return false;
+    }
+    uint8_t byte;
+    writeFile.read(&byte, 1);
+    return true;
+  }
+
+  void close_reader() {
+    closeFile(readFile, readSegment);
+  }
+
+  // Only mount() lists and sizes segments, during setup().
+  bool segments(uint32_t& first, uint32_t& last) override {
+    File dir = LittleFS.open(JOURNAL_DIR);
+    if (!dir) {
+      return false;
+    }
+    bool found = false;
+    for (File entry = dir.openNextFile(); entry; entry = dir.openNextFile()) {
+      const char* name = strrchr(entry.name(), '/');  // older cores return the whole path
+      name = name != NULL ? name + 1 : entry.name();
+      char* end = NULL;
+      uint32_t number = strtoul(name, &end, 10);
+      if (end == name || strcmp(end, ".seg") != 0 || number == 0) {
+        continue;
+      }
+      if (!found || number < first) first = number;
+      if (!found || number > last) last = number;
+      found = true;
+    }
+    return found;
+  }
+
+  bool append(uint32_t segment, const uint8_t* data, size_t length) override {
+    if (!openFile(writeFile, writeSegment, segment, "a+")) {
+      return false;
+    }
+    writeFile.seek(writeFile.size());  // a read may have moved the position
+    bool written = writeFile.write(data, length) == length;
+    writeFile.flush();  // commits the block and the new file size
+    return written;
+  }
+
+  size_t read(uint32_t segment, uint32_t offset, uint8_t* data, size_t length) override {
+    if (segment == writeSegment && writeFile) {
+      return writeFile.seek(offset) ? writeFile.read(data, length) : 0;
+    }
+    if (!openFile(readFile, readSegment, segment, FILE_READ) || !readFile.seek(offset)) {
+      return 0;
+    }
+    return readFile.read(data, length);
+  }
+
+  uint32_t size(uint32_t segment) override {
+    char name[32];
+    path(segment, name, sizeof(name));
+    File file = LittleFS.open(name, FILE_READ);
+    return file ? file.size() : 0;
+  }
+
+  bool remove(uint32_t segment) override {
+    if (writeSegment == segment) {
+      closeFile(writeFile, writeSegment);
+    }
+    if (readSegment == segment) {
+      closeFile(readFile, readSegment);
+    }
+    char name[32];
+    path(segment, name, sizeof(name));
+    return LittleFS.remove(name);
+  }
+
+private:
+  File writeFile;
+  File readFile;
+  uint32_t writeSegment = 0;
+  uint32_t readSegment = 0;
+
+  static void path(uint32_t segment, char* output, size_t outputSize) {
+    snprintf(output, outputSize, JOURNAL_DIR "/%08lu.seg", (unsigned long)segment);
+  }
+
+  static void closeFile(File& file, uint32_t& openSegment) {
+    file.close();
+    openSegment = 0;
+  }
+
+  // Closes the file first, so its buffers are free before the next open
+  // takes them.
+  static bool openFile(File& file, uint32_t& openSegment, uint32_t segment, const char* mode) {
+    if (file && openSegment == segment) {
+      return true;
+    }
+    closeFile(file, openSegment);
+    char name[32];
+    path(segment, name, sizeof(name));
+    file = LittleFS.open(name, mode);
+    if (!file) {
+      return false;
+    }
+    openSegment = segment;
+    return true;
+  }
+};
+
+LittleFsJournalStorage journalStorage;
+Journal journal(journalStorage);
+SpscRing<RxFrame, 8> journalRing;
+SemaphoreHandle_t journalMutex;
+TaskHandle_t journalTaskHandle = NULL;  // stays NULL if LittleFS did not mount
+
+// ----- Log Pipeline -----
+// LoRaReceiveTask only decodes: each frame (or aggregate record) becomes a
+// LogRecord handed to LoggerTask, which owns the serial console. A slow
+// console delays the log, never reception. If the logger falls behind, the
+// oldest records are overwritten and counted.
+enum LogKind {
+  LOG_GPS,
+  LOG_P_MSG,
+  LOG_C_MSG,
+  LOG_GPS_COMPACT,
+  LOG_GPS_NO_KEYFRAME,
+  LOG_UNKNOWN_RECORD,
+  LOG_INVALID,
+  LOG_RX_OVERFLOW,
+  LOG_RAW_FRAME,
+  LOG_DUPLICATE,
+  LOG_ACK,
+  LOG_CONTROL,
+  LOG_DUPLICATE_POSITION,
+  LOG_GEOFENCE
+};
+
+// How a frame reached the base; shared by every record it produces.
+struct RxContext {
+  uint32_t receivedAt;
+  int16_t rssi;
+  float snr;
+  uint8_t relayID;
+  uint8_t hopCount;  // 0 if heard directly
+};
+
+struct LogRecord {
+  uint8_t kind;
+  RxContext rx;
+  PayloadBuilder::PayloadDetails details;
+  PayloadBuilder::GPSData gps;  // LOG_GPS, LOG_GPS_COMPACT
+  uint8_t msgID;                // LOG_P_MSG
+  uint8_t dataLength;           // LOG_C_MSG text, LOG_RAW_FRAME frame
+  uint8_t data[MAX_FRAME_SIZE > C_MSG_TEXT_MAX_LENGTH ? MAX_FRAME_SIZE : C_MSG_TEXT_MAX_LENGTH];
+  uint32_t count;               // LOG_RX_OVERFLOW; parse status for LOG_INVALID
+  PayloadBuilder::AckData ack;  // LOG_ACK
+  PayloadBuilder::ControlData control;  // LOG_CONTROL
+  SpatialIndex::FenceEvent fence;       // LOG_GEOFENCE
+};
+
+OverwriteRing<LogRecord, 32> logRing;
+TaskHandle_t loggerTaskHandle = NULL;
+
 // ----- FreeRTOS Queue Handle -----
 // Updated to hold MessageCommand structures.
 QueueHandle_t msgQueue;
 
+// ----- Static Task and Queue Storage -----
+// Tasks, queues and the mutex are built in these buffers rather than on the
+// heap, so what they need is fixed at link time. Stack sizes are in bytes,
+// as the ESP32's FreeRTOS counts them.
+StackType_t receiveTaskStack[4096];
+StaticTask_t receiveTaskBuffer;
+// The console formats floats with snprintf for "nodes", "near" and
+// "within", and newlib's vfprintf alone takes well over 1 KB of that.
+StackType_t serialTaskStack[4096];
+StaticTask_t serialTaskBuffer;
+StackType_t transmitTaskStack[4096];
+StaticTask_t transmitTaskBuffer;
+StackType_t loggerTaskStack[4096];
+StaticTask_t loggerTaskBuffer;
+StackType_t journalTaskStack[4096];
+StaticTask_t journalTaskBuffer;
+uint8_t msgQueueStorage[10 * sizeof(MessageCommand)];
+StaticQueue_t msgQueueBuffer;
+StaticSemaphore_t linkMutexBuffer;
+StaticSemaphore_t journalMutexBuffer;
+
+// ----- Heap Check -----
+// After setup() nothing may touch the heap. setup() snapshots the heap
+// last, and every HEAP_CHECK_INTERVAL_MS LoggerTask compares it with:
+// - the allocated blocks and bytes, which catch leaks and anything still
+//   held at the check;
+// - the low-water mark, which catches a short-lived allocation that dug
+//   deeper than setup() did.
+// An allocation freed between two checks that stays above the mark is
+// invisible here; the host soak in the bench counts every operator new
+// on those paths. A soak run must never print the report.
+// The one known exception is the journal's LittleFS files (see
+// LittleFsJournalStorage). A segment roll-over swaps one open file for
+// another and nets out. "replay" holds a reader while it runs, so a check
+// during a replay may report it.
+#define HEAP_CHECK_INTERVAL_MS 10000
+multi_heap_info_t heapAfterSetup;
+volatile bool heapSnapshotTaken = false;
+
+#ifndef METRICS_DISABLED
+// ----- Metrics -----
+// Packet counters, stack and queue peaks and the receive-to-processed
+// latency histogram, printed by the "stats" console command. Build with
+// -D METRICS_DISABLED to compile all of it out.
+Metrics metrics;
+int msgQueueMetric = -1;
+int rxRingMetric = -1;
+int logRingMetric = -1;
+int txQueueMetric = -1;
+int journalRingMetric = -1;
+#endif
+
+// --------------------------------------------------------
+// Payload Handlers
+// Shared by single frames and by the records of an aggregate frame. They
+// run on the receive path, so they only fill in a LogRecord.
+// --------------------------------------------------------
+void logRecord(uint8_t kind, const RxContext& rx, const PayloadBuilder::PayloadDetails& details, LogRecord& record) {
+#ifdef TELEMETRY_BINARY
+  // The host decodes the raw frames itself; geofence alerts still go out
+  // as console text.
+  if (kind != LOG_RAW_FRAME && kind != LOG_RX_OVERFLOW && kind != LOG_GEOFENCE) return;
+#endif
+  record.kind = kind;
+  record.rx = rx;
+  record.details = details;
+  logRing.push(record);
+}
+
+// Reliable-link bookkeeping for a received message; the transmit task is
+// woken because an ACK is now owed.
+bool isDuplicateMessage(const RxContext& rx, const PayloadBuilder::PayloadDetails& details) {
+  xSemaphoreTake(linkMutex, portMAX_DELAY);
+  ReliableLink::Acceptance acceptance = link.on_data(details.sourceID, details.destinationID, details.transmissionID, rx.receivedAt);
+  if (acceptance != ReliableLink::ACCEPT_NOT_FOR_US) {
+    registry.record_message(details.sourceID, acceptance == ReliableLink::ACCEPT_DUPLICATE);
+  }
+  xSemaphoreGive(linkMutex);
+  if (acceptance == ReliableLink::ACCEPT_NOT_FOR_US) return false;
+  xTaskNotifyGive(transmitTaskHandle);
+  if (acceptance == ReliableLink::ACCEPT_DUPLICATE) {
+    LogRecord record;
+    logRecord(LOG_DUPLICATE, rx, details, record);
+    return true;
+  }
+  return false;
+}
+
+void handleAck(const RxContext& rx, const PayloadBuilder::PayloadDetails& details, const PayloadBuilder::AckData& ack) {
+  xSemaphoreTake(linkMutex, portMAX_DELAY);
+  link.on_ack(details.sourceID, details.destinationID, ack, rx.receivedAt);
+  xSemaphoreGive(linkMutex);
+  xTaskNotifyGive(transmitTaskHandle);
+
+  LogRecord record;
+  record.ack = ack;
+  logRecord(LOG_ACK, rx, details, record);
+}
+
+// Data-rate negotiation replies from users and relays.
+void handleControl(const RxContext& rx, const PayloadBuilder::PayloadDetails& details, const PayloadBuilder::ControlData& control) {
+  xSemaphoreTake(linkMutex, portMAX_DELAY);
+  adr.on_control(details.sourceID, details.destinationID, control, rx.receivedAt);
+  xSemaphoreGive(linkMutex);
+  xTaskNotifyGive(transmitTaskHandle);
+
+  LogRecord record;
+  record.control = control;
+  logRecord(LOG_CONTROL, rx, details, record);
+}
+
+// Slot requests and releases from users. Ignored unless built with
+// TDMA_MODE.
+void handleSlot(const RxContext& rx, const PayloadBuilder::PayloadDetails& details, const PayloadBuilder::SlotData& slot) {
+#ifdef TDMA_MODE
+  xSemaphoreTake(linkMutex, portMAX_DELAY);
+  tdma.on_slot(details.sourceID, details.destinationID, slot, rx.receivedAt);
+  xSemaphoreGive(linkMutex);
+  xTaskNotifyGive(transmitTaskHandle);
+#endif
+}
+
+#ifdef TDMA_MODE
+// Every frame heard straight from a user keeps its data slot.
+void recordSlotActivity(const PayloadBuilder::ParsedFrame& parsed, const RxContext& rx) {
+  if (rx.hopCount > 0 || parsed.status != PayloadBuilder::PARSE_OK) {
+    return;
+  }
+  xSemaphoreTake(linkMutex, portMAX_DELAY);
+  tdma.on_frame(parsed.details.sourceID, rx.receivedAt);
+  xSemaphoreGive(linkMutex);
+}
+#endif
+
+// ADR history is kept per transmitter. For a relayed frame that is the
+// relay, whose link to the base is the one the data rate has to cover.
+void recordLinkQuality(const PayloadBuilder::ParsedFrame& parsed, const RxContext& rx) {
+  if (parsed.status != PayloadBuilder::PARSE_OK) {
+    return;
+  }
+  uint8_t transmitterID = rx.hopCount > 0 ? rx.relayID : parsed.details.sourceID;
+  xSemaphoreTake(linkMutex, portMAX_DELAY);
+  adr.record(transmitterID, rx.rssi, rx.snr, rx.receivedAt);
+  registry.record_link(transmitterID, rx.rssi, rx.snr, rx.receivedAt);
+  xSemaphoreGive(linkMutex);
+}
+
+// Every frame or aggregate record a node originated, wherever it was heard.
+void recordNode(const RxContext& rx, const PayloadBuilder::PayloadDetails& details) {
+  xSemaphoreTake(linkMutex, portMAX_DELAY);
+  registry.record_frame(details.sourceID, details.transmissionID, rx.receivedAt, rx.relayID, rx.hopCount);
+  xSemaphoreGive(linkMutex);
+}
+
+// Position frames are not ACKed; a copy heard both directly and through a
+// relay is dropped here. Otherwise the position goes into the registry.
+bool isDuplicatePosition(const RxContext& rx, const PayloadBuilder::PayloadDetails& details) {
+  xSemaphoreTake(linkMutex, portMAX_DELAY);
+  bool accepted = registry.accept_position(details.sourceID, details.transmissionID);
+  xSemaphoreGive(linkMutex);
+  if (!accepted) {
+    LogRecord record;
+    logRecord(LOG_DUPLICATE_POSITION, rx, details, record);
+  }
+  return !accepted;
+}
+
+// Also moves the user in the spatial index; each geofence it crossed is
+// logged.
+void recordPosition(const RxContext& rx, const PayloadBuilder::PayloadDetails& details, const PayloadBuilder::GPSData& gpsData) {
+  SpatialIndex::FenceEvent events[SPATIAL_MAX_FENCES];
+  xSemaphoreTake(linkMutex, portMAX_DELAY);
+  registry.record_position(details.sourceID, gpsData.latitude, gpsData.longitude, rx.receivedAt);
+  size_t eventCount = spatialIndex.update(details.sourceID, gpsData.latitude, gpsData.longitude, events, SPATIAL_MAX_FENCES);
+  xSemaphoreGive(linkMutex);
+  for (size_t i = 0; i < eventCount; i++) {
+    LogRecord record;
+    record.fence = events[i];
+    logRecord(LOG_GEOFENCE, rx, details, record);
+  }
+}
+
+void handleGPS(const RxContext& rx, const PayloadBuilder::PayloadDetails& details, const PayloadBuilder::GPSData& gpsData) {
+  if (isDuplicatePosition(rx, details)) return;
+  recordPosition(rx, details, gpsData);
+  LogRecord record;
+  record.gps = gpsData;
+  logRecord(LOG_GPS, rx, details, record);
+}
+
+void handlePredefinedMessage(const RxContext& rx, const PayloadBuilder::PayloadDetails& details, const PayloadBuilder::PMsgData& pMsgData) {
+  if (isDuplicateMessage(rx, details)) return;
+  LogRecord record;
+  record.msgID = pMsgData.msgID;
+  logRecord(LOG_P_MSG, rx, details, record);
+}
+
+// Custom messages, raw or packed, are decoded straight into the record.
+void handleCustomMessage(const RxContext& rx, const PayloadBuilder::PayloadDetails& details, const uint8_t* payload, size_t payloadLength) {
+  if (isDuplicateMessage(rx, details)) return;
+  LogRecord record;
+  record.dataLength = payloadBuilder.decode_c_msg_text(payload, payloadLength, reinterpret_cast<char*>(record.data), sizeof(record.data));
+  logRecord(LOG_C_MSG, rx, details, record);
+}
+
+void handleCustomRecord(const RxContext& rx, const PayloadBuilder::PayloadDetails& details, const PayloadBuilder::AggregateRecord& aggregateRecord) {
+  if (isDuplicateMessage(rx, details)) return;
+  LogRecord record;
+  record.dataLength = payloadBuilder.decode_c_msg_record_text(aggregateRecord, reinterpret_cast<char*>(record.data), sizeof(record.data));
+  logRecord(LOG_C_MSG, rx, details, record);
+}
+
+void handleCompactGPS(const RxContext& rx, const PayloadBuilder::PayloadDetails& details, const uint8_t* payload, size_t payloadLength) {
+  if (isDuplicatePosition(rx, details)) return;
+  LogRecord record;
+  bool decoded = payloadBuilder.decode_gps_compact_payload(payload, payloadLength, gpsTracks[details.sourceID], record.gps);
+  if (decoded) {
+    recordPosition(rx, details, record.gps);
+  }
+  logRecord(decoded ? LOG_GPS_COMPACT : LOG_GPS_NO_KEYFRAME, rx, details, record);
+}
+
+// Each record of an aggregate frame goes through the handler for its type,
+// with the shared header's destination and timestamp. parse() has already
+// checked that the records fill the frame.
+void handleAggregate(const RxContext& rx, const PayloadBuilder::PayloadDetails& details, const uint8_t* payload, size_t payloadLength) {
+  PayloadBuilder::AggregateReader reader(payload, payloadLength);
+  PayloadBuilder::AggregateRecord record;
+  while (reader.next(record)) {
+    PayloadBuilder::PayloadDetails recordDetails = details;
+    recordDetails.type = record.type;
+    recordDetails.sourceID = record.sourceID;
+    recordDetails.transmissionID = record.transmissionID;
+    recordDetails.dataLength = record.length;
+    recordNode(rx, recordDetails);
+
+    if (record.type == PAYLOAD_TYPE_GPS) {
+      handleGPS(rx, recordDetails, payloadBuilder.decode_gps_record(record));
+    } else if (record.type == PAYLOAD_TYPE_P_MSG) {
+      handlePredefinedMessage(rx, recordDetails, payloadBuilder.decode_p_msg_record(record));
+    } else if (record.type == PAYLOAD_TYPE_C_MSG || record.type == PAYLOAD_TYPE_C_MSG_PACKED) {
+      handleCustomRecord(rx, recordDetails, record);
+    } else if (record.type == PAYLOAD_TYPE_ACK) {
+      handleAck(rx, recordDetails, payloadBuilder.decode_ack_record(record));
+    } else {
+      LogRecord unknown;
+      logRecord(LOG_UNKNOWN_RECORD, rx, recordDetails, unknown);
+    }
+  }
+}
+
+// Routes a parsed frame to the handler for its type. Frames arriving
+// through a relay are unwrapped, parsed and dispatched once more.
+void dispatchFrame(const uint8_t* payload, size_t payloadLength, const PayloadBuilder::ParsedFrame& parsed, RxContext& rx) {
+  const PayloadBuilder::PayloadDetails& details = parsed.details;
+  uint8_t type = parsed.status == PayloadBuilder::PARSE_OK ? details.type : PAYLOAD_INVALID;
+  if (type != PAYLOAD_INVALID && type != PAYLOAD_TYPE_AGGREGATE && type != PAYLOAD_TYPE_RELAY) {
+    recordNode(rx, details);
+  }
+
+  if (type == 0x01) {  // GPS Payload
+    handleGPS(rx, details, parsed.gps);
+  }
+  else if (type == 0x02) {  // Predefined Message Payload
+    handlePredefinedMessage(rx, details, parsed.pMsg);
+  }
+  else if (type == 0x03 || type == PAYLOAD_TYPE_C_MSG_PACKED) {  // Custom Message Payload
+    handleCustomMessage(rx, details, payload, payloadLength);
+  }
+  else if (type == PAYLOAD_TYPE_GPS_COMPACT || type == PAYLOAD_TYPE_GPS_DELTA) {  // Compact GPS Payload
+    handleCompactGPS(rx, details, payload, payloadLength);
+  }
+  else if (type == PAYLOAD_TYPE_AGGREGATE) {  // Several records in one packet
+    handleAggregate(rx, details, payload, payloadLength);
+  }
+  else if (type == PAYLOAD_TYPE_ACK) {  // Acknowledgement of our messages
+    handleAck(rx, details, parsed.ack);
+  }
+  else if (type == PAYLOAD_TYPE_CONTROL) {  // Data-rate negotiation
+    handleControl(rx, details, parsed.control);
+  }
+  else if (type == PAYLOAD_TYPE_SLOT) {  // TDMA slot management
+    handleSlot(rx, details, parsed.slot);
+  }
+  else if (type == PAYLOAD_TYPE_RELAY && rx.hopCount == 0) {  // Frame forwarded by an intermediate node
+    rx.relayID = parsed.relay.relayID;
+    rx.hopCount = parsed.relay.hopCount;
+    PayloadBuilder::ParsedFrame inner;
+    payloadBuilder.parse(parsed.relay.frame, parsed.relay.length, inner);
+    dispatchFrame(parsed.relay.frame, parsed.relay.length, inner, rx);
+  }
+  else {
+    if (parsed.status == PayloadBuilder::PARSE_BAD_CHECKSUM) {
+      METRICS_COUNT(CHECKSUM_FAILURES, 1);
+    }
+    LogRecord invalid;
+    invalid.count = parsed.status;
+    logRecord(LOG_INVALID, rx, details, invalid);
+  }
+}
+
+// --------------------------------------------------------
+// Log Formatting
+// Runs in LoggerTask only; this is where the serial console time goes.
+// --------------------------------------------------------
+void printDetails(const PayloadBuilder::PayloadDetails& details) {
+  Serial.print("Source ID: "); Serial.println(details.sourceID);
+  Serial.print("Destination ID: "); Serial.println(details.destinationID);
+  Serial.print("Transmission ID: "); Serial.println(details.transmissionID);
+  Serial.print("Date/Time: ");
+  for (int i = 0; i < 6; i++) {
+    Serial.print(details.dateTime[i]);
+    Serial.print(" ");
+  }
+  Serial.println();
+}
+
+// Sends a received frame to the host as one binary telemetry record.
+void writeTelemetry(const LogRecord& record) {
+  TelemetryRecord telemetry = { record.rx.receivedAt, record.rx.rssi, record.rx.snr, record.data, record.dataLength };
+  uint8_t packet[TELEMETRY_MAX_PACKET_SIZE];
+  size_t packetLength = telemetry_encode(telemetry, packet, sizeof(packet));
+  if (packetLength > 0) {
+    Serial.write(packet, packetLength);
+  }
+}
+
+void printLogRecord(const LogRecord& record) {
+  if (record.kind == LOG_RAW_FRAME) {
+    writeTelemetry(record);
+    return;
+  }
+  if (record.kind == LOG_RX_OVERFLOW) {
+    Serial.print("RX ring overflow, frames dropped so far: ");
+    Serial.println(record.count);
+    return;
+  }
+  if (record.kind == LOG_GEOFENCE) {
+    const SpatialIndex::FenceEvent& fence = record.fence;
+    bool alert = fence.entered == (fence.kind == SpatialIndex::FENCE_KEEP_OUT);
+    Serial.print(alert ? "GEOFENCE ALERT: node " : "Geofence: node "); Serial.print(fence.id);
+    Serial.print(fence.entered ? " entered " : " left ");
+    Serial.print(fence.kind == SpatialIndex::FENCE_KEEP_IN ? "safe zone " : "hazard zone ");
+    Serial.println(fence.fence);
+    return;
+  }
+
+  if (record.rx.hopCount > 0) {
+    Serial.print("Relayed by node "); Serial.print(record.rx.relayID);
+    Serial.print(" (hop "); Serial.print(record.rx.hopCount); Serial.println(")");
+  }
+
+  const PayloadBuilder::PayloadDetails& details = record.details;
+  switch (record.kind) {
+    case LOG_GPS:
+      Serial.println("---- Received GPS Payload ----");
+      printDetails(details);
+      Serial.print("Longitude: "); Serial.println(record.gps.longitude, 6);
+      Serial.print("Latitude: "); Serial.println(record.gps.latitude, 6);
+      Serial.println("------------------------------");
+      break;
+    case LOG_P_MSG: {
+      Serial.println("---- Received Predefined Message Payload ----");
+      printDetails(details);
+      int displayMsgID = record.msgID + 1;
+      Serial.print("Message ID: "); Serial.println(displayMsgID);
+      const char* receivedMsgText = getMessage(displayMsgID);
+      Serial.print("Message Text: "); Serial.println(receivedMsgText);
+      Serial.println("---------------------------------------------");
+      break;
+    }
+    case LOG_C_MSG:
+      Serial.println("---- Received Custom Message Payload ----");
+      printDetails(details);
+      Serial.print("Message: ");
+      Serial.write(record.data, record.dataLength);
+      Serial.println();
+      if (details.type == PAYLOAD_TYPE_C_MSG_PACKED) {
+        Serial.print("Packed: "); Serial.print(details.dataLength);
+        Serial.print(" bytes for "); Serial.print(record.dataLength); Serial.println(" characters");
+      }
+      Serial.println("-----------------------------------------");
+      break;
+    case LOG_GPS_COMPACT:
+    case LOG_GPS_NO_KEYFRAME:
+      Serial.println(details.type == PAYLOAD_TYPE_GPS_COMPACT ? "---- Received Compact GPS Keyframe ----" : "---- Received Compact GPS Delta ----");
+      Serial.print("Source ID: "); Serial.println(details.sourceID);
+      Serial.print("Transmission ID: "); Serial.println(details.transmissionID);
+      if (record.kind == LOG_GPS_COMPACT) {
+        Serial.print("Longitude: "); Serial.println(record.gps.longitude, 6);
+        Serial.print("Latitude: "); Serial.println(record.gps.latitude, 6);
+      } else {
+        Serial.println("No keyframe for this delta, position dropped.");
+      }
+      Serial.println("---------------------------------------");
+      break;
+    case LOG_UNKNOWN_RECORD:
+      Serial.print("Skipped aggregate record of unknown type ");
+      Serial.println(details.type);
+      break;
+    case LOG_INVALID: {
+      // Indexed by parse status; a valid frame lands here only as a relay
+      // nested in another relay, or a type the base does not handle.
+      static const char* const reasons[] = { "not for the base", "truncated", "checksum error", "unknown type",
+                                             "length fields disagree with its size" };
+      Serial.print("Dropped frame: ");
+      Serial.println(record.count < sizeof(reasons) / sizeof(reasons[0]) ? reasons[record.count] : "invalid");
+      break;
+    }
+    case LOG_DUPLICATE:
+      Serial.print("Duplicate of transmission "); Serial.print(details.transmissionID);
+      Serial.print(" from source "); Serial.print(details.sourceID);
+      Serial.println(" dropped, ACK resent.");
+      break;
+    case LOG_DUPLICATE_POSITION:
+      Serial.print("Duplicate of GPS transmission "); Serial.print(details.transmissionID);
+      Serial.print(" from source "); Serial.print(details.sourceID);
+      Serial.println(" dropped.");
+      break;
+    case LOG_ACK:
+      Serial.print("ACK from source "); Serial.print(details.sourceID);
+      Serial.print(" up to transmission "); Serial.print(record.ack.transmissionID);
+      Serial.print(", map 0x"); Serial.println(record.ack.receivedMap, HEX);
+      break;
+    case LOG_CONTROL:
+      Serial.print("Data rate control from source "); Serial.print(details.sourceID);
+      if (record.control.command == CONTROL_ADR_ACCEPT) {
+        Serial.print(": accepts DR"); Serial.print(record.control.dataRate);
+        Serial.print(", hears us at "); Serial.print((int8_t)record.control.parameter); Serial.println(" dB SNR");
+      } else {
+        Serial.print(": command "); Serial.println(record.control.command);
+      }
+      break;
+    default:
+      Serial.println("Received unknown payload or checksum error.");
+      break;
+  }
+
+  const char* rssiStatus = getRSSIStatus(record.rx.rssi);
+  Serial.print("RSSI: ");
+  Serial.print(record.rx.rssi);
+  Serial.print(" dBm - ");
+  Serial.print(rssiStatus);
+  Serial.print(", SNR: ");
+  Serial.println(record.rx.snr);
+  Serial.println();
+}
+
+// SX127x packet SNR register. LoRa.packetSnr() scales it to a float,
+// which the ISR must not do, so the raw value is read directly.
+#define SX127X_REG_PKT_SNR_VALUE 0x19
+
+// Reads one SX127x register with the LoRa library's SPI settings.
+uint8_t readRadioRegister(uint8_t address) {
+  SPI.beginTransaction(SPISettings(8E6, MSBFIRST, SPI_MODE0));
+  digitalWrite(csPin, LOW);
+  SPI.transfer(address & 0x7F);
+  uint8_t value = SPI.transfer(0x00);
+  digitalWrite(csPin, HIGH);
+  SPI.endTransaction();
+  return value;
+}
+
+// --------------------------------------------------------
+// DIO0 Receive Interrupt
+// Copies the frame out of the radio FIFO into the ring and wakes the
+// receive task. If the ring is full the frame is dropped and counted.
+// The library's own DIO0 handler has already done SPI work by now; the
+// Arduino core does not register GPIO interrupts as IRAM, so this runs
+// with the flash cache enabled. No floating point here: the FPU state
+// is not saved for interrupts.
+// --------------------------------------------------------
+void onLoRaReceive(int packetSize) {
+  RxFrame* frame = rxRing.acquire();
+  if (frame == NULL) {
+    return;
+  }
+  size_t length = 0;
+  while (LoRa.available() && length < sizeof(frame->data)) {
+    frame->data[length++] = LoRa.read();
+  }
+  frame->length = length;
+  frame->rssi = LoRa.packetRssi();
+  frame->snrRaw = (int8_t)readRadioRegister(SX127X_REG_PKT_SNR_VALUE);
+  frame->receivedAt = millis();
+#ifndef METRICS_DISABLED
+  frame->receivedAtUs = micros();
+#endif
+  rxRing.commit();
+
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+  vTaskNotifyGiveFromISR(receiveTaskHandle, &higherPriorityTaskWoken);
+  portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
+
 // --------------------------------------------------------
 // Task 1: LoRa Receive Task (handles both GPS and predefined/custom messages)
+// Sleeps until the receive interrupt signals, then decodes every queued
+// frame into the log pipeline. Nothing here waits on the serial console.
 // --------------------------------------------------------
 void LoRaReceiveTask(void* pvParameters) {
+  uint32_t reportedDrops = 0;
   for (;;) {
-    int packetSize = LoRa.parsePacket();
-    if (packetSize) {
-      std::vector<uint8_t> payload;
-      while (LoRa.available()) {
-        payload.push_back(LoRa.read());
-      }
-      
-      uint8_t type = payloadBuilder.identify_type_and_check_checksum(payload);
-
-      if (type == 0x01) {  // GPS Payload
-        PayloadBuilder::GPSData gpsData = payloadBuilder.decode_gps_payload(payload);
-        PayloadBuilder::PayloadDetails details = payloadBuilder.get_payload_details(payload);
-        
-        Serial.println("---- Received GPS Payload ----");
-        Serial.print("Source ID: "); Serial.println(details.sourceID);
-        Serial.print("Destination ID: "); Serial.println(details.destinationID);
-        Serial.print("Transmission ID: "); Serial.println(details.transmissionID);
-        Serial.print("Date/Time: ");
-        for (int i = 0; i < 6; i++) {
-          Serial.print(details.dateTime[i]);
-          Serial.print(" ");
-        }
-        Serial.println();
-        Serial.print("Longitude: "); Serial.println(gpsData.longitude, 6);
-        Serial.print("Latitude: "); Serial.println(gpsData.latitude, 6);
-        Serial.println("------------------------------");
-      }
-      else if (type == 0x02) {  // Predefined Message Payload
-        PayloadBuilder::PMsgData pMsgData = payloadBuilder.decode_p_msg_payload(payload);
-        PayloadBuilder::PayloadDetails details = payloadBuilder.get_payload_details(payload);
-        
-        Serial.println("---- Received Predefined Message Payload ----");
-        Serial.print("Source ID: "); Serial.println(details.sourceID);
-        Serial.print("Destination ID: "); Serial.println(details.destinationID);
-        Serial.print("Transmission ID: "); Serial.println(details.transmissionID);
-        Serial.print("Date/Time: ");
-        for (int i = 0; i < 6; i++) {
-          Serial.print(details.dateTime[i]);
-          Serial.print(" ");
-        }
-        Serial.println();
-        int displayMsgID = pMsgData.msgID + 1;
-        Serial.print("Message ID: "); Serial.println(displayMsgID);
-        String receivedMsgText = getMessage(displayMsgID);
-        Serial.print("Message Text: "); Serial.println(receivedMsgText);
-        Serial.println("---------------------------------------------");
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    const RxFrame* frame;
+    bool journaled = false;
+    while ((frame = rxRing.peek()) != NULL) {
+      float snr = frame->snrRaw * 0.25f;
+      RxContext rx = { frame->receivedAt, frame->rssi, snr, 0, 0 };
+      // Parsed once; the dispatch and the link bookkeeping share the result.
+      PayloadBuilder::ParsedFrame parsed;
+      bool valid = payloadBuilder.parse(frame->data, frame->length, parsed);
+      if (valid && journalTaskHandle != NULL) {
+        journalRing.push(*frame);  // counted as dropped if JournalTask is behind
+        journaled = true;
       }
-      else if (type == 0x03) {  // Custom Message Payload
-        PayloadBuilder::CMsgData cMsgData = payloadBuilder.decode_c_msg_payload(payload);
-        PayloadBuilder::PayloadDetails details = payloadBuilder.get_payload_details(payload);
-        
-        Serial.println("---- Received Custom Message Payload ----");
-        Serial.print("Source ID: "); Serial.println(details.sourceID);
-        Serial.print("Destination ID: "); Serial.println(details.destinationID);
-        Serial.print("Transmission ID: "); Serial.println(details.transmissionID);
-        Serial.print("Date/Time: ");
-        for (int i = 0; i < 6; i++) {
-          Serial.print(details.dateTime[i]);
-          Serial.print(" ");
-        }
-        Serial.println();
-        Serial.print("Message: "); Serial.println(cMsgData.message.c_str());
-        Serial.println("-----------------------------------------");
+#ifdef TELEMETRY_BINARY
+      // The host decodes; only frames that pass their checksum go out.
+      if (valid) {
+        LogRecord record;
+        record.dataLength = frame->length;
+        memcpy(record.data, frame->data, frame->length);
+        logRecord(LOG_RAW_FRAME, rx, PayloadBuilder::PayloadDetails(), record);
       }
-      else {
-        Serial.println("Received unknown payload or checksum error.");
+#endif
+      // Still dispatched in binary mode: ACKs have to be sent and handled.
+      dispatchFrame(frame->data, frame->length, parsed, rx);
+      recordLinkQuality(parsed, rx);
+#ifdef TDMA_MODE
+      recordSlotActivity(parsed, rx);
+#endif
+      METRICS_COUNT(RX_PACKETS, 1);
+      METRICS_COUNT(RX_BYTES, frame->length);
+      METRICS_LATENCY_US(micros() - frame->receivedAtUs);
+      rxRing.release();
+    }
+
+    if (rxRing.dropped() != reportedDrops) {
+      reportedDrops = rxRing.dropped();
+      LogRecord overflow;
+      overflow.kind = LOG_RX_OVERFLOW;
+      overflow.count = reportedDrops;
+      logRing.push(overflow);
+    }
+    xTaskNotifyGive(loggerTaskHandle);
+    if (journaled) {
+      xTaskNotifyGive(journalTaskHandle);
+    }
+  }
+}
+
+// Prints the network data rate and the link history behind it.
+void printAdrStatus() {
+  AdrLinkTable::LinkSummary summaries[ADR_MAX_LINKS];
+  size_t count = 0;
+  xSemaphoreTake(linkMutex, portMAX_DELAY);
+  uint8_t dataRate = adr.data_rate();
+  for (size_t i = 0; i < adr.links().size(); i++) {
+    if (adr.links().summary(i, summaries[count])) count++;
+  }
+  xSemaphoreGive(linkMutex);
+
+  const AdrDataRate& rate = adr_data_rate(dataRate);
+  uint32_t now = millis();
+  Serial.print("Data rate: DR"); Serial.print(dataRate);
+  Serial.print(" (SF"); Serial.print(rate.spreadingFactor);
+  Serial.print(", "); Serial.print(rate.bandwidth / 1000); Serial.println(" kHz)");
+  for (size_t i = 0; i < count; i++) {
+    const AdrLinkTable::LinkSummary& link = summaries[i];
+    Serial.print("Node "); Serial.print(link.id);
+    Serial.print(": "); Serial.print(link.samples); Serial.print(" frames, mean RSSI ");
+    Serial.print(link.meanRssi); Serial.print(" dBm, best SNR ");
+    Serial.print(link.maxSnrDb); Serial.print(" dB, heard ");
+    Serial.print((now - link.lastHeard) / 1000); Serial.print(" s ago, supports DR");
+    Serial.println(link.recommended);
+  }
+}
+
+// Prints airtime and queueing delay per traffic class, and the duty-cycle
+// budget left.
+void printTxStatus() {
+  TxScheduler::ClassStats stats[TxScheduler::TX_CLASS_COUNT];
+  xSemaphoreTake(linkMutex, portMAX_DELAY);
+  for (int c = 0; c < TxScheduler::TX_CLASS_COUNT; c++) {
+    stats[c] = txScheduler.stats((TxScheduler::TrafficClass)c);
+  }
+  uint32_t budgetMs = txScheduler.budget_ms(millis());
+  size_t queued = txScheduler.queued();
+  xSemaphoreGive(linkMutex);
+
+  Serial.print("Duty-cycle budget: "); Serial.print(budgetMs); Serial.print(" ms airtime, ");
+  Serial.print(queued); Serial.println(" frames queued");
+  for (int c = 0; c < TxScheduler::TX_CLASS_COUNT; c++) {
+    const TxScheduler::ClassStats& cls = stats[c];
+    Serial.print(TxScheduler::class_name((TxScheduler::TrafficClass)c));
+    Serial.print(": "); Serial.print(cls.sent); Serial.print(" sent, ");
+    Serial.print((uint32_t)(cls.airtimeUs / 1000)); Serial.print(" ms airtime, delay mean ");
+    Serial.print(cls.sent ? cls.totalDelayMs / cls.sent : 0); Serial.print(" / max ");
+    Serial.print(cls.maxDelayMs); Serial.print(" ms, ");
+    Serial.print(cls.coalesced); Serial.print(" coalesced, ");
+    Serial.print(cls.dropped); Serial.println(" dropped");
+  }
+}
+
+void printStatsLine(const char* line) {
+  Serial.println(line);
+}
+
+// Prints the runtime metrics. Stack high-water marks and the ring peaks
+// are read now; everything else is counted as it happens.
+void printStats() {
+#ifndef METRICS_DISABLED
+  for (size_t i = 0; i < metrics.task_count(); i++) {
+    metrics.set_task_stack_free(i, uxTaskGetStackHighWaterMark((TaskHandle_t)metrics.task_handle(i)));
+  }
+  metrics.queue_depth(rxRingMetric, rxRing.peak());
+  metrics.queue_depth(logRingMetric, logRing.peak());
+  metrics.queue_depth(journalRingMetric, journalRing.peak());
+  metrics.report(millis(), printStatsLine);
+#else
+  Serial.println("Metrics are disabled in this build.");
+  // This runs on the console task, so it reports the console's own
+  // headroom. With metrics built in, the task table shows it.
+  Serial.print("SerialInputTask stack free: ");
+  Serial.print(uxTaskGetStackHighWaterMark(NULL));
+  Serial.println(" bytes");
+#endif
+}
+
+// Dumps the node registry, one line per node heard since boot. Entries
+// are copied out one at a time, so the receive task never waits on the
+// console for more than one copy.
+void printNodes() {
+  char line[112];
+  uint32_t now = millis();
+  size_t count = 0;
+  Serial.println(NodeRegistry::header());
+  for (size_t id = 0; id < NODE_REGISTRY_SIZE; id++) {
+    xSemaphoreTake(linkMutex, portMAX_DELAY);
+    bool known = registry.known(id);
+    NodeRegistry::Node node = registry.node(id);
+    xSemaphoreGive(linkMutex);
+    if (!known) {
+      continue;
+    }
+    NodeRegistry::format(id, node, now, line, sizeof(line));
+    Serial.println(line);
+    count++;
+  }
+  Serial.print(count); Serial.println(" nodes");
+}
+
+// Prints query results with how old each user's position is.
+void printNeighbors(const SpatialIndex::Neighbor* neighbors, size_t count) {
+  uint32_t now = millis();
+  for (size_t i = 0; i < count; i++) {
+    xSemaphoreTake(linkMutex, portMAX_DELAY);
+    uint32_t positionMs = registry.node(neighbors[i].id).positionMs;
+    xSemaphoreGive(linkMutex);
+    Serial.print("Node "); Serial.print(neighbors[i].id);
+    Serial.print(": "); Serial.print((uint32_t)(neighbors[i].distanceM + 0.5f));
+    Serial.print(" m, position "); Serial.print((now - positionMs) / 1000); Serial.println(" s old");
+  }
+  Serial.print(count); Serial.println(" nodes");
+}
+
+// "near <lat> <lon> [k]": the k (default 5) users nearest to a point.
+// "within <lat> <lon> <metres>": every user within that distance of it.
+void handleSpatialQuery(bool nearest, char* arguments) {
+  char* rest = NULL;
+  char* latitude = strtok_r(arguments, " \t", &rest);
+  char* longitude = strtok_r(NULL, " \t", &rest);
+  char* third = strtok_r(NULL, " \t", &rest);
+  if (latitude == NULL || longitude == NULL || (!nearest && third == NULL)) {
+    Serial.println(nearest ? "Usage: near <lat> <lon> [k]" : "Usage: within <lat> <lon> <metres>");
+    return;
+  }
+  SpatialIndex::Neighbor neighbors[32];
+  size_t count;
+  xSemaphoreTake(linkMutex, portMAX_DELAY);
+  if (nearest) {
+    int k = third != NULL ? atoi(third) : 5;
+    k = k < 1 ? 1 : (k > 32 ? 32 : k);
+    count = spatialIndex.nearest(atof(latitude), atof(longitude), k, neighbors);
+  } else {
+    count = spatialIndex.within(atof(latitude), atof(longitude), atof(third), neighbors, 32);
+  }
+  xSemaphoreGive(linkMutex);
+  printNeighbors(neighbors, count);
+}
+
+// "fence in|out <lat>,<lon> <lat>,<lon> <lat>,<lon> ...": a safe zone
+// (alert when a user leaves it) or a hazard (alert when one enters it).
+void handleFenceCommand(char* arguments) {
+  char* rest = NULL;
+  char* kind = strtok_r(arguments, " \t", &rest);
+  float latitudes[SPATIAL_MAX_VERTICES];
+  float longitudes[SPATIAL_MAX_VERTICES];
+  size_t vertexCount = 0;
+  bool valid = kind != NULL && (strcasecmp(kind, "in") == 0 || strcasecmp(kind, "out") == 0);
+  char* vertex;
+  while (valid && (vertex = strtok_r(NULL, " \t", &rest)) != NULL) {
+    char* comma = strchr(vertex, ',');
+    if (comma == NULL || vertexCount == SPATIAL_MAX_VERTICES) {
+      valid = false;
+      break;
+    }
+    latitudes[vertexCount] = atof(vertex);
+    longitudes[vertexCount] = atof(comma + 1);
+    vertexCount++;
+  }
+  if (!valid || vertexCount < 3) {
+    Serial.println("Usage: fence in|out <lat>,<lon> <lat>,<lon> <lat>,<lon> ... (3 to 12 corners)");
+    return;
+  }
+  SpatialIndex::FenceKind fenceKind = strcasecmp(kind, "in") == 0 ? SpatialIndex::FENCE_KEEP_IN : SpatialIndex::FENCE_KEEP_OUT;
+  xSemaphoreTake(linkMutex, portMAX_DELAY);
+  int fence = spatialIndex.add_fence(fenceKind, latitudes, longitudes, vertexCount);
+  size_t members = spatialIndex.fence_members(fence);
+  xSemaphoreGive(linkMutex);
+  if (fence < 0) {
+    Serial.println("Geofence table full.");
+    return;
+  }
+  Serial.print("Geofence "); Serial.print(fence); Serial.print(" added, ");
+  Serial.print(members); Serial.println(" users inside now");
+}
+
+// Lists the geofences and how many users are inside each.
+void printFences() {
+  for (int fence = 0; fence < SPATIAL_MAX_FENCES; fence++) {
+    xSemaphoreTake(linkMutex, portMAX_DELAY);
+    bool used = spatialIndex.fence_used(fence);
+    SpatialIndex::FenceKind kind = used ? spatialIndex.fence_kind(fence) : SpatialIndex::FENCE_KEEP_IN;
+    size_t vertices = spatialIndex.fence_vertices(fence);
+    size_t members = spatialIndex.fence_members(fence);
+    xSemaphoreGive(linkMutex);
+    if (!used) {
+      continue;
+    }
+    Serial.print("Geofence "); Serial.print(fence);
+    Serial.print(kind == SpatialIndex::FENCE_KEEP_IN ? ": safe zone, " : ": hazard zone, ");
+    Serial.print(vertices); Serial.print(" corners, ");
+    Serial.print(members); Serial.println(" users inside");
+  }
+}
+
+// Prints the heap figures the heap check works from.
+void printHeapStatus() {
+  multi_heap_info_t heap;
+  heap_caps_get_info(&heap, MALLOC_CAP_8BIT);
+  Serial.print("Heap: "); Serial.print(heap.total_free_bytes); Serial.print(" bytes free, ");
+  Serial.print(heap.allocated_blocks); Serial.print(" blocks ("); Serial.print(heap.total_allocated_bytes);
+  Serial.print(" bytes) allocated, low-water mark "); Serial.println(heap.minimum_free_bytes);
+  if (heapSnapshotTaken) {
+    Serial.print("After setup: "); Serial.print(heapAfterSetup.allocated_blocks); Serial.print(" blocks (");
+    Serial.print(heapAfterSetup.total_allocated_bytes); Serial.print(" bytes) allocated, low-water mark ");
+    Serial.println(heapAfterSetup.minimum_free_bytes);
+  }
+}
+
+// True if the heap shows any allocation made since the snapshot.
+bool heapUsedSinceSetup(const multi_heap_info_t& heap) {
+  return heap.allocated_blocks > heapAfterSetup.allocated_blocks ||
+         heap.total_allocated_bytes > heapAfterSetup.total_allocated_bytes ||
+         heap.minimum_free_bytes < heapAfterSetup.minimum_free_bytes;
+}
+
+#ifdef TDMA_MODE
+// Prints the superframe layout and how many users hold a slot.
+void printTdmaStatus() {
+  xSemaphoreTake(linkMutex, portMAX_DELAY);
+  uint8_t assigned = tdma.assigned();
+  uint16_t slotMs = tdma.slot_ms();
+  uint32_t superframeMs = tdma.superframe_ms();
+  xSemaphoreGive(linkMutex);
+
+  Serial.print("TDMA: "); Serial.print(assigned); Serial.print(" slots assigned, ");
+  Serial.print(slotMs); Serial.print(" ms per slot, superframe ");
+  Serial.print(superframeMs); Serial.println(" ms");
+}
+#endif
+
+// Where the journal stands: what flash holds and what this boot has
+// written.
+void printJournalStatus() {
+  if (journalTaskHandle == NULL) {
+    Serial.println("Journal unavailable: LittleFS did not mount.");
+    return;
+  }
+  xSemaphoreTake(journalMutex, portMAX_DELAY);
+  size_t segments = journal.segment_count();
+  uint32_t blocks = journal.stored_blocks();
+  uint32_t oldestMs = 0;
+  bool stored = journal.oldest_ms(oldestMs);
+  uint32_t now = journal.now(millis());
+  uint32_t unwrittenMs = journal.unwritten_ms(millis());
+  Journal::Stats stats = journal.stats();
+  xSemaphoreGive(journalMutex);
+
+  Serial.print("Journal: "); Serial.print(blocks); Serial.print(" blocks in ");
+  Serial.print(segments); Serial.print(" segments");
+  if (stored) {
+    Serial.print(", oldest frame "); Serial.print((now - oldestMs) / 60000); Serial.print(" min ago");
+  }
+  Serial.println();
+  Serial.print("Since boot: "); Serial.print(stats.records); Serial.print(" frames, ");
+  Serial.print(stats.blocksWritten); Serial.print(" blocks written, ");
+  Serial.print(stats.writeFailures); Serial.print(" failed writes (");
+  Serial.print(stats.recordsLost); Serial.print(" frames lost), ");
+  Serial.print(journalRing.dropped()); Serial.println(" frames not journaled");
+  if (unwrittenMs > 0) {
+    Serial.print("Open block waiting "); Serial.print(unwrittenMs / 1000); Serial.println(" s");
+  }
+}
+
+// One replayed frame. In binary telemetry mode it goes out as a telemetry
+// record stamped with journal time, so the host can take in what it missed.
+void printReplayRecord(const JournalRecord& record, uint32_t now) {
+#ifdef TELEMETRY_BINARY
+  static uint8_t packet[TELEMETRY_MAX_PACKET_SIZE];  // the console stack is small
+  TelemetryRecord telemetry = { record.timeMs, record.rssi, record.snr, record.frame, record.length };
+  size_t packetLength = telemetry_encode(telemetry, packet, sizeof(packet));
+  if (packetLength > 0) {
+    Serial.write(packet, packetLength);
+  }
+#else
+  const uint8_t* frame = record.frame;
+  size_t length = record.length;
+  PayloadBuilder::RelayView relay = payloadBuilder.decode_relay_view(frame, length);
+  if (relay.length > 0) {
+    frame = relay.frame;
+    length = relay.length;
+  }
+  PayloadBuilder::PayloadDetails details = payloadBuilder.get_payload_details(frame, length);
+  Serial.print("Replay, "); Serial.print((now - record.timeMs) / 1000); Serial.print(" s ago: node ");
+  Serial.print(record.sourceID); Serial.print(", type "); Serial.print(details.type);
+  Serial.print(", transmission "); Serial.print(details.transmissionID);
+  if (details.type == PAYLOAD_TYPE_GPS) {
+    PayloadBuilder::GPSData gps = payloadBuilder.decode_gps_payload(frame, length);
+    Serial.print(", "); Serial.print(gps.latitude, 6); Serial.print(","); Serial.print(gps.longitude, 6);
+  }
+  if (relay.length > 0) {
+    Serial.print(", via "); Serial.print(relay.relayID);
+  }
+  Serial.print(", RSSI "); Serial.print(record.rssi); Serial.print(" dBm, SNR ");
+  Serial.print(record.snr); Serial.println(" dB");
+#endif
+}
+
+// "replay <minutes> [node]": the journaled frames of the last minutes,
+// oldest first, from every node or just one.
+void handleReplayCommand(char* arguments) {
+  char* rest = NULL;
+  char* minutesText = strtok_r(arguments, " \t", &rest);
+  char* nodeText = strtok_r(NULL, " \t", &rest);
+  long minutes = minutesText != NULL ? atol(minutesText) : 0;
+  if (minutes <= 0 || minutes > 10080) {
+    Serial.println("Usage: replay <minutes, up to 10080> [node]");
+    return;
+  }
+  if (journalTaskHandle == NULL) {
+    Serial.println("Journal unavailable: LittleFS did not mount.");
+    return;
+  }
+  static Journal::Cursor cursor;
+  xSemaphoreTake(journalMutex, portMAX_DELAY);
+  uint32_t now = journal.now(millis());
+  journal.begin_replay(cursor, now - (uint32_t)minutes * 60000, now, nodeText != NULL ? atoi(nodeText) : -1);
+  xSemaphoreGive(journalMutex);
+
+  size_t count = 0;
+  for (;;) {
+    // The record points into the journal's read buffer, which only a
+    // replay touches, so it is printed after the mutex is given back.
+    JournalRecord record;
+    xSemaphoreTake(journalMutex, portMAX_DELAY);
+    bool found = journal.next(cursor, record);
+    xSemaphoreGive(journalMutex);
+    if (!found) {
+      break;
+    }
+    printReplayRecord(record, now);
+    count++;
+  }
+  xSemaphoreTake(journalMutex, portMAX_DELAY);
+  journalStorage.close_reader();
+  xSemaphoreGive(journalMutex);
+  Serial.print(count); Serial.print(" frames replayed, ");
+  Serial.print(cursor.blocksRead); Serial.print(" blocks read, ");
+  Serial.print(cursor.blocksSkipped); Serial.println(" skipped by the index");
+}
+
+// Strips leading and trailing whitespace in place.
+char* trimLine(char* line) {
+  while (*line == ' ' || *line == '\t') line++;
+  size_t length = strlen(line);
+  while (length > 0 && (line[length - 1] == ' ' || line[length - 1] == '\t')) line[--length] = '\0';
+  return line;
+}
+
+void handleConsoleLine(char* line, bool truncated) {
+  char* input = trimLine(line);
+  if (strcasecmp(input, "adr") == 0) {
+    printAdrStatus();
+  } else if (strcasecmp(input, "tx") == 0) {
+    printTxStatus();
+  } else if (strcasecmp(input, "heap") == 0) {
+    printHeapStatus();
+  } else if (strcasecmp(input, "stats") == 0) {
+    printStats();
+  } else if (strcasecmp(input, "nodes") == 0) {
+    printNodes();
+  } else if (strcasecmp(input, "journal") == 0) {
+    printJournalStatus();
+  } else if (strncasecmp(input, "replay ", 7) == 0) {
+    handleReplayCommand(input + 7);
+  } else if (strncasecmp(input, "near ", 5) == 0) {
+    handleSpatialQuery(true, input + 5);
+  } else if (strncasecmp(input, "within ", 7) == 0) {
+    handleSpatialQuery(false, input + 7);
+  } else if (strncasecmp(input, "fence ", 6) == 0) {
+    handleFenceCommand(input + 6);
+  } else if (strcasecmp(input, "fences") == 0) {
+    printFences();
+  } else if (strncasecmp(input, "unfence ", 8) == 0) {
+    xSemaphoreTake(linkMutex, portMAX_DELAY);
+    bool removed = spatialIndex.remove_fence(atoi(input + 8));
+    xSemaphoreGive(linkMutex);
+    Serial.println(removed ? "Geofence removed." : "No such geofence.");
+#ifdef TDMA_MODE
+  } else if (strcasecmp(input, "tdma") == 0) {
+    printTdmaStatus();
+#endif
+  } else if (*input != '\0') {
+    MessageCommand cmd;
+    // If input starts with "C:" treat it as a custom message.
+    if ((input[0] == 'C' || input[0] == 'c') && input[1] == ':') {
+      char* text = trimLine(input + 2);
+      size_t length = strlen(text);
+      if (truncated || length > sizeof(cmd.customText)) {
+        Serial.println("Custom message too long, not transmitted.");
+        return;
       }
-      
-      int rssi = LoRa.packetRssi();
-      String rssiStatus = getRSSIStatus(rssi);
-      Serial.print("RSSI: ");
-      Serial.print(rssi);
-      Serial.print(" dBm - ");
-      Serial.println(rssiStatus);
-      Serial.println();
+      cmd.type = CUSTOM;
+      cmd.customLength = length;
+      memcpy(cmd.customText, text, length);
+    } else {
+      // Otherwise, treat input as a predefined message number.
+      cmd.type = PREDEFINED;
+      cmd.predefinedID = atoi(input);
+    }
+    if (xQueueSend(msgQueue, &cmd, portMAX_DELAY) != pdPASS) {
+      Serial.println("Failed to send message command to queue");
     }
-    vTaskDelay(10 / portTICK_PERIOD_MS);
+    METRICS_QUEUE_DEPTH(msgQueueMetric, uxQueueMessagesWaiting(msgQueue));
+    xTaskNotifyGive(transmitTaskHandle);
   }
 }
 
 // --------------------------------------------------------
 // Task 2: Serial Input Task
 // Updated to accept both predefined commands and custom messages.
+// "adr" and "tx" print the data-rate and transmit scheduler state instead,
+// "heap" the heap figures, "stats" the runtime metrics, "nodes" the node
+// registry, "near", "within", "fence", "fences" and "unfence" query the
+// spatial index and manage geofences, "journal" and "replay" show the frame
+// journal, and "tdma" shows the slot allocation when built with TDMA_MODE.
+// Lines are collected in a fixed buffer; a longer line is cut off and
+// rejected if it was a custom message.
 // --------------------------------------------------------
+#define CONSOLE_LINE_SIZE 128
+
 void SerialInputTask(void* pvParameters) {
+  char line[CONSOLE_LINE_SIZE];
+  size_t lineLength = 0;
+  bool truncated = false;
   for (;;) {
-    if (Serial.available()) {
-      String input = Serial.readStringUntil('\n');
-      input.trim();
-      if (input.length() > 0) {
-        MessageCommand cmd;
-        // If input starts with "C:" treat it as a custom message.
-        if (input.startsWith("C:") || input.startsWith("c:")) {
-          cmd.type = CUSTOM;
-          cmd.customText = input.substring(2);
-          cmd.customText.trim();
-        } else {
-          // Otherwise, treat input as a predefined message number.
-          cmd.type = PREDEFINED;
-          cmd.predefinedID = input.toInt();
-        }
-        if (xQueueSend(msgQueue, &cmd, portMAX_DELAY) != pdPASS) {
-          Serial.println("Failed to send message command to queue");
-        }
+    while (Serial.available()) {
+      char c = Serial.read();
+      if (c == '\n' || c == '\r') {
+        line[lineLength] = '\0';
+        handleConsoleLine(line, truncated);
+        lineLength = 0;
+        truncated = false;
+      } else if (lineLength < sizeof(line) - 1) {
+        line[lineLength++] = c;
+      } else {
+        truncated = true;
       }
     }
     vTaskDelay(50 / portTICK_PERIOD_MS);
@@ -209,36 +1378,333 @@ void SerialInputTask(void* pvParameters) {
 
 // --------------------------------------------------------
 // Task 3: LoRa Transmit Task
-// Now handles both predefined and custom messages.
+// Hands commands to the reliable link and puts every frame it has due on
+// air: first transmissions, retransmissions, ACKs and data-rate control,
+// ordered by the transmit scheduler. Wakes on a new command, on a received
+// frame, when the next retransmit or data-rate timer expires, or when the
+// duty-cycle budget covers the next queued frame. In TDMA mode it also
+// sends the beacons, and queued frames only go out in the downlink slots.
 // --------------------------------------------------------
+void transmitFrame(const uint8_t* frame, size_t length) {
+  // Detach the receive interrupt while this task drives the radio,
+  // then return to continuous receive.
+  LoRa.onReceive(NULL);
+  LoRa.beginPacket();
+  LoRa.write(frame, length);
+  LoRa.endPacket();
+  METRICS_COUNT(TX_PACKETS, 1);
+  METRICS_COUNT(TX_BYTES, length);
+  LoRa.onReceive(onLoRaReceive);
+  LoRa.receive();
+}
+
+// Retunes the radio once a data-rate switch is due and returns to receive.
+void applyDataRate(uint8_t dataRate) {
+  const AdrDataRate& rate = adr_data_rate(dataRate);
+  LoRa.onReceive(NULL);
+  LoRa.idle();
+  LoRa.setSpreadingFactor(rate.spreadingFactor);
+  LoRa.setSignalBandwidth(rate.bandwidth);
+  LoRa.onReceive(onLoRaReceive);
+  LoRa.receive();
+  radioDataRate = dataRate;
+
+  Serial.print("Data rate now DR"); Serial.print(dataRate);
+  Serial.print(" (SF"); Serial.print(rate.spreadingFactor);
+  Serial.print(", "); Serial.print(rate.bandwidth / 1000); Serial.println(" kHz)");
+}
+
+TxScheduler::TrafficClass recordClass(uint8_t type, uint8_t msgID) {
+  if (type == PAYLOAD_TYPE_P_MSG) {
+    return isEmergencyBaseMessage(msgID) ? TxScheduler::TX_EMERGENCY : TxScheduler::TX_PREDEFINED;
+  }
+  if (type == PAYLOAD_TYPE_C_MSG || type == PAYLOAD_TYPE_C_MSG_PACKED) return TxScheduler::TX_CUSTOM;
+  if (type == PAYLOAD_TYPE_ACK || type == PAYLOAD_TYPE_CONTROL) return TxScheduler::TX_CONTROL;
+  return TxScheduler::TX_GPS;
+}
+
+// Hands a frame to the scheduler. An aggregate takes the class of its most
+// urgent record. A retransmission replaces its own copy if that is still
+// queued, and a newer ACK to a peer replaces an older one.
+void scheduleFrame(const uint8_t* frame, size_t length, uint32_t now) {
+  uint8_t type = PayloadBuilder::frame_type(frame[0]);
+  PayloadBuilder::PayloadDetails details = payloadBuilder.get_payload_details(frame, length);
+  TxScheduler::TrafficClass trafficClass = TxScheduler::TX_GPS;
+  uint32_t key = 0;
+
+  if (type == PAYLOAD_TYPE_AGGREGATE) {
+    PayloadBuilder::AggregateReader reader(frame, length);
+    PayloadBuilder::AggregateRecord record;
+    while (reader.next(record)) {
+      uint8_t msgID = record.type == PAYLOAD_TYPE_P_MSG ? payloadBuilder.decode_p_msg_record(record).msgID : 0;
+      TxScheduler::TrafficClass recordTrafficClass = recordClass(record.type, msgID);
+      if (recordTrafficClass < trafficClass) {
+        trafficClass = recordTrafficClass;
+      }
+    }
+  } else {
+    uint8_t msgID = type == PAYLOAD_TYPE_P_MSG ? payloadBuilder.decode_p_msg_payload(frame, length).msgID : 0;
+    trafficClass = recordClass(type, msgID);
+    if (type == PAYLOAD_TYPE_P_MSG || type == PAYLOAD_TYPE_C_MSG || type == PAYLOAD_TYPE_C_MSG_PACKED) {
+      key = ((uint32_t)type << 24) | ((uint32_t)details.destinationID << 16) | details.transmissionID;
+    } else if (type == PAYLOAD_TYPE_ACK) {
+      key = ((uint32_t)type << 24) | ((uint32_t)details.destinationID << 16);
+    }
+  }
+  txScheduler.enqueue(trafficClass, frame, length, now, key);
+  METRICS_QUEUE_DEPTH(txQueueMetric, txScheduler.queued());
+}
+
 void LoRaTransmitTask(void* pvParameters) {
-  uint16_t transmissionID = 0;
   MessageCommand cmd;
+  bool holding = false;  // cmd is waiting for room in the user's window
+  uint32_t reportedFailures = 0;
   for (;;) {
-    if (xQueueReceive(msgQueue, &cmd, portMAX_DELAY) == pdPASS) {
-      std::vector<uint8_t> txPayload;
+    xSemaphoreTake(linkMutex, portMAX_DELAY);
+    uint32_t wait = link.time_to_next_event(millis());
+    uint32_t adrWait = adr.time_to_next_event(millis());
+    uint32_t budgetWait = txScheduler.time_to_next_event(millis());
+#ifdef TDMA_MODE
+    uint32_t tdmaWait = tdma.time_to_next_event(millis());
+    if (tdma.downlink_remaining_us(millis()) == 0) {
+      budgetWait = UINT32_MAX;  // queued frames wait for the next downlink slots
+    }
+    if (tdmaWait < budgetWait) {
+      budgetWait = tdmaWait;
+    }
+#endif
+    xSemaphoreGive(linkMutex);
+    if (adrWait < wait) {
+      wait = adrWait;
+    }
+    if (budgetWait < wait) {
+      wait = budgetWait;
+    }
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait) + 1);
+
+    if (!holding) {
+      holding = xQueueReceive(msgQueue, &cmd, 0) == pdPASS;
+    }
+    while (holding) {
+      xSemaphoreTake(linkMutex, portMAX_DELAY);
+      bool room = link.can_send(userID);
+      bool queued = false;
+      if (room && cmd.type == PREDEFINED) {
+        queued = link.send_p_msg(userID, (uint8_t)(cmd.predefinedID - 1), millis());
+      } else if (room && cmd.type == CUSTOM) {
+        queued = link.send_c_msg(userID, cmd.customText, cmd.customLength, millis());
+      }
+      xSemaphoreGive(linkMutex);
+      if (!room) {
+        break;  // retried once an ACK frees a slot
+      }
+
       if (cmd.type == PREDEFINED) {
-        txPayload = payloadBuilder.create_p_msg_payload(transmissionID, (uint8_t)(cmd.predefinedID - 1));
-        String msgText = getBaseMessage(cmd.predefinedID);
+        const char* msgText = getBaseMessage(cmd.predefinedID);
         Serial.print("Transmitted base predefined message with msgID: ");
         Serial.print(cmd.predefinedID);
         Serial.print(" - ");
         Serial.println(msgText);
-      } else if (cmd.type == CUSTOM) {
-        txPayload = payloadBuilder.create_c_msg_payload(transmissionID, std::string(cmd.customText.c_str()));
+      } else if (queued) {
         Serial.print("Transmitted custom message: ");
-        Serial.println(cmd.customText);
+        Serial.write(reinterpret_cast<const uint8_t*>(cmd.customText), cmd.customLength);
+        Serial.println();
+      } else {
+        Serial.println("Custom message too long, not transmitted.");
+      }
+      holding = xQueueReceive(msgQueue, &cmd, 0) == pdPASS;
+    }
+
+    // Frames are encoded into a stack buffer and copied into the scheduler,
+    // so a transmit never touches the heap. Everything due is queued first,
+    // then sent in priority order as far as the duty-cycle budget allows.
+    for (;;) {
+      PayloadBuilder::Buffer txPayload;
+      xSemaphoreTake(linkMutex, portMAX_DELAY);
+      uint32_t now = millis();
+      size_t txLength = adr.poll(now, txPayload.data(), txPayload.size());
+      if (txLength == 0) {
+        txLength = link.poll(now, txPayload.data(), txPayload.size());
+      }
+      if (txLength > 0) {
+        scheduleFrame(txPayload.data(), txLength, now);
+      }
+      uint32_t failures = link.stats().failed;
+      if (failures != reportedFailures) {
+        // A user stopped answering; it may have fallen back already.
+        adr.fallback(now);
+      }
+      uint8_t dataRate = adr.data_rate();
+      if (dataRate != radioDataRate) {
+        txScheduler.set_modem_config(adr_modem_config(dataRate, lora_default_config()));
+#ifdef TDMA_MODE
+        tdma.set_modem_config(adr_modem_config(dataRate, lora_default_config()));
+#endif
+      }
+      xSemaphoreGive(linkMutex);
+
+      if (dataRate != radioDataRate) {
+        applyDataRate(dataRate);
+      }
+      if (failures != reportedFailures) {
+        reportedFailures = failures;
+        Serial.print("Message not acknowledged after ");
+        Serial.print(RELIABLE_MAX_ATTEMPTS);
+        Serial.print(" attempts, undelivered so far: ");
+        Serial.println(failures);
+      }
+      if (txLength == 0) {
+        break;
+      }
+    }
+
+#ifdef TDMA_MODE
+    // The beacon has to go out on time, so it skips the queues; its airtime
+    // still comes out of the budget. Slot assignments follow it.
+    for (;;) {
+      PayloadBuilder::Buffer txPayload;
+      xSemaphoreTake(linkMutex, portMAX_DELAY);
+      size_t txLength = tdma.poll(millis(), txPayload.data(), txPayload.size());
+      if (txLength > 0) {
+        txScheduler.charge(millis(), txLength);
+      }
+      xSemaphoreGive(linkMutex);
+      if (txLength == 0) {
+        break;
+      }
+      transmitFrame(txPayload.data(), txLength);
+    }
+#endif
+
+    for (;;) {
+      PayloadBuilder::Buffer txPayload;
+      xSemaphoreTake(linkMutex, portMAX_DELAY);
+#ifdef TDMA_MODE
+      size_t txLength = txScheduler.next(millis(), txPayload.data(), txPayload.size(), tdma.downlink_remaining_us(millis()));
+#else
+      size_t txLength = txScheduler.next(millis(), txPayload.data(), txPayload.size());
+#endif
+      xSemaphoreGive(linkMutex);
+      if (txLength == 0) {
+        break;
       }
-      
-      LoRa.beginPacket();
-      for (uint8_t byte : txPayload) {
-        LoRa.write(byte);
+      transmitFrame(txPayload.data(), txLength);
+    }
+  }
+}
+
+// --------------------------------------------------------
+// Task 4: Logger Task
+// Lowest-priority task on the core opposite the receive task. Formats
+// queued records to the serial console and reports records lost because
+// the console could not keep up, any heap use since setup(), and nodes
+// that went silent or came back (checked at least every
+// HEAP_CHECK_INTERVAL_MS).
+// --------------------------------------------------------
+void LoggerTask(void* pvParameters) {
+  uint32_t reportedDrops = 0;
+  multi_heap_info_t reportedHeap = {};
+  LogRecord record;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(HEAP_CHECK_INTERVAL_MS));
+
+    while (logRing.pop(record)) {
+      printLogRecord(record);
+    }
+
+    if (logRing.dropped() != reportedDrops) {
+      reportedDrops = logRing.dropped();
+      Serial.print("Log pipeline overflow, records dropped so far: ");
+      Serial.println(reportedDrops);
+    }
+
+    multi_heap_info_t heap;
+    heap_caps_get_info(&heap, MALLOC_CAP_8BIT);
+    if (heapSnapshotTaken && heapUsedSinceSetup(heap) &&
+        (heap.allocated_blocks != reportedHeap.allocated_blocks ||
+         heap.total_allocated_bytes != reportedHeap.total_allocated_bytes ||
+         heap.minimum_free_bytes != reportedHeap.minimum_free_bytes)) {
+      reportedHeap = heap;
+      Serial.print("Heap used after setup: ");
+      Serial.print((int32_t)(heap.allocated_blocks - heapAfterSetup.allocated_blocks)); Serial.print(" blocks, ");
+      Serial.print((int32_t)(heap.total_allocated_bytes - heapAfterSetup.total_allocated_bytes));
+      Serial.print(" bytes more allocated, low-water mark down ");
+      Serial.print((int32_t)(heapAfterSetup.minimum_free_bytes - heap.minimum_free_bytes));
+      Serial.println(" bytes");
+    }
+
+    NodeRegistry::Alert alert;
+    for (;;) {
+      xSemaphoreTake(linkMutex, portMAX_DELAY);
+      bool pending = registry.next_alert(millis(), alert);
+      xSemaphoreGive(linkMutex);
+      if (!pending) {
+        break;
       }
-      LoRa.endPacket();
-      
-      transmissionID++;
+      Serial.print("Node "); Serial.print(alert.id);
+      Serial.print(alert.type == NodeRegistry::ALERT_STALE ? " not heard for " : " heard again after ");
+      Serial.print(alert.silentMs / 1000); Serial.println(" s");
+    }
+  }
+}
+
+// --------------------------------------------------------
+// Task 5: Journal Task
+// Appends the frames LoRaReceiveTask copied into journalRing and does the
+// flash writes: a block as soon as it is full, a partly filled one once
+// its oldest frame has waited JOURNAL_FLUSH_MS, and one holding a message
+// right away. A block write takes tens of ms, so this runs at the lowest
+// priority on the core opposite the receive task.
+// --------------------------------------------------------
+// The node a frame is journaled under (its originator, also when it came
+// through a relay), and whether it carries a message.
+uint8_t journalSource(const uint8_t* frame, size_t length, bool& message) {
+  PayloadBuilder::RelayView relay = payloadBuilder.decode_relay_view(frame, length);
+  if (relay.length > 0) {
+    frame = relay.frame;
+    length = relay.length;
+  }
+  uint8_t type = PayloadBuilder::frame_type(frame[0]);
+  message = type == PAYLOAD_TYPE_P_MSG || type == PAYLOAD_TYPE_C_MSG || type == PAYLOAD_TYPE_C_MSG_PACKED ||
+            type == PAYLOAD_TYPE_AGGREGATE;
+  return payloadBuilder.get_payload_details(frame, length).sourceID;
+}
+
+void JournalTask(void* pvParameters) {
+  uint32_t reportedFailures = 0;
+  for (;;) {
+    xSemaphoreTake(journalMutex, portMAX_DELAY);
+    uint32_t waited = journal.unwritten_ms(millis());
+    xSemaphoreGive(journalMutex);
+    TickType_t wait = portMAX_DELAY;
+    if (waited > 0) {
+      wait = waited >= JOURNAL_FLUSH_MS ? 0 : pdMS_TO_TICKS(JOURNAL_FLUSH_MS - waited) + 1;
+    }
+    ulTaskNotifyTake(pdTRUE, wait);
+
+    bool message = false;
+    const RxFrame* frame;
+    while ((frame = journalRing.peek()) != NULL) {
+      bool carriesMessage = false;
+      uint8_t sourceID = journalSource(frame->data, frame->length, carriesMessage);
+      message = message || carriesMessage;
+      xSemaphoreTake(journalMutex, portMAX_DELAY);
+      journal.append(frame->receivedAt, frame->rssi, frame->snrRaw * 0.25f, sourceID, frame->data, frame->length);
+      xSemaphoreGive(journalMutex);
+      journalRing.release();
+    }
+
+    xSemaphoreTake(journalMutex, portMAX_DELAY);
+    if (message || journal.unwritten_ms(millis()) >= JOURNAL_FLUSH_MS) {
+      journal.flush();
+    }
+    uint32_t failures = journal.stats().writeFailures;
+    xSemaphoreGive(journalMutex);
+    if (failures != reportedFailures) {
+      reportedFailures = failures;
+      Serial.print("Journal write failed, failures so far: ");
+      Serial.println(failures);
     }
-    vTaskDelay(10 / portTICK_PERIOD_MS);
   }
 }
 
@@ -246,7 +1712,7 @@ void LoRaTransmitTask(void* pvParameters) {
 // Setup: Print base station messages and initialize modules and tasks.
 // --------------------------------------------------------
 void setup() {
-  Serial.begin(9600);
+  Serial.begin(serialBaud);
   while (!Serial);
   
   Serial.println("Base Station Starting...");
@@ -266,18 +1732,80 @@ void setup() {
     while (1);
   }
   Serial.println("LoRa init succeeded.");
+  // Every node starts on the slowest, longest-range data rate.
+  LoRa.setSpreadingFactor(adr_data_rate(ADR_SAFE_DATA_RATE).spreadingFactor);
+  LoRa.setSignalBandwidth(adr_data_rate(ADR_SAFE_DATA_RATE).bandwidth);
   
-  payloadBuilder.configure_device(0x02, 0x01);
-  
-  msgQueue = xQueueCreate(10, sizeof(MessageCommand));
-  if (msgQueue == NULL) {
-    Serial.println("Failed to create message queue.");
-    while (1);
+  payloadBuilder.configure_device(baseID, userID);
+  // The tasks share this builder and read its time base unlocked, so it
+  // is read here, before any of them starts.
+  payloadBuilder.sync_time_base();
+  payloadBuilder.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  link.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  // Custom messages from the console go out packed when that is shorter;
+  // up to C_MSG_TEXT_MAX_LENGTH characters fit in one frame that way.
+  link.set_text_compression(true);
+  // Messages and piggybacked ACKs carry the compact v2 header; users read
+  // both versions.
+  link.set_header_version(PayloadBuilder::HEADER_V2);
+  adr.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  txScheduler.set_modem_config(adr_modem_config(ADR_SAFE_DATA_RATE, lora_default_config()));
+#ifdef TDMA_MODE
+  tdma.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  tdma.set_modem_config(adr_modem_config(ADR_SAFE_DATA_RATE, lora_default_config()));
+#endif
+
+  linkMutex = xSemaphoreCreateMutexStatic(&linkMutexBuffer);
+  journalMutex = xSemaphoreCreateMutexStatic(&journalMutexBuffer);
+  bool journalReady = journalStorage.begin();
+  if (journalReady) {
+    journal.mount();
+    journalStorage.open_write_segment(journal.write_segment());
+    Serial.print("Journal: "); Serial.print(journal.stored_blocks());
+    Serial.print(" blocks in "); Serial.print(journal.segment_count()); Serial.println(" segments");
+  } else {
+    Serial.println("Journal unavailable: LittleFS did not mount.");
   }
-  
-  xTaskCreatePinnedToCore(LoRaReceiveTask, "LoRaReceiveTask", 4096, NULL, 1, NULL, 1);
-  xTaskCreatePinnedToCore(SerialInputTask, "SerialInputTask", 2048, NULL, 1, NULL, 0);
-  xTaskCreatePinnedToCore(LoRaTransmitTask, "LoRaTransmitTask", 4096, NULL, 1, NULL, 0);
+  msgQueue = xQueueCreateStatic(10, sizeof(MessageCommand), msgQueueStorage, &msgQueueBuffer);
+#ifndef METRICS_DISABLED
+  msgQueueMetric = metrics.add_queue("msgQueue", 10);
+  rxRingMetric = metrics.add_queue("rxRing", rxRing.capacity());
+  logRingMetric = metrics.add_queue("logRing", logRing.capacity());
+  txQueueMetric = metrics.add_queue("txScheduler", TX_QUEUE_DEPTH * TxScheduler::TX_CLASS_COUNT);
+  journalRingMetric = metrics.add_queue("journalRing", journalRing.capacity());
+#endif
+
+  receiveTaskHandle = xTaskCreateStaticPinnedToCore(LoRaReceiveTask, "LoRaReceiveTask", sizeof(receiveTaskStack), NULL, 2,
+                                                    receiveTaskStack, &receiveTaskBuffer, 1);
+  transmitTaskHandle = xTaskCreateStaticPinnedToCore(LoRaTransmitTask, "LoRaTransmitTask", sizeof(transmitTaskStack), NULL, 1,
+                                                     transmitTaskStack, &transmitTaskBuffer, 0);
+  loggerTaskHandle = xTaskCreateStaticPinnedToCore(LoggerTask, "LoggerTask", sizeof(loggerTaskStack), NULL, tskIDLE_PRIORITY + 1,
+                                                   loggerTaskStack, &loggerTaskBuffer, 0);
+  if (journalReady) {
+    journalTaskHandle = xTaskCreateStaticPinnedToCore(JournalTask, "JournalTask", sizeof(journalTaskStack), NULL, tskIDLE_PRIORITY + 1,
+                                                      journalTaskStack, &journalTaskBuffer, 0);
+  }
+  // Last: console commands notify the transmit task.
+  TaskHandle_t serialTaskHandle = xTaskCreateStaticPinnedToCore(SerialInputTask, "SerialInputTask", sizeof(serialTaskStack), NULL, 1,
+                                                                serialTaskStack, &serialTaskBuffer, 0);
+#ifndef METRICS_DISABLED
+  metrics.add_task("LoRaReceiveTask", receiveTaskHandle, sizeof(receiveTaskStack));
+  metrics.add_task("LoRaTransmitTask", transmitTaskHandle, sizeof(transmitTaskStack));
+  metrics.add_task("LoggerTask", loggerTaskHandle, sizeof(loggerTaskStack));
+  if (journalTaskHandle != NULL) {
+    metrics.add_task("JournalTask", journalTaskHandle, sizeof(journalTaskStack));
+  }
+  metrics.add_task("SerialInputTask", serialTaskHandle, sizeof(serialTaskStack));
+#else
+  (void)serialTaskHandle;
+#endif
+
+  // Reception is interrupt driven from here on.
+  LoRa.onReceive(onLoRaReceive);
+  LoRa.receive();
+
+  heap_caps_get_info(&heapAfterSetup, MALLOC_CAP_8BIT);
+  heapSnapshotTaken = true;
 }
 
 // --------------------------------------------------------
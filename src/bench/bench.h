@@ -0,0 +1,74 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Fixed iteration counts and repeat counts keep results comparable between
+// runs; the reported figure is the fastest repeat, which filters out most
+// scheduler noise on a desktop host.
+#define BENCH_ITERATIONS 200000
+#define BENCH_REPEATS 7
+
+struct AllocStats {
+  size_t count;
+  size_t bytes;
+};
+
+// Maintained by the global operator new in main.cpp.
+AllocStats alloc_snapshot();
+
+// Results are folded into this so the optimiser cannot drop the work.
+extern volatile uint32_t benchSink;
+
+struct BenchResult {
+  const char* name;
+  double nsPerOp;
+  double allocsPerOp;
+  double bytesPerOp;
+};
+
+void print_bench_header(const char* suite);
+void print_bench_result(const BenchResult& result);
+
+template <typename Fn>
+BenchResult run_bench(const char* name, Fn fn, size_t iterations = BENCH_ITERATIONS) {
+  for (size_t i = 0; i < iterations / 10; i++) fn(i);  // warm-up
+
+  double best = 0;
+  AllocStats allocs = {0, 0};
+  for (int repeat = 0; repeat < BENCH_REPEATS; repeat++) {
+    AllocStats before = alloc_snapshot();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) fn(i);
+    auto end = std::chrono::steady_clock::now();
+    AllocStats after = alloc_snapshot();
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+    if (repeat == 0 || ns < best) best = ns;
+    allocs.count = after.count - before.count;
+    allocs.bytes = after.bytes - before.bytes;
+  }
+
+  BenchResult result = {name, best, (double)allocs.count / iterations, (double)allocs.bytes / iterations};
+  print_bench_result(result);
+  return result;
+}
+
+void run_codec_benchmarks();
+void run_airtime_report();
+void run_ring_benchmarks();
+void run_telemetry_benchmarks();
+void run_scheduler_report();
+void run_display_report();
+void run_metrics_benchmarks();
+void run_text_codec_benchmarks();
+void run_registry_benchmarks();
+void run_spatial_benchmarks();
+void run_journal_benchmarks();
+// Returns false if the steady state allocated.
+bool run_soak_report();
+
+#endif // BENCH_H
@@ -0,0 +1,132 @@
+#include "bench.h"
+#include "payload_builder.h"
+#include "lora_airtime.h"
+#include "adr.h"
+
+// Airtime per position report for each GPS frame format, the data rate
+// ADR picks for a given link, and the cost of the compact codec itself.
+
+static void print_airtime_row(const char* name, size_t length, const LoRaModemConfig& config, uint32_t baseline) {
+  uint32_t airtime = lora_time_on_air_us(config, length);
+  double saving = 100.0 * (1.0 - (double)airtime / baseline);
+  std::printf("%-36s %6zu %12.1f %10.1f%%\n", name, length, airtime / 1000.0, saving);
+}
+
+void run_airtime_report() {
+  PayloadBuilder builder;
+  builder.configure_device(0x01, 0x02);
+
+  size_t gpsLength = builder.create_gps_payload(1, 79.9005f, 6.9271f).size();
+  size_t keyLength = builder.create_gps_compact_payload(2, 79.9005f, 6.9271f).size();
+  builder.set_gps_delta_mode(true);
+  builder.create_gps_compact_payload(3, 79.9005f, 6.9271f);
+  size_t deltaLength = builder.create_gps_compact_payload(4, 79.9010f, 6.9275f).size();
+
+  PayloadBuilder crcBuilder;
+  crcBuilder.configure_device(0x01, 0x02);
+  crcBuilder.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  crcBuilder.set_gps_delta_mode(true);
+  size_t gpsCrcLength = crcBuilder.create_gps_payload(1, 79.9005f, 6.9271f).size();
+  size_t keyCrcLength = crcBuilder.create_gps_compact_payload(2, 79.9005f, 6.9271f).size();
+  size_t deltaCrcLength = crcBuilder.create_gps_compact_payload(3, 79.9010f, 6.9275f).size();
+  // A transmission ID of 300 takes 2 varint bytes, as most do.
+  crcBuilder.set_header_version(PayloadBuilder::HEADER_V2);
+  size_t gpsV2CrcLength = crcBuilder.create_gps_payload(300, 79.9005f, 6.9271f).size();
+
+  for (uint8_t sf = 7; sf <= 12; sf++) {
+    LoRaModemConfig config = lora_default_config();
+    config.spreadingFactor = sf;
+    config.crc = true;
+
+    uint32_t baseline = lora_time_on_air_us(config, gpsLength);
+    uint32_t mixed = (lora_time_on_air_us(config, keyLength) +
+                      GPS_DEFAULT_KEYFRAME_INTERVAL * lora_time_on_air_us(config, deltaLength)) /
+                     (GPS_DEFAULT_KEYFRAME_INTERVAL + 1);
+
+    std::printf("\n== Airtime per GPS report, SF%u/125 kHz CR4/5, CRC on ==\n", sf);
+    std::printf("%-36s %6s %12s %11s\n", "frame", "bytes", "airtime ms", "saving");
+    print_airtime_row("gps (float, 12-byte header)", gpsLength, config, baseline);
+    print_airtime_row("gps compact keyframe", keyLength, config, baseline);
+    print_airtime_row("gps compact delta", deltaLength, config, baseline);
+    std::printf("%-36s %6s %12.1f %10.1f%%\n", "delta mode stream (1 key : 8 delta)", "-",
+                mixed / 1000.0, 100.0 * (1.0 - (double)mixed / baseline));
+    print_airtime_row("gps, crc16 trailer", gpsCrcLength, config, baseline);
+    print_airtime_row("gps, v2 header, crc16 trailer", gpsV2CrcLength, config, baseline);
+    print_airtime_row("gps compact keyframe, crc16 trailer", keyCrcLength, config, baseline);
+    print_airtime_row("gps compact delta, crc16 trailer", deltaCrcLength, config, baseline);
+  }
+
+  // Four GPS reports and four predefined messages, sent one packet each or
+  // as a single aggregate frame.
+  PayloadBuilder::Buffer aggregate;
+  PayloadBuilder::AggregateWriter writer;
+  builder.begin_aggregate_payload(writer, aggregate, 5);
+  for (uint8_t r = 0; r < 4; r++) {
+    builder.append_gps_record(writer, r, r, 79.9005f, 6.9271f);
+    builder.append_p_msg_record(writer, r, r, r);
+  }
+  size_t aggregateLength = builder.finish_aggregate_payload(writer);
+  size_t pMsgLength = builder.create_p_msg_payload(6, 1).size();
+
+  std::printf("\n== Airtime for 4 GPS + 4 predefined messages, CRC on ==\n");
+  std::printf("%-10s %18s %18s %11s\n", "modem", "separate ms", "aggregate ms", "saving");
+  for (uint8_t sf = 7; sf <= 12; sf++) {
+    LoRaModemConfig config = lora_default_config();
+    config.spreadingFactor = sf;
+    config.crc = true;
+    uint32_t separate = 4 * (lora_time_on_air_us(config, gpsLength) + lora_time_on_air_us(config, pMsgLength));
+    uint32_t combined = lora_time_on_air_us(config, aggregateLength);
+    std::printf("SF%-8u %18.1f %18.1f %10.1f%%\n", sf, separate / 1000.0, combined / 1000.0,
+                100.0 * (1.0 - (double)combined / separate));
+  }
+
+  // The rate ADR settles on for a link heard at a given SNR, and what a
+  // compact keyframe then costs compared with the fixed safe rate.
+  std::printf("\n== ADR data rate by link SNR, %d dB margin, compact keyframe, CRC on ==\n", ADR_DEFAULT_MARGIN_DB);
+  std::printf("%-10s %6s %14s %12s %11s\n", "SNR dB", "rate", "modem", "airtime ms", "saving");
+  LoRaModemConfig safeConfig = lora_default_config();
+  safeConfig.crc = true;
+  safeConfig = adr_modem_config(ADR_SAFE_DATA_RATE, safeConfig);
+  uint32_t safeAirtime = lora_time_on_air_us(safeConfig, keyCrcLength);
+  const float linkSnr[] = {10.0f, 5.0f, 0.0f, -2.5f, -5.0f, -7.5f, -10.0f, -15.0f};
+  for (float snr : linkSnr) {
+    AdrLinkTable links;
+    for (int sample = 0; sample < ADR_MIN_SAMPLES; sample++) {
+      links.record(0x01, -100, snr, ADR_SAFE_DATA_RATE, sample * 1000);
+    }
+    uint8_t dataRate = links.recommend(0x01);
+    LoRaModemConfig config = adr_modem_config(dataRate, safeConfig);
+    uint32_t airtime = lora_time_on_air_us(config, keyCrcLength);
+    char modem[24];
+    std::snprintf(modem, sizeof(modem), "SF%u/%u kHz", config.spreadingFactor, (unsigned)(config.bandwidth / 1000));
+    std::printf("%-10.1f %5s%u %14s %12.1f %10.1f%%\n", snr, "DR", dataRate, modem, airtime / 1000.0,
+                100.0 * (1.0 - (double)airtime / safeAirtime));
+  }
+
+  PayloadBuilder encoder;
+  encoder.configure_device(0x01, 0x02);
+  encoder.set_gps_delta_mode(true);
+  PayloadBuilder::Buffer keyframe;
+  size_t keyframeLength = encoder.encode_gps_compact_payload(keyframe, 10, 79.9005f, 6.9271f);
+  PayloadBuilder::Buffer delta;
+  size_t deltaFrameLength = encoder.encode_gps_compact_payload(delta, 11, 79.9010f, 6.9275f);
+
+  print_bench_header("Compact GPS codec");
+  run_bench("encode_gps_compact_payload (delta mode)", [&](size_t i) {
+    PayloadBuilder::Buffer frame;
+    size_t length = encoder.encode_gps_compact_payload(frame, i, 79.9005f + (i % 64) * 1e-5f, 6.9271f);
+    benchSink += frame[length - 1];
+  });
+  run_bench("decode_gps_compact_payload (keyframe)", [&](size_t) {
+    PayloadBuilder::GPSTrackState track = {};
+    PayloadBuilder::GPSData data;
+    benchSink += encoder.decode_gps_compact_payload(keyframe.data(), keyframeLength, track, data);
+  });
+  PayloadBuilder::GPSTrackState track = {};
+  PayloadBuilder::GPSData data;
+  encoder.decode_gps_compact_payload(keyframe.data(), keyframeLength, track, data);
+  run_bench("decode_gps_compact_payload (delta)", [&](size_t) {
+    PayloadBuilder::GPSData out;
+    benchSink += encoder.decode_gps_compact_payload(delta.data(), deltaFrameLength, track, out);
+  });
+}
@@ -0,0 +1,187 @@
+#include "bench.h"
+#include "payload_builder.h"
+#include <vector>
+#include <string>
+
+// Encode, decode and checksum cost for the three frame types, through both
+// the vector API and the allocation-free buffer API, and a received frame
+// taken in by parse() against the separate identify, details and decode
+// calls it replaces.
+
+static const char* customText = "I am trapped, please rescue. Two people, one injured.";
+
+// The checksum check as it was before the pointer/length API: copy all but
+// the last byte into a temporary vector, then XOR it.
+static uint8_t legacy_check(const std::vector<uint8_t>& payload) {
+  std::vector<uint8_t> data(payload.begin(), payload.end() - 1);
+  uint8_t checksum = 0;
+  for (uint8_t byte : data) checksum ^= byte;
+  return checksum == payload.back() ? payload[0] : PAYLOAD_INVALID;
+}
+
+void run_codec_benchmarks() {
+  PayloadBuilder builder;
+  builder.configure_device(0x01, 0x02);
+  std::string customString(customText);
+  size_t customLength = customString.size();
+
+  print_bench_header("PayloadBuilder encode");
+  run_bench("create_gps_payload (vector)", [&](size_t i) {
+    std::vector<uint8_t> frame = builder.create_gps_payload(i, 79.9005f, 6.9271f);
+    benchSink += frame.back();
+  });
+  run_bench("create_p_msg_payload (vector)", [&](size_t i) {
+    std::vector<uint8_t> frame = builder.create_p_msg_payload(i, i % 10);
+    benchSink += frame.back();
+  });
+  run_bench("create_c_msg_payload (vector)", [&](size_t i) {
+    std::vector<uint8_t> frame = builder.create_c_msg_payload(i, customString);
+    benchSink += frame.back();
+  });
+  run_bench("encode_gps_payload (buffer)", [&](size_t i) {
+    PayloadBuilder::Buffer frame;
+    size_t length = builder.encode_gps_payload(frame, i, 79.9005f, 6.9271f);
+    benchSink += frame[length - 1];
+  });
+  run_bench("encode_p_msg_payload (buffer)", [&](size_t i) {
+    PayloadBuilder::Buffer frame;
+    size_t length = builder.encode_p_msg_payload(frame, i, i % 10);
+    benchSink += frame[length - 1];
+  });
+  run_bench("encode_c_msg_payload (buffer)", [&](size_t i) {
+    PayloadBuilder::Buffer frame;
+    size_t length = builder.encode_c_msg_payload(frame, i, customText, customLength);
+    benchSink += frame[length - 1];
+  });
+  PayloadBuilder v2Builder;
+  v2Builder.configure_device(0x01, 0x02);
+  v2Builder.set_header_version(PayloadBuilder::HEADER_V2);
+  run_bench("encode_gps_payload, v2 header (buffer)", [&](size_t i) {
+    PayloadBuilder::Buffer frame;
+    size_t length = v2Builder.encode_gps_payload(frame, i, 79.9005f, 6.9271f);
+    benchSink += frame[length - 1];
+  });
+
+  std::vector<uint8_t> gpsFrame = builder.create_gps_payload(1, 79.9005f, 6.9271f);
+  std::vector<uint8_t> pMsgFrame = builder.create_p_msg_payload(2, 4);
+  std::vector<uint8_t> cMsgFrame = builder.create_c_msg_payload(3, customString);
+
+  PayloadBuilder crcBuilder;
+  crcBuilder.configure_device(0x01, 0x02);
+  crcBuilder.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  std::vector<uint8_t> gpsCrcFrame = crcBuilder.create_gps_payload(1, 79.9005f, 6.9271f);
+  std::vector<uint8_t> cMsgCrcFrame = crcBuilder.create_c_msg_payload(3, customString);
+
+  print_bench_header("PayloadBuilder checksum");
+  run_bench("legacy copy + XOR, gps", [&](size_t) {
+    benchSink += legacy_check(gpsFrame);
+  });
+  run_bench("legacy copy + XOR, c_msg", [&](size_t) {
+    benchSink += legacy_check(cMsgFrame);
+  });
+  run_bench("in-place XOR, gps", [&](size_t) {
+    benchSink += builder.identify_type_and_check_checksum(gpsFrame);
+  });
+  run_bench("in-place XOR, p_msg", [&](size_t) {
+    benchSink += builder.identify_type_and_check_checksum(pMsgFrame);
+  });
+  run_bench("in-place XOR, c_msg", [&](size_t) {
+    benchSink += builder.identify_type_and_check_checksum(cMsgFrame);
+  });
+  run_bench("CRC-16 table, gps", [&](size_t) {
+    benchSink += builder.identify_type_and_check_checksum(gpsCrcFrame);
+  });
+  run_bench("CRC-16 table, c_msg", [&](size_t) {
+    benchSink += builder.identify_type_and_check_checksum(cMsgCrcFrame);
+  });
+
+  print_bench_header("PayloadBuilder decode");
+  run_bench("decode_gps_payload (vector)", [&](size_t) {
+    PayloadBuilder::GPSData data = builder.decode_gps_payload(gpsFrame);
+    benchSink += (uint32_t)data.latitude;
+  });
+  run_bench("decode_p_msg_payload (vector)", [&](size_t) {
+    benchSink += builder.decode_p_msg_payload(pMsgFrame).msgID;
+  });
+  run_bench("decode_c_msg_payload (vector)", [&](size_t) {
+    PayloadBuilder::CMsgData data = builder.decode_c_msg_payload(cMsgFrame);
+    benchSink += data.message.size();
+  });
+  run_bench("decode_c_msg_view (buffer)", [&](size_t) {
+    benchSink += builder.decode_c_msg_view(cMsgFrame.data(), cMsgFrame.size()).length;
+  });
+  run_bench("get_payload_details (buffer)", [&](size_t) {
+    benchSink += builder.get_payload_details(gpsFrame.data(), gpsFrame.size()).transmissionID;
+  });
+
+  print_bench_header("Aggregate frames (8 records)");
+  run_bench("build aggregate", [&](size_t i) {
+    PayloadBuilder::Buffer frame;
+    PayloadBuilder::AggregateWriter writer;
+    builder.begin_aggregate_payload(writer, frame, i);
+    for (uint8_t r = 0; r < 4; r++) {
+      builder.append_gps_record(writer, r, i + r, 79.9005f, 6.9271f);
+      builder.append_p_msg_record(writer, r, i + r, r);
+    }
+    benchSink += builder.finish_aggregate_payload(writer);
+  });
+  PayloadBuilder::Buffer aggregate;
+  PayloadBuilder::AggregateWriter writer;
+  builder.begin_aggregate_payload(writer, aggregate, 4);
+  for (uint8_t r = 0; r < 4; r++) {
+    builder.append_gps_record(writer, r, r, 79.9005f, 6.9271f);
+    builder.append_p_msg_record(writer, r, r, r);
+  }
+  size_t aggregateLength = builder.finish_aggregate_payload(writer);
+  run_bench("iterate aggregate records", [&](size_t) {
+    PayloadBuilder::AggregateReader reader(aggregate.data(), aggregateLength);
+    PayloadBuilder::AggregateRecord record;
+    while (reader.next(record)) benchSink += record.length;
+  });
+
+  // What a receiver does with each frame: validate it, read the header,
+  // decode the body.
+  print_bench_header("Receive path: separate calls vs parse()");
+  PayloadBuilder::ParsedFrame parsed;
+  run_bench("identify + details + decode, gps", [&](size_t) {
+    if (builder.identify_type_and_check_checksum(gpsFrame.data(), gpsFrame.size()) == PAYLOAD_INVALID) return;
+    benchSink += builder.get_payload_details(gpsFrame.data(), gpsFrame.size()).sourceID;
+    benchSink += (uint32_t)builder.decode_gps_payload(gpsFrame.data(), gpsFrame.size()).latitude;
+  });
+  run_bench("parse, gps", [&](size_t) {
+    if (!builder.parse(gpsFrame.data(), gpsFrame.size(), parsed)) return;
+    benchSink += parsed.details.sourceID + (uint32_t)parsed.gps.latitude;
+  });
+  run_bench("identify + details + decode, gps CRC-16", [&](size_t) {
+    if (builder.identify_type_and_check_checksum(gpsCrcFrame.data(), gpsCrcFrame.size()) == PAYLOAD_INVALID) return;
+    benchSink += builder.get_payload_details(gpsCrcFrame.data(), gpsCrcFrame.size()).sourceID;
+    benchSink += (uint32_t)builder.decode_gps_payload(gpsCrcFrame.data(), gpsCrcFrame.size()).latitude;
+  });
+  run_bench("parse, gps CRC-16", [&](size_t) {
+    if (!builder.parse(gpsCrcFrame.data(), gpsCrcFrame.size(), parsed)) return;
+    benchSink += parsed.details.sourceID + (uint32_t)parsed.gps.latitude;
+  });
+  run_bench("identify + details + view, c_msg", [&](size_t) {
+    if (builder.identify_type_and_check_checksum(cMsgFrame.data(), cMsgFrame.size()) == PAYLOAD_INVALID) return;
+    benchSink += builder.get_payload_details(cMsgFrame.data(), cMsgFrame.size()).sourceID;
+    benchSink += builder.decode_c_msg_view(cMsgFrame.data(), cMsgFrame.size()).length;
+  });
+  run_bench("parse, c_msg", [&](size_t) {
+    if (!builder.parse(cMsgFrame.data(), cMsgFrame.size(), parsed)) return;
+    benchSink += parsed.details.sourceID + parsed.bodyLength;
+  });
+  run_bench("identify + details + records, aggregate", [&](size_t) {
+    if (builder.identify_type_and_check_checksum(aggregate.data(), aggregateLength) == PAYLOAD_INVALID) return;
+    benchSink += builder.get_payload_details(aggregate.data(), aggregateLength).transmissionID;
+    PayloadBuilder::AggregateReader reader(aggregate.data(), aggregateLength);
+    PayloadBuilder::AggregateRecord record;
+    while (reader.next(record)) benchSink += record.length;
+  });
+  run_bench("parse + records, aggregate", [&](size_t) {
+    if (!builder.parse(aggregate.data(), aggregateLength, parsed)) return;
+    benchSink += parsed.details.transmissionID;
+    PayloadBuilder::AggregateReader reader(aggregate.data(), aggregateLength);
+    PayloadBuilder::AggregateRecord record;
+    while (reader.next(record)) benchSink += record.length;
+  });
+}
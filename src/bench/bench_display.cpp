@@ -0,0 +1,99 @@
+#include "bench.h"
+#include "dirty_tiles.h"
+#include <cstring>
+
+// What the user device's OLED costs per UI change when the whole frame is
+// resent, as the old 100 ms refresh did, and when only the changed tiles
+// are. Screens are mocked up with 6x8 blocks in place of glyphs, at the
+// positions renderInbox()/renderSend() draw their text.
+
+static const uint8_t tileWidth = 16;
+static const uint8_t tileHeight = 8;
+static const size_t frameBytes = tileWidth * tileHeight * DIRTY_TILE_BYTES;
+
+// SSD1306 over 400 kHz I2C as u8g2 drives it: each tile row is addressed
+// with one command transfer (address, control and 3 command bytes), and
+// data goes in transfers of up to 30 bytes behind an address and a control
+// byte. Every byte costs 9 clocks with its ACK.
+static double i2c_ms(size_t rows, size_t dataBytes) {
+  size_t transfers = (dataBytes + 29) / 30;
+  size_t bytes = rows * 5 + dataBytes + transfers * 2;
+  return bytes * 9 / 400.0;
+}
+
+static void draw_text(uint8_t* frame, int x, int baseline, const char* text) {
+  for (; *text; text++, x += 6) {
+    if (*text == ' ') continue;
+    for (int column = 0; column < 5 && x + column < 128; column++) {
+      uint8_t bits = (uint8_t)(*text * (column + 3)) | 0x81;  // any non-blank pattern
+      for (int row = 0; row < 8; row++) {
+        int y = baseline - 7 + row;
+        if ((bits >> row) & 1) frame[(y / 8) * 128 + x + column] |= 1 << (y % 8);
+      }
+    }
+  }
+}
+
+static void draw_screen(uint8_t* frame, const char* title, const char* label, int value, bool okPressed) {
+  std::memset(frame, 0, frameBytes);
+  draw_text(frame, 0, 10, title);
+  for (int x = 0; x < 128; x++) frame[(11 / 8) * 128 + x] |= 1 << (11 % 8);
+  if (label) {
+    char digits[8];
+    std::snprintf(digits, sizeof(digits), "%d", value);
+    draw_text(frame, 0, 21, label);
+    draw_text(frame, 0, 31, digits);
+  }
+  if (okPressed) draw_text(frame, 0, 41, "OK Pressed...");
+}
+
+struct DisplayChange {
+  const char* name;
+  const char* title;
+  const char* label;
+  int value;
+  bool okPressed;
+};
+
+void run_display_report() {
+  // One button press each, starting from the inbox at message 8.
+  const DisplayChange changes[] = {
+    {"UP: 8 -> 9", "INBOX", "SELECTED MSG:", 9, false},
+    {"UP: 9 -> 10", "INBOX", "SELECTED MSG:", 10, false},
+    {"OK pressed", "INBOX", "SELECTED MSG:", 10, true},
+    {"MODE: inbox -> send", "SEND", "SELECTED P_MSG:", 10, false},
+    {"MODE: send -> welcome", "WELCOME", nullptr, 0, false},
+  };
+
+  uint8_t shown[frameBytes];
+  uint8_t frame[frameBytes];
+  draw_screen(shown, "INBOX", "SELECTED MSG:", 8, false);
+
+  std::printf("\n== OLED update per button press, 128x64 SSD1306 at 400 kHz I2C ==\n");
+  std::printf("%-24s %10s %10s %10s %10s %6s\n", "change", "full B", "full ms", "dirty B", "dirty ms", "rows");
+  for (const DisplayChange& change : changes) {
+    draw_screen(frame, change.title, change.label, change.value, change.okPressed);
+    TileSpan spans[tileHeight];
+    size_t count = dirty_tile_spans(shown, frame, tileWidth, tileHeight, spans, tileHeight);
+    size_t dirtyBytes = 0;
+    for (size_t i = 0; i < count; i++) dirtyBytes += spans[i].width * DIRTY_TILE_BYTES;
+    dirty_tiles_commit(shown, frame, tileWidth, spans, count);
+    std::printf("%-24s %10zu %10.2f %10zu %10.2f %6zu\n", change.name, frameBytes, i2c_ms(tileHeight, frameBytes),
+                dirtyBytes, i2c_ms(count, dirtyBytes), count);
+  }
+  // One full frame per 100 ms: its transfer time in ms is the busy share in %.
+  std::printf("idle: the 100 ms refresh sent %.0f B/s and kept the bus busy %.0f%% of the time; now nothing is sent\n",
+              frameBytes * 10.0, i2c_ms(tileHeight, frameBytes));
+
+  uint8_t changed[frameBytes];
+  draw_screen(shown, "INBOX", "SELECTED MSG:", 9, false);
+  draw_screen(changed, "INBOX", "SELECTED MSG:", 10, false);
+  TileSpan spans[tileHeight];
+  print_bench_header("Dirty tiles");
+  run_bench("diff unchanged 128x64 frame", [&](size_t) {
+    benchSink += dirty_tile_spans(shown, shown, tileWidth, tileHeight, spans, tileHeight);
+  });
+  run_bench("diff frame with one changed value", [&](size_t) {
+    benchSink += dirty_tile_spans(shown, changed, tileWidth, tileHeight, spans, tileHeight);
+  });
+}
@@ -0,0 +1,87 @@
+#include "bench.h"
+#include "journal.h"
+#include "file_journal_storage.h"
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+// The frame journal on the file-backed storage, in a scratch directory:
+// appending a GPS-sized frame (block writes, each flushed and synced,
+// included), mounting a full journal, and replaying one user's last half
+// hour through the block index against reading every block. Host file
+// systems are far faster than LittleFS on flash, so these figures show
+// what the journal costs in CPU, not what the base waits for; the blocks
+// read per replay carry over.
+
+namespace {
+
+uint8_t frame[32];
+
+void fill(Journal& journal, uint32_t hours) {
+  // Twenty users reporting every 30 s, written the way the base does it.
+  uint32_t uptimeMs = 0;
+  for (uint32_t second = 0; second < hours * 3600; second++, uptimeMs += 1000) {
+    for (uint8_t user = 0; user < 20; user++) {
+      if ((second + user * 7) % 30 != 0) continue;
+      frame[1] = 0x10 + user;
+      journal.append(uptimeMs, -95, 6.5f, 0x10 + user, frame, sizeof(frame));
+    }
+    if (journal.unwritten_ms(uptimeMs) >= JOURNAL_FLUSH_MS) journal.flush();
+  }
+  journal.flush();
+}
+
+void removeAll(JournalStorage& storage) {
+  uint32_t first, last;
+  if (!storage.segments(first, last)) return;
+  for (uint32_t segment = first; segment <= last; segment++) storage.remove(segment);
+}
+
+}  // namespace
+
+void run_journal_benchmarks() {
+  char directory[] = "/tmp/wayfinder-journal-XXXXXX";
+  if (mkdtemp(directory) == NULL) {
+    std::printf("\n(journal benchmarks skipped: no scratch directory)\n");
+    return;
+  }
+  static FileJournalStorage storage(directory);
+  static Journal journal(storage);
+  journal.mount();
+  for (size_t i = 0; i < sizeof(frame); i++) frame[i] = (uint8_t)(i * 37);
+
+  print_bench_header("Frame journal (file-backed, 4 KB blocks)");
+  run_bench("append 32-byte frame, writes amortised", [&](size_t i) {
+    benchSink += journal.append((uint32_t)i, -95, 6.5f, (uint8_t)(i & 15), frame, sizeof(frame));
+  }, BENCH_ITERATIONS / 10);
+
+  removeAll(storage);
+  journal.mount();
+  fill(journal, 8);
+  uint32_t blocks = journal.stored_blocks();
+  uint32_t endMs = journal.now(8 * 3600000u);  // before mounting moves the clock on
+  run_bench("mount, block headers only", [&](size_t) {
+    journal.mount();
+    benchSink += journal.segment_count();
+  }, 100);
+
+  Journal::Cursor cursor;
+  JournalRecord record;
+  uint32_t indexedRead = 0;
+  run_bench("replay one user's last 30 min, indexed", [&](size_t i) {
+    journal.begin_replay(cursor, endMs - 1800000, endMs, 0x10 + (i % 20));
+    while (journal.next(cursor, record)) benchSink += record.length;
+    indexedRead = cursor.blocksRead;
+  }, 200);
+  run_bench("same, reading every block", [&](size_t i) {
+    journal.begin_replay(cursor, 0, UINT32_MAX, -1);
+    uint8_t user = 0x10 + (i % 20);
+    while (journal.next(cursor, record)) {
+      if (record.sourceID == user && record.timeMs >= endMs - 1800000) benchSink += record.length;
+    }
+  }, 200);
+  std::printf("8 h of 20 users: %u blocks stored, %u read for a half-hour replay of one user\n", blocks, indexedRead);
+
+  removeAll(storage);
+  rmdir(directory);
+}
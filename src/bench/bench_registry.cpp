@@ -0,0 +1,65 @@
+#include "bench.h"
+#include "node_registry.h"
+
+// What the node registry adds to each received frame on the base (the
+// frame, its link quality and, for a GPS frame, the duplicate check and
+// position), the stale scan LoggerTask runs, and a sample of the "nodes"
+// dump: a few users heard directly or through a relay, one of them copied
+// by both.
+
+void run_registry_benchmarks() {
+  static NodeRegistry registry;
+  print_bench_header("Node registry (256 nodes, one GPS frame per op)");
+  run_bench("record frame, link, position", [&](size_t i) {
+    uint8_t id = (uint8_t)(i * 167);
+    uint16_t transmissionID = (uint16_t)(i >> 8);
+    registry.record_frame(id, transmissionID, (uint32_t)i, 0, 0);
+    registry.record_link(id, -90 - (int16_t)(i & 15), 5.0f, (uint32_t)i);
+    if (registry.accept_position(id, transmissionID)) {
+      registry.record_position(id, 6.9271f, 79.8612f, (uint32_t)i);
+    }
+    benchSink += registry.node(id).frames;
+  });
+  run_bench("stale scan, nothing due", [&](size_t) {
+    NodeRegistry::Alert alert;
+    benchSink += registry.next_alert(BENCH_ITERATIONS, alert);
+  }, BENCH_ITERATIONS / 100);
+
+  static NodeRegistry sample;
+  const uint8_t relayID = 0x03;
+  uint32_t now = 0;
+  // A GPS frame from each of four users every 30 s for an hour. User 0x01
+  // is also heard through the relay, user 0x11 only through it, and 0x12
+  // goes quiet after 20 minutes.
+  for (uint16_t frame = 0; frame < 120; frame++, now += 30000) {
+    const uint8_t users[] = {0x01, 0x10, 0x11, 0x12};
+    for (uint8_t user : users) {
+      if (user == 0x12 && now > 1200000) continue;
+      bool relayed = user == 0x11;
+      float drift = frame * 0.00002f;
+      for (int copy = 0; copy < (user == 0x01 ? 2 : 1); copy++) {
+        if (copy == 1) relayed = true;
+        sample.record_frame(user, frame, now, relayed ? relayID : 0, relayed ? 1 : 0);
+        sample.record_link(relayed ? relayID : user, relayed ? -78 : -95 - user % 7, relayed ? 9.5f : 2.0f - user % 5, now);
+        if (sample.accept_position(user, frame)) {
+          sample.record_position(user, 6.9271f + user * 0.001f + drift, 79.8612f - drift, now);
+        }
+      }
+    }
+    if (frame % 10 == 0) sample.record_message(0x10, false);
+  }
+
+  std::printf("\n== Sample nodes dump (after 1 h) ==\n");
+  std::printf("  %s\n", NodeRegistry::header());
+  char line[112];
+  for (size_t id = 0; id < NODE_REGISTRY_SIZE; id++) {
+    if (!sample.known(id)) continue;
+    NodeRegistry::format(id, sample.node(id), now, line, sizeof(line));
+    std::printf("  %s\n", line);
+  }
+  NodeRegistry::Alert alert;
+  while (sample.next_alert(now, alert)) {
+    std::printf("  alert: node %u %s %u s\n", alert.id, alert.type == NodeRegistry::ALERT_STALE ? "not heard for" : "heard again after",
+                (unsigned)(alert.silentMs / 1000));
+  }
+}
@@ -0,0 +1,75 @@
+#include "bench.h"
+#include "spsc_ring.h"
+#include "overwrite_ring.h"
+#include "payload_builder.h"
+#include <cstring>
+
+// Cost of handing a received frame from the radio ISR to the receive task,
+// including the overflow path taken when the task falls behind, and of
+// handing a decoded record to the base station's logger task.
+
+struct BenchFrame {
+  uint32_t receivedAt;
+  int16_t rssi;
+  float snr;
+  uint8_t length;
+  uint8_t data[MAX_FRAME_SIZE];
+};
+
+// Same size class as the base station's LogRecord.
+struct BenchLogRecord {
+  uint8_t kind;
+  uint32_t receivedAt;
+  int16_t rssi;
+  float snr;
+  uint8_t header[16];
+  float longitude;
+  float latitude;
+  uint8_t textLength;
+  char text[MAX_PAYLOAD_SIZE];
+};
+
+void run_ring_benchmarks() {
+  static SpscRing<BenchFrame, 8> ring;
+  uint8_t frame[32];
+  std::memset(frame, 0xA5, sizeof(frame));
+
+  print_bench_header("SPSC frame ring");
+  run_bench("acquire/commit + peek/release (32 B)", [&](size_t i) {
+    BenchFrame* slot = ring.acquire();
+    slot->length = sizeof(frame);
+    slot->receivedAt = i;
+    std::memcpy(slot->data, frame, sizeof(frame));
+    ring.commit();
+    const BenchFrame* out = ring.peek();
+    benchSink += out->data[out->length - 1];
+    ring.release();
+  });
+
+  while (ring.acquire()) ring.commit();
+  uint32_t dropsBefore = ring.dropped();
+  run_bench("acquire on full ring (drop)", [&](size_t) {
+    benchSink += ring.acquire() == nullptr;
+  });
+  std::printf("ring peak %u/%zu, drops counted while full: %u\n", ring.peak(), ring.capacity(),
+              ring.dropped() - dropsBefore);
+
+  static OverwriteRing<BenchLogRecord, 32> logRing;
+  BenchLogRecord record = {};
+  BenchLogRecord out = {};
+  print_bench_header("Overwrite log ring");
+  run_bench("push + pop (log record)", [&](size_t i) {
+    record.receivedAt = i;
+    logRing.push(record);
+    logRing.pop(out);
+    benchSink += out.receivedAt;
+  });
+
+  run_bench("push only, consumer stalled", [&](size_t i) {
+    record.receivedAt = i;
+    logRing.push(record);
+  });
+  size_t drained = 0;
+  while (logRing.pop(out)) drained++;
+  std::printf("after stall: %zu newest records kept, %u oldest dropped\n", drained, logRing.dropped());
+}
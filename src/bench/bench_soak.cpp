@@ -0,0 +1,195 @@
+#include "bench.h"
+#include "payload_builder.h"
+#include "reliable_link.h"
+#include "adr.h"
+#include "tx_scheduler.h"
+#include "tdma.h"
+#include "debounce.h"
+#include "overwrite_ring.h"
+#include "spsc_ring.h"
+#include <cstring>
+
+// Host half of the heap soak: a day of base/user traffic through the same
+// library calls the firmware makes after setup(), with the allocation
+// counter of main.cpp read around everything after the first hour. Any
+// operator new in those paths shows up here before it lowers the
+// firmware's heap low-water mark (the base checks that on target).
+//
+// Frames are delivered at the next 100 ms step, with every seventh lost, so
+// the link retransmits and ACKs and ADR keeps renegotiating.
+
+namespace {
+
+const uint8_t baseID = 0x02;
+const uint8_t userID = 0x01;
+const uint32_t stepMs = 100;
+const uint32_t warmupMs = 3600000;
+const uint32_t soakMs = 24 * 3600000u;
+
+struct Frame {
+  uint8_t length;
+  uint8_t data[MAX_FRAME_SIZE];
+};
+
+// What the base's receive path keeps per frame (a LogRecord stand-in).
+struct SoakRecord {
+  uint8_t type;
+  PayloadBuilder::PayloadDetails details;
+  uint8_t length;
+  uint8_t data[MAX_FRAME_SIZE];
+};
+
+struct SoakNode {
+  PayloadBuilder builder;
+  ReliableLink link;
+  SpscRing<Frame, 8> inbox;
+
+  SoakNode(uint8_t id, uint16_t initialID) : link(id, initialID) {
+    builder.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+    link.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  }
+};
+
+struct SoakCounts {
+  uint32_t frames;
+  uint32_t lost;
+  uint32_t delivered;
+  uint32_t beacons;
+  uint32_t buttonEvents;
+  uint32_t packedTexts;
+};
+
+void deliver(SoakNode& to, const uint8_t* frame, size_t length, SoakCounts& counts) {
+  counts.frames++;
+  if (counts.frames % 7 == 0) {
+    counts.lost++;
+    return;
+  }
+  Frame* slot = to.inbox.acquire();
+  if (slot == nullptr) return;
+  slot->length = (uint8_t)length;
+  std::memcpy(slot->data, frame, length);
+  to.inbox.commit();
+}
+
+}  // namespace
+
+bool run_soak_report() {
+  SoakNode base(baseID, 0x1000);
+  SoakNode user(userID, 0x2000);
+  AdrCoordinator baseAdr(baseID);
+  AdrMember userAdr(userID);
+  TxScheduler scheduler;
+  TdmaCoordinator coordinator(baseID);
+  TdmaMember member(userID, 0x5EED);
+  ButtonDebouncer okButton(0);
+  OverwriteRing<SoakRecord, 32> logRing;
+  base.link.set_text_compression(true);
+  baseAdr.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  userAdr.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  coordinator.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  member.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  LoRaModemConfig modem = adr_modem_config(ADR_SAFE_DATA_RATE, lora_default_config());
+  scheduler.set_modem_config(modem);
+  coordinator.set_modem_config(modem);
+
+  const char* text = "Proceed to the north checkpoint";
+  SoakCounts counts = {0, 0, 0, 0, 0, 0};
+  AllocStats before = {0, 0};
+  PayloadBuilder::Buffer tx;
+  SoakRecord record;
+
+  for (uint32_t now = 0; now < soakMs; now += stepMs) {
+    if (now == warmupMs) before = alloc_snapshot();
+
+    // User: a button press every 10 s queues a message, every 30 s.
+    okButton.on_edge(now % 10000 < 200, now);
+    ButtonEvent event;
+    while (okButton.poll(now, event)) counts.buttonEvents++;
+    if (now % 30000 == 0) user.link.send_p_msg(baseID, (uint8_t)(now / 30000 % 10), now);
+
+    // Base: a custom message every 5 minutes.
+    if (now % 300000 == 0) base.link.send_c_msg(userID, text, std::strlen(text), now);
+
+    // Base receive path.
+    const Frame* frame;
+    while ((frame = base.inbox.peek()) != nullptr) {
+      uint8_t type = base.builder.identify_type_and_check_checksum(frame->data, frame->length);
+      PayloadBuilder::PayloadDetails details = base.builder.get_payload_details(frame->data, frame->length);
+      if (type == PAYLOAD_TYPE_P_MSG || type == PAYLOAD_TYPE_C_MSG) {
+        if (base.link.on_data(details.sourceID, details.destinationID, details.transmissionID, now) == ReliableLink::ACCEPT_NEW) {
+          counts.delivered++;
+        }
+      } else if (type == PAYLOAD_TYPE_ACK) {
+        base.link.on_ack(details.sourceID, details.destinationID, base.builder.decode_ack_payload(frame->data, frame->length), now);
+      } else if (type == PAYLOAD_TYPE_CONTROL) {
+        baseAdr.on_control(details.sourceID, details.destinationID, base.builder.decode_control_payload(frame->data, frame->length), now);
+      } else if (type == PAYLOAD_TYPE_SLOT) {
+        coordinator.on_slot(details.sourceID, details.destinationID, base.builder.decode_slot_payload(frame->data, frame->length), now);
+      }
+      if (type != PAYLOAD_INVALID) {
+        baseAdr.record(details.sourceID, -90, 5.0f, now);
+        coordinator.on_frame(details.sourceID, now);
+      }
+      record.type = type;
+      record.details = details;
+      record.length = frame->length;
+      std::memcpy(record.data, frame->data, frame->length);
+      logRing.push(record);
+      base.inbox.release();
+    }
+    while (logRing.pop(record)) benchSink += record.length;
+
+    // Base transmit path: everything due into the scheduler, the beacon
+    // past it, then the downlink slots.
+    size_t length;
+    while ((length = baseAdr.poll(now, tx.data(), tx.size())) > 0 || (length = base.link.poll(now, tx.data(), tx.size())) > 0) {
+      scheduler.enqueue(TxScheduler::TX_CUSTOM, tx.data(), length, now);
+    }
+    while ((length = coordinator.poll(now, tx.data(), tx.size())) > 0) {
+      scheduler.charge(now, length);
+      counts.beacons += PayloadBuilder::frame_type(tx[0]) == PAYLOAD_TYPE_BEACON;
+      deliver(user, tx.data(), length, counts);
+    }
+    while ((length = scheduler.next(now, tx.data(), tx.size(), coordinator.downlink_remaining_us(now))) > 0) {
+      deliver(user, tx.data(), length, counts);
+    }
+
+    // User receive and transmit paths.
+    while ((frame = user.inbox.peek()) != nullptr) {
+      uint8_t type = user.builder.identify_type_and_check_checksum(frame->data, frame->length);
+      PayloadBuilder::PayloadDetails details = user.builder.get_payload_details(frame->data, frame->length);
+      if (type == PAYLOAD_TYPE_P_MSG || type == PAYLOAD_TYPE_C_MSG || type == PAYLOAD_TYPE_C_MSG_PACKED) {
+        if (user.link.on_data(details.sourceID, details.destinationID, details.transmissionID, now) == ReliableLink::ACCEPT_NEW &&
+            type == PAYLOAD_TYPE_C_MSG_PACKED) {
+          char text[C_MSG_TEXT_MAX_LENGTH];
+          benchSink += user.builder.decode_c_msg_text(frame->data, frame->length, text, sizeof(text));
+          counts.packedTexts++;
+        }
+      } else if (type == PAYLOAD_TYPE_ACK) {
+        user.link.on_ack(details.sourceID, details.destinationID, user.builder.decode_ack_payload(frame->data, frame->length), now);
+      } else if (type == PAYLOAD_TYPE_CONTROL) {
+        userAdr.on_control(details.sourceID, details.destinationID, user.builder.decode_control_payload(frame->data, frame->length), now);
+      } else if (type == PAYLOAD_TYPE_BEACON) {
+        member.on_beacon(details.sourceID, user.builder.decode_beacon_payload(frame->data, frame->length), now);
+      } else if (type == PAYLOAD_TYPE_SLOT) {
+        member.on_slot(details.sourceID, details.destinationID, user.builder.decode_slot_payload(frame->data, frame->length));
+      }
+      if (type != PAYLOAD_INVALID) userAdr.record(details.sourceID, -90, 5.0f, now);
+      user.inbox.release();
+    }
+    while ((length = userAdr.poll(now, tx.data(), tx.size())) > 0 || (length = user.link.poll(now, tx.data(), tx.size())) > 0) {
+      deliver(base, tx.data(), length, counts);
+    }
+    if ((length = member.poll(now, false, tx.data(), tx.size())) > 0) deliver(base, tx.data(), length, counts);
+  }
+  AllocStats after = alloc_snapshot();
+
+  size_t allocations = after.count - before.count;
+  std::printf("\n== Heap soak: base and user steady state, %u h simulated ==\n", soakMs / 3600000);
+  std::printf("%u frames (%u lost), %u messages delivered to the base, %u packed texts to the user, %u beacons, %u button events\n",
+              counts.frames, counts.lost, counts.delivered, counts.packedTexts, counts.beacons, counts.buttonEvents);
+  std::printf("allocations after the first hour: %zu (%zu bytes) -> %s\n", allocations, after.bytes - before.bytes,
+              allocations == 0 ? "PASS" : "FAIL");
+  return allocations == 0;
+}
@@ -0,0 +1,81 @@
+#include "bench.h"
+#include "spatial_index.h"
+#include <cmath>
+
+// The base's spatial index with a full table: 256 users spread over a
+// 10 km square, eight geofences. A position update (with its geofence
+// checks) against the queries dispatchers run, and the radius query
+// against scanning every user, which is what it replaces.
+
+namespace {
+
+const float originLat = 6.9271f;
+const float originLon = 79.8612f;
+const float degreesPerMetre = 1.0f / 111319.5f;
+
+struct Lcg {
+  uint32_t state;
+  float next() {  // [0, 1)
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) / 16777216.0f;
+  }
+};
+
+}  // namespace
+
+void run_spatial_benchmarks() {
+  static SpatialIndex index;
+  static float lat[SPATIAL_MAX_NODES];
+  static float lon[SPATIAL_MAX_NODES];
+  Lcg random = {0x5EED};
+  SpatialIndex::FenceEvent events[SPATIAL_MAX_FENCES];
+  for (size_t id = 0; id < SPATIAL_MAX_NODES; id++) {
+    lat[id] = originLat + random.next() * 10000 * degreesPerMetre;
+    lon[id] = originLon + random.next() * 10000 * degreesPerMetre;
+    index.update((uint8_t)id, lat[id], lon[id], events, SPATIAL_MAX_FENCES);
+  }
+  // Eight 1-2 km hexagons across the area.
+  for (int f = 0; f < SPATIAL_MAX_FENCES; f++) {
+    float centreLat = originLat + (1500 + (f % 4) * 2300) * degreesPerMetre;
+    float centreLon = originLon + (2500 + (f / 4) * 5000) * degreesPerMetre;
+    float radius = (500 + f * 60) * degreesPerMetre;
+    float fenceLat[6];
+    float fenceLon[6];
+    for (int v = 0; v < 6; v++) {
+      fenceLat[v] = centreLat + radius * std::sin(v * 1.0472f);
+      fenceLon[v] = centreLon + radius * std::cos(v * 1.0472f);
+    }
+    index.add_fence(f % 2 ? SpatialIndex::FENCE_KEEP_OUT : SpatialIndex::FENCE_KEEP_IN, fenceLat, fenceLon, 6);
+  }
+
+  print_bench_header("Spatial index (256 users over 10 km, 8 geofences)");
+  run_bench("update, 3 m step, 8 fence checks", [&](size_t i) {
+    uint8_t id = (uint8_t)(i * 167);
+    lat[id] += ((i >> 8) & 1 ? 3 : -3) * degreesPerMetre;
+    benchSink += index.update(id, lat[id], lon[id], events, SPATIAL_MAX_FENCES);
+  });
+  run_bench("update, new cell every time", [&](size_t i) {
+    uint8_t id = (uint8_t)(i * 167);
+    lon[id] += ((i >> 8) & 1 ? 300 : -300) * degreesPerMetre;
+    benchSink += index.update(id, lat[id], lon[id], events, SPATIAL_MAX_FENCES);
+  });
+  SpatialIndex::Neighbor neighbors[SPATIAL_MAX_NODES];
+  run_bench("nearest 5", [&](size_t i) {
+    benchSink += index.nearest(lat[i & 255], lon[(i * 7) & 255], 5, neighbors);
+  }, BENCH_ITERATIONS / 10);
+  run_bench("within 500 m", [&](size_t i) {
+    benchSink += index.within(lat[i & 255], lon[(i * 7) & 255], 500, neighbors, SPATIAL_MAX_NODES);
+  }, BENCH_ITERATIONS / 10);
+  run_bench("within 500 m, scanning every user", [&](size_t i) {
+    float queryLat = lat[i & 255];
+    float queryLon = lon[(i * 7) & 255];
+    float cosLat = std::cos(queryLat * 0.0174533f);
+    uint32_t found = 0;
+    for (size_t id = 0; id < SPATIAL_MAX_NODES; id++) {
+      float dx = (lon[id] - queryLon) * cosLat / degreesPerMetre;
+      float dy = (lat[id] - queryLat) / degreesPerMetre;
+      found += std::sqrt(dx * dx + dy * dy) <= 500;
+    }
+    benchSink += found;
+  }, BENCH_ITERATIONS / 10);
+}
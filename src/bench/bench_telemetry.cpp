@@ -0,0 +1,39 @@
+#include "bench.h"
+#include "telemetry.h"
+
+// Base-station cost of wrapping a frame for the binary telemetry link, and
+// host-side decode rate compared with the link's line rate.
+
+void run_telemetry_benchmarks() {
+  PayloadBuilder builder;
+  builder.configure_device(0x01, 0x02);
+  PayloadBuilder::Buffer frame;
+  size_t gpsLength = builder.encode_gps_payload(frame, 1, 79.861f, 6.927f);
+  std::string text(80, 'x');
+  PayloadBuilder::Buffer longFrame;
+  size_t longLength = builder.encode_c_msg_payload(longFrame, 2, text.c_str(), text.size());
+
+  uint8_t packet[TELEMETRY_MAX_PACKET_SIZE];
+  print_bench_header("Binary telemetry");
+  run_bench("telemetry_encode (GPS frame)", [&](size_t i) {
+    TelemetryRecord record = {(uint32_t)i, -80, 7.5f, frame.data(), (uint8_t)gpsLength};
+    benchSink += telemetry_encode(record, packet, sizeof(packet));
+  });
+  run_bench("telemetry_encode (93 B custom message)", [&](size_t i) {
+    TelemetryRecord record = {(uint32_t)i, -80, 7.5f, longFrame.data(), (uint8_t)longLength};
+    benchSink += telemetry_encode(record, packet, sizeof(packet));
+  });
+
+  TelemetryRecord record = {1234, -80, 7.5f, longFrame.data(), (uint8_t)longLength};
+  size_t packetLength = telemetry_encode(record, packet, sizeof(packet));
+  TelemetryDecoder decoder;
+  BenchResult decode = run_bench("TelemetryDecoder (93 B custom message)", [&](size_t) {
+    for (size_t b = 0; b < packetLength; b++) {
+      if (decoder.feed(packet[b])) benchSink += decoder.record().length;
+    }
+  });
+  // 921600 baud, 8N1: 92160 bytes/s.
+  double recordsPerSecond = 1e9 / decode.nsPerOp;
+  std::printf("decoder: %.0f records/s, link carries at most %.0f records/s of this size\n",
+              recordsPerSecond, 92160.0 / packetLength);
+}
@@ -0,0 +1,134 @@
+#include "bench.h"
+#include "payload_builder.h"
+#include "text_codec.h"
+#include "lora_airtime.h"
+#include "adr.h"
+#include <cstring>
+
+// Packed custom messages on a corpus of what field teams send: the
+// predefined messages typed out, short free-text reports, and long reports
+// that do not fit a raw custom message at all. Frames are built as the
+// base builds them (CRC-16 trailer) and timed at the network's starting
+// data rate.
+
+struct TextSample {
+  const char* group;
+  const char* text;
+};
+
+static const TextSample textCorpus[] = {
+  {"predefined", "I'm OK"},
+  {"predefined", "I need water"},
+  {"predefined", "I need food"},
+  {"predefined", "I need medical assistance"},
+  {"predefined", "I'm lost, send help"},
+  {"predefined", "I am injured"},
+  {"predefined", "There is a fire nearby"},
+  {"predefined", "I need shelter"},
+  {"predefined", "I am trapped, please rescue"},
+  {"predefined", "Send my location to the rescue team"},
+  {"predefined", "All clear"},
+  {"predefined", "Evacuate immediately"},
+  {"predefined", "Proceed to checkpoint"},
+  {"predefined", "Remain calm"},
+  {"predefined", "Await further instructions"},
+  {"predefined", "Medical team is en route"},
+  {"predefined", "Rescue team dispatched"},
+  {"predefined", "Help is arriving"},
+  {"predefined", "Situation under control"},
+  {"predefined", "Mission accomplished"},
+  {"short", "Need water for 6 people"},
+  {"short", "Two injured, one can't walk"},
+  {"short", "Road to the village is blocked"},
+  {"short", "We are safe at the school"},
+  {"short", "Send boat, water rising fast"},
+  {"short", "Child missing near the river"},
+  {"short", "Battery low, will check in at 18:00"},
+  {"short", "Helicopter can land on the hill"},
+  {"short", "lat 6.92710 lon 79.86120"},
+  {"short", "Stay at the shelter until further instructions"},
+  {"long", "We need water and food for 12 people, two children and one elderly person with a broken leg. Please send help"},
+  {"long", "Bridge on the north road collapsed, we are stuck on the east side of the river with 3 injured people"},
+  {"long", "Injured person bleeding, unconscious but breathing. Need medical team and ambulance now, road from the south is clear"},
+  {"long", "Water is rising near the school, 30 people on the second floor need rescue before night, send boats"},
+  {"long", "Landslide blocked the trail 2 km south of camp, send helicopter. Four people trapped in a house, lat 6.9271 lon 79.8612"},
+  {"long", "Fire spreading to the west, smoke everywhere, moving everyone to the checkpoint. Medical supplies running low"},
+};
+
+static const size_t textCorpusSize = sizeof(textCorpus) / sizeof(textCorpus[0]);
+
+struct TextGroupTotals {
+  size_t messages;
+  size_t rawBytes;
+  size_t packedBytes;
+  size_t rawFits;
+  size_t packedFits;
+  uint64_t rawAirtimeUs;
+  uint64_t packedAirtimeUs;
+};
+
+void run_text_codec_benchmarks() {
+  PayloadBuilder raw;
+  PayloadBuilder packed;
+  raw.configure_device(0x02, 0x01);
+  packed.configure_device(0x02, 0x01);
+  raw.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  packed.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  packed.set_text_compression(true);
+  LoRaModemConfig modem = adr_modem_config(ADR_SAFE_DATA_RATE, lora_default_config());
+
+  const char* groups[] = {"predefined", "short", "long"};
+  std::printf("\n== Custom messages, raw (type 3) vs packed (type 11), SF%u/%lu kHz, CRC-16 frames ==\n",
+              modem.spreadingFactor, (unsigned long)(modem.bandwidth / 1000));
+  std::printf("%-12s %5s %10s %10s %7s %10s %14s %14s\n", "corpus", "msgs", "text B", "packed B", "ratio",
+              "fit raw", "raw ms/msg", "packed ms/msg");
+  for (const char* group : groups) {
+    TextGroupTotals totals = {0, 0, 0, 0, 0, 0, 0};
+    for (const TextSample& sample : textCorpus) {
+      if (std::strcmp(sample.group, group) != 0) continue;
+      size_t length = std::strlen(sample.text);
+      uint8_t body[C_MSG_TEXT_MAX_LENGTH];
+      PayloadBuilder::Buffer frame;
+      size_t rawFrame = raw.encode_c_msg_payload(frame, 1, sample.text, length);
+      size_t packedFrame = packed.encode_c_msg_payload(frame, 1, sample.text, length);
+      totals.messages++;
+      totals.rawBytes += length;
+      totals.packedBytes += text_compress(sample.text, length, body, sizeof(body));
+      totals.rawFits += rawFrame > 0;
+      totals.packedFits += packedFrame > 0;
+      // A raw message too long for one frame goes as two.
+      totals.rawAirtimeUs += rawFrame > 0 ? lora_time_on_air_us(modem, rawFrame)
+                                          : 2 * lora_time_on_air_us(modem, PAYLOAD_HEADER_SIZE + (length + 1) / 2 + PAYLOAD_CRC_SIZE);
+      totals.packedAirtimeUs += lora_time_on_air_us(modem, packedFrame);
+    }
+    char fits[16];
+    std::snprintf(fits, sizeof(fits), "%zu/%zu", totals.rawFits, totals.messages);
+    std::printf("%-12s %5zu %10zu %10zu %6.0f%% %10s %14.1f %14.1f\n", group, totals.messages, totals.rawBytes,
+                totals.packedBytes, 100.0 * totals.packedBytes / totals.rawBytes, fits,
+                totals.rawAirtimeUs / 1000.0 / totals.messages, totals.packedAirtimeUs / 1000.0 / totals.messages);
+    if (totals.packedFits != totals.messages) {
+      std::printf("  %zu message(s) did not fit one packed frame\n", totals.messages - totals.packedFits);
+    }
+  }
+
+  PayloadBuilder::Buffer frame;
+  size_t packedLengths[textCorpusSize];
+  uint8_t packedText[textCorpusSize][C_MSG_MAX_LENGTH];
+  for (size_t i = 0; i < textCorpusSize; i++) {
+    packedLengths[i] = text_compress(textCorpus[i].text, std::strlen(textCorpus[i].text), packedText[i], C_MSG_MAX_LENGTH);
+  }
+  print_bench_header("Text codec (one corpus message per op)");
+  run_bench("text_compress", [&](size_t i) {
+    const char* text = textCorpus[i % textCorpusSize].text;
+    uint8_t out[C_MSG_MAX_LENGTH];
+    benchSink += text_compress(text, std::strlen(text), out, sizeof(out));
+  });
+  run_bench("text_decompress", [&](size_t i) {
+    char text[C_MSG_TEXT_MAX_LENGTH];
+    benchSink += text_decompress(packedText[i % textCorpusSize], packedLengths[i % textCorpusSize], text, sizeof(text));
+  });
+  run_bench("encode_c_msg_payload, packed", [&](size_t i) {
+    const char* text = textCorpus[i % textCorpusSize].text;
+    benchSink += packed.encode_c_msg_payload(frame, i, text, std::strlen(text));
+  });
+}
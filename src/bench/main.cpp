@@ -0,0 +1,59 @@
+#include "bench.h"
+#include <cstdlib>
+#include <new>
+
+// Host-side benchmark runner for the shared libraries. Build and run with:
+//   pio run -e native -t exec
+// All suites use fixed inputs and iteration counts, so numbers from two
+// builds can be compared directly. Exits non-zero if the heap soak fails.
+
+static size_t allocCount = 0;
+static size_t allocBytes = 0;
+
+void* operator new(size_t size) {
+  allocCount++;
+  allocBytes += size;
+  void* ptr = std::malloc(size ? size : 1);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  std::free(ptr);
+}
+
+AllocStats alloc_snapshot() {
+  AllocStats stats = {allocCount, allocBytes};
+  return stats;
+}
+
+volatile uint32_t benchSink = 0;
+
+void print_bench_header(const char* suite) {
+  std::printf("\n== %s ==\n", suite);
+  std::printf("%-40s %12s %12s %12s\n", "benchmark", "ns/op", "allocs/op", "bytes/op");
+}
+
+void print_bench_result(const BenchResult& result) {
+  std::printf("%-40s %12.1f %12.2f %12.1f\n", result.name, result.nsPerOp, result.allocsPerOp, result.bytesPerOp);
+}
+
+int main() {
+  std::printf("WayFinder host benchmarks (%d iterations, best of %d)\n", BENCH_ITERATIONS, BENCH_REPEATS);
+  run_codec_benchmarks();
+  run_airtime_report();
+  run_ring_benchmarks();
+  run_telemetry_benchmarks();
+  run_scheduler_report();
+  run_display_report();
+  run_metrics_benchmarks();
+  run_text_codec_benchmarks();
+  run_registry_benchmarks();
+  run_spatial_benchmarks();
+  run_journal_benchmarks();
+  return run_soak_report() ? 0 : 1;
+}
@@ -0,0 +1,283 @@
+// Fuzz target for PayloadBuilder::parse(), which every receiver runs on
+// whatever the radio hands it.
+//
+//   fuzz_parse [iterations]
+//
+// Built as is, main() seeds a corpus with a valid frame of every type, in
+// both integrity modes and header versions and inside a relay, and mutates it: bit flips, byte
+// overwrites, truncation, extension and corrupted length fields, with the
+// trailer recomputed for half the mutants so they get past the checksum.
+// Built with clang and -D LIBFUZZER -fsanitize=fuzzer, libFuzzer calls
+// LLVMFuzzerTestOneInput instead. Every input sits in a heap block of
+// exactly its length, so the sanitizers catch any read past its end.
+//
+// For each input the parse must keep its body span inside the input, and
+// an accepted frame must decode as the per-type decoders decode it. The
+// relay's wrapped frame is parsed in turn, and the bodies left to other
+// decoders (aggregate records, packed text, compact GPS) are decoded too.
+// Exits non-zero on the first disagreement.
+// Run with: pio run -e fuzz -t exec
+
+#include "payload_builder.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+
+PayloadBuilder builder;
+PayloadBuilder::GPSTrackState tracks[256];
+unsigned long statusCounts[5];
+
+void fail(const char* what, const uint8_t* data, size_t size) {
+  std::printf("violation: %s\n  input (%zu bytes):", what, size);
+  for (size_t i = 0; i < size; i++) std::printf(" %02x", data[i]);
+  std::printf("\n");
+  std::abort();
+}
+
+bool sameDetails(const PayloadBuilder::PayloadDetails& a, const PayloadBuilder::PayloadDetails& b) {
+  return a.type == b.type && a.sourceID == b.sourceID && a.destinationID == b.destinationID &&
+         a.transmissionID == b.transmissionID && std::memcmp(a.dateTime, b.dateTime, sizeof(a.dateTime)) == 0 &&
+         a.dataLength == b.dataLength;
+}
+
+void checkFrame(const uint8_t* data, size_t size, int depth) {
+  PayloadBuilder::ParsedFrame frame;
+  bool accepted = builder.parse(data, size, frame);
+  if (depth == 0) statusCounts[frame.status]++;
+  uint8_t identified = builder.identify_type_and_check_checksum(data, size);
+  if (accepted != (frame.status == PayloadBuilder::PARSE_OK)) fail("return value disagrees with status", data, size);
+  if (!accepted) {
+    if (frame.status == PayloadBuilder::PARSE_BAD_CHECKSUM && identified != PAYLOAD_INVALID) {
+      fail("checksum rejected by parse() but not by identify", data, size);
+    }
+    return;
+  }
+
+  const PayloadBuilder::PayloadDetails& details = frame.details;
+  if (identified != details.type) fail("type differs from identify", data, size);
+  if (frame.bodyLength > 0 && (frame.body < data || frame.body + frame.bodyLength > data + size)) {
+    fail("body span outside the input", data, size);
+  }
+  if (details.type != PAYLOAD_TYPE_RELAY && !sameDetails(details, builder.get_payload_details(data, size))) {
+    fail("details differ from get_payload_details", data, size);
+  }
+
+  char text[C_MSG_TEXT_MAX_LENGTH];
+  switch (details.type) {
+  case PAYLOAD_TYPE_GPS: {
+    PayloadBuilder::GPSData gps = builder.decode_gps_payload(data, size);
+    if (std::memcmp(&gps, &frame.gps, sizeof(gps)) != 0) fail("GPS differs from decode_gps_payload", data, size);
+    break;
+  }
+  case PAYLOAD_TYPE_P_MSG:
+    if (frame.pMsg.msgID != builder.decode_p_msg_payload(data, size).msgID) fail("msgID differs", data, size);
+    break;
+  case PAYLOAD_TYPE_C_MSG:
+  case PAYLOAD_TYPE_C_MSG_PACKED: {
+    PayloadBuilder::CMsgView view = builder.decode_c_msg_view(data, size);
+    if (view.length != frame.bodyLength || (const uint8_t*)view.message != frame.body) {
+      fail("text span differs from decode_c_msg_view", data, size);
+    }
+    builder.decode_c_msg_text(data, size, text, sizeof(text));
+    break;
+  }
+  case PAYLOAD_TYPE_GPS_COMPACT:
+  case PAYLOAD_TYPE_GPS_DELTA: {
+    PayloadBuilder::GPSData gps;
+    builder.decode_gps_compact_payload(data, size, tracks[details.sourceID], gps);
+    break;
+  }
+  case PAYLOAD_TYPE_AGGREGATE: {
+    PayloadBuilder::AggregateReader reader(data, size);
+    PayloadBuilder::AggregateRecord record;
+    size_t recordBytes = 0;
+    while (reader.next(record)) {
+      if (record.data < frame.body || record.data + record.length > frame.body + frame.bodyLength) {
+        fail("aggregate record outside the body", data, size);
+      }
+      recordBytes += AGGREGATE_RECORD_HEADER_SIZE + record.length;
+      if (record.type == PAYLOAD_TYPE_C_MSG || record.type == PAYLOAD_TYPE_C_MSG_PACKED) {
+        builder.decode_c_msg_record_text(record, text, sizeof(text));
+      } else if (record.type == PAYLOAD_TYPE_GPS) {
+        builder.decode_gps_record(record);
+      } else if (record.type == PAYLOAD_TYPE_ACK) {
+        builder.decode_ack_record(record);
+      }
+    }
+    if (reader.malformed() || recordBytes != frame.bodyLength) fail("accepted aggregate does not tile its data", data, size);
+    break;
+  }
+  case PAYLOAD_TYPE_ACK: {
+    PayloadBuilder::AckData ack = builder.decode_ack_payload(data, size);
+    if (ack.transmissionID != frame.ack.transmissionID || ack.receivedMap != frame.ack.receivedMap) {
+      fail("ACK differs from decode_ack_payload", data, size);
+    }
+    break;
+  }
+  case PAYLOAD_TYPE_CONTROL: {
+    PayloadBuilder::ControlData control = builder.decode_control_payload(data, size);
+    if (control.command != frame.control.command || control.dataRate != frame.control.dataRate ||
+        control.parameter != frame.control.parameter) {
+      fail("control differs from decode_control_payload", data, size);
+    }
+    break;
+  }
+  case PAYLOAD_TYPE_BEACON: {
+    PayloadBuilder::BeaconData beacon = builder.decode_beacon_payload(data, size);
+    if (beacon.sequence != frame.beacon.sequence || beacon.slotMs != frame.beacon.slotMs ||
+        beacon.dataSlots != frame.beacon.dataSlots || beacon.slotMap != frame.beacon.slotMap ||
+        frame.beacon.dataSlots > BEACON_MAX_DATA_SLOTS) {
+      fail("beacon differs from decode_beacon_payload", data, size);
+    }
+    break;
+  }
+  case PAYLOAD_TYPE_SLOT: {
+    PayloadBuilder::SlotData slot = builder.decode_slot_payload(data, size);
+    if (slot.command != frame.slot.command || slot.slot != frame.slot.slot) fail("slot differs", data, size);
+    break;
+  }
+  case PAYLOAD_TYPE_RELAY: {
+    PayloadBuilder::RelayView relay = builder.decode_relay_view(data, size);
+    if (relay.frame != frame.relay.frame || relay.length != frame.relay.length || relay.length > MAX_PAYLOAD_SIZE) {
+      fail("relay differs from decode_relay_view", data, size);
+    }
+    if (depth < 2) checkFrame(frame.relay.frame, frame.relay.length, depth + 1);
+    break;
+  }
+  default:
+    fail("accepted a frame of unknown type", data, size);
+  }
+}
+
+// One valid frame of every type, in both integrity modes and header
+// versions, and each of them relayed.
+std::vector<std::vector<uint8_t>> seedCorpus() {
+  std::vector<std::vector<uint8_t>> corpus;
+  uint8_t buffer[MAX_FRAME_SIZE];
+  const char* text = "Water needed at the north ridge camp";
+  for (int mode = 0; mode < 4; mode++) {
+    PayloadBuilder seeder;
+    seeder.configure_device(0x21, 0x01);
+    seeder.set_integrity_mode(mode & 1 ? PayloadBuilder::INTEGRITY_CRC16 : PayloadBuilder::INTEGRITY_XOR);
+    seeder.set_header_version(mode & 2 ? PayloadBuilder::HEADER_V2 : PayloadBuilder::HEADER_V1);
+    size_t first = corpus.size();
+    auto add = [&](size_t length) {
+      if (length > 0) corpus.push_back(std::vector<uint8_t>(buffer, buffer + length));
+    };
+    add(seeder.encode_gps_payload(buffer, sizeof(buffer), 7, 80.6350f, 7.2906f));
+    add(seeder.encode_gps_payload(buffer, sizeof(buffer), 20000, 80.6350f, 7.2906f));
+    add(seeder.encode_p_msg_payload(buffer, sizeof(buffer), 8, 3));
+    add(seeder.encode_c_msg_payload(buffer, sizeof(buffer), 9, text, std::strlen(text)));
+    seeder.set_text_compression(true);
+    add(seeder.encode_c_msg_payload(buffer, sizeof(buffer), 10, text, std::strlen(text)));
+    seeder.set_gps_delta_mode(true);
+    add(seeder.encode_gps_compact_payload(buffer, sizeof(buffer), 11, 80.6350f, 7.2906f));
+    add(seeder.encode_gps_compact_payload(buffer, sizeof(buffer), 12, 80.6352f, 7.2905f));
+
+    PayloadBuilder::AggregateWriter writer;
+    seeder.begin_aggregate_payload(writer, buffer, MAX_PAYLOAD_SIZE, 13);
+    seeder.append_gps_record(writer, 0x22, 40, 80.6340f, 7.2910f);
+    seeder.append_p_msg_record(writer, 0x23, 41, 1);
+    seeder.append_c_msg_record(writer, 0x24, 42, "ok", 2);
+    PayloadBuilder::AckData ack = {5, 0x0003};
+    seeder.append_ack_record(writer, ack);
+    add(seeder.finish_aggregate_payload(writer));
+
+    add(seeder.encode_ack_payload(buffer, sizeof(buffer), 0x01, ack));
+    PayloadBuilder::ControlData control = {CONTROL_ADR_ACCEPT, 3, (uint8_t)-4};
+    add(seeder.encode_control_payload(buffer, sizeof(buffer), 0x01, 14, control));
+    uint8_t slotMap[4] = {0x0F, 0x00, 0x81, 0x01};
+    PayloadBuilder::BeaconData beacon = {15, 400, 2, 2, 25, slotMap};
+    add(seeder.encode_beacon_payload(buffer, sizeof(buffer), beacon));
+    PayloadBuilder::SlotData slot = {SLOT_ASSIGN, 4};
+    add(seeder.encode_slot_payload(buffer, sizeof(buffer), 0x21, slot));
+
+    size_t last = corpus.size();
+    for (size_t i = first; i < last; i++) {
+      std::vector<uint8_t> inner = corpus[i];
+      add(seeder.encode_relay_payload(buffer, sizeof(buffer), 0x31, 1, inner.data(), inner.size()));
+    }
+  }
+  return corpus;
+}
+
+void fixTrailer(std::vector<uint8_t>& frame) {
+  if (frame.empty()) return;
+  size_t trailer = PayloadBuilder::trailer_size(frame[0]);
+  if (frame.size() <= trailer) return;
+  size_t end = frame.size() - trailer;
+  if (trailer == PAYLOAD_CRC_SIZE) {
+    uint16_t crc = PayloadBuilder::crc16(frame.data(), end);
+    frame[end] = crc >> 8;
+    frame[end + 1] = crc & 0xFF;
+  } else {
+    uint8_t checksum = 0;
+    for (size_t i = 0; i < end; i++) checksum ^= frame[i];
+    frame[end] = checksum;
+  }
+}
+
+void mutate(std::vector<uint8_t>& frame, std::mt19937& rng) {
+  int mutations = 1 + rng() % 3;
+  for (int m = 0; m < mutations; m++) {
+    switch (rng() % 5) {
+    case 0:
+      if (!frame.empty()) frame[rng() % frame.size()] ^= 1 << (rng() % 8);
+      break;
+    case 1:
+      if (!frame.empty()) frame[rng() % frame.size()] = rng();
+      break;
+    case 2:
+      frame.resize(rng() % (frame.size() + 1));
+      break;
+    case 3:
+      for (int n = rng() % 8; n >= 0 && frame.size() < MAX_FRAME_SIZE + 8; n--) frame.push_back(rng());
+      break;
+    default:
+      // Length fields: dataLength, record lengths, beacon slot counts and
+      // the relay's inner header sit in the first few dozen bytes.
+      if (!frame.empty()) frame[rng() % (frame.size() < 24 ? frame.size() : 24)] = rng() % 2 ? rng() % 16 : rng();
+      break;
+    }
+  }
+  if (rng() % 2) fixTrailer(frame);
+}
+
+}  // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+  checkFrame(data, size, 0);
+  return 0;
+}
+
+#ifndef LIBFUZZER
+int main(int argc, char** argv) {
+  unsigned long iterations = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 2000000;
+  std::vector<std::vector<uint8_t>> corpus = seedCorpus();
+  std::mt19937 rng(2024);
+
+  for (const std::vector<uint8_t>& seed : corpus) {
+    PayloadBuilder::ParsedFrame frame;
+    if (!builder.parse(seed.data(), seed.size(), frame)) fail("seed frame rejected", seed.data(), seed.size());
+  }
+  for (unsigned long i = 0; i < iterations; i++) {
+    std::vector<uint8_t> frame = corpus[rng() % corpus.size()];
+    mutate(frame, rng);
+    // An exact-size copy, so reading one byte past the end is caught.
+    std::unique_ptr<uint8_t[]> input(new uint8_t[frame.size() ? frame.size() : 1]);
+    if (!frame.empty()) std::memcpy(input.get(), frame.data(), frame.size());
+    LLVMFuzzerTestOneInput(input.get(), frame.size());
+  }
+
+  std::printf("%lu inputs from %zu seeds: %lu accepted, %lu too short, %lu bad checksum, %lu unknown type, %lu bad length\n",
+              iterations, corpus.size(), statusCounts[PayloadBuilder::PARSE_OK], statusCounts[PayloadBuilder::PARSE_TOO_SHORT],
+              statusCounts[PayloadBuilder::PARSE_BAD_CHECKSUM], statusCounts[PayloadBuilder::PARSE_UNKNOWN_TYPE],
+              statusCounts[PayloadBuilder::PARSE_BAD_LENGTH]);
+  return 0;
+}
+#endif
@@ -1,15 +1,312 @@
 #include <Arduino.h>
+#include <SPI.h>
+#include <LoRa.h>
+#include "payload_builder.h"
+#include "relay_queue.h"
+#include "adr.h"
+#include "tx_scheduler.h"
+#include "metrics.h"
 
+// ----- LoRa Module Pin Definitions -----
+const int csPin    = 5;
+const int resetPin = 14;
+const int irqPin   = 2;
 
+// Frequency for the SX1278
+const long frequency = 433E6;
+
+// ----- Relay Settings -----
+const uint8_t relayID = 0x10;
+
+// ----- Global Instances -----
+PayloadBuilder payloadBuilder;
+
+// Which frames to forward and when (lib/relay_queue, which the network
+// sim runs too). The receive task offers frames and the transmit task
+// moves them to the scheduler once their backoff is over, so every call
+// goes through relayMutex.
+RelayQueue relays(relayID);
+SemaphoreHandle_t relayMutex;
+TaskHandle_t transmitTaskHandle = NULL;
+
+uint32_t framesRelayed = 0;
+
+// Relayed frames and ADR replies leave in priority order within the
+// duty-cycle budget. Only RelayTransmitTask uses the scheduler.
+TxScheduler txScheduler;
+
+// Relays run at the network data rate like every other node. Their answer
+// to a proposal covers the users they relay for, whose frames they hear.
+AdrMember adr(relayID);
+SemaphoreHandle_t adrMutex;
+uint8_t radioDataRate = ADR_SAFE_DATA_RATE;
+
+// The receive and transmit tasks run on different cores but share one
+// SX127x. parsePacket() switches the modem to single receive and clears
+// its IRQ flags, which would abort a transmission in progress and leave
+// endPacket() waiting for TX_DONE for ever. Every LoRa call after setup()
+// holds this mutex.
+SemaphoreHandle_t radioMutex;
+
+// ----- Static Task and Queue Storage -----
+// Nothing here comes from the heap. Stack sizes are in bytes on the ESP32.
+StackType_t receiveTaskStack[4096];
+StaticTask_t receiveTaskBuffer;
+StackType_t transmitTaskStack[4096];
+StaticTask_t transmitTaskBuffer;
+StaticSemaphore_t relayMutexBuffer;
+StaticSemaphore_t adrMutexBuffer;
+StaticSemaphore_t radioMutexBuffer;
+
+#ifndef METRICS_DISABLED
+// Runtime metrics, printed by "stats" on the serial console. Build with
+// -D METRICS_DISABLED to compile them out.
+Metrics metrics;
+int relayQueueMetric = -1;
+int txQueueMetric = -1;
+#endif
+
+// Feeds a received frame to ADR: link history for its transmitter and,
+// for control frames, the negotiation itself. Control frames are still
+// relayed, so users out of the base's range hear every SET. original is
+// the frame itself, or the one a relay wraps.
+void handleLinkQuality(const PayloadBuilder::ParsedFrame& received, const PayloadBuilder::ParsedFrame& original, int16_t rssi, float snr) {
+  if (received.status != PayloadBuilder::PARSE_OK) {
+    return;
+  }
+  uint8_t transmitterID = received.details.type == PAYLOAD_TYPE_RELAY ? received.relay.relayID : received.details.sourceID;
+
+  uint32_t now = millis();
+  xSemaphoreTake(adrMutex, portMAX_DELAY);
+  adr.record(transmitterID, rssi, snr, now);
+  if (original.status == PayloadBuilder::PARSE_OK && original.details.type == PAYLOAD_TYPE_CONTROL) {
+    adr.on_control(original.details.sourceID, original.details.destinationID, original.control, now);
+  }
+  xSemaphoreGive(adrMutex);
+}
+
+// Offers a received frame to the relay queue and wakes the transmit task
+// if it was queued.
+void queueForRelay(const uint8_t* payload, size_t payloadLength, const PayloadBuilder::ParsedFrame& received,
+                   const PayloadBuilder::ParsedFrame& original) {
+  if (original.status == PayloadBuilder::PARSE_BAD_CHECKSUM) {
+    METRICS_COUNT(CHECKSUM_FAILURES, 1);
+  }
+  uint32_t backoff = random(RELAY_BACKOFF_MIN_MS, RELAY_BACKOFF_MAX_MS);
+  xSemaphoreTake(relayMutex, portMAX_DELAY);
+  RelayQueue::Decision decision = relays.offer(payload, payloadLength, received, original, millis(), backoff);
+  METRICS_QUEUE_DEPTH(relayQueueMetric, relays.pending());
+  xSemaphoreGive(relayMutex);
+  if (decision == RelayQueue::RELAY_QUEUED) {
+    xTaskNotifyGive(transmitTaskHandle);
+  }
+}
+
+// --------------------------------------------------------
+// Task 1: LoRa Receive Task
+// --------------------------------------------------------
+void LoRaReceiveTask(void* pvParameters) {
+  for (;;) {
+    PayloadBuilder::FrameBuffer payload;
+    size_t payloadLength = 0;
+    int16_t rssi = 0;
+    float snr = 0;
+    xSemaphoreTake(radioMutex, portMAX_DELAY);
+    int packetSize = LoRa.parsePacket();
+    if (packetSize) {
+      while (LoRa.available()) {
+        uint8_t byte = LoRa.read();
+        if (payloadLength < payload.size()) {
+          payload[payloadLength++] = byte;
+        }
+      }
+      rssi = LoRa.packetRssi();
+      snr = LoRa.packetSnr();
+    }
+    xSemaphoreGive(radioMutex);
+
+    if (packetSize) {
+#ifndef METRICS_DISABLED
+      uint32_t receivedAtUs = micros();  // the radio is polled; this is when we noticed
+#endif
+      // Parsed once, and a relay's wrapped frame once more, for both uses.
+      PayloadBuilder::ParsedFrame received;
+      PayloadBuilder::ParsedFrame original;
+      if (payloadBuilder.parse(payload.data(), payloadLength, received) && received.details.type == PAYLOAD_TYPE_RELAY) {
+        payloadBuilder.parse(received.relay.frame, received.relay.length, original);
+      } else {
+        original = received;
+      }
+      handleLinkQuality(received, original, rssi, snr);
+      queueForRelay(payload.data(), payloadLength, received, original);
+      METRICS_COUNT(RX_PACKETS, 1);
+      METRICS_COUNT(RX_BYTES, payloadLength);
+      METRICS_LATENCY_US(micros() - receivedAtUs);
+    }
+    vTaskDelay(10 / portTICK_PERIOD_MS);
+  }
+}
+
+// --------------------------------------------------------
+// Task 2: Relay Transmit Task
+// Hands relayed frames to the scheduler once their backoff is over, then
+// sends what the duty-cycle budget allows. In between, queues ADR replies
+// and switches the data rate when told to. Wakes on a newly queued frame
+// or when the next backoff, ADR or budget timer expires.
+// --------------------------------------------------------
+void serviceAdr() {
+  for (;;) {
+    PayloadBuilder::Buffer txPayload;
+    xSemaphoreTake(adrMutex, portMAX_DELAY);
+    uint32_t now = millis();
+    size_t txLength = adr.poll(now, txPayload.data(), txPayload.size());
+    uint8_t dataRate = adr.data_rate();
+    xSemaphoreGive(adrMutex);
+
+    if (dataRate != radioDataRate) {
+      radioDataRate = dataRate;
+      xSemaphoreTake(radioMutex, portMAX_DELAY);
+      LoRa.setSpreadingFactor(adr_data_rate(dataRate).spreadingFactor);
+      LoRa.setSignalBandwidth(adr_data_rate(dataRate).bandwidth);
+      xSemaphoreGive(radioMutex);
+      txScheduler.set_modem_config(adr_modem_config(dataRate, lora_default_config()));
+      Serial.print("Data rate now DR");
+      Serial.println(dataRate);
+    }
+    if (txLength == 0) {
+      return;
+    }
+    txScheduler.enqueue(TxScheduler::TX_CONTROL, txPayload.data(), txLength, now);
+  }
+}
+
+void RelayTransmitTask(void* pvParameters) {
+  for (;;) {
+    xSemaphoreTake(adrMutex, portMAX_DELAY);
+    uint32_t wait = adr.time_to_next_event(millis());
+    xSemaphoreGive(adrMutex);
+    xSemaphoreTake(relayMutex, portMAX_DELAY);
+    uint32_t relayWait = relays.time_to_next_event(millis());
+    xSemaphoreGive(relayMutex);
+    uint32_t budgetWait = txScheduler.time_to_next_event(millis());
+    if (relayWait < wait) {
+      wait = relayWait;
+    }
+    if (budgetWait < wait) {
+      wait = budgetWait;
+    }
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait) + 1);
+
+    xSemaphoreTake(relayMutex, portMAX_DELAY);
+    relays.schedule_due(millis(), payloadBuilder, txScheduler);
+    METRICS_QUEUE_DEPTH(relayQueueMetric, relays.pending());
+    xSemaphoreGive(relayMutex);
+    METRICS_QUEUE_DEPTH(txQueueMetric, txScheduler.queued());
+    serviceAdr();
+
+    PayloadBuilder::FrameBuffer txPayload;
+    size_t txLength;
+    while ((txLength = txScheduler.next(millis(), txPayload.data(), txPayload.size())) > 0) {
+      xSemaphoreTake(radioMutex, portMAX_DELAY);
+      LoRa.beginPacket();
+      LoRa.write(txPayload.data(), txLength);
+      LoRa.endPacket();
+      xSemaphoreGive(radioMutex);
+      METRICS_COUNT(TX_PACKETS, 1);
+      METRICS_COUNT(TX_BYTES, txLength);
+      if (PayloadBuilder::frame_type(txPayload[0]) != PAYLOAD_TYPE_RELAY) {
+        continue;  // our own ADR reply
+      }
+      framesRelayed++;
+
+      Serial.print("Relayed frame type ");
+      Serial.print(txPayload[RELAY_HEADER_SIZE]);
+      Serial.print(" from source ");
+      Serial.print(txPayload[RELAY_HEADER_SIZE + 1]);
+      Serial.print(" at hop ");
+      Serial.println(txPayload[1]);
+    }
+  }
+}
+
+// --------------------------------------------------------
+// Setup: Initialize LoRa, the relay queue and tasks.
+// --------------------------------------------------------
 void setup() {
-  // put your setup code here, to run once:
+  Serial.begin(9600);
 
-    Serial.begin(9600);
+  Serial.println("Intermediate Node Starting...");
+
+  LoRa.setPins(csPin, resetPin, irqPin);
+  if (!LoRa.begin(frequency)) {
+    Serial.println("LoRa init failed. Check connections.");
+    while (1);
+  }
+  Serial.println("LoRa init succeeded.");
+  LoRa.setSpreadingFactor(adr_data_rate(ADR_SAFE_DATA_RATE).spreadingFactor);
+  LoRa.setSignalBandwidth(adr_data_rate(ADR_SAFE_DATA_RATE).bandwidth);
+
+  payloadBuilder.configure_device(relayID, PAYLOAD_BROADCAST_ID);
+  // The tasks share this builder and read its time base unlocked, so it
+  // is read here, before any of them starts.
+  payloadBuilder.sync_time_base();
+  payloadBuilder.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  adr.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  txScheduler.set_modem_config(adr_modem_config(ADR_SAFE_DATA_RATE, lora_default_config()));
+  adrMutex = xSemaphoreCreateMutexStatic(&adrMutexBuffer);
+  radioMutex = xSemaphoreCreateMutexStatic(&radioMutexBuffer);
+  relayMutex = xSemaphoreCreateMutexStatic(&relayMutexBuffer);
+#ifndef METRICS_DISABLED
+  relayQueueMetric = metrics.add_queue("relayQueue", RELAY_QUEUE_DEPTH);
+  txQueueMetric = metrics.add_queue("txScheduler", TX_QUEUE_DEPTH * TxScheduler::TX_CLASS_COUNT);
+#endif
+
+  // The transmit task first: the receive task notifies it.
+  transmitTaskHandle = xTaskCreateStaticPinnedToCore(RelayTransmitTask, "RelayTransmitTask", sizeof(transmitTaskStack), NULL, 1,
+                                                     transmitTaskStack, &transmitTaskBuffer, 0);
+  TaskHandle_t receiveTaskHandle = xTaskCreateStaticPinnedToCore(LoRaReceiveTask, "LoRaReceiveTask", sizeof(receiveTaskStack), NULL, 1,
+                                                                 receiveTaskStack, &receiveTaskBuffer, 1);
+#ifndef METRICS_DISABLED
+  metrics.add_task("LoRaReceiveTask", receiveTaskHandle, sizeof(receiveTaskStack));
+  metrics.add_task("RelayTransmitTask", transmitTaskHandle, sizeof(transmitTaskStack));
+#else
+  (void)receiveTaskHandle;
+#endif
 }
 
-void loop() {
-  // put your main code here, to run repeatedly:
-    Serial.println("Hello World");
-    delay(1000);
+void printStatsLine(const char* line) {
+  Serial.println(line);
 }
 
+void printStats() {
+#ifndef METRICS_DISABLED
+  for (size_t i = 0; i < metrics.task_count(); i++) {
+    metrics.set_task_stack_free(i, uxTaskGetStackHighWaterMark((TaskHandle_t)metrics.task_handle(i)));
+  }
+  metrics.report(millis(), printStatsLine);
+#else
+  Serial.println("Metrics are disabled in this build.");
+#endif
+}
+
+// --------------------------------------------------------
+// loop(): The tasks do the work; this only serves the serial
+// console, where "stats" prints the runtime metrics.
+// --------------------------------------------------------
+void loop() {
+  static char line[16];
+  static size_t lineLength = 0;
+  while (Serial.available()) {
+    char c = Serial.read();
+    if (c == '\n' || c == '\r') {
+      line[lineLength] = '\0';
+      if (strcmp(line, "stats") == 0) {
+        printStats();
+      }
+      lineLength = 0;
+    } else if (lineLength < sizeof(line) - 1) {
+      line[lineLength++] = c;
+    }
+  }
+  delay(50);
+}
@@ -0,0 +1,16 @@
+#include "sim.h"
+
+// Host-side protocol simulation runner. Build and run with:
+//   pio run -e sim -t exec
+// Exits non-zero if any scenario saw a protocol violation.
+
+int main() {
+  bool ok = true;
+  ok = run_reliability_scenarios() && ok;
+  ok = run_access_scenarios() && ok;
+  ok = run_button_scenarios() && ok;
+  ok = run_journal_scenarios() && ok;
+  ok = run_network_scenarios() && ok;
+  std::printf("\n%s\n", ok ? "all scenarios passed" : "PROTOCOL VIOLATION");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+// Host-side protocol simulations. Each scenario prints its own report and
+// returns false if it observed a protocol violation, so the runner can be
+// used as a regression check as well as a tuning aid. Seeds are fixed, so
+// two runs of the same build print identical numbers.
+
+bool run_reliability_scenarios();
+bool run_access_scenarios();
+bool run_button_scenarios();
+bool run_journal_scenarios();
+bool run_network_scenarios();
+
+#endif // SIM_H
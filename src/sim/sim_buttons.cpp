@@ -0,0 +1,165 @@
+#include "sim.h"
+#include "debounce.h"
+#include <string>
+#include <vector>
+
+// The user device's button input on synthetic edge traces: raw edges as the
+// GPIO interrupt would record them, fed through ButtonDebouncer the way
+// InputTask does (wake on an edge or when a debouncer's timer is due). The
+// events must match each trace's expectation exactly.
+//
+// For comparison, the same traces are run through the input handling the
+// firmware had before: all four pins read every 50 ms and, after any press,
+// every button ignored for 200 ms. Its column counts the physical presses
+// it noticed at all.
+
+namespace {
+
+enum { MODE, UP, DOWN, OK, BUTTONS };
+const char* const buttonNames[BUTTONS] = {"MODE", "UP", "DOWN", "OK"};
+
+struct Edge {
+  uint8_t button;
+  uint32_t atMs;
+  bool pressed;
+};
+
+struct Trace {
+  const char* name;
+  std::vector<Edge> edges;
+  std::vector<ButtonEvent> expected;
+};
+
+std::vector<ButtonEvent> debounce(const std::vector<Edge>& edges, uint32_t endMs) {
+  ButtonDebouncer buttons[BUTTONS] = {
+    ButtonDebouncer(MODE, ButtonDebouncer::GESTURE_LONG_PRESS),
+    ButtonDebouncer(UP, ButtonDebouncer::GESTURE_AUTO_REPEAT),
+    ButtonDebouncer(DOWN, ButtonDebouncer::GESTURE_AUTO_REPEAT),
+    ButtonDebouncer(OK),
+  };
+  std::vector<ButtonEvent> events;
+  size_t next = 0;
+  uint32_t now = 0;
+  while (now <= endMs) {
+    while (next < edges.size() && edges[next].atMs <= now) {
+      buttons[edges[next].button].on_edge(edges[next].pressed, edges[next].atMs);
+      next++;
+    }
+    uint32_t wake = next < edges.size() ? edges[next].atMs : UINT32_MAX;
+    for (ButtonDebouncer& button : buttons) {
+      ButtonEvent event;
+      while (button.poll(now, event)) events.push_back(event);
+      uint32_t wait = button.time_to_next_event(now);
+      if (wait != UINT32_MAX && now + wait < wake) wake = now + wait;
+    }
+    if (wake == UINT32_MAX) break;
+    now = wake > now ? wake : now + 1;
+  }
+  return events;
+}
+
+bool levelAt(const std::vector<Edge>& edges, uint8_t button, uint32_t atMs) {
+  bool level = false;
+  for (const Edge& edge : edges) {
+    if (edge.button == button && edge.atMs <= atMs) level = edge.pressed;
+  }
+  return level;
+}
+
+// Presses (from PRESS to RELEASE of the expected events) during which the
+// old poller acted on that button at least once.
+int oldPollerNoticed(const Trace& trace, uint32_t endMs) {
+  std::vector<std::pair<uint8_t, uint32_t>> actions;
+  int64_t lastDebounceTime = -1000;  // long ago: no lockout at the start
+  for (uint32_t now = 0; now <= endMs; now += 50) {
+    if ((int64_t)now - lastDebounceTime <= 200) continue;
+    for (uint8_t button = 0; button < BUTTONS; button++) {
+      if (levelAt(trace.edges, button, now)) {
+        actions.push_back({button, now});
+        lastDebounceTime = now;
+      }
+    }
+  }
+  int noticed = 0;
+  for (size_t i = 0; i < trace.expected.size(); i++) {
+    const ButtonEvent& press = trace.expected[i];
+    if (press.type != BUTTON_PRESS) continue;
+    uint32_t releasedAt = endMs;
+    for (size_t j = i + 1; j < trace.expected.size(); j++) {
+      if (trace.expected[j].button == press.button && trace.expected[j].type == BUTTON_RELEASE) {
+        releasedAt = trace.expected[j].timeMs;
+        break;
+      }
+    }
+    for (const auto& action : actions) {
+      if (action.first == press.button && action.second >= press.timeMs && action.second < releasedAt) {
+        noticed++;
+        break;
+      }
+    }
+  }
+  return noticed;
+}
+
+std::string describe(const std::vector<ButtonEvent>& events) {
+  std::string text;
+  char item[40];
+  for (const ButtonEvent& event : events) {
+    std::snprintf(item, sizeof(item), "%s%s %s@%u", text.empty() ? "" : ", ", buttonNames[event.button],
+                  button_event_name(event.type), (unsigned)event.timeMs);
+    text += item;
+  }
+  return text.empty() ? "(none)" : text;
+}
+
+bool sameEvents(const std::vector<ButtonEvent>& a, const std::vector<ButtonEvent>& b) {
+  if (a.size() != b.size()) return false;
+  for (size_t i = 0; i < a.size(); i++) {
+    if (a[i].button != b[i].button || a[i].type != b[i].type || a[i].timeMs != b[i].timeMs) return false;
+  }
+  return true;
+}
+
+std::vector<Trace> traces() {
+  return {
+    {"clean 120 ms tap", {{OK, 100, true}, {OK, 220, false}},
+     {{OK, BUTTON_PRESS, 100}, {OK, BUTTON_RELEASE, 220}}},
+    {"bouncing press and release",
+     {{OK, 100, true}, {OK, 101, false}, {OK, 103, true}, {OK, 104, false}, {OK, 106, true},
+      {OK, 400, false}, {OK, 401, true}, {OK, 402, false}},
+     {{OK, BUTTON_PRESS, 100}, {OK, BUTTON_RELEASE, 400}}},
+    {"40 ms tap between polls", {{OK, 110, true}, {OK, 150, false}},
+     {{OK, BUTTON_PRESS, 110}, {OK, BUTTON_RELEASE, 150}}},
+    {"5 ms glitch", {{OK, 100, true}, {OK, 105, false}}, {}},
+    {"UP then DOWN 80 ms apart", {{UP, 100, true}, {UP, 160, false}, {DOWN, 180, true}, {DOWN, 240, false}},
+     {{UP, BUTTON_PRESS, 100}, {UP, BUTTON_RELEASE, 160}, {DOWN, BUTTON_PRESS, 180}, {DOWN, BUTTON_RELEASE, 240}}},
+    {"MODE and OK together", {{MODE, 100, true}, {OK, 110, true}, {OK, 200, false}, {MODE, 210, false}},
+     {{MODE, BUTTON_PRESS, 100}, {OK, BUTTON_PRESS, 110}, {OK, BUTTON_RELEASE, 200}, {MODE, BUTTON_RELEASE, 210}}},
+    {"UP held 1.2 s", {{UP, 100, true}, {UP, 1300, false}},
+     {{UP, BUTTON_PRESS, 100}, {UP, BUTTON_REPEAT, 600}, {UP, BUTTON_REPEAT, 750}, {UP, BUTTON_REPEAT, 900},
+      {UP, BUTTON_REPEAT, 1050}, {UP, BUTTON_REPEAT, 1200}, {UP, BUTTON_RELEASE, 1300}}},
+    {"MODE held 1 s", {{MODE, 100, true}, {MODE, 1100, false}},
+     {{MODE, BUTTON_PRESS, 100}, {MODE, BUTTON_LONG_PRESS, 900}, {MODE, BUTTON_RELEASE, 1100}}},
+  };
+}
+
+}  // namespace
+
+bool run_button_scenarios() {
+  bool ok = true;
+  std::printf("\n== Button input on synthetic edge traces (settle %u ms, long press %u ms, repeat %u+%u ms) ==\n",
+              DEBOUNCE_SETTLE_MS, DEBOUNCE_LONG_PRESS_MS, DEBOUNCE_REPEAT_DELAY_MS, DEBOUNCE_REPEAT_INTERVAL_MS);
+  std::printf("%-28s %8s  %s\n", "trace", "old poll", "events");
+  for (const Trace& trace : traces()) {
+    uint32_t endMs = trace.edges.back().atMs + 1000;
+    std::vector<ButtonEvent> events = debounce(trace.edges, endMs);
+    int presses = 0;
+    for (const ButtonEvent& event : trace.expected) presses += event.type == BUTTON_PRESS;
+    std::printf("%-28s %6d/%d  %s\n", trace.name, oldPollerNoticed(trace, endMs), presses, describe(events).c_str());
+    if (!sameEvents(events, trace.expected)) {
+      std::printf("  violation: expected %s\n", describe(trace.expected).c_str());
+      ok = false;
+    }
+  }
+  return ok;
+}
@@ -0,0 +1,215 @@
+#include "sim.h"
+#include "journal.h"
+#include <map>
+#include <random>
+#include <vector>
+
+// The base's frame journal through a day of traffic with resets: twenty
+// users reporting every 30 s, flushed the way the base does it (a full
+// block, or one whose oldest record has waited JOURNAL_FLUSH_MS). The base
+// is reset now and then, sometimes part-way through writing a block; the
+// storage keeps only the bytes written before the cut, as a file system
+// without atomic appends would.
+//
+// Every record in a block that was written must replay byte for byte, in
+// order, as long as retention still holds its segment; a torn block must
+// not replay at all; and journal time must carry on after the last written
+// record across a reset. Indexed range replays must return exactly what filtering a full
+// replay returns.
+
+namespace {
+
+class MemoryStorage : public JournalStorage {
+public:
+  int cutAfterBytes = -1;  // the next append stops here and "resets"
+
+  bool segments(uint32_t& first, uint32_t& last) override {
+    if (files.empty()) return false;
+    first = files.begin()->first;
+    last = files.rbegin()->first;
+    return true;
+  }
+
+  bool append(uint32_t segment, const uint8_t* data, size_t length) override {
+    std::vector<uint8_t>& file = files[segment];
+    if (cutAfterBytes >= 0) {
+      file.insert(file.end(), data, data + (cutAfterBytes < (int)length ? cutAfterBytes : length));
+      cutAfterBytes = -1;
+      return false;
+    }
+    file.insert(file.end(), data, data + length);
+    return true;
+  }
+
+  size_t read(uint32_t segment, uint32_t offset, uint8_t* data, size_t length) override {
+    auto file = files.find(segment);
+    if (file == files.end() || offset >= file->second.size()) return 0;
+    size_t bytes = file->second.size() - offset < length ? file->second.size() - offset : length;
+    std::copy(file->second.begin() + offset, file->second.begin() + offset + bytes, data);
+    return bytes;
+  }
+
+  uint32_t size(uint32_t segment) override {
+    auto file = files.find(segment);
+    return file == files.end() ? 0 : (uint32_t)file->second.size();
+  }
+
+  bool remove(uint32_t segment) override {
+    return files.erase(segment) > 0;
+  }
+
+private:
+  std::map<uint32_t, std::vector<uint8_t>> files;
+};
+
+struct Reference {
+  uint32_t timeMs;
+  uint8_t sourceID;
+  std::vector<uint8_t> frame;
+};
+
+bool sameRecord(const Reference& expected, const JournalRecord& record) {
+  return expected.timeMs == record.timeMs && expected.sourceID == record.sourceID &&
+         expected.frame.size() == record.length && std::equal(expected.frame.begin(), expected.frame.end(), record.frame);
+}
+
+} // namespace
+
+bool run_journal_scenarios() {
+  const int users = 20;
+  const uint32_t reportMs = 30000;
+  const uint32_t dayMs = 24 * 3600000u;
+  std::mt19937 rng(2024);
+  MemoryStorage storage;
+  static Journal journal(storage);
+  journal.mount();
+
+  std::vector<Reference> durable;   // in blocks that were written
+  std::vector<Reference> pending;   // in the open block
+  uint32_t uptimeMs = 0;
+  int resets = 0;
+  int tornWrites = 0;
+  size_t lostToResets = 0;
+  bool ok = true;
+
+  for (uint32_t now = 0; now < dayMs; now += 1000) {
+    uptimeMs += 1000;
+    for (int user = 0; user < users; user++) {
+      if ((now / 1000 + user * 7) % (reportMs / 1000) != 0) continue;
+      Reference reference;
+      reference.sourceID = (uint8_t)(0x10 + user);
+      reference.frame.resize(14 + rng() % 30);
+      for (uint8_t& byte : reference.frame) byte = (uint8_t)rng();
+      reference.timeMs = journal.now(uptimeMs);
+      uint32_t written = journal.stats().blocksWritten;
+      bool appended = journal.append(uptimeMs, -90 - (int16_t)(rng() % 30), 5.25f, reference.sourceID,
+                                     reference.frame.data(), (uint8_t)reference.frame.size());
+      if (journal.stats().blocksWritten != written) {
+        durable.insert(durable.end(), pending.begin(), pending.end());
+        pending.clear();
+      } else if (!appended) {
+        lostToResets += pending.size();
+        pending.clear();
+      }
+      pending.push_back(reference);
+    }
+    if (journal.unwritten_ms(uptimeMs) >= JOURNAL_FLUSH_MS) {
+      if (journal.flush()) {
+        durable.insert(durable.end(), pending.begin(), pending.end());
+      } else {
+        lostToResets += pending.size();
+      }
+      pending.clear();
+    }
+
+    // A reset roughly every two hours, every other one cutting the next
+    // block write short.
+    if (rng() % 7200 == 0) {
+      resets++;
+      if (resets % 2 == 0 && !pending.empty()) {
+        tornWrites++;
+        storage.cutAfterBytes = (int)(rng() % JOURNAL_BLOCK_SIZE);
+        journal.flush();
+      }
+      lostToResets += pending.size();
+      pending.clear();
+      journal.mount();
+      uptimeMs = 0;
+      if (!durable.empty() && (int32_t)(journal.now(uptimeMs) - durable.back().timeMs) <= 0) {
+        std::printf("  violation: journal time went back across a reset\n");
+        ok = false;
+      }
+    }
+  }
+  if (journal.flush()) durable.insert(durable.end(), pending.begin(), pending.end());
+
+  // Everything still stored, oldest first: a suffix of what was written.
+  std::vector<JournalRecord> all;
+  std::vector<std::vector<uint8_t>> frames;
+  Journal::Cursor cursor;
+  journal.begin_replay(cursor, 0, UINT32_MAX, -1);
+  JournalRecord record;
+  size_t mismatches = 0;
+  size_t start = 0;
+  size_t recordBytes = 0;
+  while (journal.next(cursor, record)) {
+    if (all.empty()) {
+      while (start < durable.size() && durable[start].timeMs != record.timeMs) start++;
+    }
+    size_t index = start + all.size();
+    if (index >= durable.size() || !sameRecord(durable[index], record)) mismatches++;
+    frames.push_back(std::vector<uint8_t>(record.frame, record.frame + record.length));
+    all.push_back(record);
+    recordBytes += JOURNAL_RECORD_HEADER_SIZE + record.length;
+  }
+  size_t missing = durable.size() - start > all.size() ? durable.size() - start - all.size() : 0;
+
+  std::printf("\n== Frame journal, %d users for 24 h with resets ==\n", users);
+  std::printf("records %zu, written %zu, lost in open or torn blocks %zu (%d resets, %d torn writes)\n",
+              durable.size() + lostToResets, durable.size(), lostToResets, resets, tornWrites);
+  std::printf("retained %zu records in %u blocks over %zu segments, block fill %.0f%%\n", all.size(),
+              journal.stored_blocks(), journal.segment_count(),
+              100.0 * recordBytes / (journal.stored_blocks() * (double)(JOURNAL_BLOCK_SIZE - JOURNAL_BLOCK_HEADER_SIZE)));
+  if (mismatches > 0 || missing > 0) {
+    std::printf("  violation: %zu replayed records differ from what was written, %zu missing\n", mismatches, missing);
+    ok = false;
+  }
+
+  // The last half hour of one user, and one hour in the middle of it all.
+  size_t queries = 0;
+  size_t wrong = 0;
+  uint32_t blocksRead = 0;
+  uint32_t blocksSkipped = 0;
+  uint32_t endMs = all.empty() ? 0 : all.back().timeMs;
+  for (int user = 0; user < users && !all.empty(); user++) {
+    uint32_t fromMs = user % 2 ? endMs - 1800000 : all[all.size() / 2].timeMs;
+    uint32_t toMs = user % 2 ? endMs : fromMs + 3600000;
+    std::vector<size_t> expected;
+    for (size_t i = 0; i < all.size(); i++) {
+      if (all[i].sourceID == 0x10 + user && all[i].timeMs >= fromMs && all[i].timeMs <= toMs) expected.push_back(i);
+    }
+    journal.begin_replay(cursor, fromMs, toMs, 0x10 + user);
+    size_t matched = 0;
+    while (journal.next(cursor, record)) {
+      if (matched < expected.size() && record.timeMs == all[expected[matched]].timeMs &&
+          record.length == frames[expected[matched]].size() &&
+          std::equal(frames[expected[matched]].begin(), frames[expected[matched]].end(), record.frame)) {
+        matched++;
+      } else {
+        wrong++;
+      }
+    }
+    wrong += expected.size() - matched;
+    blocksRead += cursor.blocksRead;
+    blocksSkipped += cursor.blocksSkipped;
+    queries++;
+  }
+  std::printf("%zu node/time range replays: %.1f blocks read, %.1f skipped on their index entry, of %u\n", queries,
+              queries ? (double)blocksRead / queries : 0.0, queries ? (double)blocksSkipped / queries : 0.0,
+              journal.stored_blocks());
+  if (wrong > 0) {
+    std::printf("  violation: range replays differ from a filtered full replay in %zu records\n", wrong);
+    ok = false;
+  }
+  return ok;
+}
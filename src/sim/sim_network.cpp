@@ -0,0 +1,605 @@
+#include "sim.h"
+#include "payload_builder.h"
+#include "reliable_link.h"
+#include "relay_queue.h"
+#include "tx_scheduler.h"
+#include "adr.h"
+#include "lora_airtime.h"
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <queue>
+#include <random>
+#include <vector>
+
+// A whole deployment on one channel: a base, a few relays and tens to
+// hundreds of users, driven by a discrete-event loop. Users report their
+// position every two minutes and now and then send a predefined message
+// through ReliableLink; relays forward what they hear through the same
+// RelayQueue and TxScheduler duty-cycle budget as src/inter; the
+// base acknowledges messages through its own ReliableLink and TxScheduler.
+// Frames are encoded and decoded by the real libraries, so a change to a
+// frame size, a retransmit timer or a scheduler rule shows up here.
+//
+// The radio:
+// - time-on-air from lora_airtime at the scenario's data rate;
+// - log-distance path loss with a fixed log-normal shadowing per link and
+//   a fresh fading draw per frame and receiver;
+// - a frame is heard if it clears the noise floor by the data rate's
+//   demodulation SNR;
+// - a receiver locks on to the first frame it hears and keeps it only if
+//   every overlapping frame is at least captureDb weaker (capture effect);
+//   anything arriving while it is locked is lost to it;
+// - radios are half-duplex, and no node listens before it talks;
+// - a residual random loss covers everything else.
+//
+// Delivery ratio and latency count reports and messages made between the
+// warm-up and the last few minutes; utilisation is the fraction of time at
+// least one frame was on air anywhere.
+
+namespace {
+
+const uint8_t baseID = 0x02;
+const uint8_t firstRelayID = 0x10;
+const uint8_t firstUserID = 0x20;
+
+const uint32_t simulatedMs = 12 * 3600000u;
+const uint32_t warmupMs = 10 * 60000;
+const uint32_t drainMs = 10 * 60000;
+const uint32_t reportIntervalMs = 120000;
+const uint32_t reportJitterMs = 2000;
+const double meanMessageIntervalMs = 20 * 60000.0;
+
+// Users spread evenly over a disc around the base, relays on a ring
+// half-way out. At SF9 the outer users only reach the base through a relay.
+const double areaRadiusM = 7000.0;
+const double relayRingM = 3500.0;
+
+const double txPowerDbm = 17.0;         // the LoRa library's default
+const double referenceLossDb = 25.2;    // free space at 1 m, 433 MHz
+const double pathLossExponent = 3.3;
+const double shadowingSigmaDb = 6.0;
+const double fadingSigmaDb = 2.0;
+const double relayGainDb = 6.0;         // relays sit on masts, with better antennas
+const double noiseFigureDb = 6.0;
+const double captureDb = 6.0;
+const double residualLoss = 0.01;
+
+enum Role { BASE, RELAY, USER };
+
+struct Node {
+  Role role;
+  uint8_t id;
+  double x;
+  double y;
+  PayloadBuilder builder;
+  std::unique_ptr<ReliableLink> link;       // base and users
+  std::unique_ptr<TxScheduler> scheduler;   // base and relays
+  std::unique_ptr<RelayQueue> relays;       // relays
+  std::deque<std::vector<uint8_t>> outbox;  // user frames waiting for the radio
+  uint64_t wakeAtUs = 0;
+  uint32_t wakeGeneration = 0;
+
+  // Radio state.
+  bool transmitting = false;
+  int locked = -1;           // transmission being received
+  float lockedDbm = 0;
+  bool lockedFailed = false;
+  bool lockedCaptured = false;
+
+  // User traffic.
+  uint16_t gpsTransmissionID = 0;
+  std::vector<uint32_t> reportAt;    // per GPS transmission ID
+  std::vector<uint32_t> messageAt;   // per message, msgID is the index
+  int messagesWaiting = 0;
+};
+
+struct Transmission {
+  int sender;
+  uint64_t endUs;
+  std::vector<uint8_t> bytes;
+  std::vector<float> rxDbm;  // at every node, this frame's fading included
+};
+
+struct Event {
+  uint64_t atUs;
+  uint32_t order;   // ties go in scheduling order, so runs repeat exactly
+  enum Type { TX_END, REPORT, MESSAGE, WAKE } type;
+  int node;
+  uint32_t value;   // transmission for TX_END, generation for WAKE
+
+  bool operator>(const Event& other) const {
+    return atUs != other.atUs ? atUs > other.atUs : order > other.order;
+  }
+};
+
+struct NetworkResult {
+  int reports;
+  int reportsDelivered;
+  int reportsDirect;             // first copy came straight from the user
+  int reportCopies;              // copies the base decoded, duplicates included
+  std::vector<uint32_t> reportLatencies;
+  int messages;
+  int messagesDelivered;
+  std::vector<uint32_t> messageLatencies;
+  int messageRetransmissions;
+  int baseCollisions;            // frames the base heard but lost to overlap
+  int baseCaptures;              // frames it kept despite an overlapping one
+  int baseHalfDuplex;            // frames it missed while transmitting
+  int relayDrops;                // relay or duty-cycle queue full, cache or hop limit
+  uint64_t busyUs;
+  uint64_t airtimeUs[3];         // per role
+  int violations;
+};
+
+uint32_t percentile(std::vector<uint32_t>& values, double fraction) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  return values[std::min(values.size() - 1, (size_t)(fraction * values.size()))];
+}
+
+class Network {
+public:
+  Network(int users, int relays, uint8_t dataRate, uint32_t seed)
+      : modem(adr_modem_config(dataRate, lora_default_config())), rng(seed), relayCount(relays) {
+    double noiseDbm = -174.0 + 10.0 * std::log10((double)modem.bandwidth) + noiseFigureDb;
+    sensitivityDbm = noiseDbm + adr_data_rate(dataRate).requiredSnrDb;
+    result = NetworkResult();
+
+    addNode(BASE, baseID, 0.0, 0.0);
+    for (int r = 0; r < relayCount; r++) {
+      double angle = 2.0 * M_PI * r / relayCount;
+      addNode(RELAY, (uint8_t)(firstRelayID + r), relayRingM * std::cos(angle), relayRingM * std::sin(angle));
+    }
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    for (int u = 0; u < users; u++) {
+      double radius = areaRadiusM * std::sqrt(unit(rng));
+      double angle = 2.0 * M_PI * unit(rng);
+      addNode(USER, (uint8_t)(firstUserID + u), radius * std::cos(angle), radius * std::sin(angle));
+    }
+
+    // Shadowing belongs to the link, so it is the same both ways.
+    std::normal_distribution<double> shadowing(0.0, shadowingSigmaDb);
+    linkDbm.assign(nodes.size() * nodes.size(), 0.0f);
+    for (size_t a = 0; a < nodes.size(); a++) {
+      for (size_t b = a + 1; b < nodes.size(); b++) {
+        double distance = std::max(1.0, std::hypot(nodes[a]->x - nodes[b]->x, nodes[a]->y - nodes[b]->y));
+        double loss = referenceLossDb + 10.0 * pathLossExponent * std::log10(distance) + shadowing(rng);
+        loss -= relayGainDb * ((nodes[a]->role == RELAY) + (nodes[b]->role == RELAY));
+        linkDbm[a * nodes.size() + b] = linkDbm[b * nodes.size() + a] = (float)(txPowerDbm - loss);
+      }
+    }
+
+    std::normal_distribution<float> fading(0.0f, (float)fadingSigmaDb);
+    for (float& draw : fadingDb) draw = fading(rng);
+
+    std::uniform_int_distribution<uint32_t> phase(0, reportIntervalMs - 1);
+    for (size_t n = 0; n < nodes.size(); n++) {
+      if (nodes[n]->role != USER) continue;
+      push(phase(rng) * 1000ull, Event::REPORT, (int)n, 0);
+      push(nextMessageDelayMs() * 1000ull, Event::MESSAGE, (int)n, 0);
+    }
+  }
+
+  NetworkResult run() {
+    while (!events.empty() && events.top().atUs < simulatedMs * 1000ull) {
+      Event event = events.top();
+      events.pop();
+      nowUs = event.atUs;
+      switch (event.type) {
+        case Event::TX_END:
+          endTransmission((int)event.value);
+          break;
+        case Event::REPORT:
+          makeReport(event.node);
+          break;
+        case Event::MESSAGE:
+          makeMessage(event.node);
+          break;
+        case Event::WAKE:
+          if (event.value == nodes[event.node]->wakeGeneration) service(event.node);
+          break;
+      }
+    }
+    if (activeTransmissions > 0) result.busyUs += measuredUs(busySinceUs, simulatedMs * 1000ull);
+
+    for (const std::unique_ptr<Node>& node : nodes) {
+      if (node->role == RELAY) {
+        for (int c = 0; c < TxScheduler::TX_CLASS_COUNT; c++) {
+          result.relayDrops += node->scheduler->stats((TxScheduler::TrafficClass)c).dropped;
+        }
+        const RelayQueue::Stats& stats = node->relays->stats();
+        result.relayDrops += node->relays->cache().full_drops() + stats.hopLimit + stats.queueFull;
+      } else if (node->role == USER) {
+        const ReliableLink::Stats& stats = node->link->stats();
+        result.messageRetransmissions += stats.retransmissions;
+        int accepted = 0;
+        for (uint32_t heardAt : acceptedAt[node->id]) {
+          if (heardAt != UINT32_MAX) accepted++;
+        }
+        // An ACK for a message the base never took would be a lost message
+        // the user believes delivered.
+        if ((int)stats.delivered > accepted) {
+          std::printf("  violation: user %u counts %u messages delivered, the base accepted %d\n", node->id,
+                      stats.delivered, accepted);
+          result.violations++;
+        }
+      }
+    }
+    return result;
+  }
+
+private:
+  LoRaModemConfig modem;
+  std::mt19937 rng;
+  int relayCount;
+  double sensitivityDbm;
+  std::vector<std::unique_ptr<Node>> nodes;
+  std::vector<float> linkDbm;  // mean received power, row = sender
+  float fadingDb[4096];        // normal draws, picked from at random per frame and receiver
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+  uint32_t eventOrder = 0;
+  uint64_t nowUs = 0;
+
+  std::vector<Transmission> pool;
+  std::vector<int> freeTransmissions;
+  std::vector<int> onAir;
+  int activeTransmissions = 0;
+  uint64_t busySinceUs = 0;
+
+  // Base side: when each user's reports and messages first arrived.
+  std::vector<std::vector<uint32_t>> reportHeardAt = std::vector<std::vector<uint32_t>>(256);
+  std::vector<std::vector<uint32_t>> acceptedAt = std::vector<std::vector<uint32_t>>(256);
+  NetworkResult result;
+
+  uint32_t nowMs() const { return (uint32_t)(nowUs / 1000); }
+
+  static bool measured(uint32_t madeAt) { return madeAt >= warmupMs && madeAt < simulatedMs - drainMs; }
+
+  static uint64_t measuredUs(uint64_t fromUs, uint64_t toUs) {
+    fromUs = std::max<uint64_t>(fromUs, warmupMs * 1000ull);
+    toUs = std::min<uint64_t>(toUs, (simulatedMs - drainMs) * 1000ull);
+    return toUs > fromUs ? toUs - fromUs : 0;
+  }
+
+  uint32_t nextMessageDelayMs() {
+    std::exponential_distribution<double> interval(1.0 / meanMessageIntervalMs);
+    return (uint32_t)interval(rng) + 1;
+  }
+
+  void push(uint64_t atUs, Event::Type type, int node, uint32_t value) {
+    events.push(Event{atUs, eventOrder++, type, node, value});
+  }
+
+  void addNode(Role role, uint8_t id, double x, double y) {
+    std::unique_ptr<Node> node(new Node());
+    node->role = role;
+    node->id = id;
+    node->x = x;
+    node->y = y;
+    node->builder.configure_device(id, role == USER ? baseID : PAYLOAD_BROADCAST_ID);
+    node->builder.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+    if (role != RELAY) {
+      node->link.reset(new ReliableLink(id, (uint16_t)rng()));
+      node->link->set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+    }
+    if (role != USER) {
+      node->scheduler.reset(new TxScheduler());
+      node->scheduler->set_modem_config(modem);
+    }
+    if (role == RELAY) {
+      node->relays.reset(new RelayQueue(id));
+    }
+    nodes.push_back(std::move(node));
+  }
+
+  // ----- Traffic -----
+
+  void makeReport(int n) {
+    Node& node = *nodes[n];
+    uint32_t now = nowMs();
+    PayloadBuilder::Buffer frame;
+    size_t length = node.builder.encode_gps_payload(frame, node.gpsTransmissionID++, 80.0f + (float)(node.x / 111000.0),
+                                                   7.0f + (float)(node.y / 111000.0));
+    node.reportAt.push_back(now);
+    node.outbox.push_back(std::vector<uint8_t>(frame.data(), frame.data() + length));
+    if (measured(now)) result.reports++;
+    std::uniform_int_distribution<uint32_t> jitter(0, 2 * reportJitterMs);
+    push((uint64_t)(now + reportIntervalMs - reportJitterMs + jitter(rng)) * 1000, Event::REPORT, n, 0);
+    service(n);
+  }
+
+  void makeMessage(int n) {
+    Node& node = *nodes[n];
+    node.messagesWaiting++;
+    push(nowUs + nextMessageDelayMs() * 1000ull, Event::MESSAGE, n, 0);
+    service(n);
+  }
+
+  // Does what the node's tasks would do now, then books its next wake-up.
+  void service(int n) {
+    Node& node = *nodes[n];
+    uint32_t now = nowMs();
+    if (node.role == USER) {
+      // A message waits, like the firmware's held one, until the window
+      // has room.
+      while (node.messagesWaiting > 0 && node.link->can_send(baseID)) {
+        node.link->send_p_msg(baseID, (uint8_t)node.messageAt.size(), now);
+        if (measured(now)) result.messages++;
+        node.messageAt.push_back(now);
+        node.messagesWaiting--;
+      }
+      PayloadBuilder::Buffer frame;
+      size_t length;
+      while ((length = node.link->poll(now, frame.data(), frame.size())) > 0) {
+        node.outbox.push_back(std::vector<uint8_t>(frame.data(), frame.data() + length));
+      }
+      if (!node.transmitting && !node.outbox.empty()) {
+        std::vector<uint8_t> bytes = std::move(node.outbox.front());
+        node.outbox.pop_front();
+        startTransmission(n, bytes);
+      }
+    } else {
+      if (node.role == BASE) {
+        PayloadBuilder::Buffer frame;
+        size_t length;
+        while ((length = node.link->poll(now, frame.data(), frame.size())) > 0) {
+          uint32_t key = 0;
+          if (PayloadBuilder::frame_type(frame[0]) == PAYLOAD_TYPE_ACK) {
+            key = ((uint32_t)PAYLOAD_TYPE_ACK << 24) | ((uint32_t)node.builder.get_payload_details(frame.data(), length).destinationID << 16);
+          }
+          node.scheduler->enqueue(TxScheduler::TX_CONTROL, frame.data(), length, now, key);
+        }
+      } else {
+        node.relays->schedule_due(now, node.builder, *node.scheduler);
+      }
+      PayloadBuilder::FrameBuffer frame;
+      size_t length;
+      if (!node.transmitting && (length = node.scheduler->next(now, frame.data(), frame.size())) > 0) {
+        startTransmission(n, std::vector<uint8_t>(frame.data(), frame.data() + length));
+      }
+    }
+
+    if (node.transmitting) return;  // serviced again when the frame ends
+    uint32_t wait = UINT32_MAX;
+    if (node.link) wait = std::min(wait, node.link->time_to_next_event(now));
+    if (node.scheduler) wait = std::min(wait, node.scheduler->time_to_next_event(now));
+    if (node.relays) wait = std::min(wait, node.relays->time_to_next_event(now));
+    if (wait == UINT32_MAX) return;
+    uint64_t atUs = nowUs + std::max<uint32_t>(wait, 1) * 1000ull;
+    if (node.wakeAtUs > nowUs && node.wakeAtUs <= atUs) return;  // an earlier one is booked
+    node.wakeAtUs = atUs;
+    push(atUs, Event::WAKE, n, ++node.wakeGeneration);
+  }
+
+  // ----- Relays -----
+
+  // queueForRelay() of src/inter: parse the frame, and the one a relay
+  // wraps, then offer it with a random backoff.
+  void queueForRelay(Node& node, const uint8_t* payload, size_t payloadLength) {
+    PayloadBuilder::ParsedFrame received;
+    PayloadBuilder::ParsedFrame original;
+    if (node.builder.parse(payload, payloadLength, received) && received.details.type == PAYLOAD_TYPE_RELAY) {
+      node.builder.parse(received.relay.frame, received.relay.length, original);
+    } else {
+      original = received;
+    }
+    std::uniform_int_distribution<uint32_t> backoff(RELAY_BACKOFF_MIN_MS, RELAY_BACKOFF_MAX_MS - 1);
+    node.relays->offer(payload, payloadLength, received, original, nowMs(), backoff(rng));
+  }
+
+  // ----- Receiving -----
+
+  // Returns true if the node may have something new to do.
+  bool deliver(int n, const std::vector<uint8_t>& bytes) {
+    Node& node = *nodes[n];
+    uint8_t type = node.builder.identify_type_and_check_checksum(bytes.data(), bytes.size());
+    if (type == PAYLOAD_INVALID) return false;
+    if (node.role == RELAY) {
+      queueForRelay(node, bytes.data(), bytes.size());
+      return true;
+    }
+
+    const uint8_t* frame = bytes.data();
+    size_t length = bytes.size();
+    bool relayed = false;
+    if (type == PAYLOAD_TYPE_RELAY) {
+      PayloadBuilder::RelayView relay = node.builder.decode_relay_view(frame, length);
+      type = node.builder.identify_type_and_check_checksum(relay.frame, relay.length);
+      if (type == PAYLOAD_INVALID) return false;
+      if (relay.hopCount > RELAY_MAX_HOPS) {
+        std::printf("  violation: frame arrived after %u hops\n", relay.hopCount);
+        result.violations++;
+      }
+      frame = relay.frame;
+      length = relay.length;
+      relayed = true;
+    }
+    PayloadBuilder::PayloadDetails details = node.builder.get_payload_details(frame, length);
+    uint32_t now = nowMs();
+
+    if (node.role == USER) {
+      if (type != PAYLOAD_TYPE_ACK || details.destinationID != node.id) return false;
+      node.link->on_ack(details.sourceID, details.destinationID, node.builder.decode_ack_payload(frame, length), now);
+      return true;
+    }
+
+    Node* sender = details.sourceID >= firstUserID ? nodes[userIndex(details.sourceID)].get() : nullptr;
+    if (type == PAYLOAD_TYPE_GPS && sender != nullptr && details.transmissionID < sender->reportAt.size()) {
+      std::vector<uint32_t>& heard = reportHeardAt[details.sourceID];
+      if (heard.size() <= details.transmissionID) heard.resize(details.transmissionID + 1, UINT32_MAX);
+      uint32_t madeAt = sender->reportAt[details.transmissionID];
+      if (measured(madeAt)) result.reportCopies++;
+      if (heard[details.transmissionID] == UINT32_MAX) {
+        heard[details.transmissionID] = now;
+        if (measured(madeAt)) {
+          result.reportsDelivered++;
+          if (!relayed) result.reportsDirect++;
+          result.reportLatencies.push_back(now - madeAt);
+        }
+      }
+    } else if (type == PAYLOAD_TYPE_P_MSG && sender != nullptr) {
+      if (node.link->on_data(details.sourceID, details.destinationID, details.transmissionID, now) != ReliableLink::ACCEPT_NEW) {
+        return true;  // a duplicate is ACKed again
+      }
+      uint8_t message = node.builder.decode_p_msg_payload(frame, length).msgID;
+      std::vector<uint32_t>& accepted = acceptedAt[details.sourceID];
+      if (message >= sender->messageAt.size()) return true;
+      if (accepted.size() <= message) accepted.resize(message + 1, UINT32_MAX);
+      if (accepted[message] == UINT32_MAX) {
+        accepted[message] = now;
+        if (measured(sender->messageAt[message])) {
+          result.messagesDelivered++;
+          result.messageLatencies.push_back(now - sender->messageAt[message]);
+        }
+      }
+      return true;
+    }
+    return false;
+  }
+
+  int userIndex(uint8_t id) const { return 1 + relayCount + (id - firstUserID); }
+
+  // ----- Radio -----
+
+  void startTransmission(int sender, const std::vector<uint8_t>& bytes) {
+    Node& node = *nodes[sender];
+    if (node.locked >= 0) {
+      if (node.role == BASE) result.baseHalfDuplex++;
+      node.locked = -1;
+    }
+    node.transmitting = true;
+
+    int index;
+    if (freeTransmissions.empty()) {
+      index = (int)pool.size();
+      pool.push_back(Transmission());
+    } else {
+      index = freeTransmissions.back();
+      freeTransmissions.pop_back();
+    }
+    uint32_t airtimeUs = lora_time_on_air_us(modem, bytes.size());
+    Transmission& tx = pool[index];
+    tx.sender = sender;
+    tx.endUs = nowUs + airtimeUs;
+    tx.bytes = bytes;
+    tx.rxDbm.resize(nodes.size());
+    result.airtimeUs[node.role] += measuredUs(nowUs, tx.endUs);
+    if (activeTransmissions++ == 0) busySinceUs = nowUs;
+
+    const float* row = &linkDbm[sender * nodes.size()];
+    // Fading can not lift a frame this far down to where it is heard or
+    // spoils another, so those receivers skip the draw.
+    float fadeFloorDbm = (float)(sensitivityDbm - captureDb - 4 * fadingSigmaDb);
+    for (size_t r = 0; r < nodes.size(); r++) {
+      if ((int)r == sender) continue;
+      float dbm = row[r] < fadeFloorDbm ? row[r] : row[r] + fadingDb[rng() >> 20];
+      tx.rxDbm[r] = dbm;
+      Node& receiver = *nodes[r];
+      if (receiver.transmitting) {
+        if (receiver.role == BASE && dbm >= sensitivityDbm) result.baseHalfDuplex++;
+      } else if (receiver.locked >= 0) {
+        // Busy with an earlier frame: this one is lost to it, and spoils
+        // the earlier one unless that is captureDb stronger.
+        if (dbm > receiver.lockedDbm - captureDb) {
+          receiver.lockedFailed = true;
+        } else if (dbm >= sensitivityDbm - captureDb) {
+          receiver.lockedCaptured = true;
+        }
+        if (receiver.role == BASE && dbm >= sensitivityDbm) result.baseCollisions++;
+      } else if (dbm >= sensitivityDbm) {
+        receiver.locked = index;
+        receiver.lockedDbm = dbm;
+        receiver.lockedFailed = false;
+        receiver.lockedCaptured = false;
+        for (int other : onAir) {
+          float interference = pool[other].rxDbm[r];
+          if (interference > dbm - captureDb) {
+            receiver.lockedFailed = true;
+          } else if (interference >= sensitivityDbm - captureDb) {
+            receiver.lockedCaptured = true;
+          }
+        }
+      }
+    }
+    onAir.push_back(index);
+    push(tx.endUs, Event::TX_END, sender, (uint32_t)index);
+  }
+
+  void endTransmission(int index) {
+    Transmission& tx = pool[index];
+    onAir.erase(std::find(onAir.begin(), onAir.end(), index));
+    if (--activeTransmissions == 0) result.busyUs += measuredUs(busySinceUs, nowUs);
+    nodes[tx.sender]->transmitting = false;
+
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<int> receivers;
+    for (size_t r = 0; r < nodes.size(); r++) {
+      Node& receiver = *nodes[r];
+      if (receiver.locked != index) continue;
+      receiver.locked = -1;
+      if (receiver.lockedFailed) {
+        if (receiver.role == BASE) result.baseCollisions++;
+      } else if (unit(rng) >= residualLoss) {
+        if (receiver.role == BASE && receiver.lockedCaptured) result.baseCaptures++;
+        receivers.push_back((int)r);
+      }
+    }
+    std::vector<uint8_t> bytes = std::move(tx.bytes);
+    int sender = tx.sender;
+    freeTransmissions.push_back(index);
+
+    for (int r : receivers) {
+      if (deliver(r, bytes)) service(r);
+    }
+    service(sender);
+  }
+};
+
+}  // namespace
+
+bool run_network_scenarios() {
+  bool ok = true;
+  std::printf("\n== Network, base and relays over a %.0f km radius, GPS every %u s and a message every %.0f min per user, %u h ==\n",
+              areaRadiusM / 1000.0, reportIntervalMs / 1000, meanMessageIntervalMs / 60000.0, simulatedMs / 3600000u);
+  std::printf("%-9s %6s %5s | %6s %6s %6s %7s %7s %7s | %6s %7s %7s %6s | %5s %7s | %6s %6s %6s %6s\n", "rate", "relays",
+              "users", "GPS", "direct", "copies", "p50 ms", "p95 ms", "p99 ms", "msg", "p50 ms", "p95 ms", "retx", "busy",
+              "offered", "lost", "capt", "hdx", "relay");
+
+  struct Setup {
+    uint8_t dataRate;
+    int relays;
+  };
+  const Setup setups[] = {{3, 4}, {3, 0}, {ADR_SAFE_DATA_RATE, 4}};
+  const int userCounts[] = {25, 50, 100, 200};
+  double nodeHours = 0;
+  for (const Setup& setup : setups) {
+    for (int users : userCounts) {
+      Network network(users, setup.relays, setup.dataRate, 0xD15C0000u + setup.dataRate * 1000 + setup.relays * 100 + users);
+      NetworkResult r = network.run();
+      nodeHours += (users + setup.relays + 1) * (simulatedMs / 3600000.0);
+
+      double measuredMs = simulatedMs - warmupMs - drainMs;
+      uint64_t offeredUs = r.airtimeUs[BASE] + r.airtimeUs[RELAY] + r.airtimeUs[USER];
+      char rate[16];
+      std::snprintf(rate, sizeof(rate), "DR%u SF%u", setup.dataRate, adr_data_rate(setup.dataRate).spreadingFactor);
+      std::printf("%-9s %6d %5d | %5.1f%% %5.1f%% %6.2f %7u %7u %7u | %5.1f%% %7u %7u %6d | %4.0f%% %5.2f E | %6d %6d %6d %6d\n",
+                  rate, setup.relays, users, 100.0 * r.reportsDelivered / r.reports,
+                  r.reportsDelivered ? 100.0 * r.reportsDirect / r.reportsDelivered : 0.0,
+                  r.reportsDelivered ? (double)r.reportCopies / r.reportsDelivered : 0.0,
+                  percentile(r.reportLatencies, 0.50), percentile(r.reportLatencies, 0.95),
+                  percentile(r.reportLatencies, 0.99), r.messages ? 100.0 * r.messagesDelivered / r.messages : 0.0,
+                  percentile(r.messageLatencies, 0.50), percentile(r.messageLatencies, 0.95), r.messageRetransmissions,
+                  100.0 * r.busyUs / 1000.0 / measuredMs, offeredUs / 1000.0 / measuredMs, r.baseCollisions,
+                  r.baseCaptures, r.baseHalfDuplex, r.relayDrops);
+      if (r.violations > 0) ok = false;
+    }
+  }
+  std::printf("%.0f node-hours. GPS: reports that reached the base; direct: of those, first heard straight from the\n"
+              "user; copies: decoded per delivered report. msg: predefined messages the base accepted. busy: time a\n"
+              "frame was on air; offered: airtime of all frames. At the base: frames lost to overlap, kept by capture,\n"
+              "missed while transmitting. relay: frames relays dropped on a full queue or cache.\n",
+              nodeHours);
+  return ok;
+}
@@ -0,0 +1,297 @@
+#include "sim.h"
+#include "payload_builder.h"
+#include "reliable_link.h"
+#include "lora_airtime.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <vector>
+
+// Two devices exchanging custom messages through ReliableLink over a lossy
+// LoRa channel. Time advances in 1 ms steps. The channel is shared and
+// half-duplex with ideal carrier sense: a device only transmits when the
+// channel is idle, a frame occupies it for its time-on-air, and each frame
+// is then lost independently with the scenario's loss rate.
+//
+// Every message carries its sequence number as text, so the receiver can
+// check that each one is delivered to the application at most once and that
+// every message the sender counts as delivered really arrived.
+
+namespace {
+
+const uint8_t userID = 0x01;
+const uint8_t baseID = 0x02;
+
+struct SimNode {
+  uint8_t id;
+  uint8_t peerID;
+  ReliableLink link;
+  std::deque<int> outbox;            // messages not yet accepted by the link
+  uint32_t nextMessageAt;
+  uint32_t messageInterval;
+  int messagesCreated;
+  int messageCount;
+  std::vector<uint32_t> createdAt;   // per message sent by this node
+  std::vector<int> receivedCount;    // per message sent by the peer
+  std::vector<uint32_t> latencies;   // creation to first delivery, peer's messages
+
+  SimNode(uint8_t id, uint8_t peerID, uint16_t initialID, uint32_t interval, int count)
+      : id(id), peerID(peerID), link(id, initialID), nextMessageAt(0), messageInterval(interval),
+        messagesCreated(0), messageCount(count), createdAt(count, 0) {}
+};
+
+struct InFlightFrame {
+  uint32_t arrivesAt;
+  SimNode* receiver;
+  bool lost;
+  std::vector<uint8_t> bytes;
+};
+
+struct ScenarioResult {
+  int sent;
+  int delivered;
+  int duplicatesDelivered;
+  int phantomAcks;  // sender counted delivered, receiver never got it
+  uint32_t framesOnAir;
+  uint32_t airtimeMs;
+  double meanLatencyMs;
+  uint32_t p95LatencyMs;
+  ReliableLink::Stats stats;
+  uint32_t finalRtoMs;
+};
+
+void deliver(SimNode& node, SimNode& sender, const uint8_t* frame, size_t length, uint32_t now, PayloadBuilder& decoder) {
+  auto acceptMessage = [&](uint8_t sourceID, uint8_t destinationID, uint16_t transmissionID, const char* text, size_t textLength) {
+    if (node.link.on_data(sourceID, destinationID, transmissionID, now) != ReliableLink::ACCEPT_NEW) return;
+    int message = std::atoi(std::string(text, textLength).c_str());
+    if (message < 0 || message >= (int)node.receivedCount.size()) return;
+    if (node.receivedCount[message]++ == 0) {
+      node.latencies.push_back(now - sender.createdAt[message]);
+    }
+  };
+
+  uint8_t type = decoder.identify_type_and_check_checksum(frame, length);
+  PayloadBuilder::PayloadDetails details = decoder.get_payload_details(frame, length);
+  if (type == PAYLOAD_TYPE_C_MSG) {
+    PayloadBuilder::CMsgView view = decoder.decode_c_msg_view(frame, length);
+    acceptMessage(details.sourceID, details.destinationID, details.transmissionID, view.message, view.length);
+  } else if (type == PAYLOAD_TYPE_ACK) {
+    node.link.on_ack(details.sourceID, details.destinationID, decoder.decode_ack_payload(frame, length), now);
+  } else if (type == PAYLOAD_TYPE_AGGREGATE) {
+    PayloadBuilder::AggregateReader reader(frame, length);
+    PayloadBuilder::AggregateRecord record;
+    while (reader.next(record)) {
+      if (record.type == PAYLOAD_TYPE_C_MSG) {
+        PayloadBuilder::CMsgView view = decoder.decode_c_msg_record(record);
+        acceptMessage(record.sourceID, details.destinationID, record.transmissionID, view.message, view.length);
+      } else if (record.type == PAYLOAD_TYPE_ACK) {
+        node.link.on_ack(record.sourceID, details.destinationID, decoder.decode_ack_record(record), now);
+      }
+    }
+  }
+}
+
+ScenarioResult runScenario(double lossRate, uint8_t window, uint8_t spreadingFactor, int messages) {
+  std::mt19937 rng(12345);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  LoRaModemConfig modem = lora_default_config();
+  modem.spreadingFactor = spreadingFactor;
+  modem.crc = true;
+
+  // The user reports faster than the base answers; both directions carry
+  // traffic so ACKs can ride on messages.
+  SimNode user(userID, baseID, 0x1200, 400, messages);
+  SimNode base(baseID, userID, 0xBEEF, 900, messages / 2);
+  user.receivedCount.assign(base.messageCount, 0);
+  base.receivedCount.assign(user.messageCount, 0);
+  SimNode* nodes[2] = {&user, &base};
+  for (SimNode* node : nodes) {
+    node->link.set_window(window);
+    node->link.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  }
+
+  PayloadBuilder decoder;
+  std::vector<InFlightFrame> air;
+  uint32_t channelBusyUntil = 0;
+  ScenarioResult result = {};
+  const uint32_t limitMs = 3600 * 1000;
+
+  uint32_t now = 0;
+  for (; now < limitMs; now++) {
+    for (size_t i = 0; i < air.size();) {
+      if (air[i].arrivesAt <= now) {
+        if (!air[i].lost) {
+          SimNode& sender = air[i].receiver == &user ? base : user;
+          deliver(*air[i].receiver, sender, air[i].bytes.data(), air[i].bytes.size(), now, decoder);
+        }
+        air.erase(air.begin() + i);
+      } else {
+        i++;
+      }
+    }
+
+    bool allDone = true;
+    for (int k = 0; k < 2; k++) {
+      SimNode& node = *nodes[(now + k) % 2];  // alternate who gets the channel first
+      SimNode& peer = &node == &user ? base : user;
+
+      if (node.messagesCreated < node.messageCount && now >= node.nextMessageAt) {
+        node.createdAt[node.messagesCreated] = now;
+        node.outbox.push_back(node.messagesCreated++);
+        node.nextMessageAt = now + node.messageInterval;
+      }
+      while (!node.outbox.empty()) {
+        char text[16];
+        int length = std::snprintf(text, sizeof(text), "%d", node.outbox.front());
+        if (!node.link.send_c_msg(node.peerID, text, length, now)) break;
+        node.outbox.pop_front();
+      }
+
+      if (now >= channelBusyUntil) {
+        uint8_t frame[MAX_PAYLOAD_SIZE];
+        size_t length = node.link.poll(now, frame, sizeof(frame));
+        if (length > 0) {
+          uint32_t airtime = (lora_time_on_air_us(modem, length) + 999) / 1000;
+          channelBusyUntil = now + airtime;
+          result.framesOnAir++;
+          result.airtimeMs += airtime;
+          air.push_back({now + airtime, &peer, uniform(rng) < lossRate, std::vector<uint8_t>(frame, frame + length)});
+        }
+      }
+
+      if (node.messagesCreated < node.messageCount || !node.outbox.empty() ||
+          node.link.in_flight(node.peerID) > 0 || node.link.time_to_next_event(now) == 0) {
+        allDone = false;
+      }
+    }
+    if (allDone && air.empty()) break;
+  }
+
+  // Merge both directions into one report.
+  for (SimNode* node : nodes) {
+    SimNode& peer = node == &user ? base : user;
+    result.sent += node->messageCount;
+    const ReliableLink::Stats& s = node->link.stats();
+    result.stats.messagesQueued += s.messagesQueued;
+    result.stats.framesSent += s.framesSent;
+    result.stats.retransmissions += s.retransmissions;
+    result.stats.delivered += s.delivered;
+    result.stats.failed += s.failed;
+    result.stats.acksSent += s.acksSent;
+    result.stats.acksPiggybacked += s.acksPiggybacked;
+    result.stats.duplicatesReceived += s.duplicatesReceived;
+
+    int arrived = 0;
+    for (int count : peer.receivedCount) {
+      if (count > 0) arrived++;
+      if (count > 1) result.duplicatesDelivered += count - 1;
+    }
+    result.delivered += arrived;
+    if ((int)s.delivered > arrived) result.phantomAcks += s.delivered - arrived;
+  }
+  result.finalRtoMs = user.link.rto_ms(baseID);
+
+  std::vector<uint32_t> latencies = user.latencies;
+  latencies.insert(latencies.end(), base.latencies.begin(), base.latencies.end());
+  if (!latencies.empty()) {
+    std::sort(latencies.begin(), latencies.end());
+    double sum = 0;
+    for (uint32_t latency : latencies) sum += latency;
+    result.meanLatencyMs = sum / latencies.size();
+    result.p95LatencyMs = latencies[(latencies.size() * 95) / 100 < latencies.size() ? (latencies.size() * 95) / 100 : latencies.size() - 1];
+  }
+  return result;
+}
+
+// The base answers a user's message with a custom message before its ACK
+// is due, so its link sends the message and the ACK as one aggregate. The
+// user has to take both records out of it: the ACK releases the user's
+// message, and the base's text must come out whole. With text compression
+// the message record is a packed one.
+bool runAckOwedScenario(bool textCompression) {
+  const char* reply = "Stay at the north gate, help is on the way";
+  ReliableLink user(userID, 0x1200);
+  ReliableLink base(baseID, 0xBEEF);
+  base.set_text_compression(textCompression);
+  PayloadBuilder decoder;
+  uint8_t frame[MAX_PAYLOAD_SIZE];
+  const uint32_t now = 0;
+
+  user.send_c_msg(baseID, "0", 1, now);
+  size_t length = user.poll(now, frame, sizeof(frame));
+  PayloadBuilder::PayloadDetails details = decoder.get_payload_details(frame, length);
+  base.on_data(details.sourceID, details.destinationID, details.transmissionID, now);
+
+  base.send_c_msg(userID, reply, std::strlen(reply), now);
+  length = base.poll(now, frame, sizeof(frame));
+  PayloadBuilder::ParsedFrame parsed;
+  bool aggregated = decoder.parse(frame, length, parsed) && parsed.details.type == PAYLOAD_TYPE_AGGREGATE;
+
+  // What the user firmware does with an aggregate from the base.
+  char text[C_MSG_TEXT_MAX_LENGTH];
+  size_t textLength = 0;
+  int shown = 0;
+  uint8_t messageType = 0;
+  PayloadBuilder::AggregateReader reader(frame, length);
+  PayloadBuilder::AggregateRecord record;
+  while (aggregated && reader.next(record)) {
+    if (record.type == PAYLOAD_TYPE_ACK) {
+      user.on_ack(record.sourceID, parsed.details.destinationID, decoder.decode_ack_record(record), now);
+    } else if ((record.type == PAYLOAD_TYPE_C_MSG || record.type == PAYLOAD_TYPE_C_MSG_PACKED) &&
+               user.on_data(record.sourceID, parsed.details.destinationID, record.transmissionID, now) == ReliableLink::ACCEPT_NEW) {
+      textLength = decoder.decode_c_msg_record_text(record, text, sizeof(text));
+      messageType = record.type;
+      shown++;
+    }
+  }
+
+  bool textIntact = textLength == std::strlen(reply) && std::memcmp(text, reply, textLength) == 0;
+  uint8_t expectedType = textCompression ? PAYLOAD_TYPE_C_MSG_PACKED : PAYLOAD_TYPE_C_MSG;
+  std::printf("%-8s aggregate %s, messages shown %d, text %s, user in flight %u\n",
+              textCompression ? "packed" : "raw", aggregated ? "yes" : "no", shown,
+              textIntact ? "intact" : "lost", user.in_flight(baseID));
+  if (!aggregated || shown != 1 || messageType != expectedType || !textIntact || user.in_flight(baseID) != 0) {
+    std::printf("  violation: the message or the ACK riding with it was not taken out of the aggregate\n");
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+bool run_reliability_scenarios() {
+  const int messages = 120;
+  const double lossRates[] = {0.0, 0.1, 0.3, 0.5};
+  const uint8_t windows[] = {1, RELIABLE_WINDOW_SIZE};
+  bool ok = true;
+
+  std::printf("\n== Reliable link over a lossy channel, SF7/125 kHz, %d + %d messages ==\n", messages, messages / 2);
+  std::printf("%5s %4s %10s %6s %6s %10s %10s %8s %8s %8s %8s %7s\n", "loss", "win", "delivered", "failed",
+              "dups", "mean ms", "p95 ms", "frames", "retx", "ack", "piggy", "rto ms");
+  for (double loss : lossRates) {
+    for (uint8_t window : windows) {
+      ScenarioResult r = runScenario(loss, window, 7, messages);
+      std::printf("%4.0f%% %4u %6d/%-3d %6u %6d %10.0f %10u %8u %8u %8u %8u %7u\n", loss * 100, window,
+                  r.delivered, r.sent, r.stats.failed, r.duplicatesDelivered, r.meanLatencyMs, r.p95LatencyMs,
+                  r.framesOnAir, r.stats.retransmissions, r.stats.acksSent, r.stats.acksPiggybacked, r.finalRtoMs);
+      if (r.duplicatesDelivered > 0 || r.phantomAcks > 0) {
+        std::printf("  violation: %d duplicate deliveries, %d ACKed but never received\n",
+                    r.duplicatesDelivered, r.phantomAcks);
+        ok = false;
+      }
+      if (r.delivered + (int)r.stats.failed < r.sent) {
+        std::printf("  violation: %d messages neither delivered nor reported failed\n",
+                    r.sent - r.delivered - (int)r.stats.failed);
+        ok = false;
+      }
+    }
+  }
+  std::printf("\n== Custom message from the base while it owes an ACK ==\n");
+  for (bool textCompression : {false, true}) {
+    if (!runAckOwedScenario(textCompression)) ok = false;
+  }
+  return ok;
+}
@@ -0,0 +1,270 @@
+#include "sim.h"
+#include "payload_builder.h"
+#include "tdma.h"
+#include "lora_airtime.h"
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+// Many users reporting to one base station on a single channel, with pure
+// ALOHA (every report goes on air the moment it is made, which is what the
+// firmware does without TDMA) and with the beacon-synchronised TDMA of
+// lib/tdma. Every node hears every other node and there is no capture: two
+// frames that overlap in time are both lost, and a node cannot receive
+// while it transmits.
+//
+// Each user makes one report per interval at a random phase. The TDMA run
+// starts from cold, so every user first has to win a contention slot; only
+// reports made after the warm-up count. Channel efficiency is the fraction
+// of the measured time the channel carried reports that were received.
+
+namespace {
+
+const uint8_t baseID = 0xFE;
+const size_t reportLength = 16;               // a compact GPS report with its CRC
+const uint32_t reportIntervalMs = 120000;
+const uint32_t warmupMs = 15 * 60000;
+const uint32_t measureMs = 30 * 60000;
+const uint32_t drainMs = 5 * 60000;
+
+struct AccessResult {
+  int reports;
+  int delivered;
+  double efficiency;
+  uint32_t p50LatencyMs;
+  uint32_t p95LatencyMs;
+  int slotCollisions;     // reports sent in assigned slots that still collided
+};
+
+LoRaModemConfig simModem() {
+  LoRaModemConfig config = lora_default_config();
+  config.spreadingFactor = 9;
+  return config;
+}
+
+uint32_t percentile(std::vector<uint32_t>& values, double fraction) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  return values[std::min(values.size() - 1, (size_t)(fraction * values.size()))];
+}
+
+bool measured(uint32_t generatedAt) {
+  return generatedAt >= warmupMs && generatedAt < warmupMs + measureMs;
+}
+
+// Reports of user u start at phase[u] and repeat every reportIntervalMs.
+std::vector<uint32_t> reportPhases(int users, std::mt19937& rng) {
+  std::uniform_int_distribution<uint32_t> phase(0, reportIntervalMs - 1);
+  std::vector<uint32_t> phases(users);
+  for (uint32_t& p : phases) p = phase(rng);
+  return phases;
+}
+
+AccessResult runAloha(int users, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::vector<uint32_t> phases = reportPhases(users, rng);
+  uint32_t airtimeMs = (lora_time_on_air_us(simModem(), reportLength) + 999) / 1000;
+
+  std::vector<uint32_t> starts;
+  for (int u = 0; u < users; u++) {
+    for (uint32_t t = phases[u]; t < warmupMs + measureMs + drainMs; t += reportIntervalMs) starts.push_back(t);
+  }
+  std::sort(starts.begin(), starts.end());
+
+  AccessResult result = {0, 0, 0.0, airtimeMs, airtimeMs, 0};
+  for (size_t i = 0; i < starts.size(); i++) {
+    if (!measured(starts[i])) continue;
+    result.reports++;
+    bool collided = (i > 0 && starts[i] - starts[i - 1] < airtimeMs) ||
+                    (i + 1 < starts.size() && starts[i + 1] - starts[i] < airtimeMs);
+    if (!collided) result.delivered++;
+  }
+  result.efficiency = (double)result.delivered * airtimeMs / measureMs;
+  return result;
+}
+
+struct Transmission {
+  uint32_t start;
+  uint32_t end;
+  int sender;              // user index, or -1 for the base
+  bool collided;
+  bool report;
+  bool inSlot;             // report sent in an assigned data slot
+  uint32_t generatedAt;
+  std::vector<uint8_t> bytes;
+};
+
+struct SimUser {
+  TdmaMember member;
+  uint32_t nextReportAt;
+  bool pending;
+  uint32_t generatedAt;
+  bool transmitting;
+
+  SimUser(uint8_t id, uint32_t seed, uint32_t phase)
+      : member(id, seed), nextReportAt(phase), pending(false), generatedAt(0), transmitting(false) {}
+};
+
+AccessResult runTdma(int users, uint32_t seed, uint32_t& superframeMs, uint8_t& assigned) {
+  std::mt19937 rng(seed);
+  std::vector<uint32_t> phases = reportPhases(users, rng);
+  LoRaModemConfig modem = simModem();
+  uint32_t reportAirtimeUs = lora_time_on_air_us(modem, reportLength);
+
+  TdmaCoordinator coordinator(baseID);
+  coordinator.set_modem_config(modem, reportLength);
+  std::vector<SimUser> nodes;
+  nodes.reserve(users);
+  for (int u = 0; u < users; u++) nodes.emplace_back((uint8_t)u, rng(), phases[u]);
+
+  PayloadBuilder decoder;
+  std::vector<Transmission> onAir;
+  bool baseTransmitting = false;
+  AccessResult result = {0, 0, 0.0, 0, 0, 0};
+  std::vector<uint32_t> latencies;
+  uint8_t buffer[MAX_FRAME_SIZE];
+
+  auto startTransmission = [&](int sender, const uint8_t* frame, size_t length, uint32_t now, bool report, bool inSlot, uint32_t generatedAt) {
+    Transmission tx = {now, now + (lora_time_on_air_us(modem, length) + 999) / 1000, sender, false, report, inSlot,
+                       generatedAt, std::vector<uint8_t>(frame, frame + length)};
+    for (Transmission& other : onAir) {
+      other.collided = true;
+      tx.collided = true;
+    }
+    onAir.push_back(tx);
+    if (sender < 0) {
+      baseTransmitting = true;
+    } else {
+      nodes[sender].transmitting = true;
+    }
+  };
+
+  auto finishTransmission = [&](const Transmission& tx) {
+    if (tx.sender < 0) {
+      baseTransmitting = false;
+      if (tx.collided) return;
+      uint8_t type = decoder.identify_type_and_check_checksum(tx.bytes.data(), tx.bytes.size());
+      PayloadBuilder::PayloadDetails details = decoder.get_payload_details(tx.bytes.data(), tx.bytes.size());
+      for (SimUser& node : nodes) {
+        if (type == PAYLOAD_TYPE_BEACON) {
+          node.member.on_beacon(details.sourceID, decoder.decode_beacon_payload(tx.bytes.data(), tx.bytes.size()), tx.start);
+        } else if (type == PAYLOAD_TYPE_SLOT) {
+          node.member.on_slot(details.sourceID, details.destinationID, decoder.decode_slot_payload(tx.bytes.data(), tx.bytes.size()));
+        }
+      }
+      return;
+    }
+
+    nodes[tx.sender].transmitting = false;
+    if (tx.collided) {
+      if (tx.inSlot && measured(tx.generatedAt)) result.slotCollisions++;
+      return;
+    }
+    if (tx.report) {
+      coordinator.on_frame((uint8_t)tx.sender, tx.end);
+      if (measured(tx.generatedAt)) {
+        result.delivered++;
+        latencies.push_back(tx.end - tx.generatedAt);
+      }
+      return;
+    }
+    PayloadBuilder::PayloadDetails details = decoder.get_payload_details(tx.bytes.data(), tx.bytes.size());
+    coordinator.on_slot(details.sourceID, details.destinationID, decoder.decode_slot_payload(tx.bytes.data(), tx.bytes.size()), tx.end);
+  };
+
+  // Jumps from one event to the next: a frame ending, the base or a user
+  // having something to do.
+  uint32_t now = 0;
+  const uint32_t endMs = warmupMs + measureMs + drainMs;
+  while (now < endMs) {
+    for (size_t i = 0; i < onAir.size();) {
+      if (onAir[i].end <= now) {
+        Transmission tx = std::move(onAir[i]);
+        onAir.erase(onAir.begin() + i);
+        finishTransmission(tx);
+      } else {
+        i++;
+      }
+    }
+
+    if (!baseTransmitting) {
+      size_t length = coordinator.poll(now, buffer, sizeof(buffer));
+      if (length > 0) startTransmission(-1, buffer, length, now, false, false, 0);
+    }
+
+    for (size_t u = 0; u < nodes.size(); u++) {
+      SimUser& node = nodes[u];
+      if (now >= node.nextReportAt) {
+        // A report still waiting for its slot is replaced by the newer one.
+        node.pending = true;
+        node.generatedAt = node.nextReportAt;
+        node.nextReportAt += reportIntervalMs;
+        if (measured(node.generatedAt)) result.reports++;
+      }
+      if (node.transmitting || baseTransmitting) continue;
+      if (node.pending && node.member.may_transmit(now, reportAirtimeUs)) {
+        bool inSlot = node.member.state(now) == TdmaMember::ASSIGNED;
+        std::fill(buffer, buffer + reportLength, 0);
+        startTransmission((int)u, buffer, reportLength, now, true, inSlot, node.generatedAt);
+        node.pending = false;
+        continue;
+      }
+      size_t length = node.member.poll(now, node.pending, buffer, sizeof(buffer));
+      if (length > 0) startTransmission((int)u, buffer, length, now, false, false, 0);
+    }
+
+    uint32_t next = endMs;
+    for (const Transmission& tx : onAir) next = std::min(next, tx.end);
+    if (!baseTransmitting) {
+      uint32_t wait = coordinator.time_to_next_event(now);
+      if (wait != UINT32_MAX) next = std::min(next, now + wait);
+    }
+    for (const SimUser& node : nodes) {
+      next = std::min(next, node.nextReportAt);
+      if (node.transmitting || baseTransmitting) continue;
+      uint32_t wait = node.member.time_to_next_event(now, node.pending);
+      if (wait != UINT32_MAX) next = std::min(next, now + wait);
+    }
+    now = std::max(next, now + 1);
+  }
+
+  result.efficiency = (double)result.delivered * reportAirtimeUs / 1000.0 / measureMs;
+  result.p50LatencyMs = percentile(latencies, 0.50);
+  result.p95LatencyMs = percentile(latencies, 0.95);
+  superframeMs = coordinator.superframe_ms();
+  assigned = coordinator.assigned();
+  return result;
+}
+
+}  // namespace
+
+bool run_access_scenarios() {
+  bool ok = true;
+  LoRaModemConfig modem = simModem();
+  double airtimeMs = lora_time_on_air_us(modem, reportLength) / 1000.0;
+  std::printf("\n== Channel access, %u-byte reports every %u s, SF%u/%u kHz (%.0f ms on air), slot %u ms ==\n",
+              (unsigned)reportLength, reportIntervalMs / 1000, modem.spreadingFactor, modem.bandwidth / 1000,
+              airtimeMs, tdma_slot_ms(modem, reportLength));
+  std::printf("%5s %6s %7s | %6s %6s %7s | %6s %6s %7s %8s %8s %10s %6s\n", "users", "load", "G*e^-2G",
+              "ALOHA", "PDR", "eff", "TDMA", "PDR", "eff", "p50 ms", "p95 ms", "superframe", "slots");
+
+  const int userCounts[] = {10, 25, 50, 100, 150, 200, 250};
+  for (int users : userCounts) {
+    double load = users * airtimeMs / reportIntervalMs;
+    AccessResult aloha = runAloha(users, 0x5EED0000u + users);
+    uint32_t superframeMs = 0;
+    uint8_t assigned = 0;
+    AccessResult tdma = runTdma(users, 0x5EED0000u + users, superframeMs, assigned);
+
+    std::printf("%5d %6.3f %7.3f | %6d %5.1f%% %7.3f | %6d %5.1f%% %7.3f %8u %8u %8.1f s %6u\n", users, load,
+                load * std::exp(-2.0 * load), aloha.delivered, 100.0 * aloha.delivered / aloha.reports,
+                aloha.efficiency, tdma.delivered, 100.0 * tdma.delivered / tdma.reports, tdma.efficiency,
+                tdma.p50LatencyMs, tdma.p95LatencyMs, superframeMs / 1000.0, assigned);
+    if (tdma.slotCollisions > 0) {
+      std::printf("  violation: %d reports collided in assigned slots\n", tdma.slotCollisions);
+      ok = false;
+    }
+  }
+  return ok;
+}
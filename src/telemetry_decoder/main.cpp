@@ -0,0 +1,271 @@
+// Host decoder for the base station's binary telemetry stream
+// (env:base_telemetry). Reads COBS-framed records from a serial device,
+// a capture file or stdin, decodes every frame with PayloadBuilder and
+// writes one CSV row (default) or JSON line per message to stdout.
+//
+//   telemetry_decoder [--json] [device-or-file]
+//
+// Console text the base prints between records is passed to stderr.
+
+#include "payload_builder.h"
+#include "telemetry.h"
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+const char* emergencyMessages[10] = {
+  "I'm OK",
+  "I need water",
+  "I need food",
+  "I need medical assistance",
+  "I'm lost, send help",
+  "I am injured",
+  "There is a fire nearby",
+  "I need shelter",
+  "I am trapped, please rescue",
+  "Send my location to the rescue team"
+};
+
+// One decoded message. Fields a frame type does not carry stay unset.
+struct Row {
+  const TelemetryRecord* record;
+  uint8_t relayID;
+  uint8_t hopCount;
+  uint8_t type;
+  uint8_t sourceID;
+  uint16_t transmissionID;
+  bool hasHeader;  // destination and timestamp (full-header frames only)
+  uint8_t destinationID;
+  uint8_t dateTime[6];
+  bool hasPosition;
+  PayloadBuilder::GPSData gps;
+  int msgID;  // 1-based, 0 if none
+  std::string message;
+};
+
+bool jsonOutput = false;
+PayloadBuilder payloadBuilder;
+PayloadBuilder::GPSTrackState gpsTracks[256];
+uint32_t rowsWritten = 0;
+
+const char* typeName(uint8_t type) {
+  switch (type) {
+    case PAYLOAD_TYPE_GPS: return "gps";
+    case PAYLOAD_TYPE_P_MSG: return "predefined";
+    case PAYLOAD_TYPE_C_MSG: return "custom";
+    case PAYLOAD_TYPE_C_MSG_PACKED: return "custom_packed";
+    case PAYLOAD_TYPE_GPS_COMPACT: return "gps_keyframe";
+    case PAYLOAD_TYPE_GPS_DELTA: return "gps_delta";
+    default: return "unknown";
+  }
+}
+
+std::string csvQuote(const std::string& text) {
+  std::string out = "\"";
+  for (char c : text) {
+    if (c == '"') out += '"';
+    out += c;
+  }
+  return out + "\"";
+}
+
+std::string jsonQuote(const std::string& text) {
+  std::string out = "\"";
+  for (unsigned char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += (char)c;
+    } else if (c < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += (char)c;
+    }
+  }
+  return out + "\"";
+}
+
+void printCsvHeader() {
+  std::printf("received_at_ms,rssi_dbm,snr_db,relay_id,hop,type,source_id,destination_id,"
+              "transmission_id,date_time,latitude,longitude,msg_id,message\n");
+}
+
+void writeRow(const Row& row) {
+  char dateTime[32] = "";
+  if (row.hasHeader) {
+    std::snprintf(dateTime, sizeof(dateTime), "20%02u-%02u-%02uT%02u:%02u:%02u",
+                  row.dateTime[0], row.dateTime[1], row.dateTime[2],
+                  row.dateTime[3], row.dateTime[4], row.dateTime[5]);
+  }
+
+  if (jsonOutput) {
+    std::printf("{\"received_at_ms\":%u,\"rssi_dbm\":%d,\"snr_db\":%.2f",
+                row.record->receivedAt, row.record->rssi, row.record->snr);
+    if (row.hopCount > 0) std::printf(",\"relay_id\":%u,\"hop\":%u", row.relayID, row.hopCount);
+    std::printf(",\"type\":\"%s\",\"source_id\":%u,\"transmission_id\":%u",
+                typeName(row.type), row.sourceID, row.transmissionID);
+    if (row.hasHeader) std::printf(",\"destination_id\":%u,\"date_time\":\"%s\"", row.destinationID, dateTime);
+    if (row.hasPosition) std::printf(",\"latitude\":%.6f,\"longitude\":%.6f", row.gps.latitude, row.gps.longitude);
+    if (row.msgID > 0) std::printf(",\"msg_id\":%d", row.msgID);
+    if (!row.message.empty()) std::printf(",\"message\":%s", jsonQuote(row.message).c_str());
+    std::printf("}\n");
+  } else {
+    std::printf("%u,%d,%.2f,", row.record->receivedAt, row.record->rssi, row.record->snr);
+    if (row.hopCount > 0) std::printf("%u,%u", row.relayID, row.hopCount);
+    else std::printf(",");
+    std::printf(",%s,%u,", typeName(row.type), row.sourceID);
+    if (row.hasHeader) std::printf("%u", row.destinationID);
+    std::printf(",%u,%s,", row.transmissionID, dateTime);
+    if (row.hasPosition) std::printf("%.6f,%.6f", row.gps.latitude, row.gps.longitude);
+    else std::printf(",");
+    std::printf(",");
+    if (row.msgID > 0) std::printf("%d", row.msgID);
+    std::printf(",%s\n", row.message.empty() ? "" : csvQuote(row.message).c_str());
+  }
+  rowsWritten++;
+}
+
+void setMessage(Row& row, uint8_t msgID) {
+  row.msgID = msgID + 1;
+  row.message = msgID < 10 ? emergencyMessages[msgID] : "";
+}
+
+void setCustomMessage(Row& row, const char* text, size_t length) {
+  row.message.assign(text, length);
+}
+
+// Mirrors the base station's dispatchFrame: one row per message, aggregate
+// frames expanded into their records, relay envelopes unwrapped once.
+void decodeFrame(Row base, const uint8_t* payload, size_t length) {
+  PayloadBuilder::ParsedFrame parsed;
+  if (!payloadBuilder.parse(payload, length, parsed)) return;
+  const PayloadBuilder::PayloadDetails& details = parsed.details;
+  uint8_t type = details.type;
+
+  Row row = base;
+  row.type = type;
+  row.sourceID = details.sourceID;
+  row.transmissionID = details.transmissionID;
+  row.hasHeader = type == PAYLOAD_TYPE_GPS || type == PAYLOAD_TYPE_P_MSG || type == PAYLOAD_TYPE_C_MSG ||
+                  type == PAYLOAD_TYPE_C_MSG_PACKED;
+  row.destinationID = details.destinationID;
+  std::memcpy(row.dateTime, details.dateTime, sizeof(row.dateTime));
+
+  if (type == PAYLOAD_TYPE_GPS) {
+    row.hasPosition = true;
+    row.gps = parsed.gps;
+    writeRow(row);
+  } else if (type == PAYLOAD_TYPE_P_MSG) {
+    setMessage(row, parsed.pMsg.msgID);
+    writeRow(row);
+  } else if (type == PAYLOAD_TYPE_C_MSG || type == PAYLOAD_TYPE_C_MSG_PACKED) {
+    char text[C_MSG_TEXT_MAX_LENGTH];
+    setCustomMessage(row, text, payloadBuilder.decode_c_msg_text(payload, length, text, sizeof(text)));
+    writeRow(row);
+  } else if (type == PAYLOAD_TYPE_GPS_COMPACT || type == PAYLOAD_TYPE_GPS_DELTA) {
+    row.hasPosition = payloadBuilder.decode_gps_compact_payload(payload, length, gpsTracks[details.sourceID], row.gps);
+    writeRow(row);
+  } else if (type == PAYLOAD_TYPE_AGGREGATE) {
+    PayloadBuilder::AggregateReader reader(payload, length);
+    PayloadBuilder::AggregateRecord record;
+    while (reader.next(record)) {
+      Row recordRow = row;
+      recordRow.type = record.type;
+      recordRow.sourceID = record.sourceID;
+      recordRow.transmissionID = record.transmissionID;
+      recordRow.hasHeader = true;  // records share the aggregate's header
+      if (record.type == PAYLOAD_TYPE_GPS) {
+        recordRow.hasPosition = true;
+        recordRow.gps = payloadBuilder.decode_gps_record(record);
+      } else if (record.type == PAYLOAD_TYPE_P_MSG) {
+        setMessage(recordRow, payloadBuilder.decode_p_msg_record(record).msgID);
+      } else if (record.type == PAYLOAD_TYPE_C_MSG || record.type == PAYLOAD_TYPE_C_MSG_PACKED) {
+        char text[C_MSG_TEXT_MAX_LENGTH];
+        setCustomMessage(recordRow, text, payloadBuilder.decode_c_msg_record_text(record, text, sizeof(text)));
+      }
+      writeRow(recordRow);
+    }
+  } else if (type == PAYLOAD_TYPE_RELAY && base.hopCount == 0) {
+    base.relayID = parsed.relay.relayID;
+    base.hopCount = parsed.relay.hopCount;
+    decodeFrame(base, parsed.relay.frame, parsed.relay.length);
+  }
+}
+
+void printConsoleText(const TelemetryDecoder& decoder) {
+  size_t length;
+  const uint8_t* text = decoder.last_bad_packet(length);
+  for (size_t i = 0; i < length; i++) {
+    if (!std::isprint(text[i]) && !std::isspace(text[i])) return;
+  }
+  std::fwrite(text, 1, length, stderr);
+}
+
+// Serial devices are switched to raw mode at the base station's telemetry
+// baud rate; plain files are read as they are.
+bool configureSerial(int fd) {
+  if (!isatty(fd)) return true;
+  struct termios tty;
+  if (tcgetattr(fd, &tty) != 0) return false;
+  cfmakeraw(&tty);
+#ifdef B921600
+  cfsetispeed(&tty, B921600);
+  cfsetospeed(&tty, B921600);
+#endif
+  tty.c_cc[VMIN] = 1;
+  tty.c_cc[VTIME] = 0;
+  return tcsetattr(fd, TCSANOW, &tty) == 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  const char* path = nullptr;
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], "--json") == 0) jsonOutput = true;
+    else path = argv[i];
+  }
+
+  int fd = STDIN_FILENO;
+  if (path) {
+    fd = open(path, O_RDONLY | O_NOCTTY);
+    if (fd < 0) {
+      std::perror(path);
+      return 1;
+    }
+  }
+  if (!configureSerial(fd)) {
+    std::perror("termios");
+    return 1;
+  }
+
+  if (!jsonOutput) printCsvHeader();
+  TelemetryDecoder decoder;
+  uint8_t chunk[4096];
+  ssize_t received;
+  while ((received = read(fd, chunk, sizeof(chunk))) > 0) {
+    for (ssize_t i = 0; i < received; i++) {
+      uint32_t badBefore = decoder.bad_packets();
+      if (decoder.feed(chunk[i])) {
+        Row row = {};
+        row.record = &decoder.record();
+        decodeFrame(row, row.record->frame, row.record->length);
+      } else if (decoder.bad_packets() != badBefore) {
+        printConsoleText(decoder);
+      }
+    }
+    std::fflush(stdout);
+  }
+
+  std::fprintf(stderr, "telemetry: %u records, %u rows, %u skipped packets\n",
+               decoder.records(), rowsWritten, decoder.bad_packets());
+  if (fd != STDIN_FILENO) close(fd);
+  return 0;
+}
@@ -0,0 +1,319 @@
+// Host replay of NMEA logs through the user device's GPS path: every byte
+// into NmeaParser as the UART task feeds it, every fix into TrackFilter,
+// and the points it sends compared with what the old firmware sent (a GPS
+// frame every 5 s while it had a fix).
+//
+//   track_replay [log.nmea ...]
+//
+// Without arguments it replays a built-in synthetic walk and drive (1 Hz
+// RMC and GGA with a few metres of noise and some damaged sentences). For
+// each corridor width it prints the frames sent, the reduction against the
+// 5 s schedule, the distance of every fix from the track the base
+// reconstructs by joining the points it received, and the longest silence
+// between two points. A second synthetic log has the user standing still.
+// Exits non-zero if a fix lies further from that track than the filter's
+// bound, or if the silence is long enough for the base's ADR to count the
+// link as lost.
+// Run with: pio run -e track_replay -t exec
+
+#include "nmea.h"
+#include "track_filter.h"
+#include "adr.h"
+#include "payload_builder.h"
+#include "lora_airtime.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+const uint32_t oldIntervalMs = 5000;
+const float corridorSweep[] = {5, TRACK_CORRIDOR_M, 15, 25};
+const double metresPerDegree = 111319.5;
+
+struct Replay {
+  std::vector<TrackPoint> fixes;
+  NmeaParser::Stats stats;
+};
+
+// Times of day, made monotonic across midnight.
+class ReplayClock {
+public:
+  uint32_t toMonotonic(uint32_t timeOfDayMs) {
+    if (started && timeOfDayMs < last) days++;
+    started = true;
+    last = timeOfDayMs;
+    return days * 86400000u + timeOfDayMs;
+  }
+
+private:
+  bool started = false;
+  uint32_t last = 0;
+  uint32_t days = 0;
+};
+
+void feed(NmeaParser& parser, ReplayClock& clock, const char* data, size_t length, std::vector<TrackPoint>& fixes) {
+  for (size_t i = 0; i < length; i++) {
+    if (!parser.feed(data[i])) continue;
+    const NmeaFix& fix = parser.fix();
+    fixes.push_back({fix.latitudeE7, fix.longitudeE7, clock.toMonotonic(fix.timeOfDayMs)});
+  }
+}
+
+bool replayFile(const char* path, Replay& replay) {
+  FILE* file = std::fopen(path, "rb");
+  if (file == nullptr) {
+    std::perror(path);
+    return false;
+  }
+  NmeaParser parser;
+  ReplayClock clock;
+  char chunk[256];
+  size_t length;
+  while ((length = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+    feed(parser, clock, chunk, length, replay.fixes);
+  }
+  std::fclose(file);
+  replay.stats = parser.stats();
+  return true;
+}
+
+// ----- Synthetic log -----
+
+struct Lcg {
+  uint32_t state;
+  // Uniform in [-1, 1).
+  double next() {
+    state = state * 1664525u + 1013904223u;
+    return (state >> 8) / 8388608.0 - 1.0;
+  }
+};
+
+void appendCoordinate(std::string& out, double degrees, int degreeDigits, char positive, char negative) {
+  double magnitude = std::fabs(degrees);
+  int whole = (int)magnitude;
+  double minutes = (magnitude - whole) * 60.0;
+  char text[32];
+  std::snprintf(text, sizeof(text), "%0*d%08.5f,%c", degreeDigits, whole, minutes, degrees < 0 ? negative : positive);
+  out += text;
+}
+
+void appendSentence(std::string& log, const std::string& body, bool damage) {
+  uint8_t checksum = 0;
+  for (char c : body) checksum ^= (uint8_t)c;
+  char tail[8];
+  std::snprintf(tail, sizeof(tail), "*%02X\r\n", checksum);
+  std::string sentence = "$" + body + tail;
+  if (damage) sentence[sentence.size() / 2] ^= 0x20;
+  log += sentence;
+}
+
+// Legs of the route: duration, speed and the heading change per second.
+struct Leg {
+  const char* name;
+  uint32_t seconds;
+  double speedMS;
+  double headingDeg;      // at the start of the leg; < 0 keeps the current one
+  double turnDegPerS;
+  uint32_t zigzagS;       // nonzero: heading swings +-45 degrees every zigzagS
+};
+
+const Leg route[] = {
+  {"standing at the shelter", 120, 0.0, 0, 0, 0},
+  {"walking north", 300, 1.4, 0, 0, 0},
+  {"walking east", 200, 1.4, 90, 0, 0},
+  {"zigzag up a slope", 240, 1.0, 0, 0, 30},
+  {"stopped", 180, 0.0, -1, 0, 0},
+  {"driving a long bend", 300, 12.0, 20, 0.5, 0},
+};
+
+// Only heartbeats go out: the base must still hear the user often enough.
+const Leg waiting[] = {
+  {"waiting at the shelter", 1800, 0.0, 0, 0, 0},
+};
+
+template <size_t N>
+std::string syntheticLog(const Leg (&legs)[N]) {
+  std::string log;
+  Lcg noise = {0x5EED};
+  double north = 0;
+  double east = 0;
+  double heading = 0;
+  uint32_t second = 10 * 3600;
+  size_t sentences = 0;
+  const double originLat = 6.9271;
+  const double originLon = 79.8612;
+  for (const Leg& leg : legs) {
+    if (leg.headingDeg >= 0) heading = leg.headingDeg;
+    for (uint32_t s = 0; s < leg.seconds; s++, second++) {
+      double course = heading;
+      if (leg.zigzagS > 0) course += (s / leg.zigzagS) % 2 == 0 ? 45 : -45;
+      north += leg.speedMS * std::cos(course / 57.2957795);
+      east += leg.speedMS * std::sin(course / 57.2957795);
+      heading += leg.turnDegPerS;
+
+      // About 3 m of receiver noise on each axis.
+      double lat = originLat + (north + 3 * noise.next()) / metresPerDegree;
+      double lon = originLon + (east + 3 * noise.next()) / (metresPerDegree * std::cos(originLat / 57.2957795));
+      char time[16];
+      std::snprintf(time, sizeof(time), "%02u%02u%02u.00", second / 3600 % 24, second / 60 % 60, second % 60);
+      std::string position;
+      appendCoordinate(position, lat, 2, 'N', 'S');
+      position += ",";
+      appendCoordinate(position, lon, 3, 'E', 'W');
+
+      char motion[32];
+      std::snprintf(motion, sizeof(motion), ",%.2f,%.1f,171026,,,A", leg.speedMS / 0.514444, std::fmod(course + 360, 360));
+      appendSentence(log, std::string("GPRMC,") + time + ",A," + position + motion, ++sentences % 97 == 0);
+      appendSentence(log, std::string("GPGGA,") + time + "," + position + ",1,08,0.9,12.0,M,-95.0,M,,", ++sentences % 97 == 0);
+    }
+  }
+  return log;
+}
+
+// ----- Evaluation -----
+
+struct RunResult {
+  size_t frames;
+  double meanErrorM;
+  double maxErrorM;
+  uint32_t longestSilenceMs;  // between two points sent
+};
+
+void toMetres(const TrackPoint& point, const TrackPoint& origin, double& x, double& y) {
+  double cosLat = std::cos(origin.latitudeE7 / 1e7 / 57.2957795);
+  x = ((int64_t)point.longitudeE7 - origin.longitudeE7) / 1e7 * metresPerDegree * cosLat;
+  y = ((int64_t)point.latitudeE7 - origin.latitudeE7) / 1e7 * metresPerDegree;
+}
+
+double distanceToSegment(const TrackPoint& point, const TrackPoint& from, const TrackPoint& to) {
+  double px, py, tx, ty;
+  toMetres(point, from, px, py);
+  toMetres(to, from, tx, ty);
+  double lengthSquared = tx * tx + ty * ty;
+  double t = lengthSquared > 0 ? (px * tx + py * ty) / lengthSquared : 0;
+  t = t < 0 ? 0 : (t > 1 ? 1 : t);
+  return std::hypot(px - t * tx, py - t * ty);
+}
+
+RunResult runFilter(const std::vector<TrackPoint>& fixes, float corridorM) {
+  TrackFilter filter(corridorM);
+  std::vector<TrackPoint> sent;
+  TrackPoint out;
+  for (const TrackPoint& fix : fixes) {
+    if (filter.offer(fix, out)) sent.push_back(out);
+  }
+  if (filter.flush(out)) sent.push_back(out);
+
+  // Each fix against the segment between the sent points around it.
+  RunResult result = {sent.size(), 0, 0, 0};
+  for (size_t i = 1; i < sent.size(); i++) {
+    uint32_t silence = sent[i].timeMs - sent[i - 1].timeMs;
+    if (silence > result.longestSilenceMs) result.longestSilenceMs = silence;
+  }
+  size_t segment = 0;
+  for (const TrackPoint& fix : fixes) {
+    while (segment + 1 < sent.size() && sent[segment + 1].timeMs <= fix.timeMs) segment++;
+    const TrackPoint& from = sent[segment];
+    const TrackPoint& to = segment + 1 < sent.size() ? sent[segment + 1] : from;
+    double error = distanceToSegment(fix, from, to);
+    result.meanErrorM += error;
+    if (error > result.maxErrorM) result.maxErrorM = error;
+  }
+  result.meanErrorM /= fixes.size();
+  return result;
+}
+
+size_t oldScheduleFrames(const std::vector<TrackPoint>& fixes) {
+  size_t frames = 0;
+  uint32_t lastMs = 0;
+  for (const TrackPoint& fix : fixes) {
+    if (frames == 0 || fix.timeMs - lastMs >= oldIntervalMs) {
+      frames++;
+      lastMs = fix.timeMs;
+    }
+  }
+  return frames;
+}
+
+bool report(const char* name, const Replay& replay) {
+  std::printf("\n== %s ==\n", name);
+  std::printf("%u sentences, %u checksum errors, %u overflows, %zu fixes", replay.stats.sentences,
+              replay.stats.checksumErrors, replay.stats.overflows, replay.fixes.size());
+  if (replay.fixes.empty()) {
+    std::printf("\n");
+    return true;
+  }
+  std::printf(" over %.1f min\n", (replay.fixes.back().timeMs - replay.fixes.front().timeMs) / 60000.0);
+
+  PayloadBuilder builder;
+  PayloadBuilder::Buffer frame;
+  uint32_t frameAirtimeUs = lora_time_on_air_us(lora_default_config(), builder.encode_gps_payload(frame, 0, 0, 0));
+  size_t oldFrames = oldScheduleFrames(replay.fixes);
+  std::printf("old 5 s schedule: %zu frames, %.1f s on air\n", oldFrames, oldFrames * frameAirtimeUs / 1e6);
+  std::printf("%10s %8s %10s %10s %12s %12s %10s %10s\n", "corridor", "frames", "reduction", "air s", "mean err m",
+              "max err m", "bound m", "silence s");
+  // Gaps in the log itself are not the filter's silence.
+  uint32_t longestFixGapMs = 0;
+  for (size_t i = 1; i < replay.fixes.size(); i++) {
+    uint32_t gap = replay.fixes[i].timeMs - replay.fixes[i - 1].timeMs;
+    if (gap > longestFixGapMs) longestFixGapMs = gap;
+  }
+  bool ok = true;
+  for (float corridorM : corridorSweep) {
+    RunResult result = runFilter(replay.fixes, corridorM);
+    float boundM = TRACK_DEAD_BAND_M + corridorM;
+    std::printf("%8.0f m %8zu %9.1fx %10.1f %12.2f %12.2f %10.0f %10.1f%s\n", corridorM, result.frames,
+                (double)oldFrames / result.frames, result.frames * frameAirtimeUs / 1e6, result.meanErrorM,
+                result.maxErrorM, boundM, result.longestSilenceMs / 1000.0,
+                corridorM == TRACK_CORRIDOR_M ? "  (firmware)" : "");
+    if (result.maxErrorM > boundM) {
+      std::printf("  violation: a fix is %.2f m from the reconstructed track\n", result.maxErrorM);
+      ok = false;
+    }
+    // With one point lost the base's ADR must still not count the link as lost.
+    if (2 * result.longestSilenceMs >= ADR_SILENCE_FALLBACK_MS + 2 * longestFixGapMs) {
+      std::printf("  violation: %.1f s without a point; one lost point and the base's ADR drops the link\n",
+                  result.longestSilenceMs / 1000.0);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  bool ok = true;
+  if (argc < 2) {
+    std::string log = syntheticLog(route);
+    NmeaParser parser;
+    ReplayClock clock;
+    Replay replay;
+    feed(parser, clock, log.data(), log.size(), replay.fixes);
+    replay.stats = parser.stats();
+    std::printf("synthetic route:");
+    for (const Leg& leg : route) std::printf(" %s %u s;", leg.name, leg.seconds);
+    std::printf("\n");
+    ok = report("synthetic walk and drive, 1 Hz", replay);
+
+    std::string waitingLog = syntheticLog(waiting);
+    NmeaParser waitingParser;
+    ReplayClock waitingClock;
+    Replay waitingReplay;
+    feed(waitingParser, waitingClock, waitingLog.data(), waitingLog.size(), waitingReplay.fixes);
+    waitingReplay.stats = waitingParser.stats();
+    ok = report("synthetic user standing still for 30 min, 1 Hz", waitingReplay) && ok;
+  }
+  for (int i = 1; i < argc; i++) {
+    Replay replay;
+    if (!replayFile(argv[i], replay)) {
+      ok = false;
+      continue;
+    }
+    ok = report(argv[i], replay) && ok;
+  }
+  return ok ? 0 : 1;
+}
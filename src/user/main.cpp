@@ -3,8 +3,18 @@
 #include <Wire.h>
 #include <SPI.h>
 #include <LoRa.h>
+#include "driver/uart.h"
 #include "MyIoT.h"
 #include "payload_builder.h"
+#include "reliable_link.h"
+#include "adr.h"
+#include "tdma.h"
+#include "dirty_tiles.h"
+#include "debounce.h"
+#include "spsc_ring.h"
+#include "metrics.h"
+#include "nmea.h"
+#include "track_filter.h"
 #include <U8g2lib.h>
 // #include <Arduino.h>
 // #include <U8g2lib.h>
@@ -23,6 +33,17 @@
 #define LORA_RST   14   // LoRa reset pin
 #define LORA_DIO0  26   // LoRa IRQ pin
 
+// GPS module on UART1; pin names are the module's, as in the old sketch
+#define GPS_UART        UART_NUM_1
+#define GPS_TX_PIN      16   // module TX, ESP32 RX
+#define GPS_RX_PIN      17   // module RX, ESP32 TX
+#define GPS_BAUD        9600
+#define GPS_UART_BUFFER 1024 // driver RX buffer: about a second of sentences
+
+// Device IDs
+const uint8_t deviceID = 0x01;
+const uint8_t baseID   = 0x02;
+
 // U8G2 for I2C Display
 U8G2_SSD1306_128X64_NONAME_F_HW_I2C u8g2(U8G2_R0, /* reset=*/ U8X8_PIN_NONE);
 
@@ -30,24 +51,120 @@ U8G2_SSD1306_128X64_NONAME_F_HW_I2C u8g2(U8G2_R0, /* reset=*/ U8X8_PIN_NONE);
 uint8_t states[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
 uint8_t selectedRow = 0;  // Tracks which row is active (0, 1, or 2)
 
-// Debounce Handling
-unsigned long lastDebounceTime = 0;
-const unsigned long debounceDelay = 200;  // Debounce time
+// What the display shows. ButtonTask changes the state above under
+// xSemaphore and notifies DisplayTask, which renders from a copy of this
+// taken under the same lock, so I2C transfers never hold it.
+struct UiSnapshot {
+  uint8_t selectedRow;
+  uint8_t value;
+  uint8_t okPressed;
+};
+
+// Button Input
+// Every pin interrupts on both edges and records the level and time in
+// edgeRing. InputTask debounces each button on its own and posts the
+// resulting ButtonEvents to inputQueue, which ButtonTask applies to the UI.
+// The four pin handlers are all run by the one GPIO interrupt, never at the
+// same time, so together they are the ring's single producer.
+enum ButtonIndex { MODE_BUTTON, UP_BUTTON, DOWN_BUTTON, OK_BUTTON, BUTTON_COUNT };
+const uint8_t buttonPins[BUTTON_COUNT] = {MODE_BTN, UP_BTN, DOWN_BTN, OK_BTN};
+
+struct ButtonEdge {
+  uint8_t button;
+  bool pressed;
+  uint32_t atMs;
+};
+
+SpscRing<ButtonEdge, 32> edgeRing;
+ButtonDebouncer buttons[BUTTON_COUNT] = {
+  ButtonDebouncer(MODE_BUTTON, ButtonDebouncer::GESTURE_LONG_PRESS),  // long press: back to WELCOME
+  ButtonDebouncer(UP_BUTTON, ButtonDebouncer::GESTURE_AUTO_REPEAT),
+  ButtonDebouncer(DOWN_BUTTON, ButtonDebouncer::GESTURE_AUTO_REPEAT),
+  ButtonDebouncer(OK_BUTTON),
+};
+
+// Messages to the base are retransmitted until it ACKs them. Only LoRaTask
+// touches the radio and the link.
+PayloadBuilder payloadBuilder;
+ReliableLink link(deviceID, (uint16_t)esp_random());
+
+// The base picks the data rate; this device answers its proposals, follows
+// its SETs and drops back to the safe rate if the base stops answering.
+AdrMember adr(deviceID);
+uint8_t radioDataRate = ADR_SAFE_DATA_RATE;
+
+#ifdef TDMA_MODE
+// Against a base running TDMA this device only transmits in its own slot,
+// asking for one in a contention slot first. Without beacons it transmits
+// freely as before.
+TdmaMember tdma(deviceID, esp_random());
+#endif
+
+// GPS: GpsTask sleeps on the UART driver's events and feeds the parser
+// whatever bytes arrived. The track filter keeps fixes that only repeat the
+// track to itself, and LoRaTask sends the points it lets through.
+NmeaParser nmea;
+TrackFilter trackFilter;
+// A user standing still is only heard once per heartbeat. The base must
+// not take that for a lost link, even with one heartbeat lost.
+static_assert(2 * TRACK_HEARTBEAT_MS < ADR_SILENCE_FALLBACK_MS, "heartbeat too slow for the ADR silence fallback");
+uint16_t gpsTransmissionID = 0;
 
 // FreeRTOS handles
 SemaphoreHandle_t xSemaphore;
 QueueHandle_t loraQueue;  // Queue to handle LoRa message requests
-
+QueueHandle_t inputQueue;  // ButtonEvents from InputTask
+QueueHandle_t gpsUartQueue;  // UART driver events for GpsTask
+QueueHandle_t gpsQueue;  // TrackPoints from GpsTask to send
+TaskHandle_t displayTaskHandle = NULL;
+TaskHandle_t inputTaskHandle = NULL;
+
+// Task, queue and mutex storage, so none of them comes from the heap.
+// Stack sizes are in bytes on the ESP32.
+StackType_t inputTaskStack[2048];
+StaticTask_t inputTaskBuffer;
+StackType_t buttonTaskStack[2048];
+StaticTask_t buttonTaskBuffer;
+StackType_t displayTaskStack[4096];
+StaticTask_t displayTaskBuffer;
+StackType_t loraTaskStack[4096];
+StaticTask_t loraTaskBuffer;
+StackType_t gpsTaskStack[3072];
+StaticTask_t gpsTaskBuffer;
+uint8_t loraQueueStorage[5 * sizeof(int)];
+StaticQueue_t loraQueueBuffer;
+uint8_t inputQueueStorage[16 * sizeof(ButtonEvent)];
+StaticQueue_t inputQueueBuffer;
+uint8_t gpsQueueStorage[4 * sizeof(TrackPoint)];
+StaticQueue_t gpsQueueBuffer;
+StaticSemaphore_t xSemaphoreBuffer;
+
+#ifndef METRICS_DISABLED
+// Runtime metrics, printed by "stats" on the serial console. Build with
+// -D METRICS_DISABLED to compile them out.
+Metrics metrics;
+int loraQueueMetric = -1;
+int inputQueueMetric = -1;
+int edgeRingMetric = -1;
+int gpsQueueMetric = -1;
+#endif
+
+void onButtonEdge(void *arg);
+void InputTask(void *pvParameters);
 void ButtonTask(void *pvParameters);
 void DisplayTask(void *pvParameters);
 void LoRaTask(void *pvParameters);
+void GpsTask(void *pvParameters);
 
 
-// UI Render Functions
-void renderUI();
-void renderInbox();
-void renderSend();
+// UI Render Functions. They draw into the u8g2 buffer; pushFrame() sends
+// what changed.
+void renderUI(const UiSnapshot& ui);
+void renderInbox(const UiSnapshot& ui);
+void renderSend(const UiSnapshot& ui);
 void renderWelcome();
+void pushFrame(bool partial);
+void printStats();
 
 void setup() {
   Serial.begin(9600);
@@ -66,153 +183,538 @@ void setup() {
     while (1);
   }
   Serial.println("LoRa init succeeded.");
+  LoRa.setSpreadingFactor(adr_data_rate(ADR_SAFE_DATA_RATE).spreadingFactor);
+  LoRa.setSignalBandwidth(adr_data_rate(ADR_SAFE_DATA_RATE).bandwidth);
+
+  // GPS UART. The driver allocates its RX buffer and event queue here, in
+  // setup; GpsTask only reads from them.
+  uart_config_t gpsConfig = {};
+  gpsConfig.baud_rate = GPS_BAUD;
+  gpsConfig.data_bits = UART_DATA_8_BITS;
+  gpsConfig.parity = UART_PARITY_DISABLE;
+  gpsConfig.stop_bits = UART_STOP_BITS_1;
+  gpsConfig.flow_ctrl = UART_HW_FLOWCTRL_DISABLE;
+  uart_param_config(GPS_UART, &gpsConfig);
+  uart_set_pin(GPS_UART, GPS_RX_PIN, GPS_TX_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE);
+  uart_driver_install(GPS_UART, GPS_UART_BUFFER, 0, 16, &gpsUartQueue, 0);
+
+  payloadBuilder.configure_device(deviceID, baseID);
+  // The tasks share this builder and read its time base unlocked, so it
+  // is read here, before any of them starts.
+  payloadBuilder.sync_time_base();
+  payloadBuilder.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  link.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+  // Compact headers on reports and messages: relays forward them unchanged
+  // and the base reads both versions.
+  payloadBuilder.set_header_version(PayloadBuilder::HEADER_V2);
+  link.set_header_version(PayloadBuilder::HEADER_V2);
+  adr.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+#ifdef TDMA_MODE
+  tdma.set_integrity_mode(PayloadBuilder::INTEGRITY_CRC16);
+#endif
 
   // Create a semaphore for shared access between tasks
-  xSemaphore = xSemaphoreCreateMutex();
-  loraQueue = xQueueCreate(5, sizeof(int));  // Queue can hold 5 integers (message IDs)
+  xSemaphore = xSemaphoreCreateMutexStatic(&xSemaphoreBuffer);
+  loraQueue = xQueueCreateStatic(5, sizeof(int), loraQueueStorage, &loraQueueBuffer);  // Queue can hold 5 integers (message IDs)
+  inputQueue = xQueueCreateStatic(16, sizeof(ButtonEvent), inputQueueStorage, &inputQueueBuffer);
+  gpsQueue = xQueueCreateStatic(4, sizeof(TrackPoint), gpsQueueStorage, &gpsQueueBuffer);
+#ifndef METRICS_DISABLED
+  loraQueueMetric = metrics.add_queue("loraQueue", 5);
+  inputQueueMetric = metrics.add_queue("inputQueue", 16);
+  edgeRingMetric = metrics.add_queue("edgeRing", edgeRing.capacity());
+  gpsQueueMetric = metrics.add_queue("gpsQueue", 4);
+#endif
 
   // Create FreeRTOS tasks
-  xTaskCreatePinnedToCore(ButtonTask, "Button Task", 2048, NULL, 1, NULL, 1);
-  xTaskCreatePinnedToCore(DisplayTask, "Display Task", 4096, NULL, 1, NULL, 1);
-  xTaskCreate(LoRaTask, "LoRaTask", 2048, NULL, 1, NULL);
+  inputTaskHandle = xTaskCreateStaticPinnedToCore(InputTask, "Input Task", sizeof(inputTaskStack), NULL, 2,
+                                                  inputTaskStack, &inputTaskBuffer, 1);
+  TaskHandle_t buttonTaskHandle = xTaskCreateStaticPinnedToCore(ButtonTask, "Button Task", sizeof(buttonTaskStack), NULL, 1,
+                                                                buttonTaskStack, &buttonTaskBuffer, 1);
+  displayTaskHandle = xTaskCreateStaticPinnedToCore(DisplayTask, "Display Task", sizeof(displayTaskStack), NULL, 1,
+                                                    displayTaskStack, &displayTaskBuffer, 1);
+  TaskHandle_t loraTaskHandle = xTaskCreateStatic(LoRaTask, "LoRaTask", sizeof(loraTaskStack), NULL, 1, loraTaskStack, &loraTaskBuffer);
+  TaskHandle_t gpsTaskHandle = xTaskCreateStatic(GpsTask, "GPS Task", sizeof(gpsTaskStack), NULL, 1, gpsTaskStack, &gpsTaskBuffer);
+#ifndef METRICS_DISABLED
+  metrics.add_task("Input Task", inputTaskHandle, sizeof(inputTaskStack));
+  metrics.add_task("Button Task", buttonTaskHandle, sizeof(buttonTaskStack));
+  metrics.add_task("Display Task", displayTaskHandle, sizeof(displayTaskStack));
+  metrics.add_task("LoRaTask", loraTaskHandle, sizeof(loraTaskStack));
+  metrics.add_task("GPS Task", gpsTaskHandle, sizeof(gpsTaskStack));
+#else
+  (void)buttonTaskHandle;
+  (void)loraTaskHandle;
+  (void)gpsTaskHandle;
+#endif
+  xTaskNotifyGive(displayTaskHandle);  // first frame
+
+  // Interrupts last: the handler wakes InputTask.
+  for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+    attachInterruptArg(buttonPins[i], onButtonEdge, (void*)(uintptr_t)i, CHANGE);
+  }
 }
 
+// The tasks do the work; loop() only serves the serial console, where
+// "stats" prints the runtime metrics.
 void loop() {
-  // Not needed as FreeRTOS manages tasks
+  static char line[16];
+  static size_t lineLength = 0;
+  while (Serial.available()) {
+    char c = Serial.read();
+    if (c == '\n' || c == '\r') {
+      line[lineLength] = '\0';
+      if (strcmp(line, "stats") == 0) {
+        printStats();
+      }
+      lineLength = 0;
+    } else if (lineLength < sizeof(line) - 1) {
+      line[lineLength++] = c;
+    }
+  }
+  delay(50);
 }
 
-void ButtonTask(void *pvParameters) {
-  while (1) {
-    if (millis() - lastDebounceTime > debounceDelay) {
-      if (digitalRead(MODE_BTN) == HIGH) {
-        if (xSemaphoreTake(xSemaphore, portMAX_DELAY)) {
-          selectedRow = (selectedRow + 1) % 3;
-          for (uint8_t i = 0; i < 3; i++) {
-            states[i][0] = (i == selectedRow) ? 1 : 0;
-          }
-          xSemaphoreGive(xSemaphore);
-        }
-        lastDebounceTime = millis();
+void printStatsLine(const char* line) {
+  Serial.println(line);
+}
+
+// Stack high-water marks and the edge ring's peak are read now; everything
+// else is counted as it happens.
+void printStats() {
+#ifndef METRICS_DISABLED
+  for (size_t i = 0; i < metrics.task_count(); i++) {
+    metrics.set_task_stack_free(i, uxTaskGetStackHighWaterMark((TaskHandle_t)metrics.task_handle(i)));
+  }
+  metrics.queue_depth(edgeRingMetric, edgeRing.peak());
+  metrics.report(millis(), printStatsLine);
+#else
+  Serial.println("Metrics are disabled in this build.");
+#endif
+}
+
+// Records the pin's new level; debouncing is left to InputTask. If the
+// ring is full the edge is dropped and counted.
+void IRAM_ATTR onButtonEdge(void *arg) {
+  uint8_t button = (uint8_t)(uintptr_t)arg;
+  ButtonEdge* edge = edgeRing.acquire();
+  if (edge != NULL) {
+    edge->button = button;
+    edge->pressed = digitalRead(buttonPins[button]) == HIGH;
+    edge->atMs = millis();
+    edgeRing.commit();
+  }
+
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+  vTaskNotifyGiveFromISR(inputTaskHandle, &higherPriorityTaskWoken);
+  portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
+
+// Sleeps until an edge arrives or a debounce, long-press or repeat timer
+// expires, and posts the events that result.
+void InputTask(void *pvParameters) {
+  uint32_t reportedDrops = 0;
+  uint32_t wait = UINT32_MAX;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, wait == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(wait) + 1);
+
+    const ButtonEdge* edge;
+    while ((edge = edgeRing.peek()) != NULL) {
+      buttons[edge->button].on_edge(edge->pressed, edge->atMs);
+      edgeRing.release();
+    }
+    // After a lost edge the last level recorded may be stale: read the pins.
+    if (edgeRing.dropped() != reportedDrops) {
+      reportedDrops = edgeRing.dropped();
+      for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+        buttons[i].on_edge(digitalRead(buttonPins[i]) == HIGH, millis());
       }
+    }
 
-      if (digitalRead(UP_BTN) == HIGH) {
-        if (xSemaphoreTake(xSemaphore, portMAX_DELAY)) {
-          if (states[selectedRow][1] < 256) {
-            states[selectedRow][1]++;
-          }
-          xSemaphoreGive(xSemaphore);
-        }
-        lastDebounceTime = millis();
+    uint32_t now = millis();
+    wait = UINT32_MAX;
+    for (uint8_t i = 0; i < BUTTON_COUNT; i++) {
+      ButtonEvent event;
+      while (buttons[i].poll(now, event)) {
+        xQueueSend(inputQueue, &event, 0);  // a full queue drops the event
+        METRICS_QUEUE_DEPTH(inputQueueMetric, uxQueueMessagesWaiting(inputQueue));
+      }
+      uint32_t buttonWait = buttons[i].time_to_next_event(now);
+      if (buttonWait < wait) {
+        wait = buttonWait;
       }
+    }
+  }
+}
 
-      if (digitalRead(DOWN_BTN) == HIGH) {
-        if (xSemaphoreTake(xSemaphore, portMAX_DELAY)) {
-          if (states[selectedRow][1] > 0) {
-            states[selectedRow][1]--;
-          }
-          xSemaphoreGive(xSemaphore);
+// Sleeps until the UART driver reports received bytes and parses them as
+// they are. Each new fix goes through the track filter; the points it keeps
+// are queued for LoRaTask. After an overflow the buffered bytes and pending
+// events are thrown away: the sentence cut short fails its checksum.
+void GpsTask(void *pvParameters) {
+  uint8_t chunk[128];
+  uart_event_t event;
+  for (;;) {
+    if (xQueueReceive(gpsUartQueue, &event, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    if (event.type == UART_FIFO_OVF || event.type == UART_BUFFER_FULL) {
+      uart_flush_input(GPS_UART);
+      xQueueReset(gpsUartQueue);
+      continue;
+    }
+    if (event.type != UART_DATA) {
+      continue;
+    }
+
+    size_t remaining = event.size;
+    while (remaining > 0) {
+      int count = uart_read_bytes(GPS_UART, chunk, remaining < sizeof(chunk) ? remaining : sizeof(chunk), 0);
+      if (count <= 0) {
+        break;
+      }
+      remaining -= count;
+      for (int i = 0; i < count; i++) {
+        if (!nmea.feed((char)chunk[i])) {
+          continue;
+        }
+        const NmeaFix& fix = nmea.fix();
+        TrackPoint point = {fix.latitudeE7, fix.longitudeE7, (uint32_t)millis()};
+        TrackPoint keep;
+        if (trackFilter.offer(point, keep)) {
+          xQueueSend(gpsQueue, &keep, 0);  // a full queue drops the point
+          METRICS_QUEUE_DEPTH(gpsQueueMetric, uxQueueMessagesWaiting(gpsQueue));
         }
-        lastDebounceTime = millis();
       }
+    }
+  }
+}
 
-      if (digitalRead(OK_BTN) == HIGH) {
-        if (xSemaphoreTake(xSemaphore, portMAX_DELAY)) {
-          states[selectedRow][2] = !states[selectedRow][2];
-          if (selectedRow == 2 && states[selectedRow][2] == 1) {
-            int messageID = states[selectedRow][1];
-            xQueueSend(loraQueue, &messageID, portMAX_DELAY);
-            states[selectedRow][2] = 0;  // Send message to LoRa task
-          }
-          xSemaphoreGive(xSemaphore);
+// Applies input events to the UI state: MODE cycles the screens and a long
+// MODE press returns to WELCOME, UP/DOWN step the value (repeating while
+// held), OK toggles and on the SEND screen queues the selected message.
+void ButtonTask(void *pvParameters) {
+  ButtonEvent event;
+  while (1) {
+    if (xQueueReceive(inputQueue, &event, portMAX_DELAY) != pdTRUE || event.type == BUTTON_RELEASE) {
+      continue;
+    }
+    bool isPress = event.type == BUTTON_PRESS;
+    int messageID = -1;
+    if (xSemaphoreTake(xSemaphore, portMAX_DELAY)) {
+      if (event.button == MODE_BUTTON && (isPress || event.type == BUTTON_LONG_PRESS)) {
+        selectedRow = isPress ? (selectedRow + 1) % 3 : 0;
+        for (uint8_t i = 0; i < 3; i++) {
+          states[i][0] = (i == selectedRow) ? 1 : 0;
+        }
+      } else if (event.button == UP_BUTTON) {
+        if (states[selectedRow][1] < UINT8_MAX) {
+          states[selectedRow][1]++;
+        }
+      } else if (event.button == DOWN_BUTTON) {
+        if (states[selectedRow][1] > 0) {
+          states[selectedRow][1]--;
+        }
+      } else if (event.button == OK_BUTTON && isPress) {
+        states[selectedRow][2] = !states[selectedRow][2];
+        if (selectedRow == 2 && states[selectedRow][2] == 1) {
+          messageID = states[selectedRow][1];
+          states[selectedRow][2] = 0;
         }
-        lastDebounceTime = millis();
       }
+      xSemaphoreGive(xSemaphore);
+      xTaskNotifyGive(displayTaskHandle);
+    }
+    if (messageID >= 0) {
+      xQueueSend(loraQueue, &messageID, portMAX_DELAY);  // Send message to LoRa task
+      METRICS_QUEUE_DEPTH(loraQueueMetric, uxQueueMessagesWaiting(loraQueue));
     }
-    vTaskDelay(50 / portTICK_PERIOD_MS);
   }
 }
 
+// Sleeps until the UI state changes, then redraws from a snapshot and
+// sends only the tiles that differ from what the panel already shows.
 void DisplayTask(void *pvParameters) {
+  UiSnapshot shown = {0, 0, 0};
+  bool drawn = false;
   while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    UiSnapshot ui;
     if (xSemaphoreTake(xSemaphore, portMAX_DELAY)) {
-      renderUI();
+      ui.selectedRow = selectedRow;
+      ui.value = states[selectedRow][1];
+      ui.okPressed = states[selectedRow][2];
       xSemaphoreGive(xSemaphore);
     }
-    vTaskDelay(100 / portTICK_PERIOD_MS);  // Refresh rate
+    if (drawn && memcmp(&ui, &shown, sizeof(ui)) == 0) {
+      continue;  // e.g. DOWN at 0: nothing on screen changes
+    }
+    renderUI(ui);
+    pushFrame(drawn);
+    shown = ui;
+    drawn = true;
   }
 }
 
-void renderUI() {
-  if (selectedRow == 0) {
-    renderWelcome();
-  } else if (selectedRow == 1) {
-    renderInbox();
-  } else if (selectedRow == 2) {
-    renderSend();
+// The first frame goes out whole; after that only the changed span of
+// each tile row (8 pixel rows) is sent.
+void pushFrame(bool partial) {
+  static uint8_t shownFrame[128 * 64 / 8];
+  uint8_t* frame = u8g2.getBufferPtr();
+  uint8_t tileWidth = u8g2.getBufferTileWidth();
+  uint8_t tileHeight = u8g2.getBufferTileHeight();
+
+  if (!partial) {
+    u8g2.sendBuffer();
+    memcpy(shownFrame, frame, sizeof(shownFrame));
+    return;
+  }
+  TileSpan spans[8];
+  size_t count = dirty_tile_spans(shownFrame, frame, tileWidth, tileHeight, spans, 8);
+  for (size_t i = 0; i < count; i++) {
+    u8g2.updateDisplayArea(spans[i].x, spans[i].y, spans[i].width, 1);
   }
+  dirty_tiles_commit(shownFrame, frame, tileWidth, spans, count);
 }
 
-void renderInbox() {
+void renderUI(const UiSnapshot& ui) {
   u8g2.clearBuffer();
+  if (ui.selectedRow == 0) {
+    renderWelcome();
+  } else if (ui.selectedRow == 1) {
+    renderInbox(ui);
+  } else if (ui.selectedRow == 2) {
+    renderSend(ui);
+  }
+}
+
+void renderInbox(const UiSnapshot& ui) {
   u8g2.setFont(H_FONT);
   u8g2.drawStr(0, 10, "INBOX");
   u8g2.drawLine(0, 11, 127, 11);
 
   char buffer[10];
-  itoa(states[selectedRow][1], buffer, 10);
+  itoa(ui.value, buffer, 10);
   u8g2.setFont(P_FONT);
   u8g2.drawStr(0, 21, "SELECTED MSG:");
   u8g2.drawStr(0, 31, buffer);
 
-  if (states[selectedRow][2] == 1) {
+  if (ui.okPressed == 1) {
     u8g2.drawStr(0, 41, "OK Pressed...");
   }
-
-  u8g2.sendBuffer();
 }
 
-void renderSend() {
-  u8g2.clearBuffer();
+void renderSend(const UiSnapshot& ui) {
   u8g2.setFont(H_FONT);
   u8g2.drawStr(0, 10, "SEND");
   u8g2.drawLine(0, 11, 127, 11);
 
   char buffer[10];
-  itoa(states[selectedRow][1], buffer, 10);
+  itoa(ui.value, buffer, 10);
   u8g2.setFont(P_FONT);
   u8g2.drawStr(0, 21, "SELECTED P_MSG:");
   u8g2.drawStr(0, 31, buffer);
 
-  if (states[selectedRow][2] == 1) {
+  if (ui.okPressed == 1) {
     u8g2.drawStr(0, 41, "OK Pressed...");
   }
-
-  u8g2.sendBuffer();
 }
 
 void renderWelcome() {
-  u8g2.clearBuffer();
   u8g2.setFont(H_FONT);
   u8g2.drawStr(0, 10, "WELCOME");
   u8g2.drawLine(0, 11, 127, 11);
-  u8g2.sendBuffer();
+}
+
+// Feeds a received frame to the reliable link: ACKs release our messages,
+// messages from the base are ACKed and shown once.
+void handleReceivedFrame(const uint8_t* frame, size_t length, const PayloadBuilder::ParsedFrame& parsed, bool relayed) {
+  if (parsed.status != PayloadBuilder::PARSE_OK) {
+    return;
+  }
+  uint8_t type = parsed.details.type;
+  const PayloadBuilder::PayloadDetails& details = parsed.details;
+  uint32_t now = millis();
+
+  if (type == PAYLOAD_TYPE_P_MSG || type == PAYLOAD_TYPE_C_MSG || type == PAYLOAD_TYPE_C_MSG_PACKED) {
+    if (link.on_data(details.sourceID, details.destinationID, details.transmissionID, now) == ReliableLink::ACCEPT_NEW) {
+      Serial.print("Message from base: ");
+      if (type == PAYLOAD_TYPE_P_MSG) {
+        Serial.println(parsed.pMsg.msgID + 1);
+      } else {
+        char text[C_MSG_TEXT_MAX_LENGTH];
+        size_t textLength = payloadBuilder.decode_c_msg_text(frame, length, text, sizeof(text));
+        Serial.write(reinterpret_cast<const uint8_t*>(text), textLength);
+        Serial.println();
+      }
+    }
+  } else if (type == PAYLOAD_TYPE_ACK) {
+    link.on_ack(details.sourceID, details.destinationID, parsed.ack, now);
+  } else if (type == PAYLOAD_TYPE_CONTROL) {
+    adr.on_control(details.sourceID, details.destinationID, parsed.control, now);
+  } else if (type == PAYLOAD_TYPE_AGGREGATE) {
+    PayloadBuilder::AggregateReader reader(frame, length);
+    PayloadBuilder::AggregateRecord record;
+    while (reader.next(record)) {
+      if (record.type == PAYLOAD_TYPE_ACK) {
+        link.on_ack(record.sourceID, details.destinationID, payloadBuilder.decode_ack_record(record), now);
+      } else if (record.type == PAYLOAD_TYPE_P_MSG || record.type == PAYLOAD_TYPE_C_MSG ||
+                 record.type == PAYLOAD_TYPE_C_MSG_PACKED) {
+        // The base's link puts a message and its pending ACK in one
+        // aggregate, so messages arrive here as often as on their own.
+        if (link.on_data(record.sourceID, details.destinationID, record.transmissionID, now) == ReliableLink::ACCEPT_NEW) {
+          if (record.type == PAYLOAD_TYPE_P_MSG) {
+            Serial.print("Message from base: ");
+            Serial.println(payloadBuilder.decode_p_msg_record(record).msgID + 1);
+          } else {
+            char text[C_MSG_TEXT_MAX_LENGTH];
+            size_t textLength = payloadBuilder.decode_c_msg_record_text(record, text, sizeof(text));
+            Serial.print("Message from base: ");
+            Serial.write(reinterpret_cast<const uint8_t*>(text), textLength);
+            Serial.println();
+          }
+        }
+      }
+    }
+#ifdef TDMA_MODE
+  } else if (type == PAYLOAD_TYPE_BEACON && !relayed) {
+    // Timed from the start of the beacon: reception time minus its airtime.
+    uint32_t airtimeMs = lora_time_on_air_us(adr_modem_config(radioDataRate, lora_default_config()), length) / 1000;
+    tdma.on_beacon(details.sourceID, parsed.beacon, now - airtimeMs);
+  } else if (type == PAYLOAD_TYPE_SLOT && !relayed) {
+    tdma.on_slot(details.sourceID, details.destinationID, parsed.slot);
+#endif
+  } else if (type == PAYLOAD_TYPE_RELAY && !relayed) {
+    PayloadBuilder::ParsedFrame inner;
+    payloadBuilder.parse(parsed.relay.frame, parsed.relay.length, inner);
+    handleReceivedFrame(parsed.relay.frame, parsed.relay.length, inner, true);
+  }
+}
+
+// Adds a received frame to the ADR history of whoever transmitted it: the
+// relay for a relayed frame, else its source.
+void recordLinkQuality(const PayloadBuilder::ParsedFrame& parsed) {
+  if (parsed.status != PayloadBuilder::PARSE_OK) {
+    if (parsed.status == PayloadBuilder::PARSE_BAD_CHECKSUM) {
+      METRICS_COUNT(CHECKSUM_FAILURES, 1);
+    }
+    return;
+  }
+  uint8_t transmitterID = parsed.details.type == PAYLOAD_TYPE_RELAY ? parsed.relay.relayID : parsed.details.sourceID;
+  adr.record(transmitterID, LoRa.packetRssi(), LoRa.packetSnr(), millis());
+}
+
+void sendFrame(const uint8_t* frame, size_t length) {
+  LoRa.beginPacket();
+  LoRa.write(frame, length);
+  LoRa.endPacket();
+  METRICS_COUNT(TX_PACKETS, 1);
+  METRICS_COUNT(TX_BYTES, length);
+}
+
+// Track points go out unacknowledged, like the old periodic fixes: a lost
+// one only coarsens the track until the next.
+size_t encodeTrackPoint(const TrackPoint& point, PayloadBuilder::Buffer& frame) {
+  return payloadBuilder.encode_gps_payload(frame, gpsTransmissionID++, point.longitudeE7 / 1e7f, point.latitudeE7 / 1e7f);
 }
 
 void LoRaTask(void *pvParameters) {
   int receivedMessageID;
-  
+  TrackPoint trackPoint;
+  bool holding = false;  // message waiting for room in the window
+  uint32_t reportedDelivered = 0;
+  uint32_t reportedFailures = 0;
+#ifdef TDMA_MODE
+  PayloadBuilder::Buffer pendingFrame;  // next frame, waiting for this device's slot
+  size_t pendingLength = 0;
+#endif
+
   for (;;) {
-    if (xQueueReceive(loraQueue, &receivedMessageID, portMAX_DELAY)) {
-      // Send the message via LoRa
+    if (!holding) {
+      holding = xQueueReceive(loraQueue, &receivedMessageID, 10 / portTICK_PERIOD_MS) == pdTRUE;
+    } else {
+      vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    if (holding && link.send_p_msg(baseID, (uint8_t)receivedMessageID, millis())) {
       Serial.print("Sending LoRa Message with ID: ");
       Serial.println(receivedMessageID);
-      
-      LoRa.beginPacket();
-      LoRa.print("Message ID: ");
-      LoRa.print(receivedMessageID);
-      LoRa.endPacket();
-      
+      holding = false;
+    }
+
+    // ACKs and messages from the base
+    int packetSize = LoRa.parsePacket();
+    if (packetSize) {
+#ifndef METRICS_DISABLED
+      // Latency counts from here: the radio is polled, so when the packet
+      // actually arrived is not known.
+      uint32_t receivedAtUs = micros();
+#endif
+      PayloadBuilder::FrameBuffer rxFrame;
+      size_t rxLength = 0;
+      while (LoRa.available()) {
+        uint8_t byte = LoRa.read();
+        if (rxLength < rxFrame.size()) {
+          rxFrame[rxLength++] = byte;
+        }
+      }
+      PayloadBuilder::ParsedFrame parsed;
+      payloadBuilder.parse(rxFrame.data(), rxLength, parsed);
+      recordLinkQuality(parsed);
+      handleReceivedFrame(rxFrame.data(), rxLength, parsed, false);
+      METRICS_COUNT(RX_PACKETS, 1);
+      METRICS_COUNT(RX_BYTES, rxLength);
+      METRICS_LATENCY_US(micros() - receivedAtUs);
+    }
+
+    // Data-rate replies first, then first transmissions, retransmissions
+    // and ACKs that are due, then track points
+#ifdef TDMA_MODE
+    LoRaModemConfig modem = adr_modem_config(radioDataRate, lora_default_config());
+    for (;;) {
+      if (pendingLength == 0 &&
+          (pendingLength = adr.poll(millis(), pendingFrame.data(), pendingFrame.size())) == 0 &&
+          (pendingLength = link.poll(millis(), pendingFrame.data(), pendingFrame.size())) == 0 &&
+          xQueueReceive(gpsQueue, &trackPoint, 0) == pdTRUE) {
+        pendingLength = encodeTrackPoint(trackPoint, pendingFrame);
+      }
+      if (pendingLength == 0 || !tdma.may_transmit(millis(), lora_time_on_air_us(modem, pendingLength))) {
+        break;
+      }
+      sendFrame(pendingFrame.data(), pendingLength);
+      pendingLength = 0;
+    }
+    PayloadBuilder::Buffer txFrame;
+    size_t txLength = tdma.poll(millis(), pendingLength > 0, txFrame.data(), txFrame.size());
+    if (txLength > 0) {
+      sendFrame(txFrame.data(), txLength);
+    }
+#else
+    PayloadBuilder::Buffer txFrame;
+    size_t txLength;
+    while ((txLength = adr.poll(millis(), txFrame.data(), txFrame.size())) > 0 ||
+           (txLength = link.poll(millis(), txFrame.data(), txFrame.size())) > 0) {
+      sendFrame(txFrame.data(), txLength);
+    }
+    while (xQueueReceive(gpsQueue, &trackPoint, 0) == pdTRUE) {
+      sendFrame(txFrame.data(), encodeTrackPoint(trackPoint, txFrame));
+    }
+#endif
+
+    const ReliableLink::Stats& stats = link.stats();
+    if (stats.delivered != reportedDelivered) {
+      reportedDelivered = stats.delivered;
       Serial.println("Message sent!");
     }
+    if (stats.failed != reportedFailures) {
+      reportedFailures = stats.failed;
+      Serial.println("Message not acknowledged by the base station.");
+      adr.fallback(millis());
+    }
+    if (adr.data_rate() != radioDataRate) {
+      radioDataRate = adr.data_rate();
+      LoRa.setSpreadingFactor(adr_data_rate(radioDataRate).spreadingFactor);
+      LoRa.setSignalBandwidth(adr_data_rate(radioDataRate).bandwidth);
+      Serial.print("Data rate now DR");
+      Serial.println(radioDataRate);
+    }
   }
 }